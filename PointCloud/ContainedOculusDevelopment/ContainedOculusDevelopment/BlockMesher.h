@@ -0,0 +1,611 @@
+#pragma once
+
+#include "LibOVRKernel/Src/GL/CAPI_GLE.h"
+#include "TsdfVolume.h"
+#include <vector>
+
+//--------------------------------------------------------------------------
+// Marching cubes mesh of a TsdfVolume, kept per block. After each
+// integration only the blocks that changed are extracted again, together
+// with their -x, -y and -z neighbours, whose last layer of cubes reads
+// their voxels. Blocks are extracted in parallel on the OpenMP threads.
+// The meshes of the blocks the volume evicted are dropped, and their -x,
+// -y and -z neighbours extracted again without them.
+//
+// All the meshes live in one vertex buffer, as unindexed triangles. Every
+// block owns a run of pages of that buffer, taken first fit from a list of
+// free runs and given back when its mesh needs a different number of
+// pages. The blocks are drawn with a single glMultiDrawArrays.
+
+struct BlockMesher
+{
+	enum { PageVertices = 96, Side = TsdfVolume::BlockSide + 1 };
+
+	struct Vertex
+	{
+		float x, y, z;
+		float r, g, b;
+	};
+
+	// Vertices first to first + count of the buffer, count 0 => no mesh
+	struct Range
+	{
+		int first, count;
+	};
+
+	// Pages first to first + count of the buffer
+	struct Run
+	{
+		int first, count;
+	};
+
+	float MinWeight; // Voxels observed less are left out of the mesh
+
+	GLuint vao, vbo;
+	int    maxPages;
+	bool   full;     // Some mesh did not fit in the buffer
+	int    numVertices;
+
+	std::vector<Range> ranges;    // Per pool slot of the volume
+	std::vector<Run>   freeRuns;  // Sorted, never adjacent
+	std::vector<int>   dirty;
+	std::vector<int>   dirtyFrame;
+	std::vector<std::vector<Vertex> > meshes; // Per dirty block
+	std::vector<GLint>   firsts;
+	std::vector<GLsizei> counts;
+
+	BlockMesher() :
+		MinWeight(1.0f),
+		vao(0),
+		vbo(0),
+		maxPages(0),
+		full(false),
+		numVertices(0)
+	{}
+
+	~BlockMesher()
+	{
+		if (vao)
+		{
+			glDeleteVertexArrays(1, &vao);
+			glDeleteBuffers(1, &vbo);
+		}
+	}
+
+	// Attribute locations of the program drawing the mesh, -1 => unused
+	void Init(GLint positionLoc, GLint colorLoc, int maxVertices)
+	{
+		maxPages = maxVertices / PageVertices;
+		freeRuns.clear();
+		Run all = { 0, maxPages };
+		freeRuns.push_back(all);
+
+		glGenVertexArrays(1, &vao);
+		glGenBuffers(1, &vbo);
+		glBindVertexArray(vao);
+		glBindBuffer(GL_ARRAY_BUFFER, vbo);
+		glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)maxPages * PageVertices * sizeof(Vertex), NULL, GL_DYNAMIC_DRAW);
+		if (positionLoc >= 0)
+		{
+			glEnableVertexAttribArray(positionLoc);
+			glVertexAttribPointer(positionLoc, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), 0);
+		}
+		if (colorLoc >= 0)
+		{
+			glEnableVertexAttribArray(colorLoc);
+			glVertexAttribPointer(colorLoc, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)(3 * sizeof(float)));
+		}
+		glBindVertexArray(0);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+
+	static int Pages(int vertices) { return (vertices + PageVertices - 1) / PageVertices; }
+
+	// First page of a free run of count pages, -1 if there is none
+	int Allocate(int count)
+	{
+		for (size_t i = 0; i < freeRuns.size(); i++)
+		{
+			Run& run = freeRuns[i];
+			if (run.count < count)
+				continue;
+			int first = run.first;
+			run.first += count;
+			run.count -= count;
+			if (!run.count)
+				freeRuns.erase(freeRuns.begin() + i);
+			return first;
+		}
+		return -1;
+	}
+
+	void Free(int first, int count)
+	{
+		size_t i = 0;
+		while (i < freeRuns.size() && freeRuns[i].first < first)
+			i++;
+		Run run = { first, count };
+		freeRuns.insert(freeRuns.begin() + i, run);
+		if (i + 1 < freeRuns.size() && freeRuns[i].first + freeRuns[i].count == freeRuns[i + 1].first)
+		{
+			freeRuns[i].count += freeRuns[i + 1].count;
+			freeRuns.erase(freeRuns.begin() + i + 1);
+		}
+		if (i > 0 && freeRuns[i - 1].first + freeRuns[i - 1].count == freeRuns[i].first)
+		{
+			freeRuns[i - 1].count += freeRuns[i].count;
+			freeRuns.erase(freeRuns.begin() + i);
+		}
+	}
+
+	// Extracts the blocks changed by the last integration and their
+	// neighbours again, and drops the meshes of the blocks it evicted.
+	// Returns the number of blocks extracted.
+	int Update(TsdfVolume& volume)
+	{
+		if (ranges.size() != volume.pool.size())
+		{
+			Range none = { 0, 0 };
+			ranges.assign(volume.pool.size(), none);
+			dirtyFrame.assign(volume.pool.size(), -1);
+		}
+
+		dirty.clear();
+		for (size_t i = 0; i < volume.changed.size(); i++)
+		{
+			const TsdfVolume::Block& block = volume.pool[volume.changed[i]];
+			for (int n = 0; n < 8; n++)
+			{
+				int b = volume.Find(block.x - (n & 1), block.y - ((n >> 1) & 1), block.z - ((n >> 2) & 1));
+				if (b < 0 || dirtyFrame[b] == volume.frame)
+					continue;
+				dirtyFrame[b] = volume.frame;
+				dirty.push_back(b);
+			}
+			volume.pool[volume.changed[i]].change = 0;
+		}
+		for (size_t i = 0; i < volume.evicted.size(); i++)
+		{
+			int e = volume.evicted[i];
+			if (ranges[e].count)
+				Free(ranges[e].first / PageVertices, Pages(ranges[e].count));
+			ranges[e].count = 0;
+			const TsdfVolume::Block& block = volume.pool[e];
+			for (int n = 1; n < 8; n++)
+			{
+				int b = volume.Find(block.x - (n & 1), block.y - ((n >> 1) & 1), block.z - ((n >> 2) & 1));
+				if (b < 0 || dirtyFrame[b] == volume.frame)
+					continue;
+				dirtyFrame[b] = volume.frame;
+				dirty.push_back(b);
+			}
+		}
+		if (dirty.empty() && volume.evicted.empty())
+			return 0;
+
+		int count = (int)dirty.size();
+		if (meshes.size() < dirty.size())
+			meshes.resize(dirty.size());
+		#pragma omp parallel for schedule(dynamic)
+		for (int i = 0; i < count; i++)
+			Extract(volume, dirty[i], meshes[i]);
+
+		glBindBuffer(GL_ARRAY_BUFFER, vbo);
+		for (int i = 0; i < count; i++)
+			Store(dirty[i], meshes[i]);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+		firsts.clear();
+		counts.clear();
+		numVertices = 0;
+		for (size_t b = 0; b < ranges.size(); b++)
+		{
+			if (!ranges[b].count)
+				continue;
+			firsts.push_back(ranges[b].first);
+			counts.push_back(ranges[b].count);
+			numVertices += ranges[b].count;
+		}
+		return count;
+	}
+
+	// Moves the mesh of block b into its range, which changes only when the
+	// mesh needs a different number of pages
+	void Store(int b, const std::vector<Vertex>& mesh)
+	{
+		Range& range = ranges[b];
+		int pages = Pages((int)mesh.size());
+		if (pages != Pages(range.count))
+		{
+			if (range.count)
+				Free(range.first / PageVertices, Pages(range.count));
+			range.count = 0;
+			if (!pages)
+				return;
+			int page = Allocate(pages);
+			if (page < 0)
+			{
+				full = true;
+				return;
+			}
+			range.first = page * PageVertices;
+		}
+		range.count = (int)mesh.size();
+		if (range.count)
+			glBufferSubData(GL_ARRAY_BUFFER, range.first * sizeof(Vertex), range.count * sizeof(Vertex), &mesh[0]);
+	}
+
+	// Triangles of the cubes whose lowest corner is a voxel of block b, in
+	// the space of the volume
+	void Extract(const TsdfVolume& volume, int b, std::vector<Vertex>& mesh) const
+	{
+		enum { BS = TsdfVolume::BlockSide };
+		const TsdfVolume::Block& block = volume.pool[b];
+		mesh.clear();
+
+		// Voxels of the block and the first layer of its +x, +y and +z
+		// neighbours; neighbour n is offset by bit 0, 1 and 2 of n
+		int neighbour[8];
+		for (int n = 0; n < 8; n++)
+			neighbour[n] = n ? volume.Find(block.x + (n & 1), block.y + ((n >> 1) & 1), block.z + ((n >> 2) & 1)) : b;
+
+		float        tsdf[Side * Side * Side];
+		float        weight[Side * Side * Side];
+		unsigned int color[Side * Side * Side];
+		for (int z = 0; z < Side; z++)
+		{
+			for (int y = 0; y < Side; y++)
+			{
+				for (int x = 0; x < Side; x++)
+				{
+					int s = (z * Side + y) * Side + x;
+					int n = neighbour[(x == BS) | ((y == BS) << 1) | ((z == BS) << 2)];
+					if (n < 0)
+					{
+						tsdf[s] = 1.0f;
+						weight[s] = 0;
+						color[s] = 0;
+						continue;
+					}
+					int v = ((z % BS) * BS + (y % BS)) * BS + (x % BS);
+					tsdf[s] = volume.pool[n].tsdf[v];
+					weight[s] = volume.pool[n].weight[v];
+					color[s] = volume.pool[n].color[v];
+				}
+			}
+		}
+
+		// Corner c of a cube is offset by bit 0, 1 and 2 of c; edge e joins
+		// corners EdgeCorners[e]
+		static const int EdgeCorners[12][2] = {
+			{ 0, 1 }, { 2, 3 }, { 4, 5 }, { 6, 7 },
+			{ 0, 2 }, { 1, 3 }, { 4, 6 }, { 5, 7 },
+			{ 0, 4 }, { 1, 5 }, { 2, 6 }, { 3, 7 } };
+		const int cornerOffset[8] = { 0, 1, Side, Side + 1, Side * Side, Side * Side + 1, Side * Side + Side, Side * Side + Side + 1 };
+
+		float ox = block.x * BS + 0.5f, oy = block.y * BS + 0.5f, oz = block.z * BS + 0.5f;
+		for (int z = 0; z < BS; z++)
+		{
+			for (int y = 0; y < BS; y++)
+			{
+				for (int x = 0; x < BS; x++)
+				{
+					int s = (z * Side + y) * Side + x;
+					int config = 0;
+					bool observed = true;
+					for (int c = 0; c < 8; c++)
+					{
+						observed = observed && weight[s + cornerOffset[c]] >= MinWeight;
+						config |= (tsdf[s + cornerOffset[c]] < 0) << c;
+					}
+					if (!observed || config == 0 || config == 255)
+						continue;
+
+					for (const signed char* e = Triangles(config); *e >= 0; e++)
+					{
+						int c0 = EdgeCorners[*e][0], c1 = EdgeCorners[*e][1];
+						int s0 = s + cornerOffset[c0], s1 = s + cornerOffset[c1];
+						float t = tsdf[s0] / (tsdf[s0] - tsdf[s1]);
+
+						Vertex v;
+						v.x = (ox + x + (c0 & 1) + t * ((c1 & 1) - (c0 & 1))) * volume.VoxelSize;
+						v.y = (oy + y + ((c0 >> 1) & 1) + t * (((c1 >> 1) & 1) - ((c0 >> 1) & 1))) * volume.VoxelSize;
+						v.z = (oz + z + ((c0 >> 2) & 1) + t * (((c1 >> 2) & 1) - ((c0 >> 2) & 1))) * volume.VoxelSize;
+						float rgb[3];
+						for (int k = 0; k < 3; k++)
+						{
+							float a = (float)((color[s0] >> (8 * k)) & 0xff), b = (float)((color[s1] >> (8 * k)) & 0xff);
+							rgb[k] = (a + t * (b - a)) / 255;
+						}
+						v.r = rgb[0];
+						v.g = rgb[1];
+						v.b = rgb[2];
+						mesh.push_back(v);
+					}
+				}
+			}
+		}
+	}
+
+	// Draws with the bound program; both sides are visible
+	void Draw() const
+	{
+		if (firsts.empty())
+			return;
+		GLboolean cull = glIsEnabled(GL_CULL_FACE);
+		glDisable(GL_CULL_FACE);
+		glBindVertexArray(vao);
+		glMultiDrawArrays(GL_TRIANGLES, &firsts[0], &counts[0], (GLsizei)firsts.size());
+		glBindVertexArray(0);
+		if (cull)
+			glEnable(GL_CULL_FACE);
+	}
+
+	// Edges crossed by the triangles of cube configuration config, 3 per
+	// triangle and ended by -1. Bit c of config is set when corner c is
+	// behind the surface. Ambiguous faces keep the corners behind the
+	// surface apart, so neighbouring cubes agree, and the triangles wind
+	// counterclockwise seen from in front of the surface.
+	static const signed char* Triangles(int config)
+	{
+		static const signed char Table[256][16] = {
+			{ -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+			{  8,  0,  4, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+			{  5,  0,  9, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+			{  8,  5,  4,  8,  9,  5, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+			{  4,  1, 10, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+			{  8,  1, 10,  8,  0,  1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+			{  4,  1, 10,  5,  0,  9, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+			{  8,  1, 10,  8,  5,  1,  8,  9,  5, -1, -1, -1, -1, -1, -1, -1 },
+			{ 11,  1,  5, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+			{  8,  0,  4, 11,  1,  5, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+			{ 11,  0,  9, 11,  1,  0, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+			{  8,  1,  4,  8, 11,  1,  8,  9, 11, -1, -1, -1, -1, -1, -1, -1 },
+			{  4, 11, 10,  4,  5, 11, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+			{  8, 11, 10,  8,  5, 11,  8,  0,  5, -1, -1, -1, -1, -1, -1, -1 },
+			{  4, 11, 10,  4,  9, 11,  4,  0,  9, -1, -1, -1, -1, -1, -1, -1 },
+			{  8, 11, 10,  8,  9, 11, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+			{  6,  2,  8, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+			{  6,  0,  4,  6,  2,  0, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+			{  6,  2,  8,  5,  0,  9, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+			{  6,  5,  4,  6,  9,  5,  6,  2,  9, -1, -1, -1, -1, -1, -1, -1 },
+			{  4,  1, 10,  6,  2,  8, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+			{  6,  1, 10,  6,  0,  1,  6,  2,  0, -1, -1, -1, -1, -1, -1, -1 },
+			{  4,  1, 10,  6,  2,  8,  5,  0,  9, -1, -1, -1, -1, -1, -1, -1 },
+			{  6,  1, 10,  6,  5,  1,  6,  9,  5,  6,  2,  9, -1, -1, -1, -1 },
+			{  6,  2,  8, 11,  1,  5, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+			{  6,  0,  4,  6,  2,  0, 11,  1,  5, -1, -1, -1, -1, -1, -1, -1 },
+			{  6,  2,  8, 11,  0,  9, 11,  1,  0, -1, -1, -1, -1, -1, -1, -1 },
+			{  6,  1,  4,  6, 11,  1,  6,  9, 11,  6,  2,  9, -1, -1, -1, -1 },
+			{  4, 11, 10,  4,  5, 11,  6,  2,  8, -1, -1, -1, -1, -1, -1, -1 },
+			{  6, 11, 10,  6,  5, 11,  6,  0,  5,  6,  2,  0, -1, -1, -1, -1 },
+			{  4, 11, 10,  4,  9, 11,  4,  0,  9,  6,  2,  8, -1, -1, -1, -1 },
+			{  6, 11, 10,  6,  9, 11,  6,  2,  9, -1, -1, -1, -1, -1, -1, -1 },
+			{  9,  2,  7, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+			{  8,  0,  4,  9,  2,  7, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+			{  5,  2,  7,  5,  0,  2, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+			{  8,  5,  4,  8,  7,  5,  8,  2,  7, -1, -1, -1, -1, -1, -1, -1 },
+			{  4,  1, 10,  9,  2,  7, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+			{  8,  1, 10,  8,  0,  1,  9,  2,  7, -1, -1, -1, -1, -1, -1, -1 },
+			{  4,  1, 10,  5,  2,  7,  5,  0,  2, -1, -1, -1, -1, -1, -1, -1 },
+			{  8,  1, 10,  8,  5,  1,  8,  7,  5,  8,  2,  7, -1, -1, -1, -1 },
+			{ 11,  1,  5,  9,  2,  7, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+			{  8,  0,  4, 11,  1,  5,  9,  2,  7, -1, -1, -1, -1, -1, -1, -1 },
+			{ 11,  2,  7, 11,  0,  2, 11,  1,  0, -1, -1, -1, -1, -1, -1, -1 },
+			{  8,  1,  4,  8, 11,  1,  8,  7, 11,  8,  2,  7, -1, -1, -1, -1 },
+			{  4, 11, 10,  4,  5, 11,  9,  2,  7, -1, -1, -1, -1, -1, -1, -1 },
+			{  8, 11, 10,  8,  5, 11,  8,  0,  5,  9,  2,  7, -1, -1, -1, -1 },
+			{  4, 11, 10,  4,  7, 11,  4,  2,  7,  4,  0,  2, -1, -1, -1, -1 },
+			{  8, 11, 10,  8,  7, 11,  8,  2,  7, -1, -1, -1, -1, -1, -1, -1 },
+			{  6,  9,  8,  6,  7,  9, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+			{  6,  0,  4,  6,  9,  0,  6,  7,  9, -1, -1, -1, -1, -1, -1, -1 },
+			{  6,  0,  8,  6,  5,  0,  6,  7,  5, -1, -1, -1, -1, -1, -1, -1 },
+			{  6,  5,  4,  6,  7,  5, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+			{  4,  1, 10,  6,  9,  8,  6,  7,  9, -1, -1, -1, -1, -1, -1, -1 },
+			{  6,  1, 10,  6,  0,  1,  6,  9,  0,  6,  7,  9, -1, -1, -1, -1 },
+			{  4,  1, 10,  6,  0,  8,  6,  5,  0,  6,  7,  5, -1, -1, -1, -1 },
+			{  6,  1, 10,  6,  5,  1,  6,  7,  5, -1, -1, -1, -1, -1, -1, -1 },
+			{  6,  9,  8,  6,  7,  9, 11,  1,  5, -1, -1, -1, -1, -1, -1, -1 },
+			{  6,  0,  4,  6,  9,  0,  6,  7,  9, 11,  1,  5, -1, -1, -1, -1 },
+			{  6,  0,  8,  6,  1,  0,  6, 11,  1,  6,  7, 11, -1, -1, -1, -1 },
+			{  6,  1,  4,  6, 11,  1,  6,  7, 11, -1, -1, -1, -1, -1, -1, -1 },
+			{  4, 11, 10,  4,  5, 11,  6,  9,  8,  6,  7,  9, -1, -1, -1, -1 },
+			{  6, 11, 10,  6,  5, 11,  6,  0,  5,  6,  9,  0,  6,  7,  9, -1 },
+			{  4, 11, 10,  4,  7, 11,  4,  6,  7,  4,  8,  6,  4,  0,  8, -1 },
+			{  6, 11, 10,  6,  7, 11, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+			{ 10,  3,  6, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+			{ 10,  3,  6,  8,  0,  4, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+			{ 10,  3,  6,  5,  0,  9, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+			{ 10,  3,  6,  8,  5,  4,  8,  9,  5, -1, -1, -1, -1, -1, -1, -1 },
+			{  4,  3,  6,  4,  1,  3, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+			{  8,  3,  6,  8,  1,  3,  8,  0,  1, -1, -1, -1, -1, -1, -1, -1 },
+			{  4,  3,  6,  4,  1,  3,  5,  0,  9, -1, -1, -1, -1, -1, -1, -1 },
+			{  8,  3,  6,  8,  1,  3,  8,  5,  1,  8,  9,  5, -1, -1, -1, -1 },
+			{ 10,  3,  6, 11,  1,  5, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+			{ 10,  3,  6,  8,  0,  4, 11,  1,  5, -1, -1, -1, -1, -1, -1, -1 },
+			{ 10,  3,  6, 11,  0,  9, 11,  1,  0, -1, -1, -1, -1, -1, -1, -1 },
+			{ 10,  3,  6,  8,  1,  4,  8, 11,  1,  8,  9, 11, -1, -1, -1, -1 },
+			{  4,  3,  6,  4, 11,  3,  4,  5, 11, -1, -1, -1, -1, -1, -1, -1 },
+			{  8,  3,  6,  8, 11,  3,  8,  5, 11,  8,  0,  5, -1, -1, -1, -1 },
+			{  4,  3,  6,  4, 11,  3,  4,  9, 11,  4,  0,  9, -1, -1, -1, -1 },
+			{  8,  3,  6,  8, 11,  3,  8,  9, 11, -1, -1, -1, -1, -1, -1, -1 },
+			{ 10,  2,  8, 10,  3,  2, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+			{ 10,  0,  4, 10,  2,  0, 10,  3,  2, -1, -1, -1, -1, -1, -1, -1 },
+			{ 10,  2,  8, 10,  3,  2,  5,  0,  9, -1, -1, -1, -1, -1, -1, -1 },
+			{ 10,  5,  4, 10,  9,  5, 10,  2,  9, 10,  3,  2, -1, -1, -1, -1 },
+			{  4,  2,  8,  4,  3,  2,  4,  1,  3, -1, -1, -1, -1, -1, -1, -1 },
+			{  0,  3,  2,  0,  1,  3, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+			{  4,  2,  8,  4,  3,  2,  4,  1,  3,  5,  0,  9, -1, -1, -1, -1 },
+			{  5,  2,  9,  5,  3,  2,  5,  1,  3, -1, -1, -1, -1, -1, -1, -1 },
+			{ 10,  2,  8, 10,  3,  2, 11,  1,  5, -1, -1, -1, -1, -1, -1, -1 },
+			{ 10,  0,  4, 10,  2,  0, 10,  3,  2, 11,  1,  5, -1, -1, -1, -1 },
+			{ 10,  2,  8, 10,  3,  2, 11,  0,  9, 11,  1,  0, -1, -1, -1, -1 },
+			{ 10,  1,  4, 10, 11,  1, 10,  9, 11, 10,  2,  9, 10,  3,  2, -1 },
+			{  4,  2,  8,  4,  3,  2,  4, 11,  3,  4,  5, 11, -1, -1, -1, -1 },
+			{ 11,  0,  5, 11,  2,  0, 11,  3,  2, -1, -1, -1, -1, -1, -1, -1 },
+			{  4,  2,  8,  4,  3,  2,  4, 11,  3,  4,  9, 11,  4,  0,  9, -1 },
+			{ 11,  2,  9, 11,  3,  2, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+			{ 10,  3,  6,  9,  2,  7, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+			{ 10,  3,  6,  8,  0,  4,  9,  2,  7, -1, -1, -1, -1, -1, -1, -1 },
+			{ 10,  3,  6,  5,  2,  7,  5,  0,  2, -1, -1, -1, -1, -1, -1, -1 },
+			{ 10,  3,  6,  8,  5,  4,  8,  7,  5,  8,  2,  7, -1, -1, -1, -1 },
+			{  4,  3,  6,  4,  1,  3,  9,  2,  7, -1, -1, -1, -1, -1, -1, -1 },
+			{  8,  3,  6,  8,  1,  3,  8,  0,  1,  9,  2,  7, -1, -1, -1, -1 },
+			{  4,  3,  6,  4,  1,  3,  5,  2,  7,  5,  0,  2, -1, -1, -1, -1 },
+			{  8,  3,  6,  8,  1,  3,  8,  5,  1,  8,  7,  5,  8,  2,  7, -1 },
+			{ 10,  3,  6, 11,  1,  5,  9,  2,  7, -1, -1, -1, -1, -1, -1, -1 },
+			{ 10,  3,  6,  8,  0,  4, 11,  1,  5,  9,  2,  7, -1, -1, -1, -1 },
+			{ 10,  3,  6, 11,  2,  7, 11,  0,  2, 11,  1,  0, -1, -1, -1, -1 },
+			{ 10,  3,  6,  8,  1,  4,  8, 11,  1,  8,  7, 11,  8,  2,  7, -1 },
+			{  4,  3,  6,  4, 11,  3,  4,  5, 11,  9,  2,  7, -1, -1, -1, -1 },
+			{  8,  3,  6,  8, 11,  3,  8,  5, 11,  8,  0,  5,  9,  2,  7, -1 },
+			{  4,  3,  6,  4, 11,  3,  4,  7, 11,  4,  2,  7,  4,  0,  2, -1 },
+			{  8,  3,  6,  8, 11,  3,  8,  7, 11,  8,  2,  7, -1, -1, -1, -1 },
+			{ 10,  9,  8, 10,  7,  9, 10,  3,  7, -1, -1, -1, -1, -1, -1, -1 },
+			{ 10,  0,  4, 10,  9,  0, 10,  7,  9, 10,  3,  7, -1, -1, -1, -1 },
+			{ 10,  0,  8, 10,  5,  0, 10,  7,  5, 10,  3,  7, -1, -1, -1, -1 },
+			{ 10,  5,  4, 10,  7,  5, 10,  3,  7, -1, -1, -1, -1, -1, -1, -1 },
+			{  4,  9,  8,  4,  7,  9,  4,  3,  7,  4,  1,  3, -1, -1, -1, -1 },
+			{  9,  3,  7,  9,  1,  3,  9,  0,  1, -1, -1, -1, -1, -1, -1, -1 },
+			{  4,  0,  8,  4,  5,  0,  4,  7,  5,  4,  3,  7,  4,  1,  3, -1 },
+			{  5,  3,  7,  5,  1,  3, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+			{ 10,  9,  8, 10,  7,  9, 10,  3,  7, 11,  1,  5, -1, -1, -1, -1 },
+			{ 10,  0,  4, 10,  9,  0, 10,  7,  9, 10,  3,  7, 11,  1,  5, -1 },
+			{ 10,  0,  8, 10,  1,  0, 10, 11,  1, 10,  7, 11, 10,  3,  7, -1 },
+			{ 10,  1,  4, 10, 11,  1, 10,  7, 11, 10,  3,  7, -1, -1, -1, -1 },
+			{  4,  9,  8,  4,  7,  9,  4,  3,  7,  4, 11,  3,  4,  5, 11, -1 },
+			{ 11,  0,  5, 11,  9,  0, 11,  7,  9, 11,  3,  7, -1, -1, -1, -1 },
+			{  4,  0,  8, 11,  3,  7, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+			{ 11,  3,  7, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+			{  7,  3, 11, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+			{  8,  0,  4,  7,  3, 11, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+			{  7,  3, 11,  5,  0,  9, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+			{  8,  5,  4,  8,  9,  5,  7,  3, 11, -1, -1, -1, -1, -1, -1, -1 },
+			{  4,  1, 10,  7,  3, 11, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+			{  8,  1, 10,  8,  0,  1,  7,  3, 11, -1, -1, -1, -1, -1, -1, -1 },
+			{  4,  1, 10,  7,  3, 11,  5,  0,  9, -1, -1, -1, -1, -1, -1, -1 },
+			{  8,  1, 10,  8,  5,  1,  8,  9,  5,  7,  3, 11, -1, -1, -1, -1 },
+			{  7,  1,  5,  7,  3,  1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+			{  8,  0,  4,  7,  1,  5,  7,  3,  1, -1, -1, -1, -1, -1, -1, -1 },
+			{  7,  0,  9,  7,  1,  0,  7,  3,  1, -1, -1, -1, -1, -1, -1, -1 },
+			{  8,  1,  4,  8,  3,  1,  8,  7,  3,  8,  9,  7, -1, -1, -1, -1 },
+			{  4,  3, 10,  4,  7,  3,  4,  5,  7, -1, -1, -1, -1, -1, -1, -1 },
+			{  8,  3, 10,  8,  7,  3,  8,  5,  7,  8,  0,  5, -1, -1, -1, -1 },
+			{  4,  3, 10,  4,  7,  3,  4,  9,  7,  4,  0,  9, -1, -1, -1, -1 },
+			{  8,  3, 10,  8,  7,  3,  8,  9,  7, -1, -1, -1, -1, -1, -1, -1 },
+			{  6,  2,  8,  7,  3, 11, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+			{  6,  0,  4,  6,  2,  0,  7,  3, 11, -1, -1, -1, -1, -1, -1, -1 },
+			{  6,  2,  8,  7,  3, 11,  5,  0,  9, -1, -1, -1, -1, -1, -1, -1 },
+			{  6,  5,  4,  6,  9,  5,  6,  2,  9,  7,  3, 11, -1, -1, -1, -1 },
+			{  4,  1, 10,  6,  2,  8,  7,  3, 11, -1, -1, -1, -1, -1, -1, -1 },
+			{  6,  1, 10,  6,  0,  1,  6,  2,  0,  7,  3, 11, -1, -1, -1, -1 },
+			{  4,  1, 10,  6,  2,  8,  7,  3, 11,  5,  0,  9, -1, -1, -1, -1 },
+			{  6,  1, 10,  6,  5,  1,  6,  9,  5,  6,  2,  9,  7,  3, 11, -1 },
+			{  6,  2,  8,  7,  1,  5,  7,  3,  1, -1, -1, -1, -1, -1, -1, -1 },
+			{  6,  0,  4,  6,  2,  0,  7,  1,  5,  7,  3,  1, -1, -1, -1, -1 },
+			{  6,  2,  8,  7,  0,  9,  7,  1,  0,  7,  3,  1, -1, -1, -1, -1 },
+			{  6,  1,  4,  6,  3,  1,  6,  7,  3,  6,  9,  7,  6,  2,  9, -1 },
+			{  4,  3, 10,  4,  7,  3,  4,  5,  7,  6,  2,  8, -1, -1, -1, -1 },
+			{  6,  3, 10,  6,  7,  3,  6,  5,  7,  6,  0,  5,  6,  2,  0, -1 },
+			{  4,  3, 10,  4,  7,  3,  4,  9,  7,  4,  0,  9,  6,  2,  8, -1 },
+			{  6,  3, 10,  6,  7,  3,  6,  9,  7,  6,  2,  9, -1, -1, -1, -1 },
+			{  9,  3, 11,  9,  2,  3, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+			{  8,  0,  4,  9,  3, 11,  9,  2,  3, -1, -1, -1, -1, -1, -1, -1 },
+			{  5,  3, 11,  5,  2,  3,  5,  0,  2, -1, -1, -1, -1, -1, -1, -1 },
+			{  8,  5,  4,  8, 11,  5,  8,  3, 11,  8,  2,  3, -1, -1, -1, -1 },
+			{  4,  1, 10,  9,  3, 11,  9,  2,  3, -1, -1, -1, -1, -1, -1, -1 },
+			{  8,  1, 10,  8,  0,  1,  9,  3, 11,  9,  2,  3, -1, -1, -1, -1 },
+			{  4,  1, 10,  5,  3, 11,  5,  2,  3,  5,  0,  2, -1, -1, -1, -1 },
+			{  8,  1, 10,  8,  5,  1,  8, 11,  5,  8,  3, 11,  8,  2,  3, -1 },
+			{  9,  1,  5,  9,  3,  1,  9,  2,  3, -1, -1, -1, -1, -1, -1, -1 },
+			{  8,  0,  4,  9,  1,  5,  9,  3,  1,  9,  2,  3, -1, -1, -1, -1 },
+			{  2,  1,  0,  2,  3,  1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+			{  8,  1,  4,  8,  3,  1,  8,  2,  3, -1, -1, -1, -1, -1, -1, -1 },
+			{  4,  3, 10,  4,  2,  3,  4,  9,  2,  4,  5,  9, -1, -1, -1, -1 },
+			{  8,  3, 10,  8,  2,  3,  8,  9,  2,  8,  5,  9,  8,  0,  5, -1 },
+			{  4,  3, 10,  4,  2,  3,  4,  0,  2, -1, -1, -1, -1, -1, -1, -1 },
+			{  8,  3, 10,  8,  2,  3, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+			{  6,  9,  8,  6, 11,  9,  6,  3, 11, -1, -1, -1, -1, -1, -1, -1 },
+			{  6,  0,  4,  6,  9,  0,  6, 11,  9,  6,  3, 11, -1, -1, -1, -1 },
+			{  6,  0,  8,  6,  5,  0,  6, 11,  5,  6,  3, 11, -1, -1, -1, -1 },
+			{  6,  5,  4,  6, 11,  5,  6,  3, 11, -1, -1, -1, -1, -1, -1, -1 },
+			{  4,  1, 10,  6,  9,  8,  6, 11,  9,  6,  3, 11, -1, -1, -1, -1 },
+			{  6,  1, 10,  6,  0,  1,  6,  9,  0,  6, 11,  9,  6,  3, 11, -1 },
+			{  4,  1, 10,  6,  0,  8,  6,  5,  0,  6, 11,  5,  6,  3, 11, -1 },
+			{  6,  1, 10,  6,  5,  1,  6, 11,  5,  6,  3, 11, -1, -1, -1, -1 },
+			{  6,  9,  8,  6,  5,  9,  6,  1,  5,  6,  3,  1, -1, -1, -1, -1 },
+			{  6,  0,  4,  6,  9,  0,  6,  5,  9,  6,  1,  5,  6,  3,  1, -1 },
+			{  6,  0,  8,  6,  1,  0,  6,  3,  1, -1, -1, -1, -1, -1, -1, -1 },
+			{  6,  1,  4,  6,  3,  1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+			{  4,  3, 10,  4,  6,  3,  4,  8,  6,  4,  9,  8,  4,  5,  9, -1 },
+			{  6,  3, 10,  9,  0,  5, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+			{  4,  3, 10,  4,  6,  3,  4,  8,  6,  4,  0,  8, -1, -1, -1, -1 },
+			{  6,  3, 10, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+			{ 10,  7,  6, 10, 11,  7, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+			{ 10,  7,  6, 10, 11,  7,  8,  0,  4, -1, -1, -1, -1, -1, -1, -1 },
+			{ 10,  7,  6, 10, 11,  7,  5,  0,  9, -1, -1, -1, -1, -1, -1, -1 },
+			{ 10,  7,  6, 10, 11,  7,  8,  5,  4,  8,  9,  5, -1, -1, -1, -1 },
+			{  4,  7,  6,  4, 11,  7,  4,  1, 11, -1, -1, -1, -1, -1, -1, -1 },
+			{  8,  7,  6,  8, 11,  7,  8,  1, 11,  8,  0,  1, -1, -1, -1, -1 },
+			{  4,  7,  6,  4, 11,  7,  4,  1, 11,  5,  0,  9, -1, -1, -1, -1 },
+			{  8,  7,  6,  8, 11,  7,  8,  1, 11,  8,  5,  1,  8,  9,  5, -1 },
+			{ 10,  7,  6, 10,  5,  7, 10,  1,  5, -1, -1, -1, -1, -1, -1, -1 },
+			{ 10,  7,  6, 10,  5,  7, 10,  1,  5,  8,  0,  4, -1, -1, -1, -1 },
+			{ 10,  7,  6, 10,  9,  7, 10,  0,  9, 10,  1,  0, -1, -1, -1, -1 },
+			{ 10,  7,  6, 10,  9,  7, 10,  8,  9, 10,  4,  8, 10,  1,  4, -1 },
+			{  4,  7,  6,  4,  5,  7, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+			{  8,  7,  6,  8,  5,  7,  8,  0,  5, -1, -1, -1, -1, -1, -1, -1 },
+			{  4,  7,  6,  4,  9,  7,  4,  0,  9, -1, -1, -1, -1, -1, -1, -1 },
+			{  8,  7,  6,  8,  9,  7, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+			{ 10,  2,  8, 10,  7,  2, 10, 11,  7, -1, -1, -1, -1, -1, -1, -1 },
+			{ 10,  0,  4, 10,  2,  0, 10,  7,  2, 10, 11,  7, -1, -1, -1, -1 },
+			{ 10,  2,  8, 10,  7,  2, 10, 11,  7,  5,  0,  9, -1, -1, -1, -1 },
+			{ 10,  5,  4, 10,  9,  5, 10,  2,  9, 10,  7,  2, 10, 11,  7, -1 },
+			{  4,  2,  8,  4,  7,  2,  4, 11,  7,  4,  1, 11, -1, -1, -1, -1 },
+			{  7,  1, 11,  7,  0,  1,  7,  2,  0, -1, -1, -1, -1, -1, -1, -1 },
+			{  4,  2,  8,  4,  7,  2,  4, 11,  7,  4,  1, 11,  5,  0,  9, -1 },
+			{  7,  1, 11,  7,  5,  1,  7,  9,  5,  7,  2,  9, -1, -1, -1, -1 },
+			{ 10,  2,  8, 10,  7,  2, 10,  5,  7, 10,  1,  5, -1, -1, -1, -1 },
+			{ 10,  0,  4, 10,  2,  0, 10,  7,  2, 10,  5,  7, 10,  1,  5, -1 },
+			{ 10,  2,  8, 10,  7,  2, 10,  9,  7, 10,  0,  9, 10,  1,  0, -1 },
+			{ 10,  1,  4,  7,  2,  9, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+			{  4,  2,  8,  4,  7,  2,  4,  5,  7, -1, -1, -1, -1, -1, -1, -1 },
+			{  7,  0,  5,  7,  2,  0, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+			{  4,  2,  8,  4,  7,  2,  4,  9,  7,  4,  0,  9, -1, -1, -1, -1 },
+			{  7,  2,  9, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+			{ 10,  2,  6, 10,  9,  2, 10, 11,  9, -1, -1, -1, -1, -1, -1, -1 },
+			{ 10,  2,  6, 10,  9,  2, 10, 11,  9,  8,  0,  4, -1, -1, -1, -1 },
+			{ 10,  2,  6, 10,  0,  2, 10,  5,  0, 10, 11,  5, -1, -1, -1, -1 },
+			{ 10,  2,  6, 10,  8,  2, 10,  4,  8, 10,  5,  4, 10, 11,  5, -1 },
+			{  4,  2,  6,  4,  9,  2,  4, 11,  9,  4,  1, 11, -1, -1, -1, -1 },
+			{  8,  2,  6,  8,  9,  2,  8, 11,  9,  8,  1, 11,  8,  0,  1, -1 },
+			{  4,  2,  6,  4,  0,  2,  4,  5,  0,  4, 11,  5,  4,  1, 11, -1 },
+			{  8,  2,  6,  5,  1, 11, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+			{ 10,  2,  6, 10,  9,  2, 10,  5,  9, 10,  1,  5, -1, -1, -1, -1 },
+			{ 10,  2,  6, 10,  9,  2, 10,  5,  9, 10,  1,  5,  8,  0,  4, -1 },
+			{ 10,  2,  6, 10,  0,  2, 10,  1,  0, -1, -1, -1, -1, -1, -1, -1 },
+			{ 10,  2,  6, 10,  8,  2, 10,  4,  8, 10,  1,  4, -1, -1, -1, -1 },
+			{  4,  2,  6,  4,  9,  2,  4,  5,  9, -1, -1, -1, -1, -1, -1, -1 },
+			{  8,  2,  6,  8,  9,  2,  8,  5,  9,  8,  0,  5, -1, -1, -1, -1 },
+			{  4,  2,  6,  4,  0,  2, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+			{  8,  2,  6, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+			{ 10,  9,  8, 10, 11,  9, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+			{ 10,  0,  4, 10,  9,  0, 10, 11,  9, -1, -1, -1, -1, -1, -1, -1 },
+			{ 10,  0,  8, 10,  5,  0, 10, 11,  5, -1, -1, -1, -1, -1, -1, -1 },
+			{ 10,  5,  4, 10, 11,  5, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+			{  4,  9,  8,  4, 11,  9,  4,  1, 11, -1, -1, -1, -1, -1, -1, -1 },
+			{  9,  1, 11,  9,  0,  1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+			{  4,  0,  8,  4,  5,  0,  4, 11,  5,  4,  1, 11, -1, -1, -1, -1 },
+			{  5,  1, 11, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+			{ 10,  9,  8, 10,  5,  9, 10,  1,  5, -1, -1, -1, -1, -1, -1, -1 },
+			{ 10,  0,  4, 10,  9,  0, 10,  5,  9, 10,  1,  5, -1, -1, -1, -1 },
+			{ 10,  0,  8, 10,  1,  0, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+			{ 10,  1,  4, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+			{  4,  9,  8,  4,  5,  9, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+			{  9,  0,  5, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+			{  4,  0,  8, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+			{ -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 }
+		};
+		return Table[config];
+	}
+};
@@ -0,0 +1,311 @@
+#pragma once
+
+#include "btBulletDynamicsCommon.h"
+#include "LinearMath/btConvexHullComputer.h"
+#include "LibOVR/Include/Extras/OVR_Math.h"
+#include "KinectHandler.h"
+#include "SkinnedAvatar.h"
+#include "LatestJobWorker.h"
+#include <vector>
+#include <algorithm>
+#include <math.h>
+
+//--------------------------------------------------------------------------
+// Convex decomposition of the tracked bodies. The points of a body, in the
+// camera space of the sensor, go to the bone closest to them, points further
+// than MaxBoneDistance from every bone being noise of the body index map,
+// and each bone with at least MinPoints points gets the convex hull of its
+// points. The hulls of a body hug it much closer than the joints do. A hull
+// is built over the extreme points of its bone along Directions directions
+// spread over the sphere, which bounds its corners, and so the cost of the
+// collisions with it, whatever the number of points.
+//
+// A body's hulls make a two level bounding volume hierarchy: the box of the
+// body holds the boxes of its hulls, so Visible rejects a body with one test
+// and only looks at its hulls when the body is in view. The same hulls, as
+// btConvexHullShape children of a btCompoundShape, are a collider of the
+// body.
+//
+// Compute assigns the points to their bones and builds the hulls in parallel,
+// each with OpenMP. The sensor loop goes through Submit and Take instead, so
+// a frame's hulls are built while later frames arrive, and only the newest
+// frame waiting is ever decomposed.
+
+struct BodyHulls
+{
+	enum { JointCount = SkinnedAvatar::JointCount, BoneCount = SkinnedAvatar::BoneCount };
+	enum { Directions = 32 };
+
+	// Points of one tracked body and its joints, as handed to Compute
+	struct Cloud
+	{
+		int                body;
+		float              joints[JointCount * 3];
+		std::vector<float> points; // xyz per point
+	};
+
+	// Vertices as floats: btVector3 needs 16 byte alignment, which std::vector
+	// does not give its elements on 32 bit builds
+	struct Hull
+	{
+		int                bone;
+		std::vector<float> vertices; // xyz per vertex
+		float              lo[3], hi[3];
+	};
+
+	struct Set
+	{
+		int               body;
+		std::vector<Hull> hulls;
+		float             lo[3], hi[3]; // Bounds of all the hulls
+	};
+
+	float MaxBoneDistance; // Metres
+	int   MinPoints;
+
+	BodyHulls() :
+		MaxBoneDistance(0.3f),
+		MinPoints(8)
+	{
+		worker.Process = [this](std::vector<Cloud>& clouds, std::vector<Set>& sets) { Compute(clouds, sets); };
+
+		// Fibonacci sphere
+		for (int d = 0; d < Directions; d++)
+		{
+			float z = 1.0f - (2.0f * d + 1.0f) / Directions, r = sqrtf(1.0f - z * z);
+			float a = d * 2.39996323f;
+			directions[d * 3] = r * cosf(a);
+			directions[d * 3 + 1] = r * sinf(a);
+			directions[d * 3 + 2] = z;
+		}
+	}
+
+	~BodyHulls()
+	{
+		Stop();
+	}
+
+	//----------------------------------------------------------------------
+	// Worker thread
+
+	LatestJobWorker<std::vector<Cloud>, std::vector<Set> > worker;
+
+	// Queues the clouds of a frame; clouds is left with the clouds of an
+	// earlier frame, to be refilled
+	void Submit(std::vector<Cloud>& clouds) { worker.Submit(clouds); }
+
+	// True while a frame is queued or being decomposed
+	bool Pending() { return worker.Pending(); }
+
+	// Moves the hulls of the latest frame into sets, if there are new ones
+	bool Take(std::vector<Set>& sets) { return worker.Take(sets); }
+
+	void Stop() { worker.Stop(); }
+
+	//----------------------------------------------------------------------
+	// Decomposition
+
+	// Builds the hulls of every cloud into sets, one set per cloud with hulls
+	void Compute(const std::vector<Cloud>& clouds, std::vector<Set>& sets)
+	{
+		sets.clear();
+		for (size_t c = 0; c < clouds.size(); c++)
+		{
+			sets.push_back(Set());
+			if (!Decompose(clouds[c], sets.back()))
+				sets.pop_back();
+		}
+	}
+
+	bool Decompose(const Cloud& cloud, Set& set)
+	{
+		OVR::Vector3f joints[JointCount];
+		for (int j = 0; j < JointCount; j++)
+			joints[j] = OVR::Vector3f(cloud.joints[j * 3], cloud.joints[j * 3 + 1], cloud.joints[j * 3 + 2]);
+
+		// Closest bone of every point, -1 for the outliers
+		int numPoints = (int)(cloud.points.size() / 3);
+		bones.resize(numPoints);
+		#pragma omp parallel for
+		for (int i = 0; i < numPoints; i++)
+		{
+			OVR::Vector3f p(cloud.points[i * 3], cloud.points[i * 3 + 1], cloud.points[i * 3 + 2]);
+			float best = MaxBoneDistance;
+			bones[i] = -1;
+			for (int b = 0; b < BoneCount; b++)
+			{
+				int j = SkinnedAvatar::BoneJoint(b);
+				float d = SkinnedAvatar::SegmentDistance(p, joints[SkinnedAvatar::Parent(j)], joints[j]);
+				if (d < best)
+				{
+					best = d;
+					bones[i] = b;
+				}
+			}
+		}
+
+		for (int b = 0; b < BoneCount; b++)
+			segments[b].clear();
+		for (int i = 0; i < numPoints; i++)
+		{
+			if (bones[i] < 0)
+				continue;
+			std::vector<float>& s = segments[bones[i]];
+			s.insert(s.end(), &cloud.points[i * 3], &cloud.points[i * 3 + 3]);
+		}
+
+		Hull hulls[BoneCount];
+		bool built[BoneCount];
+		#pragma omp parallel for schedule(dynamic)
+		for (int b = 0; b < BoneCount; b++)
+			built[b] = Build(segments[b], b, hulls[b]);
+
+		set.body = cloud.body;
+		set.hulls.clear();
+		for (int b = 0; b < BoneCount; b++)
+		{
+			if (!built[b])
+				continue;
+			for (int k = 0; k < 3; k++)
+			{
+				set.lo[k] = set.hulls.empty() ? hulls[b].lo[k] : std::min(set.lo[k], hulls[b].lo[k]);
+				set.hi[k] = set.hulls.empty() ? hulls[b].hi[k] : std::max(set.hi[k], hulls[b].hi[k]);
+			}
+			set.hulls.push_back(Hull());
+			std::swap(set.hulls.back(), hulls[b]);
+		}
+		return !set.hulls.empty();
+	}
+
+	// Hull of the points of bone; false if there are too few of them, or
+	// the hull has fewer than four corners
+	bool Build(const std::vector<float>& points, int bone, Hull& hull)
+	{
+		int count = (int)(points.size() / 3);
+		if (count < MinPoints)
+			return false;
+
+		// Extreme point along every direction, each point once
+		int extreme[Directions];
+		float best[Directions];
+		for (int d = 0; d < Directions; d++)
+		{
+			extreme[d] = 0;
+			best[d] = -1e30f;
+		}
+		for (int i = 0; i < count; i++)
+		{
+			const float* p = &points[i * 3];
+			for (int d = 0; d < Directions; d++)
+			{
+				const float* n = &directions[d * 3];
+				float t = p[0] * n[0] + p[1] * n[1] + p[2] * n[2];
+				if (t > best[d])
+				{
+					best[d] = t;
+					extreme[d] = i;
+				}
+			}
+		}
+		std::sort(extreme, extreme + Directions);
+		int numExtreme = (int)(std::unique(extreme, extreme + Directions) - extreme);
+		float corners[Directions * 3];
+		for (int e = 0; e < numExtreme; e++)
+		{
+			for (int k = 0; k < 3; k++)
+				corners[e * 3 + k] = points[extreme[e] * 3 + k];
+		}
+
+		btConvexHullComputer computer;
+		computer.compute(corners, 3 * sizeof(float), numExtreme, 0, 0);
+		if (computer.vertices.size() < 4)
+			return false;
+
+		hull.bone = bone;
+		hull.vertices.resize(computer.vertices.size() * 3);
+		for (int i = 0; i < computer.vertices.size(); i++)
+		{
+			for (int k = 0; k < 3; k++)
+			{
+				float x = (float)computer.vertices[i][k];
+				hull.vertices[i * 3 + k] = x;
+				hull.lo[k] = i ? std::min(hull.lo[k], x) : x;
+				hull.hi[k] = i ? std::max(hull.hi[k], x) : x;
+			}
+		}
+		return true;
+	}
+
+	float              directions[Directions * 3];
+	std::vector<int>   bones;
+	std::vector<float> segments[BoneCount];
+
+	//----------------------------------------------------------------------
+	// Uses of the hulls
+
+	// Compound of the hulls of set, in the space of the points; the caller
+	// owns it and its children (see DeleteShape)
+	static btCompoundShape* Shape(const Set& set, btScalar margin)
+	{
+		btCompoundShape* shape = new btCompoundShape();
+		btTransform identity;
+		identity.setIdentity();
+		for (size_t h = 0; h < set.hulls.size(); h++)
+		{
+			const Hull& hull = set.hulls[h];
+			btConvexHullShape* child = new btConvexHullShape(&hull.vertices[0], (int)(hull.vertices.size() / 3), 3 * sizeof(float));
+			child->setMargin(margin);
+			shape->addChildShape(identity, child);
+		}
+		return shape;
+	}
+
+	static void DeleteShape(btCompoundShape* shape)
+	{
+		for (int i = 0; i < shape->getNumChildShapes(); i++)
+			delete shape->getChildShape(i);
+		delete shape;
+	}
+
+	// True if the box is not entirely beyond one clip plane of worldViewProj
+	static bool BoxVisible(const OVR::Matrix4f& worldViewProj, const float* lo, const float* hi)
+	{
+		int outside[6] = { 0, 0, 0, 0, 0, 0 };
+		for (int k = 0; k < 8; k++)
+		{
+			OVR::Vector4f p = worldViewProj.Transform(OVR::Vector4f(
+				(k & 1) ? hi[0] : lo[0], (k & 2) ? hi[1] : lo[1], (k & 4) ? hi[2] : lo[2], 1.0f));
+			outside[0] += (p.x < -p.w);
+			outside[1] += (p.x > p.w);
+			outside[2] += (p.y < -p.w);
+			outside[3] += (p.y > p.w);
+			outside[4] += (p.z < -p.w);
+			outside[5] += (p.z > p.w);
+		}
+		for (int plane = 0; plane < 6; plane++)
+		{
+			if (outside[plane] == 8)
+				return false;
+		}
+		return true;
+	}
+
+	// True if any hull of set is in the frustum of worldViewProj; the bones
+	// of the hulls in it are added to visibleBones, if given
+	static bool Visible(const Set& set, const OVR::Matrix4f& worldViewProj, std::vector<int>* visibleBones = NULL)
+	{
+		if (!BoxVisible(worldViewProj, set.lo, set.hi))
+			return false;
+		bool any = false;
+		for (size_t h = 0; h < set.hulls.size(); h++)
+		{
+			if (!BoxVisible(worldViewProj, set.hulls[h].lo, set.hulls[h].hi))
+				continue;
+			any = true;
+			if (!visibleBones)
+				break;
+			visibleBones->push_back(set.hulls[h].bone);
+		}
+		return any;
+	}
+};
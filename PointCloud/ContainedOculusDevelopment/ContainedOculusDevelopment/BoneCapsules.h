@@ -0,0 +1,188 @@
+#pragma once
+
+#include "btBulletDynamicsCommon.h"
+#include "LibOVR/Include/Extras/OVR_Math.h"
+#include "KinectHandler.h"
+#include "SkinnedAvatar.h"
+#include <vector>
+#include <algorithm>
+
+//--------------------------------------------------------------------------
+// Collider of one tracked body: a capsule along every bone of the Kinect
+// skeleton, from the parent joint to the joint, all of them children of a
+// single btCompoundShape on a single kinematic body. A person is then one
+// broadphase proxy, and the capsules close the gaps between the joints.
+//
+// The body sits at the spine base, so the motion of the person as a whole
+// is the kinematic motion Bullet sees; Pose lays the capsules out around
+// it and sizes them to the bone lengths and to radius, which starts at
+// rough adult sizes. Measure refines radius from the points of the body:
+// up to Samples of them go to their closest bone, and the radius of a bone
+// moves by Smoothing towards the mean distance of its points.
+//
+// Measure runs with the sensor data, Pose on the physics thread, which
+// owns the shapes and the body.
+
+struct BoneCapsules
+{
+	enum { JointCount = SkinnedAvatar::JointCount, BoneCount = SkinnedAvatar::BoneCount };
+	enum { Samples = 2048, MinSamples = 4 };
+
+	float MinRadius, MaxRadius; // Metres
+	float MaxBoneDistance;      // Metres, points further from every bone are not the body's
+	float Smoothing;
+
+	float radius[BoneCount];
+
+	btCompoundShape* shape;
+	btCapsuleShape*  capsules[BoneCount];
+	btRigidBody*     body;
+	bool             inWorld;
+
+	BoneCapsules() :
+		MinRadius(0.02f),
+		MaxRadius(0.25f),
+		MaxBoneDistance(0.3f),
+		Smoothing(0.1f),
+		inWorld(false)
+	{
+		shape = new btCompoundShape();
+		btTransform identity;
+		identity.setIdentity();
+		Reset();
+		for (int b = 0; b < BoneCount; b++)
+		{
+			capsules[b] = new btCapsuleShape(radius[b], 0.1f);
+			capsules[b]->setMargin(0.01f);
+			shape->addChildShape(identity, capsules[b]);
+		}
+
+		btRigidBody::btRigidBodyConstructionInfo info(0, new btDefaultMotionState(), shape);
+		body = new btRigidBody(info);
+		body->setRestitution(btScalar(0.1));
+		body->setFriction(btScalar(2));
+		body->setCollisionFlags(body->getCollisionFlags() | btCollisionObject::CF_KINEMATIC_OBJECT);
+		body->setActivationState(DISABLE_DEACTIVATION);
+	}
+
+	~BoneCapsules()
+	{
+		delete body->getMotionState();
+		delete body;
+		for (int b = 0; b < BoneCount; b++)
+			delete capsules[b];
+		delete shape;
+	}
+
+	// Rough adult radius of bone, by the joint it ends at
+	static float DefaultRadius(int bone)
+	{
+		static const float radii[BoneCount] = {
+			0.13f,                      // SpineMid
+			0.06f, 0.10f,               // Neck, Head
+			0.06f, 0.05f, 0.04f, 0.04f, // ShoulderLeft, ElbowLeft, WristLeft, HandLeft
+			0.06f, 0.05f, 0.04f, 0.04f, // ShoulderRight, ElbowRight, WristRight, HandRight
+			0.08f, 0.07f, 0.05f, 0.04f, // HipLeft, KneeLeft, AnkleLeft, FootLeft
+			0.08f, 0.07f, 0.05f, 0.04f, // HipRight, KneeRight, AnkleRight, FootRight
+			0.13f,                      // SpineShoulder
+			0.03f, 0.02f,               // HandTipLeft, ThumbLeft
+			0.03f, 0.02f };             // HandTipRight, ThumbRight
+		return radii[bone];
+	}
+
+	// Back to the default radii, for the next person tracked as the body
+	void Reset()
+	{
+		for (int b = 0; b < BoneCount; b++)
+			radius[b] = DefaultRadius(b);
+	}
+
+	// Joint j of joints, stride floats per joint starting with the position
+	static OVR::Vector3f Joint(const float* joints, int stride, int j)
+	{
+		return OVR::Vector3f(joints[j * stride], joints[j * stride + 1], joints[j * stride + 2]);
+	}
+
+	// Refines radius from count points (xyz) of the body, whose joints are
+	// joints with stride floats per joint
+	void Measure(const float* joints, int stride, const float* points, int count)
+	{
+		OVR::Vector3f a[BoneCount], c[BoneCount];
+		for (int b = 0; b < BoneCount; b++)
+		{
+			int j = SkinnedAvatar::BoneJoint(b);
+			a[b] = Joint(joints, stride, SkinnedAvatar::Parent(j));
+			c[b] = Joint(joints, stride, j);
+		}
+
+		float sum[BoneCount];
+		int   num[BoneCount];
+		for (int b = 0; b < BoneCount; b++)
+		{
+			sum[b] = 0;
+			num[b] = 0;
+		}
+		int step = std::max(1, count / (int)Samples);
+		for (int i = 0; i < count; i += step)
+		{
+			OVR::Vector3f p(points[i * 3], points[i * 3 + 1], points[i * 3 + 2]);
+			float best = MaxBoneDistance;
+			int   bone = -1;
+			for (int b = 0; b < BoneCount; b++)
+			{
+				float d = SkinnedAvatar::SegmentDistance(p, a[b], c[b]);
+				if (d < best)
+				{
+					best = d;
+					bone = b;
+				}
+			}
+			if (bone < 0)
+				continue;
+			sum[bone] += best;
+			num[bone]++;
+		}
+
+		for (int b = 0; b < BoneCount; b++)
+		{
+			if (num[b] < MinSamples)
+				continue;
+			float r = std::min(std::max(sum[b] / num[b], MinRadius), MaxRadius);
+			radius[b] += (r - radius[b]) * Smoothing;
+		}
+	}
+
+	// Moves the body to the spine base of joints, stride floats per joint,
+	// and lays the capsules along the bones with radii. Out of the world the
+	// body jumps there, so that it does not enter the world moving.
+	void Pose(const float* joints, int stride, const float* radii)
+	{
+		OVR::Vector3f root = Joint(joints, stride, JointType_SpineBase);
+		btTransform trans;
+		trans.setIdentity();
+		trans.setOrigin(btVector3(root.x, root.y, root.z));
+		body->getMotionState()->setWorldTransform(trans);
+		if (!inWorld)
+		{
+			body->setWorldTransform(trans);
+			body->setInterpolationWorldTransform(trans);
+		}
+
+		for (int b = 0; b < BoneCount; b++)
+		{
+			int j = SkinnedAvatar::BoneJoint(b);
+			OVR::Vector3f a = Joint(joints, stride, SkinnedAvatar::Parent(j)) - root;
+			OVR::Vector3f c = Joint(joints, stride, j) - root;
+			OVR::Vector3f axis = c - a;
+			float length = axis.Length();
+
+			// The capsule runs along its y axis
+			OVR::Quatf q = length > 1e-4f ? SkinnedAvatar::Arc(OVR::Vector3f(0, 1, 0), axis / length) : OVR::Quatf();
+			OVR::Vector3f mid = (a + c) * 0.5f;
+			btTransform child(btQuaternion(q.x, q.y, q.z, q.w), btVector3(mid.x, mid.y, mid.z));
+			capsules[b]->setImplicitShapeDimensions(btVector3(radii[b], length * 0.5f, radii[b]));
+			shape->updateChildTransform(b, child, false);
+		}
+		shape->recalculateLocalAabb();
+	}
+};
@@ -0,0 +1,159 @@
+#pragma once
+
+#include "GLPlatform.h"
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <iostream>
+
+//--------------------------------------------------------------------------
+// Offscreen GL context from EGL, for headless runs on machines without a
+// window system or a display: build servers, containers, remote GPUs. It
+// asks for the surfaceless platform first (Mesa, including its llvmpipe
+// software rasterizer), then the default display (NVIDIA and most other
+// drivers). The context renders to a small pbuffer where the config
+// allows one, else to no surface at all, with EGL_KHR_surfaceless_context;
+// the scene only ever draws into its own framebuffers.
+//
+// Compiled where HEADLESS_EGL is defined and the EGL headers and library
+// are available. There are no keys: Running only ends with Quit.
+
+struct EglPlatform : GLPlatform
+{
+	EGLDisplay display;
+	EGLContext context;
+	EGLSurface surface;
+
+	EglPlatform() :
+		display(EGL_NO_DISPLAY),
+		context(EGL_NO_CONTEXT),
+		surface(EGL_NO_SURFACE)
+	{}
+
+	~EglPlatform()
+	{
+		ReleaseDevice();
+	}
+
+	static EGLDisplay OpenDisplay()
+	{
+		PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+			(PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+		EGLint major, minor;
+		if (getPlatformDisplay)
+		{
+			EGLDisplay d = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+			if (d != EGL_NO_DISPLAY && eglInitialize(d, &major, &minor))
+				return d;
+		}
+		EGLDisplay d = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+		if (d != EGL_NO_DISPLAY && eglInitialize(d, &major, &minor))
+			return d;
+		return EGL_NO_DISPLAY;
+	}
+
+	bool InitDevice(int vpW, int vpH)
+	{
+		WinSizeW = vpW;
+		WinSizeH = vpH;
+
+		display = OpenDisplay();
+		if (display == EGL_NO_DISPLAY)
+		{
+			std::cout << "No EGL display" << std::endl;
+			return false;
+		}
+		if (!eglBindAPI(EGL_OPENGL_API))
+		{
+			std::cout << "EGL has no desktop OpenGL" << std::endl;
+			return false;
+		}
+
+		EGLint attributes[] =
+		{
+			EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+			EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+			EGL_RED_SIZE, 8,
+			EGL_GREEN_SIZE, 8,
+			EGL_BLUE_SIZE, 8,
+			EGL_DEPTH_SIZE, 16,
+			EGL_NONE
+		};
+		EGLConfig config;
+		EGLint    numConfigs = 0;
+		bool      pbuffer = eglChooseConfig(display, attributes, &config, 1, &numConfigs) && numConfigs > 0;
+		if (!pbuffer)
+		{
+			// Any config renders to framebuffer objects
+			attributes[1] = 0;
+			if (!eglChooseConfig(display, attributes, &config, 1, &numConfigs) || numConfigs == 0)
+			{
+				std::cout << "No EGL config for desktop OpenGL" << std::endl;
+				return false;
+			}
+		}
+
+		// Like the WGL context: the latest version the driver has, compatibility profile
+		context = eglCreateContext(display, config, EGL_NO_CONTEXT, NULL);
+		if (context == EGL_NO_CONTEXT)
+		{
+			std::cout << "eglCreateContext failed, 0x" << std::hex << eglGetError() << std::dec << std::endl;
+			return false;
+		}
+		if (pbuffer)
+		{
+			const EGLint size[] = { EGL_WIDTH, 16, EGL_HEIGHT, 16, EGL_NONE };
+			surface = eglCreatePbufferSurface(display, config, size);
+		}
+		if (!eglMakeCurrent(display, surface, surface, context))
+		{
+			std::cout << "eglMakeCurrent failed, 0x" << std::hex << eglGetError() << std::dec << std::endl;
+			return false;
+		}
+
+		Running = true;
+		InitGL();
+		return true;
+	}
+
+	bool HandleMessages()
+	{
+		return Running;
+	}
+
+	void Quit()
+	{
+		Running = false;
+	}
+
+	void Present()
+	{
+		if (surface != EGL_NO_SURFACE)
+			eglSwapBuffers(display, surface);
+	}
+
+	void* LoadProc(const char* name)
+	{
+		return (void*)eglGetProcAddress(name);
+	}
+
+	void ReleaseDevice()
+	{
+		if (display == EGL_NO_DISPLAY)
+			return;
+		if (context != EGL_NO_CONTEXT)
+		{
+			ReleaseGL();
+			eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+			eglDestroyContext(display, context);
+			context = EGL_NO_CONTEXT;
+		}
+		if (surface != EGL_NO_SURFACE)
+		{
+			eglDestroySurface(display, surface);
+			surface = EGL_NO_SURFACE;
+		}
+		GLEContext.Shutdown();
+		eglTerminate(display);
+		display = EGL_NO_DISPLAY;
+	}
+};
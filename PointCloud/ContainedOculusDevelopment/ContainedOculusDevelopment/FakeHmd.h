@@ -0,0 +1,117 @@
+#pragma once
+
+#include "LibOVR/Include/OVR_CAPI.h"
+#include "LibOVR/Include/Extras/OVR_Math.h"
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <math.h>
+
+//--------------------------------------------------------------------------
+// Stand-in for the Rift when rendering headless: fixed eye FOVs, IPD and
+// render target size, and head poses either scripted from a file or a slow
+// sweep of the room. Frames are paced at a fixed rate, so every run renders
+// exactly the same views and images can be diffed between builds.
+//
+// A pose script has one keyframe per line, "time px py pz qx qy qz qw",
+// with time in seconds and increasing; poses between keyframes are
+// interpolated and the script loops after its last keyframe. Lines starting
+// with # are ignored.
+
+struct FakeHmd
+{
+	struct Keyframe
+	{
+		double      time;
+		OVR::Posef  pose;
+	};
+
+	ovrFovPort   Fov[2];
+	ovrVector3f  EyeOffset[2];   // Eye positions in head space
+	ovrSizei     EyeTextureSize;
+	double       FrameRate;
+
+	std::vector<Keyframe> Script;
+
+	FakeHmd() :
+		FrameRate(90.0)
+	{
+		// Close to the DK2 defaults
+		for (int eye = 0; eye < 2; eye++)
+		{
+			Fov[eye].UpTan = Fov[eye].DownTan = 1.33f;
+			Fov[eye].LeftTan = eye == 0 ? 1.06f : 0.94f;
+			Fov[eye].RightTan = eye == 0 ? 0.94f : 1.06f;
+		}
+		float ipd = 0.064f;
+		EyeOffset[0].x = -ipd / 2; EyeOffset[0].y = EyeOffset[0].z = 0;
+		EyeOffset[1].x = ipd / 2; EyeOffset[1].y = EyeOffset[1].z = 0;
+		EyeTextureSize.w = 1182;
+		EyeTextureSize.h = 1464;
+	}
+
+	// Returns false, keeping the default sweep, if the file has no keyframes
+	bool LoadScript(const char* path)
+	{
+		std::ifstream file(path);
+		std::string   line;
+		std::vector<Keyframe> keys;
+
+		while (std::getline(file, line))
+		{
+			if (line.empty() || line[0] == '#')
+				continue;
+			std::istringstream in(line);
+			Keyframe k;
+			float qx, qy, qz, qw;
+			if (in >> k.time >> k.pose.Translation.x >> k.pose.Translation.y >> k.pose.Translation.z >> qx >> qy >> qz >> qw)
+			{
+				k.pose.Rotation = OVR::Quatf(qx, qy, qz, qw).Normalized();
+				keys.push_back(k);
+			}
+		}
+
+		if (keys.empty())
+			return false;
+		Script.swap(keys);
+		return true;
+	}
+
+	double GetPredictedDisplayTime(int frameIndex) const
+	{
+		return frameIndex / FrameRate;
+	}
+
+	OVR::Posef GetHeadPose(double time) const
+	{
+		if (Script.empty())
+		{
+			// Looks around the room, 20 seconds per turn, at standing height
+			float yaw = (float)(fmod(time, 20.0) / 20.0 * 2 * MATH_DOUBLE_PI);
+			return OVR::Posef(OVR::Quatf(OVR::Axis_Y, yaw), OVR::Vector3f(0, 0.6f, 0));
+		}
+		if (Script.size() == 1)
+			return Script[0].pose;
+
+		double length = Script.back().time - Script[0].time;
+		double t = Script[0].time + (length > 0 ? fmod(time, length) : 0);
+		size_t k = 1;
+		while (k < Script.size() - 1 && Script[k].time < t)
+			k++;
+
+		OVR::Posef a = Script[k - 1].pose;
+		double span = Script[k].time - Script[k - 1].time;
+		float  s = span > 0 ? OVR::Alg::Clamp((float)((t - Script[k - 1].time) / span), 0.0f, 1.0f) : 1.0f;
+		return a.Lerp(Script[k].pose, s);
+	}
+
+	void CalcEyePoses(const OVR::Posef& head, ovrPosef eyePoses[2]) const
+	{
+		for (int eye = 0; eye < 2; eye++)
+		{
+			OVR::Posef pose(head.Rotation, head.Transform(OVR::Vector3f(EyeOffset[eye])));
+			eyePoses[eye] = pose;
+		}
+	}
+};
@@ -0,0 +1,158 @@
+#pragma once
+
+#include "TsdfVolume.h"
+#include <vector>
+#include <string>
+#include <fstream>
+#include <string.h>
+
+//--------------------------------------------------------------------------
+// Sensor frames stored in a file, to replay them without a Kinect: fusion
+// checks on Linux and headless runs both read them. Only std is used.
+//
+// The file starts with the tag "PCFRAME1", the depth frame size and the
+// pinhole intrinsics of the depth camera (see TsdfVolume::Intrinsics).
+// Frames follow one after the other, each with its time in seconds, the
+// depth in millimetres, the body index (0xff => no body) and the RGBA color
+// of every depth pixel, then the tracked flag and the camera space joint
+// positions of every body. Values are stored little endian, as x86 and ARM
+// write them.
+
+struct FrameRecording
+{
+	enum { Bodies = 6, Joints = 25 }; // BODY_COUNT and JointType_Count of the Kinect SDK
+
+	struct Frame
+	{
+		double                     time;
+		std::vector<unsigned short> depth;
+		std::vector<unsigned char>  bodyIndex;
+		std::vector<unsigned int>   colors; // 0 => no color
+		int                         tracked[Bodies];
+		float                       joints[Bodies * Joints * 3];
+
+		Frame() : time(0)
+		{
+			memset(tracked, 0, sizeof(tracked));
+			memset(joints, 0, sizeof(joints));
+		}
+
+		void Resize(int pixels)
+		{
+			depth.resize(pixels);
+			bodyIndex.resize(pixels);
+			colors.resize(pixels);
+		}
+	};
+
+	static const char* Tag() { return "PCFRAME1"; }
+
+	TsdfVolume::Intrinsics Intr;
+	int                    frames; // Written or read so far
+
+	FrameRecording() :
+		frames(0)
+	{
+		memset(&Intr, 0, sizeof(Intr));
+	}
+
+	int Pixels() const { return Intr.width * Intr.height; }
+
+	//----------------------------------------------------------------------
+	// Writing
+
+	std::ofstream out;
+
+	bool Create(const std::string& path, const TsdfVolume::Intrinsics& intr)
+	{
+		out.open(path.c_str(), std::ios::binary | std::ios::trunc);
+		if (!out)
+			return false;
+		Intr = intr;
+		frames = 0;
+		out.write(Tag(), 8);
+		Write(&Intr.width, 2);
+		Write(&Intr.fx, 4);
+		return (bool)out;
+	}
+
+	// Frame holds Pixels() pixels
+	bool Write(const Frame& f)
+	{
+		int n = Pixels();
+		Write(&f.time, 1);
+		Write(&f.depth[0], n);
+		Write(&f.bodyIndex[0], n);
+		Write(&f.colors[0], n);
+		Write(f.tracked, Bodies);
+		Write(f.joints, Bodies * Joints * 3);
+		if (!out)
+			return false;
+		frames++;
+		return true;
+	}
+
+	void Close()
+	{
+		if (out.is_open())
+			out.close();
+	}
+
+	template <typename T>
+	void Write(const T* values, int count)
+	{
+		out.write((const char*)values, (std::streamsize)count * sizeof(T));
+	}
+
+	//----------------------------------------------------------------------
+	// Reading
+
+	std::ifstream  in;
+	std::streamoff firstFrame;
+
+	bool Open(const std::string& path)
+	{
+		in.open(path.c_str(), std::ios::binary);
+		char tag[8];
+		if (!in.read(tag, 8) || memcmp(tag, Tag(), 8) != 0)
+			return false;
+		Read(&Intr.width, 2);
+		Read(&Intr.fx, 4);
+		if (!in || Intr.width <= 0 || Intr.height <= 0)
+			return false;
+		firstFrame = in.tellg();
+		frames = 0;
+		return true;
+	}
+
+	// False at the end of the file
+	bool Read(Frame& f)
+	{
+		int n = Pixels();
+		f.Resize(n);
+		Read(&f.time, 1);
+		Read(&f.depth[0], n);
+		Read(&f.bodyIndex[0], n);
+		Read(&f.colors[0], n);
+		Read(f.tracked, Bodies);
+		Read(f.joints, Bodies * Joints * 3);
+		if (!in)
+			return false;
+		frames++;
+		return true;
+	}
+
+	// Back to the first frame
+	void Rewind()
+	{
+		in.clear();
+		in.seekg(firstFrame);
+		frames = 0;
+	}
+
+	template <typename T>
+	void Read(T* values, int count)
+	{
+		in.read((char*)values, (std::streamsize)count * sizeof(T));
+	}
+};
@@ -0,0 +1,89 @@
+#pragma once
+
+#include "LibOVRKernel/Src/GL/CAPI_GLE.h"
+
+//--------------------------------------------------------------------------
+// GL context the scene renders with, and the keys it reads. OGL (see
+// Win32_GLAppUtil.h) is a Win32 window with a WGL context, as the Rift
+// needs; EglPlatform (see EglPlatform.h) is an offscreen EGL context for
+// headless runs, with no window system at all. The scene renders into its
+// own framebuffers either way, so it does not tell them apart.
+//
+// GetProc loads the entry points GLE does not, through the platform whose
+// context is current: wglGetProcAddress or eglGetProcAddress.
+
+struct GLPlatform
+{
+	bool                    Running;
+	bool                    Key[256];
+	int                     WinSizeW;
+	int                     WinSizeH;
+	GLuint                  fboId;
+	OVR::GLEContext         GLEContext;
+
+	GLPlatform() :
+		Running(false),
+		WinSizeW(0),
+		WinSizeH(0),
+		fboId(0),
+		GLEContext()
+	{
+		// Clear input
+		for (int i = 0; i < sizeof(Key) / sizeof(Key[0]); ++i)
+			Key[i] = false;
+	}
+
+	virtual ~GLPlatform() {}
+
+	// Creates a context for a vpW x vpH view and makes it current
+	virtual bool InitDevice(int vpW, int vpH) = 0;
+
+	// Handles the pending input; false once the application has to quit
+	virtual bool HandleMessages() = 0;
+
+	// Shows the default framebuffer, where there is one
+	virtual void Present() = 0;
+
+	virtual void ReleaseDevice() = 0;
+
+	// Entry point of the current context, nullptr if it has none
+	virtual void* LoadProc(const char* name) = 0;
+
+	static void* GetProc(const char* name)
+	{
+		return Current() ? Current()->LoadProc(name) : nullptr;
+	}
+
+	// The platform whose context was set up last
+	static GLPlatform*& Current()
+	{
+		static GLPlatform* current = nullptr;
+		return current;
+	}
+
+	// State shared by every context, set up once it is current
+	void InitGL()
+	{
+		Current() = this;
+		OVR::GLEContext::SetCurrentContext(&GLEContext);
+		GLEContext.Init();
+
+		glGenFramebuffers(1, &fboId);
+
+		glEnable(GL_DEPTH_TEST);
+		glFrontFace(GL_CW);
+		glEnable(GL_CULL_FACE);
+	}
+
+	// Called while the context is still current
+	void ReleaseGL()
+	{
+		if (fboId)
+		{
+			glDeleteFramebuffers(1, &fboId);
+			fboId = 0;
+		}
+		if (Current() == this)
+			Current() = nullptr;
+	}
+};
@@ -0,0 +1,285 @@
+#pragma once
+
+#include "LibOVRKernel/Src/GL/CAPI_GLE.h"
+#include "LibOVRKernel/Src/Kernel/OVR_Timer.h"
+#include "ResolutionScaler.h"
+#include <vector>
+#include <algorithm>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+
+//--------------------------------------------------------------------------
+// GPU time of the render passes, measured with timestamp queries, next to
+// CPU time of the stages of the frame. The queries of a frame are read
+// RingSize frames later, and only if the GPU is done with them, so reading
+// never stalls the pipeline. Every ReportInterval seconds the mean and the
+// percentiles of the last WindowSize frames are written to the console.
+//
+// A pass can be measured several times per frame (once per eye); its sample
+// for the frame is the sum of those times. Stage_PoseToSubmit is not a stage
+// but the age of the head pose when the frame is submitted. Stage_CloudBuild
+// is only sampled on frames with a new sensor frame. The report ends with the
+// state of the resolution scaler, when there is one.
+
+struct GpuProfiler
+{
+	enum Pass { Pass_Points, Pass_Joints, Pass_Static, Pass_Props, Pass_Prepass, Pass_HoleFill, Pass_LeftEye, Pass_RightEye, Pass_Mirror, PassCount };
+	enum Stage { Stage_Update, Stage_Render, Stage_Submit, Stage_Frame, Stage_PoseToSubmit, Stage_CloudBuild, StageCount };
+	enum { RingSize = 4, MaxScopes = 32, WindowSize = 256 };
+
+	// Last WindowSize samples, in milliseconds
+	struct Series
+	{
+		std::vector<float> samples;
+		size_t             next;
+
+		Series() : next(0) {}
+
+		void Add(float ms)
+		{
+			if (samples.size() < WindowSize)
+				samples.push_back(ms);
+			else
+				samples[next] = ms;
+			next = (next + 1) % WindowSize;
+		}
+
+		float Last() const
+		{
+			return samples.empty() ? 0 : samples[(next + WindowSize - 1) % WindowSize];
+		}
+
+		float Mean() const
+		{
+			float sum = 0;
+			for (size_t i = 0; i < samples.size(); i++)
+				sum += samples[i];
+			return samples.empty() ? 0 : sum / samples.size();
+		}
+
+		// p in [0, 1]
+		float Percentile(float p) const
+		{
+			if (samples.empty())
+				return 0;
+			std::vector<float> sorted(samples);
+			size_t k = std::min(sorted.size() - 1, (size_t)(p * sorted.size()));
+			std::nth_element(sorted.begin(), sorted.begin() + k, sorted.end());
+			return sorted[k];
+		}
+	};
+
+	// Queries of one frame: scope s of the frame uses queries 2s and 2s + 1.
+	// Scopes nest, so the query issued last is not always the end of the
+	// last scope begun; it is kept in last.
+	struct FrameQueries
+	{
+		GLuint queries[2 * MaxScopes];
+		int    pass[MaxScopes];
+		bool   ended[MaxScopes];
+		int    used;
+		int    last;
+		bool   pending;
+	};
+
+	FrameQueries frames[RingSize];
+	int          frameIndex;
+	bool         initialized;
+	bool         inFrame;
+	int          open[PassCount];
+	double       cpuStart[StageCount];
+	double       lastReport;
+	int          droppedFrames;
+
+	// GPU times of the last frame read back; measuredFrames counts them
+	float        lastFrameMs[PassCount];
+	int          measuredFrames;
+
+	Series gpu[PassCount];
+	Series cpu[StageCount];
+
+	double ReportInterval; // Seconds between reports, 0 => no reports
+	const ResolutionScaler* Scaler; // Reported with the times, if set
+
+	GpuProfiler() :
+		frameIndex(0),
+		initialized(false),
+		inFrame(false),
+		lastReport(0),
+		droppedFrames(0),
+		measuredFrames(0),
+		ReportInterval(5.0),
+		Scaler(NULL)
+	{
+		for (int p = 0; p < PassCount; p++)
+		{
+			open[p] = -1;
+			lastFrameMs[p] = 0;
+		}
+		for (int s = 0; s < StageCount; s++)
+			cpuStart[s] = 0;
+	}
+
+	static GpuProfiler& Get()
+	{
+		static GpuProfiler profiler;
+		return profiler;
+	}
+
+	// Deletes the queries, must be called before the GL context goes away
+	void Release()
+	{
+		if (!initialized)
+			return;
+		for (int f = 0; f < RingSize; f++)
+			glDeleteQueries(2 * MaxScopes, frames[f].queries);
+		initialized = false;
+		inFrame = false;
+	}
+
+	void BeginFrame()
+	{
+		if (!initialized)
+		{
+			for (int f = 0; f < RingSize; f++)
+			{
+				glGenQueries(2 * MaxScopes, frames[f].queries);
+				frames[f].used = 0;
+				frames[f].last = -1;
+				frames[f].pending = false;
+			}
+			lastReport = OVR::Timer::GetSeconds();
+			initialized = true;
+		}
+
+		FrameQueries& frame = frames[frameIndex % RingSize];
+		if (frame.pending)
+			Collect(frame);
+		frame.used = 0;
+		frame.last = -1;
+		for (int p = 0; p < PassCount; p++)
+			open[p] = -1;
+		inFrame = true;
+	}
+
+	void EndFrame()
+	{
+		if (!inFrame)
+			return;
+		frames[frameIndex % RingSize].pending = frames[frameIndex % RingSize].used > 0;
+		frameIndex++;
+		inFrame = false;
+
+		double now = OVR::Timer::GetSeconds();
+		if (ReportInterval > 0 && now - lastReport >= ReportInterval)
+		{
+			Report();
+			lastReport = now;
+		}
+	}
+
+	void Begin(int pass)
+	{
+		FrameQueries& frame = frames[frameIndex % RingSize];
+		if (!inFrame || frame.used == MaxScopes)
+			return;
+		int s = frame.used++;
+		frame.pass[s] = pass;
+		frame.ended[s] = false;
+		open[pass] = s;
+		frame.last = 2 * s;
+		glQueryCounter(frame.queries[frame.last], GL_TIMESTAMP);
+	}
+
+	void End(int pass)
+	{
+		if (!inFrame || open[pass] < 0)
+			return;
+		FrameQueries& frame = frames[frameIndex % RingSize];
+		frame.ended[open[pass]] = true;
+		frame.last = 2 * open[pass] + 1;
+		glQueryCounter(frame.queries[frame.last], GL_TIMESTAMP);
+		open[pass] = -1;
+	}
+
+	void CpuBegin(int stage)
+	{
+		cpuStart[stage] = OVR::Timer::GetSeconds();
+	}
+
+	void CpuEnd(int stage)
+	{
+		cpu[stage].Add((float)(1000 * (OVR::Timer::GetSeconds() - cpuStart[stage])));
+	}
+
+	void Collect(FrameQueries& frame)
+	{
+		frame.pending = false;
+
+		// Queries complete in order, so once the last one issued is, they all are
+		GLint available = 0;
+		glGetQueryObjectiv(frame.queries[frame.last], GL_QUERY_RESULT_AVAILABLE, &available);
+		if (!available)
+		{
+			droppedFrames++;
+			return;
+		}
+
+		float ms[PassCount];
+		bool  seen[PassCount];
+		for (int p = 0; p < PassCount; p++)
+		{
+			ms[p] = 0;
+			seen[p] = false;
+		}
+		for (int s = 0; s < frame.used; s++)
+		{
+			// A scope left open has no end query
+			if (!frame.ended[s])
+				continue;
+			GLuint64 start = 0, end = 0;
+			glGetQueryObjectui64v(frame.queries[2 * s], GL_QUERY_RESULT, &start);
+			glGetQueryObjectui64v(frame.queries[2 * s + 1], GL_QUERY_RESULT, &end);
+			ms[frame.pass[s]] += (end > start) ? (end - start) / 1.0e6f : 0.0f;
+			seen[frame.pass[s]] = true;
+		}
+		for (int p = 0; p < PassCount; p++)
+		{
+			if (seen[p])
+				gpu[p].Add(ms[p]);
+			lastFrameMs[p] = ms[p];
+		}
+		measuredFrames++;
+	}
+
+	void Report() const
+	{
+		static const char* PassNames[PassCount] = { "points", "joints", "static", "props", "prepass", "hole fill", "left eye", "right eye", "mirror" };
+		static const char* StageNames[StageCount] = { "update", "render", "submit", "frame", "pose to submit", "cloud build" };
+
+		// Formatted apart, so the rest of the program's output keeps its format
+		std::ostringstream out;
+		out << std::fixed << std::setprecision(2);
+		out << "Frame times (ms)        mean    p50    p95    p99" << std::endl;
+		for (int p = 0; p < PassCount; p++)
+			PrintSeries(out, "GPU ", PassNames[p], gpu[p]);
+		for (int s = 0; s < StageCount; s++)
+			PrintSeries(out, "CPU ", StageNames[s], cpu[s]);
+		if (droppedFrames)
+			out << droppedFrames << " frames of GPU queries not ready in time" << std::endl;
+		if (Scaler)
+			out << "Resolution scale " << Scaler->Scale << ", " << Scaler->decreases << " decreases, "
+				<< Scaler->increases << " increases" << std::endl;
+		std::cout << out.str();
+	}
+
+	static void PrintSeries(std::ostream& out, const char* prefix, const char* name, const Series& s)
+	{
+		if (s.samples.empty())
+			return;
+		out << prefix << std::left << std::setw(18) << name << std::right
+			<< std::setw(7) << s.Mean() << std::setw(7) << s.Percentile(0.5f)
+			<< std::setw(7) << s.Percentile(0.95f) << std::setw(7) << s.Percentile(0.99f) << std::endl;
+	}
+};
@@ -0,0 +1,290 @@
+#pragma once
+
+#include "LibOVRKernel/Src/GL/CAPI_GLE.h"
+#include <vector>
+#include <math.h>
+#include <string.h>
+
+//--------------------------------------------------------------------------
+// Triangle surface over the organized grid of the depth frame. Every grid
+// node (every rowStep-th row and colStep-th column of the frame) is one
+// vertex, at a fixed place in the vertex buffer, and every 2x2 block of
+// nodes is two triangles, at a fixed place in the index buffer. Vertex and
+// face ids therefore stay the same from frame to frame; the topology only
+// changes with the grid steps.
+//
+// Each sensor frame the caller rewrites the vertices, and Update keeps a
+// triangle when its three nodes are valid and its edges do not jump in
+// depth by more than JumpFactor times the sample spacing at that depth,
+// which grows with the distance to the sensor. A kept triangle is only
+// dropped past Hysteresis times that jump, so faces at the limit do not
+// flicker. Dropped triangles stay in the index buffer as degenerate ones.
+//
+// Update lists the vertices that moved past the deadbands and the faces
+// that appeared or disappeared, rows in parallel, and Upload only rewrites
+// those parts of the buffers. The same lists serve as the delta of the
+// mesh for any other consumer.
+
+struct GridSurface
+{
+	enum { VertexFloats = 9 }; // position, color, velocity
+	enum { MaxGap = 8 };       // Unchanged elements uploaded to merge two runs of changes
+
+	int   rowStep, colStep;
+	int   rows, cols;         // Grid nodes
+	float FocalLength;        // Depth pixels per metre at one metre
+	float JumpFactor;
+	float Hysteresis;
+	float PositionDeadband;   // Metres
+	float ColorDeadband;
+	float VelocityDeadband;   // Metres per second
+
+	std::vector<GLfloat> vertices;  // VertexFloats per node, written by the caller
+	std::vector<float>   depth;     // Per node, 0 => invalid
+	std::vector<GLfloat> current;   // Vertices as in the vertex buffer
+	std::vector<GLuint>  indices;   // Face f of quad q is indices [(q * 2 + f) * 3, ...)
+	std::vector<unsigned char> faceValid;
+	GLsizei              numIndices;
+	int                  numFaces;  // Valid faces
+	bool                 fullUpload;
+
+	// Changes of the last Update, in increasing order
+	std::vector<int> changedVertices;
+	std::vector<int> changedFaces;
+	std::vector<std::vector<int> > rowVertices, rowFaces;
+
+	GLuint vao, vbo, ibo;
+
+	GridSurface(float focalLength) :
+		rowStep(0),
+		colStep(0),
+		rows(0),
+		cols(0),
+		FocalLength(focalLength),
+		JumpFactor(4.0f),
+		Hysteresis(1.25f),
+		PositionDeadband(0.002f),
+		ColorDeadband(4.0f / 255),
+		VelocityDeadband(0.01f),
+		numIndices(0),
+		numFaces(0),
+		fullUpload(true),
+		vao(0),
+		vbo(0),
+		ibo(0)
+	{}
+
+	~GridSurface()
+	{
+		if (vao)
+		{
+			glDeleteVertexArrays(1, &vao);
+			glDeleteBuffers(1, &vbo);
+			glDeleteBuffers(1, &ibo);
+		}
+	}
+
+	// Attribute locations of the program drawing the surface, -1 => unused
+	void Init(GLint positionLoc, GLint colorLoc, GLint velocityLoc)
+	{
+		glGenVertexArrays(1, &vao);
+		glGenBuffers(1, &vbo);
+		glGenBuffers(1, &ibo);
+
+		glBindVertexArray(vao);
+		glBindBuffer(GL_ARRAY_BUFFER, vbo);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo);
+		GLint locs[3] = { positionLoc, colorLoc, velocityLoc };
+		for (int a = 0; a < 3; a++)
+		{
+			if (locs[a] < 0)
+				continue;
+			glEnableVertexAttribArray(locs[a]);
+			glVertexAttribPointer(locs[a], 3, GL_FLOAT, GL_FALSE, VertexFloats * sizeof(GLfloat), (void*)(a * 3 * sizeof(GLfloat)));
+		}
+		glBindVertexArray(0);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	}
+
+	// Sizes the grid for a frame of width x height sampled every rowStep-th
+	// row and colStep-th column
+	void Resize(int width, int height, int newRowStep, int newColStep)
+	{
+		if (newRowStep == rowStep && newColStep == colStep)
+			return;
+		rowStep = newRowStep;
+		colStep = newColStep;
+		rows = (height + rowStep - 1) / rowStep;
+		cols = (width + colStep - 1) / colStep;
+		vertices.assign(rows * cols * VertexFloats, 0.0f);
+		current.assign(rows * cols * VertexFloats, 0.0f);
+		depth.assign(rows * cols, 0.0f);
+		faceValid.assign((rows - 1) * (cols - 1) * 2, 0);
+		indices.resize(faceValid.size() * 3);
+		for (size_t f = 0; f < faceValid.size(); f++)
+			SetFace((int)f, false);
+		numIndices = (GLsizei)indices.size();
+		numFaces = 0;
+		rowVertices.resize(rows);
+		rowFaces.resize(rows);
+		fullUpload = true;
+	}
+
+	// Vertex of grid node (r, c); the caller also sets its depth, 0 if invalid
+	GLfloat* Vertex(int r, int c) { return &vertices[(r * cols + c) * VertexFloats]; }
+
+	// Nodes of face f: face 0 of a quad is (a, d, b), face 1 is (b, d, e)
+	// with a at its top left, b right of a, d below a and e below b
+	void FaceNodes(int f, int* nodes) const { FaceNodes(f, cols, nodes); }
+
+	// Same, for a grid of cols nodes per row
+	static void FaceNodes(int f, int cols, int* nodes)
+	{
+		int q = f / 2, r = q / (cols - 1), c = q % (cols - 1);
+		int a = r * cols + c, b = a + 1, d = a + cols, e = d + 1;
+		nodes[0] = (f & 1) ? b : a;
+		nodes[1] = d;
+		nodes[2] = (f & 1) ? e : b;
+	}
+
+	// Writes face f, or a degenerate triangle in its place
+	void SetFace(int f, bool valid)
+	{
+		int nodes[3];
+		FaceNodes(f, nodes);
+		for (int k = 0; k < 3; k++)
+			indices[f * 3 + k] = valid ? nodes[k] : nodes[0];
+		faceValid[f] = valid;
+	}
+
+	bool Edge(int a, int b, float maxJumpPerMetre) const
+	{
+		float za = depth[a], zb = depth[b];
+		return fabs(za - zb) <= maxJumpPerMetre * (za < zb ? za : zb);
+	}
+
+	bool Keep(int f, float maxJumpPerMetre) const
+	{
+		int n[3];
+		FaceNodes(f, n);
+		if (faceValid[f])
+			maxJumpPerMetre *= Hysteresis;
+		return depth[n[0]] > 0 && depth[n[1]] > 0 && depth[n[2]] > 0 &&
+			Edge(n[0], n[1], maxJumpPerMetre) && Edge(n[1], n[2], maxJumpPerMetre) && Edge(n[2], n[0], maxJumpPerMetre);
+	}
+
+	// True if the vertex written for node k moved past the deadbands
+	bool Moved(int k) const
+	{
+		const GLfloat* v = &vertices[k * VertexFloats];
+		const GLfloat* u = &current[k * VertexFloats];
+		const float deadband[3] = { PositionDeadband, ColorDeadband, VelocityDeadband };
+		for (int i = 0; i < VertexFloats; i++)
+		{
+			if (fabs(v[i] - u[i]) > deadband[i / 3])
+				return true;
+		}
+		return false;
+	}
+
+	// Brings the faces and the vertices in use up to date with the depths
+	// and the vertices written for this frame, and lists what changed
+	void Update()
+	{
+		changedVertices.clear();
+		changedFaces.clear();
+		if (rows < 2 || cols < 2)
+			return;
+
+		// Sample spacing at one metre, the jump allowed grows with it
+		float maxJumpPerMetre = JumpFactor * (rowStep > colStep ? rowStep : colStep) / FocalLength;
+		int   rowSlice = (cols - 1) * 2;
+
+		#pragma omp parallel for schedule(dynamic)
+		for (int r = 0; r < rows; r++)
+		{
+			std::vector<int>& moved = rowVertices[r];
+			moved.clear();
+			for (int k = r * cols; k < (r + 1) * cols; k++)
+			{
+				if (depth[k] > 0 && Moved(k))
+				{
+					memcpy(&current[k * VertexFloats], &vertices[k * VertexFloats], VertexFloats * sizeof(GLfloat));
+					moved.push_back(k);
+				}
+			}
+
+			std::vector<int>& toggled = rowFaces[r];
+			toggled.clear();
+			if (r == rows - 1)
+				continue;
+			for (int f = r * rowSlice; f < (r + 1) * rowSlice; f++)
+			{
+				bool keep = Keep(f, maxJumpPerMetre);
+				if (keep != (faceValid[f] != 0))
+				{
+					SetFace(f, keep);
+					toggled.push_back(f);
+				}
+			}
+		}
+
+		for (int r = 0; r < rows; r++)
+		{
+			changedVertices.insert(changedVertices.end(), rowVertices[r].begin(), rowVertices[r].end());
+			changedFaces.insert(changedFaces.end(), rowFaces[r].begin(), rowFaces[r].end());
+			for (size_t i = 0; i < rowFaces[r].size(); i++)
+				numFaces += faceValid[rowFaces[r][i]] ? 1 : -1;
+		}
+	}
+
+	// Rewrites the changed elements of the bound buffer target; ids are
+	// sorted, and runs of them closer than MaxGap go in one call
+	static void UploadRuns(GLenum target, const std::vector<int>& ids, size_t stride, const void* data)
+	{
+		for (size_t i = 0; i < ids.size();)
+		{
+			size_t j = i + 1;
+			while (j < ids.size() && ids[j] - ids[j - 1] <= MaxGap)
+				j++;
+			size_t first = ids[i], count = ids[j - 1] - ids[i] + 1;
+			glBufferSubData(target, first * stride, count * stride, (const char*)data + first * stride);
+			i = j;
+		}
+	}
+
+	// Uploads what the last Update changed, or everything after a resize
+	void Upload()
+	{
+		glBindBuffer(GL_ARRAY_BUFFER, vbo);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo);
+		if (fullUpload)
+		{
+			glBufferData(GL_ARRAY_BUFFER, current.size() * sizeof(GLfloat), &current[0], GL_DYNAMIC_DRAW);
+			glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint), &indices[0], GL_DYNAMIC_DRAW);
+			fullUpload = false;
+		}
+		else
+		{
+			UploadRuns(GL_ARRAY_BUFFER, changedVertices, VertexFloats * sizeof(GLfloat), &current[0]);
+			UploadRuns(GL_ELEMENT_ARRAY_BUFFER, changedFaces, 3 * sizeof(GLuint), &indices[0]);
+		}
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	}
+
+	// Draws with the bound program; both sides are visible
+	void Draw() const
+	{
+		if (!numFaces)
+			return;
+		GLboolean cull = glIsEnabled(GL_CULL_FACE);
+		glDisable(GL_CULL_FACE);
+		glBindVertexArray(vao);
+		glDrawElements(GL_TRIANGLES, numIndices, GL_UNSIGNED_INT, 0);
+		glBindVertexArray(0);
+		if (cull)
+			glEnable(GL_CULL_FACE);
+	}
+};
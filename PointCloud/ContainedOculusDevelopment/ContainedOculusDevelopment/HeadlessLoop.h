@@ -0,0 +1,136 @@
+#pragma once
+
+#include "Win32_GLAppUtil.h"
+#include "FakeHmd.h"
+#include "GpuProfiler.h"
+#include "LibOVRKernel/Src/Kernel/OVR_Timer.h"
+#include <fstream>
+#include <vector>
+
+//--------------------------------------------------------------------------
+// The headless runs: the scene rendered from a FakeHmd into offscreen eye
+// targets, on any GLPlatform. WinMain runs it with -headless, and the
+// Linux driver in Tests/HeadlessSceneCheck.cpp with an EglPlatform.
+
+// Saves the color attachment of the bound framebuffer as a binary PPM, top row first
+static void WritePPM(const char* path, int w, int h)
+{
+	vector<unsigned char> pixels(w * h * 3);
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glReadPixels(0, 0, w, h, GL_RGB, GL_UNSIGNED_BYTE, &pixels[0]);
+
+	ofstream file(path, ios::binary);
+	file << "P6\n" << w << " " << h << "\n255\n";
+	for (int y = h - 1; y >= 0; --y)
+		file.write((const char*)&pixels[y * w * 3], w * 3);
+}
+
+// Renders the scene without a Rift, from the poses of a FakeHmd, into
+// offscreen eye targets of platform, with the sensor frames of sensor.
+// Reports the CPU frame times, including a glFinish, and saves the eye
+// images of the last frame so that runs can be diffed.
+// Frames follow the order of MainLoop: update, pose latch, eyes, and the
+// end of the eyes stands for the submit. The frame time and the time from
+// the pose latch to it are written for every frame to headless_frames.txt.
+static bool HeadlessLoop(GLPlatform& platform, const char* poseScript, int frameCount)
+{
+	FakeHmd hmd;
+	if (poseScript && !hmd.LoadScript(poseScript))
+		cout << "Could not read the pose script " << poseScript << ", using the default sweep" << endl;
+
+	if (!platform.InitDevice(hmd.EyeTextureSize.w / 2, hmd.EyeTextureSize.h / 2))
+		return false;
+
+	TextureBuffer * eyeRenderTexture[2];
+	DepthBuffer   * eyeDepthBuffer[2];
+	for (int eye = 0; eye < 2; ++eye)
+	{
+		eyeRenderTexture[eye] = new TextureBuffer(nullptr, true, false, Sizei(hmd.EyeTextureSize.w, hmd.EyeTextureSize.h), 1, NULL, 1);
+		eyeDepthBuffer[eye] = new DepthBuffer(eyeRenderTexture[eye]->GetSize(), 0);
+	}
+
+	Scene * roomScene = new Scene(false, true);
+	vector<double> frameTimes, poseToSubmit;
+
+	GpuProfiler& profiler = GpuProfiler::Get();
+
+	for (int frame = 0; frame < frameCount && platform.HandleMessages(); ++frame)
+	{
+		double start = Timer::GetSeconds();
+		profiler.BeginFrame();
+
+		double   displayTime = hmd.GetPredictedDisplayTime(frame);
+		profiler.CpuBegin(GpuProfiler::Stage_Update);
+		roomScene->Update(displayTime);
+		profiler.CpuEnd(GpuProfiler::Stage_Update);
+
+		ovrPosef EyeRenderPose[2];
+		double   poseTime = Timer::GetSeconds();
+		hmd.CalcEyePoses(hmd.GetHeadPose(displayTime), EyeRenderPose);
+		profiler.CpuBegin(GpuProfiler::Stage_PoseToSubmit);
+
+		profiler.CpuBegin(GpuProfiler::Stage_Render);
+		for (int eye = 0; eye < 2; ++eye)
+		{
+			profiler.Begin(GpuProfiler::Pass_LeftEye + eye);
+			eyeRenderTexture[eye]->SetAndClearRenderSurface(eyeDepthBuffer[eye]);
+
+			Matrix4f orientation = Matrix4f(EyeRenderPose[eye].Orientation);
+			Vector3f up = orientation.Transform(Vector3f(0, 1, 0));
+			Vector3f forward = orientation.Transform(Vector3f(0, 0, -1));
+			Vector3f eyePos = EyeRenderPose[eye].Position;
+
+			Matrix4f view = Matrix4f::LookAtRH(eyePos, eyePos + forward, up);
+			Matrix4f proj = ovrMatrix4f_Projection(hmd.Fov[eye], 0.2f, 1000.0f, ovrProjection_RightHanded);
+
+			roomScene->Render(view, proj);
+
+			// The last frame is kept for comparison between runs
+			if (frame == frameCount - 1)
+				WritePPM(eye == 0 ? "headless_left.ppm" : "headless_right.ppm", hmd.EyeTextureSize.w, hmd.EyeTextureSize.h);
+
+			eyeRenderTexture[eye]->UnsetRenderSurface();
+			profiler.End(GpuProfiler::Pass_LeftEye + eye);
+		}
+		profiler.CpuEnd(GpuProfiler::Stage_Render);
+		profiler.CpuEnd(GpuProfiler::Stage_PoseToSubmit);
+		poseToSubmit.push_back(Timer::GetSeconds() - poseTime);
+
+		glFinish();
+		profiler.EndFrame();
+		frameTimes.push_back(Timer::GetSeconds() - start);
+	}
+	profiler.Report();
+
+	if (!frameTimes.empty())
+	{
+		double total = 0, worst = 0, poseTotal = 0, poseWorst = 0;
+		ofstream frames("headless_frames.txt");
+		frames << "# frame frame_ms pose_to_submit_ms" << endl;
+		for (size_t i = 0; i < frameTimes.size(); ++i)
+		{
+			total += frameTimes[i];
+			worst = max(worst, frameTimes[i]);
+			poseTotal += poseToSubmit[i];
+			poseWorst = max(poseWorst, poseToSubmit[i]);
+			frames << i << " " << 1000 * frameTimes[i] << " " << 1000 * poseToSubmit[i] << endl;
+		}
+		ofstream report("headless_report.txt");
+		report << "frames " << frameTimes.size() << endl;
+		report << "mean_ms " << 1000 * total / frameTimes.size() << endl;
+		report << "worst_ms " << 1000 * worst << endl;
+		report << "pose_to_submit_mean_ms " << 1000 * poseTotal / frameTimes.size() << endl;
+		report << "pose_to_submit_worst_ms " << 1000 * poseWorst << endl;
+		cout << "Headless: " << frameTimes.size() << " frames, " << 1000 * total / frameTimes.size() << " ms mean" << endl;
+	}
+
+	profiler.Release();
+	delete roomScene;
+	for (int eye = 0; eye < 2; ++eye)
+	{
+		delete eyeRenderTexture[eye];
+		delete eyeDepthBuffer[eye];
+	}
+	platform.ReleaseDevice();
+	return !frameTimes.empty();
+}
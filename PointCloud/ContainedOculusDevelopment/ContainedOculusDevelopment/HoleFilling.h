@@ -0,0 +1,352 @@
+#pragma once
+
+#include "PointSplatting.h"
+#include <vector>
+
+//--------------------------------------------------------------------------
+// Screen space hole filling of the point cloud with a pull-push pyramid.
+// The points are drawn into an offscreen layer holding color and linear
+// view depth. Pull halves the layer Levels times, averaging the samples of
+// the nearest surface in every 2x2 block. Push goes back from the coarsest
+// level and gives a pixel the coarse sample when it is empty, or when it
+// shows a surface farther than DepthThreshold behind the coarse one (the
+// background seen through a hole). Only holes enclosed by the surface on
+// the coarse level are filled, so silhouettes do not grow. The last push
+// step writes color and depth into the bound render target.
+//
+// The whole pass, points layer included, should take under 0.5 ms per eye;
+// the renderer times it as GpuProfiler::Pass_HoleFill, both eyes together.
+
+struct PullPushFiller
+{
+	GLuint pointProgram;
+	GLint  pointMatWVPLoc, pointExtrapolationLoc;
+	GLuint pullProgram;
+	GLint  pullThresholdLoc;
+	GLuint pushProgram;
+	GLint  pushThresholdLoc;
+	GLuint compositeProgram;
+	GLint  compositeThresholdLoc, compositeDepthProjLoc;
+	GLuint emptyVao;
+	GLuint layerDepth;
+
+	// pull[l] holds level l of the pyramid and push[l] its filled version;
+	// every texel is rgb color and view depth, zero depth meaning empty
+	std::vector<GLuint> pull, push;
+	std::vector<GLuint> pullFbo, pushFbo;
+	std::vector<OVR::Sizei> levelSize;
+
+	int   Levels;         // Holes up to 2^Levels pixels wide are filled
+	float DepthThreshold; // Metres between samples of different surfaces
+
+	PullPushFiller() :
+		emptyVao(0),
+		layerDepth(0),
+		Levels(3),
+		DepthThreshold(0.1f)
+	{
+		static const GLchar* PointVertexShaderSrc =
+			"#version 150\n"
+			"uniform mat4 matWVP;\n"
+			"uniform float extrapolation;\n"
+			"in vec4 position;\n"
+			"in vec3 color;\n"
+			"in vec3 velocity;\n"
+			"out vec4 layerSample;\n"
+			"void main() {\n"
+			"	gl_Position = matWVP * vec4(position.xyz + velocity * extrapolation, 1.0);\n"
+			"	layerSample = vec4(color, gl_Position.w);\n"
+			"}";
+
+		static const GLchar* PointFragmentShaderSrc =
+			"#version 150\n"
+			"in vec4 layerSample;\n"
+			"out vec4 out_color;\n"
+			"void main() {\n"
+			"	out_color = layerSample;\n"
+			"}";
+
+		static const GLchar* FullscreenVertexShaderSrc =
+			"#version 150\n"
+			"void main() {\n"
+			"	vec2 p = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);\n"
+			"	gl_Position = vec4(p * 2.0 - 1.0, 0.0, 1.0);\n"
+			"}";
+
+		static const GLchar* PullShaderSrc =
+			"#version 150\n"
+			"uniform sampler2D src;\n"
+			"uniform float depthThreshold;\n"
+			"out vec4 out_color;\n"
+			"void main() {\n"
+			"	ivec2 base = ivec2(gl_FragCoord.xy) * 2;\n"
+			"	ivec2 last = textureSize(src, 0) - 1;\n"
+			"	vec4 s[4];\n"
+			"	float nearest = 1e6;\n"
+			"	for (int k = 0; k < 4; k++) {\n"
+			"		s[k] = texelFetch(src, min(base + ivec2(k & 1, k >> 1), last), 0);\n"
+			"		if (s[k].a > 0.0) nearest = min(nearest, s[k].a);\n"
+			"	}\n"
+			"	vec4 sum = vec4(0.0);\n"
+			"	float n = 0.0;\n"
+			"	for (int k = 0; k < 4; k++) {\n"
+			"		if (s[k].a > 0.0 && s[k].a < nearest + depthThreshold) {\n"
+			"			sum += s[k];\n"
+			"			n += 1.0;\n"
+			"		}\n"
+			"	}\n"
+			"	out_color = n > 0.0 ? sum / n : vec4(0.0);\n"
+			"}";
+
+		// fine is the pulled level being filled, coarse the filled level above
+		// it and pulled the unfilled level above it, used for the enclosure test
+		#define PUSH_SHADER_SRC \
+			"uniform sampler2D fine;\n" \
+			"uniform sampler2D coarse;\n" \
+			"uniform sampler2D pulled;\n" \
+			"uniform float depthThreshold;\n" \
+			"bool sameSurface(vec4 a, vec4 b) {\n" \
+			"	return a.a > 0.0 && abs(a.a - b.a) < depthThreshold;\n" \
+			"}\n" \
+			"vec4 pushSample() {\n" \
+			"	ivec2 p = ivec2(gl_FragCoord.xy);\n" \
+			"	ivec2 q = p / 2;\n" \
+			"	ivec2 last = textureSize(pulled, 0) - 1;\n" \
+			"	vec4 f = texelFetch(fine, p, 0);\n" \
+			"	vec4 c = texelFetch(coarse, min(q, last), 0);\n" \
+			"	if (c.a == 0.0 || (f.a > 0.0 && f.a < c.a + depthThreshold)) return f;\n" \
+			"	ivec2 o[4] = ivec2[4](ivec2(1, 0), ivec2(0, 1), ivec2(1, 1), ivec2(1, -1));\n" \
+			"	for (int k = 0; k < 4; k++) {\n" \
+			"		vec4 a = texelFetch(pulled, clamp(q + o[k], ivec2(0), last), 0);\n" \
+			"		vec4 b = texelFetch(pulled, clamp(q - o[k], ivec2(0), last), 0);\n" \
+			"		if (sameSurface(a, c) && sameSurface(b, c)) return c;\n" \
+			"	}\n" \
+			"	return f;\n" \
+			"}\n"
+
+		static const GLchar* PushShaderSrc =
+			"#version 150\n"
+			PUSH_SHADER_SRC
+			"out vec4 out_color;\n"
+			"void main() {\n"
+			"	out_color = pushSample();\n"
+			"}";
+
+		// depthProj holds the third row of the projection, to turn view depth
+		// back into window depth
+		static const GLchar* CompositeShaderSrc =
+			"#version 150\n"
+			PUSH_SHADER_SRC
+			"uniform vec2 depthProj;\n"
+			"out vec4 out_color;\n"
+			"void main() {\n"
+			"	vec4 s = pushSample();\n"
+			"	if (s.a == 0.0) discard;\n"
+			"	out_color = vec4(s.rgb, 1.0);\n"
+			"	gl_FragDepth = 0.5 * (depthProj.y - depthProj.x * s.a) / s.a + 0.5;\n"
+			"}";
+
+		#undef PUSH_SHADER_SRC
+
+		ProgramCache& cache = ProgramCache::Get();
+		pointProgram = cache.Begin(PointVertexShaderSrc, PointFragmentShaderSrc, PointSplatter::AttribNames(), PointSplatter::NumAttribs);
+		pullProgram = cache.Begin(FullscreenVertexShaderSrc, PullShaderSrc);
+		pushProgram = cache.Begin(FullscreenVertexShaderSrc, PushShaderSrc);
+		compositeProgram = cache.Begin(FullscreenVertexShaderSrc, CompositeShaderSrc);
+		cache.Finish(pointProgram);
+		cache.Finish(pullProgram);
+		cache.Finish(pushProgram);
+		cache.Finish(compositeProgram);
+
+		pointMatWVPLoc = glGetUniformLocation(pointProgram, "matWVP");
+		pointExtrapolationLoc = glGetUniformLocation(pointProgram, "extrapolation");
+
+		pullThresholdLoc = glGetUniformLocation(pullProgram, "depthThreshold");
+		pushThresholdLoc = glGetUniformLocation(pushProgram, "depthThreshold");
+		compositeThresholdLoc = glGetUniformLocation(compositeProgram, "depthThreshold");
+		compositeDepthProjLoc = glGetUniformLocation(compositeProgram, "depthProj");
+
+		glUseProgram(pullProgram);
+		glUniform1i(glGetUniformLocation(pullProgram, "src"), 0);
+		GLuint pushPrograms[2] = { pushProgram, compositeProgram };
+		for (int i = 0; i < 2; i++)
+		{
+			glUseProgram(pushPrograms[i]);
+			glUniform1i(glGetUniformLocation(pushPrograms[i], "fine"), 0);
+			glUniform1i(glGetUniformLocation(pushPrograms[i], "coarse"), 1);
+			glUniform1i(glGetUniformLocation(pushPrograms[i], "pulled"), 2);
+		}
+		glUseProgram(0);
+
+		glGenVertexArrays(1, &emptyVao);
+	}
+
+	~PullPushFiller()
+	{
+		FreeTargets();
+		glDeleteProgram(pointProgram);
+		glDeleteProgram(pullProgram);
+		glDeleteProgram(pushProgram);
+		glDeleteProgram(compositeProgram);
+		glDeleteVertexArrays(1, &emptyVao);
+	}
+
+	void FreeTargets()
+	{
+		for (size_t l = 0; l < pull.size(); l++)
+		{
+			glDeleteTextures(1, &pull[l]);
+			glDeleteFramebuffers(1, &pullFbo[l]);
+			if (push[l])
+			{
+				glDeleteTextures(1, &push[l]);
+				glDeleteFramebuffers(1, &pushFbo[l]);
+			}
+		}
+		if (layerDepth)
+			glDeleteRenderbuffers(1, &layerDepth);
+		pull.clear(); push.clear(); pullFbo.clear(); pushFbo.clear(); levelSize.clear();
+		layerDepth = 0;
+	}
+
+	static void CreateLevel(GLuint& tex, GLuint& fbo, OVR::Sizei size)
+	{
+		glGenTextures(1, &tex);
+		glBindTexture(GL_TEXTURE_2D, tex);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, size.w, size.h, 0, GL_RGBA, GL_FLOAT, NULL);
+
+		glGenFramebuffers(1, &fbo);
+		glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, tex, 0);
+	}
+
+	// (Re)creates the pyramid for the given viewport extent. It is shared by
+	// both eyes, so it only ever grows.
+	void ReserveTargets(int width, int height)
+	{
+		if (!pull.empty() && (int)pull.size() == Levels + 1 &&
+			width <= levelSize[0].w && height <= levelSize[0].h)
+			return;
+
+		if (!levelSize.empty())
+		{
+			width = std::max(width, levelSize[0].w);
+			height = std::max(height, levelSize[0].h);
+		}
+		FreeTargets();
+
+		pull.resize(Levels + 1, 0); push.resize(Levels + 1, 0);
+		pullFbo.resize(Levels + 1, 0); pushFbo.resize(Levels + 1, 0);
+		for (int l = 0; l <= Levels; l++)
+		{
+			levelSize.push_back(OVR::Sizei(width, height));
+			CreateLevel(pull[l], pullFbo[l], levelSize[l]);
+			// The last push step goes straight to the render target and the
+			// coarsest level has nothing to push from
+			if (l > 0 && l < Levels)
+				CreateLevel(push[l], pushFbo[l], levelSize[l]);
+			width = (width + 1) / 2;
+			height = (height + 1) / 2;
+		}
+
+		glGenRenderbuffers(1, &layerDepth);
+		glBindRenderbuffer(GL_RENDERBUFFER, layerDepth);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, levelSize[0].w, levelSize[0].h);
+		glBindFramebuffer(GL_FRAMEBUFFER, pullFbo[0]);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, layerDepth);
+	}
+
+	void DrawLevel(GLuint fbo, OVR::Sizei size)
+	{
+		glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+		glViewport(0, 0, size.w, size.h);
+		glDrawArrays(GL_TRIANGLES, 0, 3);
+	}
+
+	// Draws the visible chunks of the vertex array (which must provide the
+	// PointSplatter attribute locations) into the bound render target,
+	// moved by extrapolation times their velocity, filling the holes between them.
+	void Render(GLuint vao, const PointChunks& chunks, const OVR::Matrix4f& world, OVR::Matrix4f view, OVR::Matrix4f proj,
+		float extrapolation)
+	{
+		if (!chunks.AnyVisible() || Levels <= 0)
+			return;
+
+		GLint target, viewport[4];
+		glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &target);
+		glGetIntegerv(GL_VIEWPORT, viewport);
+		ReserveTargets(viewport[0] + viewport[2], viewport[1] + viewport[3]);
+
+		// Points layer
+		glBindFramebuffer(GL_FRAMEBUFFER, pullFbo[0]);
+		static const GLfloat zero[4] = { 0, 0, 0, 0 };
+		glClearBufferfv(GL_COLOR, 0, zero);
+		glClear(GL_DEPTH_BUFFER_BIT);
+
+		GLboolean pointSmooth = glIsEnabled(GL_POINT_SMOOTH);
+		glDisable(GL_POINT_SMOOTH);
+		glPointSize(1.0f);
+		glUseProgram(pointProgram);
+		OVR::Matrix4f worldViewProj = proj * view * world;
+		glUniformMatrix4fv(pointMatWVPLoc, 1, GL_TRUE, (const GLfloat*)&worldViewProj);
+		glUniform1f(pointExtrapolationLoc, extrapolation);
+		glBindVertexArray(vao);
+		chunks.Draw(GL_POINTS);
+		if (pointSmooth)
+			glEnable(GL_POINT_SMOOTH);
+
+		glDisable(GL_DEPTH_TEST);
+		glDepthMask(GL_FALSE);
+		glBindVertexArray(emptyVao);
+
+		// Pull
+		glUseProgram(pullProgram);
+		glUniform1f(pullThresholdLoc, DepthThreshold);
+		glActiveTexture(GL_TEXTURE0);
+		for (int l = 1; l <= Levels; l++)
+		{
+			glBindTexture(GL_TEXTURE_2D, pull[l - 1]);
+			DrawLevel(pullFbo[l], levelSize[l]);
+		}
+
+		// Push
+		glUseProgram(pushProgram);
+		glUniform1f(pushThresholdLoc, DepthThreshold);
+		for (int l = Levels - 1; l >= 1; l--)
+		{
+			glActiveTexture(GL_TEXTURE0);
+			glBindTexture(GL_TEXTURE_2D, pull[l]);
+			glActiveTexture(GL_TEXTURE1);
+			glBindTexture(GL_TEXTURE_2D, (l + 1 == Levels) ? pull[l + 1] : push[l + 1]);
+			glActiveTexture(GL_TEXTURE2);
+			glBindTexture(GL_TEXTURE_2D, pull[l + 1]);
+			DrawLevel(pushFbo[l], levelSize[l]);
+		}
+
+		// Last push step, depth tested against the rest of the scene
+		glBindFramebuffer(GL_FRAMEBUFFER, target);
+		glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+		glEnable(GL_DEPTH_TEST);
+		glDepthMask(GL_TRUE);
+		glDepthFunc(GL_LEQUAL);
+
+		glUseProgram(compositeProgram);
+		glUniform1f(compositeThresholdLoc, DepthThreshold);
+		glUniform2f(compositeDepthProjLoc, proj.M[2][2], proj.M[2][3]);
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_2D, pull[0]);
+		glActiveTexture(GL_TEXTURE1);
+		glBindTexture(GL_TEXTURE_2D, (Levels == 1) ? pull[1] : push[1]);
+		glActiveTexture(GL_TEXTURE2);
+		glBindTexture(GL_TEXTURE_2D, pull[1]);
+		glDrawArrays(GL_TRIANGLES, 0, 3);
+
+		glDepthFunc(GL_LESS);
+		glActiveTexture(GL_TEXTURE0);
+		glBindVertexArray(0);
+		glUseProgram(0);
+	}
+};
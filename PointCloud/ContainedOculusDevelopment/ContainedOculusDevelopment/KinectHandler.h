@@ -1,5 +1,33 @@
 #pragma once
+#include "Win32Shims.h"
+#ifdef _WIN32
 #include <Kinect.h>
+#else
+// The Kinect SDK is Windows only; elsewhere there are only the types the
+// other sources use (see SensorSource.h), and no KinectHandler to construct
+#define BODY_COUNT 6
+
+enum JointType
+{
+	JointType_SpineBase, JointType_SpineMid, JointType_Neck, JointType_Head,
+	JointType_ShoulderLeft, JointType_ElbowLeft, JointType_WristLeft, JointType_HandLeft,
+	JointType_ShoulderRight, JointType_ElbowRight, JointType_WristRight, JointType_HandRight,
+	JointType_HipLeft, JointType_KneeLeft, JointType_AnkleLeft, JointType_FootLeft,
+	JointType_HipRight, JointType_KneeRight, JointType_AnkleRight, JointType_FootRight,
+	JointType_SpineShoulder, JointType_HandTipLeft, JointType_ThumbLeft, JointType_HandTipRight, JointType_ThumbRight,
+	JointType_Count
+};
+
+struct CameraSpacePoint { float X, Y, Z; };
+struct ColorSpacePoint  { float X, Y; };
+struct DepthSpacePoint  { float X, Y; };
+
+struct ICoordinateMapper;
+struct IKinectSensor;
+struct IDepthFrameReader;
+struct IColorFrameReader;
+struct IMultiSourceFrameReader;
+#endif
 #include <omp.h>
 
 typedef struct PointCloud
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+
+//--------------------------------------------------------------------------
+// Thread that turns the most recent Job handed to it into a Result with
+// Process. It holds at most one job waiting: a job submitted while another
+// waits replaces it, and one submitted while another is processed waits
+// for the next round. Jobs and results are swapped in and out rather than
+// copied, so their buffers go round between the caller and the thread.
+//
+// The thread starts with the first job. The owner of Process must Stop the
+// worker before the data Process uses goes away.
+
+template <typename Job, typename Result>
+struct LatestJobWorker
+{
+	std::function<void(Job&, Result&)> Process; // Runs on the worker thread
+
+	LatestJobWorker() :
+		quit(false),
+		hasJob(false),
+		hasResult(false),
+		busy(false)
+	{}
+
+	~LatestJobWorker()
+	{
+		Stop();
+	}
+
+	// Queues job; job is left with the contents of an earlier job, to be
+	// refilled
+	void Submit(Job& job)
+	{
+		if (!thread.joinable())
+			thread = std::thread(&LatestJobWorker::Run, this);
+		std::lock_guard<std::mutex> guard(lock);
+		std::swap(waiting, job);
+		hasJob = true;
+		wake.notify_one();
+	}
+
+	// True while a job waits or is being processed
+	bool Pending()
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		return hasJob || busy;
+	}
+
+	// Moves the result of the latest job done into result, if there is a new one
+	bool Take(Result& result)
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		if (!hasResult)
+			return false;
+		std::swap(done, result);
+		hasResult = false;
+		return true;
+	}
+
+	// Waits for the job being processed, if any, and ends the thread; the
+	// next Submit starts it again
+	void Stop()
+	{
+		if (!thread.joinable())
+			return;
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			quit = true;
+			wake.notify_one();
+		}
+		thread.join();
+		quit = false;
+		hasJob = false;
+	}
+
+	//----------------------------------------------------------------------
+	// Worker thread
+
+	std::thread             thread;
+	std::mutex              lock;
+	std::condition_variable wake;
+	bool                    quit;
+	bool                    hasJob, hasResult, busy;
+	Job                     waiting;
+	Result                  done;
+
+	void Run()
+	{
+		Job    job;
+		Result result;
+		for (;;)
+		{
+			{
+				std::unique_lock<std::mutex> guard(lock);
+				while (!quit && !hasJob)
+					wake.wait(guard);
+				if (quit)
+					return;
+				std::swap(waiting, job);
+				hasJob = false;
+				busy = true;
+			}
+
+			Process(job, result);
+
+			std::lock_guard<std::mutex> guard(lock);
+			std::swap(done, result);
+			hasResult = true;
+			busy = false;
+		}
+	}
+};
@@ -0,0 +1,543 @@
+#pragma once
+
+#include "LatestJobWorker.h"
+#include <vector>
+#include <algorithm>
+#include <math.h>
+#include <string.h>
+
+//--------------------------------------------------------------------------
+// Indexed triangle mesh with a color per vertex, as handed to and returned
+// by the decimator
+struct SimpleMesh
+{
+	std::vector<float>        positions; // xyz per vertex
+	std::vector<float>        colors;    // rgb per vertex
+	std::vector<unsigned int> indices;   // 3 per triangle
+
+	int NumTriangles() const { return (int)(indices.size() / 3); }
+
+	void Clear()
+	{
+		positions.clear();
+		colors.clear();
+		indices.clear();
+	}
+};
+
+//--------------------------------------------------------------------------
+// Quadric error mesh simplification down to a triangle budget. Edges are
+// collapsed in passes of rising error threshold, each collapse taking the
+// cheapest of the optimal point, the two ends and the middle of the edge
+// and refusing to flip triangles. Open borders, which are the silhouettes
+// of a depth mesh, and edges across which the color jumps by more than
+// ColorEdge add constraint planes through the edge to the quadrics of their
+// ends, so they keep their shape.
+//
+// Decimate works in place on the calling thread, computing the quadrics and
+// the first edge errors in parallel. The renderer Submits its surface to a
+// LatestJobWorker instead and Takes the simplified mesh frames later.
+
+struct MeshDecimator
+{
+	float BorderWeight;   // Weight of the border constraint planes
+	float ColorWeight;    // Weight of the color edge constraint planes
+	float ColorEdge;      // Color distance (rgb in [0, 1]) of a color edge
+	float Aggressiveness; // Growth of the error threshold between passes
+
+	MeshDecimator() :
+		BorderWeight(1000.0f),
+		ColorWeight(100.0f),
+		ColorEdge(0.25f),
+		Aggressiveness(7.0f)
+	{
+		worker.Process = [this](Job& job, SimpleMesh& result) { Process(job, result); };
+	}
+
+	~MeshDecimator()
+	{
+		Stop();
+	}
+
+	//----------------------------------------------------------------------
+	// Worker thread
+
+	struct Job
+	{
+		SimpleMesh mesh;
+		int        budget;
+
+		Job() : budget(0) {}
+	};
+
+	LatestJobWorker<Job, SimpleMesh> worker;
+	Job                              submitted;
+
+	// Queues mesh for simplification to budget triangles; mesh is left empty
+	void Submit(SimpleMesh& mesh, int budget)
+	{
+		std::swap(submitted.mesh, mesh);
+		mesh.Clear();
+		submitted.budget = budget;
+		worker.Submit(submitted);
+	}
+
+	// True while a mesh is queued or being simplified
+	bool Pending() { return worker.Pending(); }
+
+	// Moves the latest simplified mesh into mesh, if there is a new one
+	bool Take(SimpleMesh& mesh) { return worker.Take(mesh); }
+
+	void Stop() { worker.Stop(); }
+
+	// Simplifies in place, then hands the mesh over as the result
+	void Process(Job& job, SimpleMesh& result)
+	{
+		Decimate(job.mesh, job.budget);
+		std::swap(result, job.mesh);
+	}
+
+	//----------------------------------------------------------------------
+	// Simplification
+
+	// Symmetric 4x4 matrix, upper triangle by rows
+	struct Quadric
+	{
+		double m[10];
+
+		Quadric() { memset(m, 0, sizeof(m)); }
+
+		// Squared distance to plane ax + by + cz + d = 0, times w
+		Quadric(double a, double b, double c, double d, double w)
+		{
+			m[0] = w * a * a; m[1] = w * a * b; m[2] = w * a * c; m[3] = w * a * d;
+			m[4] = w * b * b; m[5] = w * b * c; m[6] = w * b * d;
+			m[7] = w * c * c; m[8] = w * c * d;
+			m[9] = w * d * d;
+		}
+
+		Quadric& operator+=(const Quadric& q)
+		{
+			for (int i = 0; i < 10; i++)
+				m[i] += q.m[i];
+			return *this;
+		}
+
+		Quadric operator+(const Quadric& q) const
+		{
+			Quadric r = *this;
+			return r += q;
+		}
+
+		double Error(const float* p) const
+		{
+			double x = p[0], y = p[1], z = p[2];
+			return m[0] * x * x + 2 * m[1] * x * y + 2 * m[2] * x * z + 2 * m[3] * x
+				+ m[4] * y * y + 2 * m[5] * y * z + 2 * m[6] * y
+				+ m[7] * z * z + 2 * m[8] * z + m[9];
+		}
+
+		double Det(int a11, int a12, int a13, int a21, int a22, int a23, int a31, int a32, int a33) const
+		{
+			return m[a11] * m[a22] * m[a33] + m[a13] * m[a21] * m[a32] + m[a12] * m[a23] * m[a31]
+				- m[a13] * m[a22] * m[a31] - m[a11] * m[a23] * m[a32] - m[a12] * m[a21] * m[a33];
+		}
+	};
+
+	struct Triangle
+	{
+		int    v[3];
+		double err[4]; // Of the edge starting at v[i], then the smallest
+		bool   deleted, dirty;
+		float  n[3];
+	};
+
+	struct Vertex
+	{
+		float   p[3];
+		float   c[3];
+		Quadric q;
+		int     tstart, tcount; // Refs of the triangles around the vertex
+		bool    border;
+	};
+
+	struct Ref
+	{
+		int tid, tvertex;
+	};
+
+	struct Edge
+	{
+		unsigned int a, b; // a < b
+		int          tid, tvertex;
+		bool operator<(const Edge& e) const { return a != e.a ? a < e.a : b < e.b; }
+	};
+
+	std::vector<Triangle> triangles;
+	std::vector<Vertex>   vertices;
+	std::vector<Ref>      refs;
+
+	static void Sub(float* r, const float* a, const float* b) { r[0] = a[0] - b[0]; r[1] = a[1] - b[1]; r[2] = a[2] - b[2]; }
+	static float Dot(const float* a, const float* b) { return a[0] * b[0] + a[1] * b[1] + a[2] * b[2]; }
+	static void Cross(float* r, const float* a, const float* b)
+	{
+		r[0] = a[1] * b[2] - a[2] * b[1];
+		r[1] = a[2] * b[0] - a[0] * b[2];
+		r[2] = a[0] * b[1] - a[1] * b[0];
+	}
+	static void Normalize(float* a)
+	{
+		float l = sqrtf(Dot(a, a));
+		if (l > 0)
+		{
+			a[0] /= l;
+			a[1] /= l;
+			a[2] /= l;
+		}
+	}
+
+	// Simplifies mesh to at most budget triangles, as far as it can
+	void Decimate(SimpleMesh& mesh, int budget)
+	{
+		int numVertices = (int)(mesh.positions.size() / 3);
+		int numTriangles = mesh.NumTriangles();
+		if (numTriangles <= budget)
+			return;
+
+		vertices.resize(numVertices);
+		for (int i = 0; i < numVertices; i++)
+		{
+			Vertex& v = vertices[i];
+			memcpy(v.p, &mesh.positions[i * 3], sizeof(v.p));
+			memcpy(v.c, &mesh.colors[i * 3], sizeof(v.c));
+			v.q = Quadric();
+			v.border = false;
+		}
+		triangles.resize(numTriangles);
+		for (int i = 0; i < numTriangles; i++)
+		{
+			Triangle& t = triangles[i];
+			for (int j = 0; j < 3; j++)
+				t.v[j] = mesh.indices[i * 3 + j];
+			t.deleted = false;
+			t.dirty = false;
+		}
+
+		int deleted = 0;
+		std::vector<int> deleted0, deleted1;
+		for (int iteration = 0; iteration < 100; iteration++)
+		{
+			if (numTriangles - deleted <= budget)
+				break;
+			if (iteration % 5 == 0)
+				UpdateMesh(iteration);
+			for (size_t i = 0; i < triangles.size(); i++)
+				triangles[i].dirty = false;
+
+			// Only edges cheaper than the threshold collapse in this pass
+			double threshold = 1e-9 * pow(double(iteration + 3), (double)Aggressiveness);
+
+			for (size_t i = 0; i < triangles.size(); i++)
+			{
+				Triangle& t = triangles[i];
+				if (t.err[3] > threshold || t.deleted || t.dirty)
+					continue;
+
+				for (int j = 0; j < 3; j++)
+				{
+					if (t.err[j] > threshold)
+						continue;
+					int i0 = t.v[j], i1 = t.v[(j + 1) % 3];
+					Vertex& v0 = vertices[i0];
+					Vertex& v1 = vertices[i1];
+					if (v0.border != v1.border)
+						continue;
+
+					float p[3], c[3];
+					CalculateError(i0, i1, p, c);
+					deleted0.resize(v0.tcount);
+					deleted1.resize(v1.tcount);
+					if (Flipped(p, i1, v0, deleted0) || Flipped(p, i0, v1, deleted1))
+						continue;
+
+					memcpy(v0.p, p, sizeof(p));
+					memcpy(v0.c, c, sizeof(c));
+					v0.q += v1.q;
+					int tstart = (int)refs.size();
+					UpdateTriangles(i0, v0, deleted0, deleted);
+					UpdateTriangles(i0, v1, deleted1, deleted);
+					int tcount = (int)refs.size() - tstart;
+					if (tcount <= v0.tcount)
+					{
+						if (tcount)
+							memmove(&refs[v0.tstart], &refs[tstart], tcount * sizeof(Ref));
+					}
+					else
+						v0.tstart = tstart;
+					v0.tcount = tcount;
+					break;
+				}
+				if (numTriangles - deleted <= budget)
+					break;
+			}
+		}
+
+		CompactMesh(mesh);
+	}
+
+	// Drops the deleted triangles and rebuilds the refs. The first time it
+	// also sums the quadrics, marks the borders and computes the errors.
+	void UpdateMesh(int iteration)
+	{
+		if (iteration > 0)
+		{
+			size_t dst = 0;
+			for (size_t i = 0; i < triangles.size(); i++)
+			{
+				if (!triangles[i].deleted)
+					triangles[dst++] = triangles[i];
+			}
+			triangles.resize(dst);
+		}
+
+		int numTriangles = (int)triangles.size();
+		int numVertices = (int)vertices.size();
+		for (int i = 0; i < numVertices; i++)
+		{
+			vertices[i].tstart = 0;
+			vertices[i].tcount = 0;
+		}
+		for (int i = 0; i < numTriangles; i++)
+		{
+			for (int j = 0; j < 3; j++)
+				vertices[triangles[i].v[j]].tcount++;
+		}
+		int tstart = 0;
+		for (int i = 0; i < numVertices; i++)
+		{
+			vertices[i].tstart = tstart;
+			tstart += vertices[i].tcount;
+			vertices[i].tcount = 0;
+		}
+		refs.resize(numTriangles * 3);
+		for (int i = 0; i < numTriangles; i++)
+		{
+			for (int j = 0; j < 3; j++)
+			{
+				Vertex& v = vertices[triangles[i].v[j]];
+				refs[v.tstart + v.tcount].tid = i;
+				refs[v.tstart + v.tcount].tvertex = j;
+				v.tcount++;
+			}
+		}
+
+		if (iteration > 0)
+			return;
+
+		// Planes of the triangles
+		std::vector<Quadric> planes(numTriangles);
+		#pragma omp parallel for
+		for (int i = 0; i < numTriangles; i++)
+		{
+			Triangle& t = triangles[i];
+			float e1[3], e2[3];
+			Sub(e1, vertices[t.v[1]].p, vertices[t.v[0]].p);
+			Sub(e2, vertices[t.v[2]].p, vertices[t.v[0]].p);
+			Cross(t.n, e1, e2);
+			Normalize(t.n);
+			planes[i] = Quadric(t.n[0], t.n[1], t.n[2], -Dot(t.n, vertices[t.v[0]].p), 1.0);
+		}
+
+		// Edges used by one triangle are borders, edges between colors are
+		// kept too; both add a plane through the edge, across the triangle
+		std::vector<Edge> edges(numTriangles * 3);
+		for (int i = 0; i < numTriangles; i++)
+		{
+			for (int j = 0; j < 3; j++)
+			{
+				unsigned int a = triangles[i].v[j], b = triangles[i].v[(j + 1) % 3];
+				Edge& e = edges[i * 3 + j];
+				e.a = a < b ? a : b;
+				e.b = a < b ? b : a;
+				e.tid = i;
+				e.tvertex = j;
+			}
+		}
+		std::sort(edges.begin(), edges.end());
+
+		std::vector<Quadric> constraints(numVertices);
+		for (size_t k = 0; k < edges.size();)
+		{
+			size_t end = k + 1;
+			while (end < edges.size() && edges[end].a == edges[k].a && edges[end].b == edges[k].b)
+				end++;
+			const Vertex& a = vertices[edges[k].a];
+			const Vertex& b = vertices[edges[k].b];
+			float weight = 0;
+			if (end - k == 1)
+			{
+				weight = BorderWeight;
+				vertices[edges[k].a].border = true;
+				vertices[edges[k].b].border = true;
+			}
+			else
+			{
+				float dc[3];
+				Sub(dc, a.c, b.c);
+				if (Dot(dc, dc) > ColorEdge * ColorEdge)
+					weight = ColorWeight;
+			}
+			if (weight > 0)
+			{
+				float dir[3], n[3];
+				Sub(dir, b.p, a.p);
+				for (size_t e = k; e < end; e++)
+				{
+					Cross(n, dir, triangles[edges[e].tid].n);
+					Normalize(n);
+					Quadric q(n[0], n[1], n[2], -Dot(n, a.p), weight);
+					constraints[edges[k].a] += q;
+					constraints[edges[k].b] += q;
+				}
+			}
+			k = end;
+		}
+
+		#pragma omp parallel for
+		for (int i = 0; i < numVertices; i++)
+		{
+			Vertex& v = vertices[i];
+			v.q += constraints[i];
+			for (int k = 0; k < v.tcount; k++)
+				v.q += planes[refs[v.tstart + k].tid];
+		}
+
+		#pragma omp parallel for
+		for (int i = 0; i < numTriangles; i++)
+		{
+			Triangle& t = triangles[i];
+			float p[3], c[3];
+			for (int j = 0; j < 3; j++)
+				t.err[j] = CalculateError(t.v[j], t.v[(j + 1) % 3], p, c);
+			t.err[3] = std::min(t.err[0], std::min(t.err[1], t.err[2]));
+		}
+	}
+
+	// Error of collapsing edge (i0, i1), with the point and color it
+	// collapses to
+	double CalculateError(int i0, int i1, float* p, float* c) const
+	{
+		const Vertex& v0 = vertices[i0];
+		const Vertex& v1 = vertices[i1];
+		Quadric q = v0.q + v1.q;
+		double error;
+
+		double det = q.Det(0, 1, 2, 1, 4, 5, 2, 5, 7);
+		if (det != 0 && !(v0.border && v1.border))
+		{
+			p[0] = (float)(-1 / det * q.Det(1, 2, 3, 4, 5, 6, 5, 7, 8));
+			p[1] = (float)(1 / det * q.Det(0, 2, 3, 1, 5, 6, 2, 7, 8));
+			p[2] = (float)(-1 / det * q.Det(0, 1, 3, 1, 4, 6, 2, 5, 8));
+			error = q.Error(p);
+		}
+		else
+		{
+			float mid[3] = { (v0.p[0] + v1.p[0]) / 2, (v0.p[1] + v1.p[1]) / 2, (v0.p[2] + v1.p[2]) / 2 };
+			double e0 = q.Error(v0.p), e1 = q.Error(v1.p), em = q.Error(mid);
+			error = std::min(e0, std::min(e1, em));
+			memcpy(p, error == e0 ? v0.p : error == e1 ? v1.p : mid, 3 * sizeof(float));
+		}
+
+		// Color at the projection of the point on the edge
+		float dir[3], rel[3];
+		Sub(dir, v1.p, v0.p);
+		Sub(rel, p, v0.p);
+		float len2 = Dot(dir, dir);
+		float t = len2 > 0 ? std::max(0.0f, std::min(1.0f, Dot(rel, dir) / len2)) : 0.5f;
+		for (int k = 0; k < 3; k++)
+			c[k] = v0.c[k] + t * (v1.c[k] - v0.c[k]);
+		return error;
+	}
+
+	// True if moving v to p flips one of its triangles; marks in deleted
+	// the triangles that also hold i1 and disappear with the collapse
+	bool Flipped(const float* p, int i1, const Vertex& v, std::vector<int>& deleted) const
+	{
+		for (int k = 0; k < v.tcount; k++)
+		{
+			const Triangle& t = triangles[refs[v.tstart + k].tid];
+			if (t.deleted)
+				continue;
+			int s = refs[v.tstart + k].tvertex;
+			int id1 = t.v[(s + 1) % 3], id2 = t.v[(s + 2) % 3];
+			if (id1 == i1 || id2 == i1)
+			{
+				deleted[k] = 1;
+				continue;
+			}
+			float d1[3], d2[3], n[3];
+			Sub(d1, vertices[id1].p, p);
+			Sub(d2, vertices[id2].p, p);
+			Normalize(d1);
+			Normalize(d2);
+			if (fabs(Dot(d1, d2)) > 0.999f)
+				return true;
+			Cross(n, d1, d2);
+			Normalize(n);
+			deleted[k] = 0;
+			if (Dot(n, t.n) < 0.2f)
+				return true;
+		}
+		return false;
+	}
+
+	// Moves the triangles of v to i0 and appends their refs
+	void UpdateTriangles(int i0, const Vertex& v, const std::vector<int>& deleted, int& deletedTriangles)
+	{
+		float p[3], c[3];
+		for (int k = 0; k < v.tcount; k++)
+		{
+			Ref r = refs[v.tstart + k];
+			Triangle& t = triangles[r.tid];
+			if (t.deleted)
+				continue;
+			if (deleted[k])
+			{
+				t.deleted = true;
+				deletedTriangles++;
+				continue;
+			}
+			t.v[r.tvertex] = i0;
+			t.dirty = true;
+			for (int j = 0; j < 3; j++)
+				t.err[j] = CalculateError(t.v[j], t.v[(j + 1) % 3], p, c);
+			t.err[3] = std::min(t.err[0], std::min(t.err[1], t.err[2]));
+			refs.push_back(r);
+		}
+	}
+
+	// Writes the remaining triangles and the vertices they use into mesh
+	void CompactMesh(SimpleMesh& mesh)
+	{
+		std::vector<int> remap(vertices.size(), -1);
+		mesh.Clear();
+		for (size_t i = 0; i < triangles.size(); i++)
+		{
+			const Triangle& t = triangles[i];
+			if (t.deleted)
+				continue;
+			for (int j = 0; j < 3; j++)
+			{
+				int& r = remap[t.v[j]];
+				if (r < 0)
+				{
+					r = (int)(mesh.positions.size() / 3);
+					const Vertex& v = vertices[t.v[j]];
+					mesh.positions.insert(mesh.positions.end(), v.p, v.p + 3);
+					mesh.colors.insert(mesh.colors.end(), v.c, v.c + 3);
+				}
+				mesh.indices.push_back(r);
+			}
+		}
+	}
+};
@@ -0,0 +1,226 @@
+#pragma once
+
+#include "LibOVRKernel/Src/GL/CAPI_GLE.h"
+#include <string.h>
+#include <algorithm>
+#include <iostream>
+
+//--------------------------------------------------------------------------
+// Output of the compositor's mirror texture, apart from the HMD. It can be
+// off, blitted to the desktop window, or copied into a shared memory ring
+// read by an external monitoring process, and in the last two cases only
+// every Interval-th frame. The mirror texture itself is requested at Scale
+// of the window size, so a reduced mirror also saves compositor work.
+//
+// Only window output swaps the desktop window, so the other modes never
+// wait on the desktop vsync.
+
+struct MirrorOutput
+{
+	enum Mode { Mirror_Off, Mirror_Window, Mirror_SharedMemory };
+	enum { SharedSlots = 3, ReadbackBuffers = 2 };
+
+	// Layout of the shared memory: this header, then SharedSlots frames of
+	// Width * Height BGRA pixels, bottom row first. The writer bumps the
+	// Sequence of a slot to an odd value before it overwrites the slot and
+	// to the next even value once it is done. A reader takes LatestSlot,
+	// reads its Sequence, copies the slot and reads Sequence again; the copy
+	// is whole only if both reads are the same even value, otherwise the
+	// writer came back to the slot meanwhile and the reader tries again.
+	struct SharedHeader
+	{
+		UINT32        Magic;        // SharedMagic
+		UINT32        Width, Height;
+		UINT32        SlotCount;
+		volatile LONG LatestSlot;   // -1 until the first frame
+		UINT32        Reserved;
+		UINT64        FrameNumber[SharedSlots];
+		volatile LONG Sequence[SharedSlots];
+	};
+
+	static const UINT32 SharedMagic = 0x3252494d; // "MIR2"
+	static const char*  SharedName() { return "Local\\RoomTinyMirror"; }
+
+	Mode   mode;
+	int    Interval;
+	float  Scale;
+
+	GLuint fbo;
+	int    width, height;
+	UINT64 frameCount;
+	UINT64 readbacks;
+
+	// Shared memory output: pixels are read into one pixel pack buffer per
+	// frame and copied out ReadbackBuffers presented frames later
+	HANDLE         mapping;
+	SharedHeader * header;
+	unsigned char* slots;
+	GLuint         pbo[ReadbackBuffers];
+	bool           pboPending[ReadbackBuffers];
+	UINT64         pboFrame[ReadbackBuffers];
+
+	MirrorOutput() :
+		mode(Mirror_Window),
+		Interval(1),
+		Scale(1.0f),
+		fbo(0),
+		width(0),
+		height(0),
+		frameCount(0),
+		readbacks(0),
+		mapping(NULL),
+		header(nullptr),
+		slots(nullptr)
+	{
+		for (int i = 0; i < ReadbackBuffers; i++)
+		{
+			pbo[i] = 0;
+			pboPending[i] = false;
+			pboFrame[i] = 0;
+		}
+	}
+
+	~MirrorOutput()
+	{
+		Release();
+	}
+
+	bool Enabled() const { return mode != Mirror_Off; }
+
+	// Size to request the mirror texture at
+	int TextureWidth(int windowWidth) const { return std::max(1, (int)(windowWidth * Scale)); }
+	int TextureHeight(int windowHeight) const { return std::max(1, (int)(windowHeight * Scale)); }
+
+	bool Init(GLuint mirrorTexId, int w, int h)
+	{
+		width = w;
+		height = h;
+		frameCount = 0;
+		readbacks = 0;
+
+		glGenFramebuffers(1, &fbo);
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo);
+		glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, mirrorTexId, 0);
+		glFramebufferRenderbuffer(GL_READ_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, 0);
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+
+		if (mode != Mirror_SharedMemory)
+			return true;
+
+		size_t slotSize = (size_t)w * h * 4;
+		DWORD  size = (DWORD)(sizeof(SharedHeader) + SharedSlots * slotSize);
+		mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, size, SharedName());
+		if (!mapping)
+		{
+			std::cout << "Could not create the mirror shared memory" << std::endl;
+			return false;
+		}
+		header = (SharedHeader*)MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, size);
+		if (!header)
+		{
+			std::cout << "Could not map the mirror shared memory" << std::endl;
+			return false;
+		}
+		slots = (unsigned char*)(header + 1);
+
+		header->Magic = SharedMagic;
+		header->Width = w;
+		header->Height = h;
+		header->SlotCount = SharedSlots;
+		header->LatestSlot = -1;
+		for (int i = 0; i < SharedSlots; i++)
+		{
+			header->FrameNumber[i] = 0;
+			header->Sequence[i] = 0;
+		}
+
+		glGenBuffers(ReadbackBuffers, pbo);
+		for (int i = 0; i < ReadbackBuffers; i++)
+		{
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo[i]);
+			glBufferData(GL_PIXEL_PACK_BUFFER, slotSize, NULL, GL_STREAM_READ);
+			pboPending[i] = false;
+		}
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		return true;
+	}
+
+	void Release()
+	{
+		if (fbo)
+		{
+			glDeleteFramebuffers(1, &fbo);
+			fbo = 0;
+		}
+		if (pbo[0])
+		{
+			glDeleteBuffers(ReadbackBuffers, pbo);
+			for (int i = 0; i < ReadbackBuffers; i++)
+				pbo[i] = 0;
+		}
+		if (header)
+		{
+			UnmapViewOfFile(header);
+			header = nullptr;
+			slots = nullptr;
+		}
+		if (mapping)
+		{
+			CloseHandle(mapping);
+			mapping = NULL;
+		}
+	}
+
+	// Called once per frame after the frame is submitted. Returns true when
+	// the window back buffer was drawn and has to be swapped.
+	bool Present(int windowWidth, int windowHeight)
+	{
+		bool due = fbo && (frameCount++ % std::max(1, Interval)) == 0;
+		if (!due)
+			return false;
+
+		if (mode == Mirror_Window)
+		{
+			glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo);
+			glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+			glBlitFramebuffer(0, height, width, 0,
+				0, 0, windowWidth, windowHeight,
+				GL_COLOR_BUFFER_BIT, (width == windowWidth && height == windowHeight) ? GL_NEAREST : GL_LINEAR);
+			glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+			return true;
+		}
+
+		if (mode == Mirror_SharedMemory && header)
+		{
+			int i = (int)(readbacks++ % ReadbackBuffers);
+
+			// Copy out the frame read ReadbackBuffers outputs ago, by now it has arrived
+			if (pboPending[i])
+			{
+				glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo[i]);
+				const void* pixels = glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY);
+				if (pixels)
+				{
+					LONG slot = (header->LatestSlot + 1) % SharedSlots;
+					InterlockedIncrement(&header->Sequence[slot]); // Odd, being written
+					memcpy(slots + (size_t)slot * width * height * 4, pixels, (size_t)width * height * 4);
+					header->FrameNumber[slot] = pboFrame[i];
+					InterlockedIncrement(&header->Sequence[slot]); // Even, whole
+					InterlockedExchange(&header->LatestSlot, slot);
+					glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+				}
+				pboPending[i] = false;
+			}
+
+			glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo);
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo[i]);
+			glPixelStorei(GL_PACK_ALIGNMENT, 4);
+			glReadPixels(0, 0, width, height, GL_BGRA, GL_UNSIGNED_BYTE, 0);
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+			glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+			pboPending[i] = true;
+			pboFrame[i] = frameCount;
+		}
+		return false;
+	}
+};
@@ -0,0 +1,306 @@
+#pragma once
+
+#include "btBulletDynamicsCommon.h"
+#include "LibOVR/Include/OVR_CAPI.h"
+#include "KinectHandler.h"
+#include "Win32Shims.h"
+#include <vector>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <math.h>
+
+//--------------------------------------------------------------------------
+// Latest value handed from one producer to one consumer, without a lock:
+// a triple buffer, where Put publishes its buffer by swapping it with the
+// middle one and Take swaps the middle one out when it is fresh. A value
+// not taken yet is replaced by the next one, so the consumer never falls
+// behind the producer.
+template <typename T>
+struct LatestValue
+{
+	enum { Fresh = 4 }; // Flag of middle, set by Put, cleared by Take
+
+	T                items[3];
+	std::atomic<int> middle;
+	int              back;  // Producer side
+	int              front; // Consumer side
+
+	LatestValue() : middle(1), back(0), front(2) {}
+
+	void Put(const T& item)
+	{
+		items[back] = item;
+		back = middle.exchange(back | Fresh, std::memory_order_acq_rel) & ~Fresh;
+	}
+
+	// False if nothing was Put since the last Take
+	bool Take(T& item)
+	{
+		if (!(middle.load(std::memory_order_relaxed) & Fresh))
+			return false;
+		front = middle.exchange(front, std::memory_order_acq_rel) & ~Fresh;
+		item = items[front];
+		return true;
+	}
+};
+
+//--------------------------------------------------------------------------
+// Steps the dynamics world at a fixed Rate on its own thread, so the
+// simulated time no longer depends on the frame rate. After a stall the
+// world takes at most MaxSteps steps and drops the rest of the backlog.
+//
+// The world belongs to the physics thread once Start has run. The latest
+// joint targets come in through a lock-free mailbox and are handed to
+// ApplyJoints before a step; any other change to the world is Posted and runs on the
+// physics thread before the next step. After every step the transforms of
+// the Tracked bodies are published, stamped with the simulated time, and
+// Sample interpolates between the last two of them.
+//
+// Started without a thread, the world is only stepped by StepTo, on the
+// calling thread, which keeps headless runs reproducible.
+
+struct PhysicsThread
+{
+	// Joints of all the bodies, as positions only, the radii of their bones
+	// and their tracking state
+	struct JointTargets
+	{
+		float joints[BODY_COUNT * JointType_Count * 3];
+		float radii[BODY_COUNT * (JointType_Count - 1)];
+		int   tracked[BODY_COUNT];
+	};
+
+	// Transform of a tracked body, copied out of its motion state
+	struct BodyState
+	{
+		float position[3];
+		float rotation[4]; // Quaternion, xyzw
+	};
+
+	struct Snapshot
+	{
+		double                 time;
+		std::vector<BodyState> bodies;
+	};
+
+	btDiscreteDynamicsWorld* World;
+	double Rate;     // Steps per second
+	int    MaxSteps; // Steps taken at once to catch up
+	double Delay;    // Steps the sampled time stays behind the current time
+
+	std::function<void(const JointTargets&)> ApplyJoints;
+
+	PhysicsThread(btDiscreteDynamicsWorld* world) :
+		World(world),
+		Rate(120),
+		MaxSteps(8),
+		Delay(1.5),
+		quit(false),
+		nextTick(-1),
+		ahead(-1),
+		started(false)
+	{}
+
+	~PhysicsThread()
+	{
+		Stop();
+	}
+
+	//----------------------------------------------------------------------
+	// Render thread side
+
+	// Adds a body to the published transforms, returns its index in them
+	int Track(btRigidBody* body)
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		tracked.push_back(body);
+		return (int)tracked.size() - 1;
+	}
+
+	// Runs command on the physics thread before the next step
+	void Post(const std::function<void()>& command)
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		commands.push_back(command);
+	}
+
+	// Replaces the targets the physics thread has not taken yet, if any
+	void PushJoints(const JointTargets& targets)
+	{
+		joints.Put(targets);
+	}
+
+	// Publishes the transforms of the tracked bodies as they are and
+	// starts stepping, on a thread of its own if threaded
+	void Start(bool threaded)
+	{
+		Publish(0);
+		Publish(0);
+		started = true;
+		if (!threaded)
+			return;
+		nextTick = ovr_GetTimeInSeconds();
+		worker = std::thread(&PhysicsThread::Run, this);
+	}
+
+	// Steps up to time, when started without a thread; the simulated time
+	// starts at the first time given
+	void StepTo(double time)
+	{
+		if (!started || worker.joinable())
+			return;
+		if (nextTick < 0)
+			nextTick = time;
+		Advance(time);
+	}
+
+	void Stop()
+	{
+		if (!worker.joinable())
+			return;
+		quit = true;
+		worker.join();
+	}
+
+	// Transforms of the tracked bodies for the frame shown at displayTime,
+	// sampled Delay steps before now, the current time, so that the two
+	// newest snapshots are around it. The gap between displayTime and now
+	// is smoothed, so the sampled times advance as regularly as the display
+	// times. Without a thread the world is stepped to the display times
+	// themselves, so now is not used and headless runs do not depend on how
+	// fast their frames happened to render.
+	void Sample(double displayTime, double now, std::vector<BodyState>& states)
+	{
+		if (!worker.joinable())
+			now = displayTime;
+		double gap = displayTime - now;
+		ahead = ahead < 0 ? gap : ahead + 0.05 * (gap - ahead);
+		double time = displayTime - ahead - Delay / Rate;
+
+		std::lock_guard<std::mutex> guard(lock);
+		const Snapshot& a = published[0];
+		const Snapshot& b = published[1];
+		float t = b.time > a.time ? (float)((time - a.time) / (b.time - a.time)) : 1.0f;
+		t = t < 0 ? 0 : (t > 1 ? 1 : t);
+		states.resize(b.bodies.size());
+		for (size_t i = 0; i < b.bodies.size(); i++)
+		{
+			if (i >= a.bodies.size())
+			{
+				states[i] = b.bodies[i];
+				continue;
+			}
+			Interpolate(a.bodies[i], b.bodies[i], t, states[i]);
+		}
+	}
+
+	static void Interpolate(const BodyState& a, const BodyState& b, float t, BodyState& s)
+	{
+		for (int k = 0; k < 3; k++)
+			s.position[k] = a.position[k] + (b.position[k] - a.position[k]) * t;
+
+		// Normalized lerp along the shorter arc
+		float dot = 0, len = 0;
+		for (int k = 0; k < 4; k++)
+			dot += a.rotation[k] * b.rotation[k];
+		float sign = dot < 0 ? -1.0f : 1.0f;
+		for (int k = 0; k < 4; k++)
+		{
+			s.rotation[k] = a.rotation[k] * (1 - t) + sign * b.rotation[k] * t;
+			len += s.rotation[k] * s.rotation[k];
+		}
+		len = sqrtf(len);
+		for (int k = 0; k < 4; k++)
+			s.rotation[k] /= len;
+	}
+
+	//----------------------------------------------------------------------
+	// Physics thread side
+
+	std::thread                        worker;
+	std::mutex                         lock;
+	std::atomic<bool>                  quit;
+	std::vector<std::function<void()>> commands, running;
+	std::vector<btRigidBody*>          tracked, publishing;
+	LatestValue<JointTargets>          joints;
+	JointTargets                       targets;
+	Snapshot                           published[2]; // Older, newer
+	Snapshot                           back;
+	double                             nextTick;     // Simulated time after the next step, -1 until known
+	double                             ahead;        // Smoothed display time ahead of now
+	bool                               started;
+
+	void Run()
+	{
+		// Sleeps end on the system timer, which ticks every 15.6 ms by default
+		timeBeginPeriod(1);
+		while (!quit)
+		{
+			Advance(ovr_GetTimeInSeconds());
+			double wait = nextTick - ovr_GetTimeInSeconds();
+			if (wait > 0)
+				std::this_thread::sleep_for(std::chrono::microseconds((long long)(wait * 1e6)));
+		}
+		timeEndPeriod(1);
+	}
+
+	// Takes the steps due by time
+	void Advance(double time)
+	{
+		double step = 1.0 / Rate;
+		for (int steps = 0; nextTick <= time; steps++)
+		{
+			if (steps == MaxSteps)
+			{
+				nextTick = time + step;
+				break;
+			}
+
+			{
+				std::lock_guard<std::mutex> guard(lock);
+				std::swap(commands, running);
+			}
+			for (size_t i = 0; i < running.size(); i++)
+				running[i]();
+			running.clear();
+
+			// The targets are absolute, so the latest ones are all that matter
+			if (joints.Take(targets) && ApplyJoints)
+				ApplyJoints(targets);
+
+			World->stepSimulation((btScalar)step, 0);
+			Publish(nextTick);
+			nextTick += step;
+		}
+	}
+
+	void Publish(double time)
+	{
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			publishing = tracked;
+		}
+		back.time = time;
+		back.bodies.resize(publishing.size());
+		for (size_t i = 0; i < publishing.size(); i++)
+		{
+			btTransform trans;
+			publishing[i]->getMotionState()->getWorldTransform(trans);
+			BodyState& s = back.bodies[i];
+			for (int k = 0; k < 3; k++)
+				s.position[k] = (float)trans.getOrigin()[k];
+			btQuaternion q = trans.getRotation();
+			s.rotation[0] = (float)q.x();
+			s.rotation[1] = (float)q.y();
+			s.rotation[2] = (float)q.z();
+			s.rotation[3] = (float)q.w();
+		}
+
+		std::lock_guard<std::mutex> guard(lock);
+		std::swap(published[0], published[1]);
+		std::swap(published[1], back);
+	}
+};
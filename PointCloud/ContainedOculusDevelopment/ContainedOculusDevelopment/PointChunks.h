@@ -0,0 +1,148 @@
+#pragma once
+
+#include "LibOVRKernel/Src/GL/CAPI_GLE.h"
+#include "GLPlatform.h"
+#include "LibOVR/Include/Extras/OVR_Math.h"
+#include <vector>
+#include <float.h>
+
+#ifndef GL_DRAW_INDIRECT_BUFFER
+#define GL_DRAW_INDIRECT_BUFFER 0x8F3F
+#endif
+
+// glMultiDrawArraysIndirect is core in OpenGL 4.3 and not loaded by GLE
+typedef void (GLAPIENTRY * PFNMULTIDRAWARRAYSINDIRECTPROC) (GLenum mode, const void *indirect, GLsizei drawcount, GLsizei stride);
+
+//--------------------------------------------------------------------------
+// The point buffer is split in chunks, one per tile of the depth frame, each
+// holding its points contiguously and the bounding box of them. Every eye
+// draws only the chunks that intersect its frustum, with a single indirect
+// multi draw when the context has it and glMultiDrawArrays otherwise.
+
+struct PointChunks
+{
+	enum { ChunkWidth = 64, ChunkHeight = 32, ChunkSize = ChunkWidth * ChunkHeight };
+
+	// Layout of glMultiDrawArraysIndirect commands
+	struct DrawArraysCommand
+	{
+		GLuint count, instanceCount, first, baseInstance;
+	};
+
+	int chunksX, chunksY, numChunks;
+
+	std::vector<GLint>         first;
+	std::vector<GLsizei>       count;
+	std::vector<OVR::Vector3f> boundsMin, boundsMax;
+
+	// Chunks that passed the last Cull
+	std::vector<GLint>             visibleFirst;
+	std::vector<GLsizei>           visibleCount;
+	std::vector<DrawArraysCommand> commands;
+
+	PFNMULTIDRAWARRAYSINDIRECTPROC multiDrawArraysIndirect;
+	GLuint                         indirectBuffer;
+
+	PointChunks(int width, int height) :
+		chunksX((width + ChunkWidth - 1) / ChunkWidth),
+		chunksY((height + ChunkHeight - 1) / ChunkHeight),
+		multiDrawArraysIndirect(nullptr),
+		indirectBuffer(0)
+	{
+		numChunks = chunksX * chunksY;
+		first.resize(numChunks, 0);
+		count.resize(numChunks, 0);
+		boundsMin.resize(numChunks);
+		boundsMax.resize(numChunks);
+		visibleFirst.reserve(numChunks);
+		visibleCount.reserve(numChunks);
+		commands.reserve(numChunks);
+
+		if (OVR::GLEContext::GetCurrentContext()->WholeVersion >= 403)
+			multiDrawArraysIndirect = (PFNMULTIDRAWARRAYSINDIRECTPROC)GLPlatform::GetProc("glMultiDrawArraysIndirect");
+		if (multiDrawArraysIndirect)
+			glGenBuffers(1, &indirectBuffer);
+	}
+
+	~PointChunks()
+	{
+		if (indirectBuffer)
+			glDeleteBuffers(1, &indirectBuffer);
+	}
+
+	// Number of points the chunks can hold, each one at its own slice
+	int Capacity() const { return numChunks * ChunkSize; }
+
+	// Depth pixel at which chunk c starts
+	int FirstRow(int c) const    { return (c / chunksX) * ChunkHeight; }
+	int FirstColumn(int c) const { return (c % chunksX) * ChunkWidth; }
+
+	// Keeps the chunks whose bounds, grown by margin, intersect the frustum
+	// of worldViewProj
+	void Cull(const OVR::Matrix4f& worldViewProj, float margin)
+	{
+		visibleFirst.clear();
+		visibleCount.clear();
+		commands.clear();
+
+		for (int c = 0; c < numChunks; c++)
+		{
+			if (count[c] == 0)
+				continue;
+
+			OVR::Vector3f lo = boundsMin[c] - OVR::Vector3f(margin, margin, margin);
+			OVR::Vector3f hi = boundsMax[c] + OVR::Vector3f(margin, margin, margin);
+
+			// Outside when all the corners are beyond the same clip plane
+			int outside[6] = { 0, 0, 0, 0, 0, 0 };
+			for (int k = 0; k < 8; k++)
+			{
+				OVR::Vector4f p = worldViewProj.Transform(OVR::Vector4f(
+					(k & 1) ? hi.x : lo.x, (k & 2) ? hi.y : lo.y, (k & 4) ? hi.z : lo.z, 1.0f));
+				outside[0] += (p.x < -p.w);
+				outside[1] += (p.x > p.w);
+				outside[2] += (p.y < -p.w);
+				outside[3] += (p.y > p.w);
+				outside[4] += (p.z < -p.w);
+				outside[5] += (p.z > p.w);
+			}
+			bool visible = true;
+			for (int plane = 0; plane < 6; plane++)
+				visible = visible && (outside[plane] < 8);
+			if (!visible)
+				continue;
+
+			visibleFirst.push_back(first[c]);
+			visibleCount.push_back(count[c]);
+			DrawArraysCommand cmd = { (GLuint)count[c], 1, (GLuint)first[c], 0 };
+			commands.push_back(cmd);
+		}
+
+		if (multiDrawArraysIndirect && !commands.empty())
+		{
+			glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBuffer);
+			glBufferData(GL_DRAW_INDIRECT_BUFFER, commands.size() * sizeof(DrawArraysCommand), &commands[0], GL_STREAM_DRAW);
+			glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+		}
+	}
+
+	bool AnyVisible() const { return !visibleFirst.empty(); }
+
+	// Draws the chunks kept by the last Cull from the bound vertex array
+	void Draw(GLenum mode) const
+	{
+		if (visibleFirst.empty())
+			return;
+
+		if (multiDrawArraysIndirect)
+		{
+			glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBuffer);
+			multiDrawArraysIndirect(mode, 0, (GLsizei)commands.size(), 0);
+			glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+		}
+		else
+		{
+			glMultiDrawArrays(mode, &visibleFirst[0], &visibleCount[0], (GLsizei)visibleFirst.size());
+		}
+	}
+};
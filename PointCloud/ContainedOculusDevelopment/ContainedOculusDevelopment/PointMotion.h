@@ -0,0 +1,114 @@
+#pragma once
+
+#include "KinectHandler.h"
+#include "LibOVR/Include/Extras/OVR_Math.h"
+#include <vector>
+#include <algorithm>
+
+//--------------------------------------------------------------------------
+// Velocity of the tracked bodies per tile of the depth frame, estimated from
+// the motion of the centroid of the body pixels of every tile between two
+// successive sensor frames. The sensor runs at 30 Hz, so the points are
+// moved along these velocities in the vertex shaders up to the predicted
+// display time of every HMD frame.
+//
+// A tile only gets a velocity when it holds a similar number of body pixels
+// in both frames; the ratio of the two counts scales it down (confidence),
+// and speeds no body part reaches are taken as occlusion changes and ignored.
+
+struct TileMotion
+{
+	enum { TileSize = 16, MinPixels = 16 };
+
+	int    tilesX, tilesY;
+	int    width, height;
+	double frameTime, prevFrameTime;
+
+	std::vector<OVR::Vector3f> centroid, prevCentroid, velocity;
+	std::vector<int>           count, prevCount;
+
+	float MaxSpeed;         // Metres per second, faster centroids are rejected
+	float Smoothing;        // Weight of the previous velocity, 0 to 1
+	float MaxExtrapolation; // Seconds the points can be moved ahead
+
+	TileMotion(int width, int height) :
+		tilesX((width + TileSize - 1) / TileSize),
+		tilesY((height + TileSize - 1) / TileSize),
+		width(width),
+		height(height),
+		frameTime(0),
+		prevFrameTime(0),
+		MaxSpeed(3.0f),
+		Smoothing(0.5f),
+		MaxExtrapolation(0.05f)
+	{
+		centroid.resize(tilesX * tilesY);
+		prevCentroid.resize(tilesX * tilesY);
+		velocity.resize(tilesX * tilesY);
+		count.resize(tilesX * tilesY, 0);
+		prevCount.resize(tilesX * tilesY, 0);
+	}
+
+	// Feeds a new sensor frame shown from time (seconds) on, on the clock of
+	// the display times given to Extrapolation
+	void Update(const CameraSpacePoint* grid, const BYTE* bodyIndex, double time)
+	{
+		centroid.swap(prevCentroid);
+		count.swap(prevCount);
+		prevFrameTime = frameTime;
+		frameTime = time;
+
+		#pragma omp parallel for schedule(dynamic)
+		for (int ty = 0; ty < tilesY; ty++)
+		{
+			for (int tx = 0; tx < tilesX; tx++)
+			{
+				OVR::Vector3f sum(0, 0, 0);
+				int n = 0;
+				for (int i = ty * TileSize; i < std::min((ty + 1) * TileSize, height); i++)
+				{
+					for (int j = tx * TileSize; j < std::min((tx + 1) * TileSize, width); j++)
+					{
+						int k = i * width + j;
+						if (bodyIndex[k] != 0xff && grid[k].Z > 0)
+						{
+							sum += OVR::Vector3f(grid[k].X, grid[k].Y, grid[k].Z);
+							n++;
+						}
+					}
+				}
+				int t = ty * tilesX + tx;
+				count[t] = n;
+				centroid[t] = (n > 0) ? sum / (float)n : sum;
+			}
+		}
+
+		float dt = (float)(frameTime - prevFrameTime);
+		for (int t = 0; t < tilesX * tilesY; t++)
+		{
+			OVR::Vector3f v(0, 0, 0);
+			// Frames further apart than a few sensor periods say nothing about the motion
+			if (dt > 0 && dt < 0.1f && count[t] >= MinPixels && prevCount[t] >= MinPixels)
+			{
+				float confidence = (float)std::min(count[t], prevCount[t]) / std::max(count[t], prevCount[t]);
+				confidence = OVR::Alg::Clamp((confidence - 0.5f) / 0.4f, 0.0f, 1.0f);
+				v = (centroid[t] - prevCentroid[t]) / dt;
+				if (v.LengthSq() > MaxSpeed * MaxSpeed)
+					v = OVR::Vector3f(0, 0, 0);
+				v *= confidence;
+			}
+			velocity[t] = velocity[t] * Smoothing + v * (1.0f - Smoothing);
+		}
+	}
+
+	const OVR::Vector3f& Velocity(int i, int j) const
+	{
+		return velocity[(i / TileSize) * tilesX + j / TileSize];
+	}
+
+	// Seconds to move the points of the last frame to be seen at displayTime
+	float Extrapolation(double displayTime) const
+	{
+		return OVR::Alg::Clamp((float)(displayTime - frameTime), 0.0f, MaxExtrapolation);
+	}
+};
@@ -0,0 +1,267 @@
+#pragma once
+
+#include "PointChunks.h"
+#include "ProgramCache.h"
+#include <algorithm>
+
+#ifndef GL_R32UI
+#define GL_R32UI 0x8236
+#endif
+#ifndef GL_SHADER_STORAGE_BUFFER
+#define GL_SHADER_STORAGE_BUFFER 0x90D2
+#endif
+#ifndef GL_SHADER_IMAGE_ACCESS_BARRIER_BIT
+#define GL_SHADER_IMAGE_ACCESS_BARRIER_BIT 0x00000020
+#endif
+#ifndef GL_TEXTURE_FETCH_BARRIER_BIT
+#define GL_TEXTURE_FETCH_BARRIER_BIT 0x00000008
+#endif
+
+// Image load/store (OpenGL 4.2) and compute shaders (4.3) are not loaded by
+// GLE, and its glBindBufferBase is not declared
+typedef void (GLAPIENTRY * PFNDISPATCHCOMPUTEPROC) (GLuint numGroupsX, GLuint numGroupsY, GLuint numGroupsZ);
+typedef void (GLAPIENTRY * PFNBINDIMAGETEXTUREPROC) (GLuint unit, GLuint texture, GLint level, GLboolean layered, GLint layer, GLenum access, GLenum format);
+typedef void (GLAPIENTRY * PFNMEMORYBARRIERPROC) (GLbitfield barriers);
+typedef void (GLAPIENTRY * PFNBINDBUFFERBASEPROC) (GLenum target, GLuint index, GLuint buffer);
+
+//--------------------------------------------------------------------------
+// Rasterizes the raw points in compute shaders instead of as GL_POINTS,
+// which at a few hundred thousand points are limited by vertex setup and
+// the ROPs. Each point is one invocation that projects it to a pixel:
+//   1. depth: atomic min of the window depth bits into an r32ui image
+//   2. color: the points equal to that minimum atomic max their packed
+//      color into a second r32ui image, so ties resolve the same every frame
+//   3. resolve: a fullscreen pass writes the surviving colors and depths
+//      into the bound render target, depth tested against the scene
+// Depths in [0, 1] order the same as their float bits, so no conversion is
+// needed. The invocations come from the chunks kept by the last Cull, read
+// from the indirect draw buffer of PointChunks.
+//
+// Needs OpenGL 4.3; Supported() is false otherwise. Tests/PointRasterizerCheck
+// compares its depths and colors with GL_POINTS on llvmpipe.
+
+struct ComputePointRasterizer
+{
+	enum { LocalSize = 256, ClearTileSize = 16 };
+
+	GLuint rasterProgram;
+	GLint  rasterMatWVPLoc, rasterExtrapolationLoc, rasterViewportLoc, rasterColorPassLoc;
+	GLuint clearProgram;
+	GLint  clearViewportLoc;
+	GLuint resolveProgram;
+	GLuint emptyVao;
+	GLuint depthTex, colorTex;
+	OVR::Sizei targetSize;
+
+	PFNDISPATCHCOMPUTEPROC  dispatchCompute;
+	PFNBINDIMAGETEXTUREPROC bindImageTexture;
+	PFNMEMORYBARRIERPROC    memoryBarrier;
+	PFNBINDBUFFERBASEPROC   bindBufferBase;
+
+	ComputePointRasterizer() :
+		rasterProgram(0),
+		clearProgram(0),
+		resolveProgram(0),
+		emptyVao(0),
+		depthTex(0),
+		colorTex(0),
+		targetSize(0, 0),
+		dispatchCompute(nullptr),
+		bindImageTexture(nullptr),
+		memoryBarrier(nullptr),
+		bindBufferBase(nullptr)
+	{
+		if (OVR::GLEContext::GetCurrentContext()->WholeVersion < 403)
+			return;
+		dispatchCompute = (PFNDISPATCHCOMPUTEPROC)GLPlatform::GetProc("glDispatchCompute");
+		bindImageTexture = (PFNBINDIMAGETEXTUREPROC)GLPlatform::GetProc("glBindImageTexture");
+		memoryBarrier = (PFNMEMORYBARRIERPROC)GLPlatform::GetProc("glMemoryBarrier");
+		bindBufferBase = (PFNBINDBUFFERBASEPROC)GLPlatform::GetProc("glBindBufferBase");
+		if (!Supported())
+			return;
+
+		// Points are interleaved position and color floats, as in the
+		// vertex buffer of MyDots; chunks are DrawArraysCommands
+		static const GLchar* RasterShaderSrc =
+			"#version 430\n"
+			"layout(local_size_x = 256) in;\n"
+			"struct Chunk { uint count, instanceCount, first, baseInstance; };\n"
+			"layout(std430, binding = 0) readonly buffer Points { float points[]; };\n"
+			"layout(std430, binding = 1) readonly buffer Velocities { float velocities[]; };\n"
+			"layout(std430, binding = 2) readonly buffer Chunks { Chunk chunks[]; };\n"
+			"layout(r32ui, binding = 0) uniform uimage2D depthImage;\n"
+			"layout(r32ui, binding = 1) uniform uimage2D colorImage;\n"
+			"uniform mat4 matWVP;\n"
+			"uniform float extrapolation;\n"
+			"uniform ivec4 viewport;\n"
+			"uniform bool colorPass;\n"
+			"void main() {\n"
+			"	Chunk c = chunks[gl_WorkGroupID.y];\n"
+			"	uint i = gl_WorkGroupID.x * gl_WorkGroupSize.x + gl_LocalInvocationID.x;\n"
+			"	if (i >= c.count) return;\n"
+			"	uint p = c.first + i;\n"
+			"	vec3 pos = vec3(points[6u * p], points[6u * p + 1u], points[6u * p + 2u]) +\n"
+			"		vec3(velocities[3u * p], velocities[3u * p + 1u], velocities[3u * p + 2u]) * extrapolation;\n"
+			"	vec4 clip = matWVP * vec4(pos, 1.0);\n"
+			"	if (clip.w <= 0.0) return;\n"
+			"	vec3 ndc = clip.xyz / clip.w;\n"
+			"	if (any(greaterThanEqual(abs(ndc), vec3(1.0)))) return;\n"
+			"	ivec2 pixel = viewport.xy + ivec2((ndc.xy * 0.5 + 0.5) * vec2(viewport.zw));\n"
+			"	uint depth = floatBitsToUint(ndc.z * 0.5 + 0.5);\n"
+			"	if (!colorPass) {\n"
+			"		imageAtomicMin(depthImage, pixel, depth);\n"
+			"	} else if (imageLoad(depthImage, pixel).x == depth) {\n"
+			"		vec3 color = vec3(points[6u * p + 3u], points[6u * p + 4u], points[6u * p + 5u]);\n"
+			"		imageAtomicMax(colorImage, pixel, packUnorm4x8(vec4(color, 1.0)));\n"
+			"	}\n"
+			"}";
+
+		static const GLchar* ClearShaderSrc =
+			"#version 430\n"
+			"layout(local_size_x = 16, local_size_y = 16) in;\n"
+			"layout(r32ui, binding = 0) uniform writeonly uimage2D depthImage;\n"
+			"layout(r32ui, binding = 1) uniform writeonly uimage2D colorImage;\n"
+			"uniform ivec4 viewport;\n"
+			"void main() {\n"
+			"	if (any(greaterThanEqual(gl_GlobalInvocationID.xy, uvec2(viewport.zw)))) return;\n"
+			"	ivec2 p = viewport.xy + ivec2(gl_GlobalInvocationID.xy);\n"
+			"	imageStore(depthImage, p, uvec4(0xffffffffu));\n"
+			"	imageStore(colorImage, p, uvec4(0u));\n"
+			"}";
+
+		static const GLchar* FullscreenVertexShaderSrc =
+			"#version 430\n"
+			"void main() {\n"
+			"	vec2 p = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);\n"
+			"	gl_Position = vec4(p * 2.0 - 1.0, 0.0, 1.0);\n"
+			"}";
+
+		static const GLchar* ResolveShaderSrc =
+			"#version 430\n"
+			"layout(binding = 0) uniform usampler2D depthTex;\n"
+			"layout(binding = 1) uniform usampler2D colorTex;\n"
+			"out vec4 out_color;\n"
+			"void main() {\n"
+			"	ivec2 p = ivec2(gl_FragCoord.xy);\n"
+			"	uint depth = texelFetch(depthTex, p, 0).x;\n"
+			"	if (depth == 0xffffffffu) discard;\n"
+			"	out_color = unpackUnorm4x8(texelFetch(colorTex, p, 0).x);\n"
+			"	gl_FragDepth = uintBitsToFloat(depth);\n"
+			"}";
+
+		ProgramCache& cache = ProgramCache::Get();
+		rasterProgram = cache.BeginCompute(RasterShaderSrc);
+		clearProgram = cache.BeginCompute(ClearShaderSrc);
+		resolveProgram = cache.Begin(FullscreenVertexShaderSrc, ResolveShaderSrc);
+		cache.Finish(rasterProgram);
+		cache.Finish(clearProgram);
+		cache.Finish(resolveProgram);
+
+		rasterMatWVPLoc = glGetUniformLocation(rasterProgram, "matWVP");
+		rasterExtrapolationLoc = glGetUniformLocation(rasterProgram, "extrapolation");
+		rasterViewportLoc = glGetUniformLocation(rasterProgram, "viewport");
+		rasterColorPassLoc = glGetUniformLocation(rasterProgram, "colorPass");
+		clearViewportLoc = glGetUniformLocation(clearProgram, "viewport");
+
+		glGenVertexArrays(1, &emptyVao);
+	}
+
+	~ComputePointRasterizer()
+	{
+		if (!Supported())
+			return;
+		glDeleteProgram(rasterProgram);
+		glDeleteProgram(clearProgram);
+		glDeleteProgram(resolveProgram);
+		glDeleteVertexArrays(1, &emptyVao);
+		if (depthTex)
+		{
+			glDeleteTextures(1, &depthTex);
+			glDeleteTextures(1, &colorTex);
+		}
+	}
+
+	bool Supported() const { return dispatchCompute && bindImageTexture && memoryBarrier && bindBufferBase; }
+
+	static void CreateImage(GLuint tex, OVR::Sizei size)
+	{
+		glBindTexture(GL_TEXTURE_2D, tex);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_R32UI, size.w, size.h, 0, GL_RED_INTEGER, GL_UNSIGNED_INT, NULL);
+	}
+
+	// Grows the images to cover the given viewport extent. They are shared by
+	// both eyes, so they only ever grow.
+	void ReserveTarget(int width, int height)
+	{
+		if (width <= targetSize.w && height <= targetSize.h)
+			return;
+
+		targetSize = OVR::Sizei(std::max(width, targetSize.w), std::max(height, targetSize.h));
+		if (!depthTex)
+		{
+			glGenTextures(1, &depthTex);
+			glGenTextures(1, &colorTex);
+		}
+		CreateImage(depthTex, targetSize);
+		CreateImage(colorTex, targetSize);
+	}
+
+	// Rasterizes the chunks kept by the last Cull into the bound render
+	// target. pointBuffer holds 6 floats per point (position, color) and
+	// velocityBuffer 3, the points are moved by extrapolation times their
+	// velocity.
+	void Render(GLuint pointBuffer, GLuint velocityBuffer, const PointChunks& chunks, const OVR::Matrix4f& worldViewProj,
+		float extrapolation)
+	{
+		if (!Supported() || !chunks.AnyVisible() || !chunks.indirectBuffer)
+			return;
+
+		GLint viewport[4];
+		glGetIntegerv(GL_VIEWPORT, viewport);
+		ReserveTarget(viewport[0] + viewport[2], viewport[1] + viewport[3]);
+
+		bindImageTexture(0, depthTex, 0, GL_FALSE, 0, GL_READ_WRITE, GL_R32UI);
+		bindImageTexture(1, colorTex, 0, GL_FALSE, 0, GL_READ_WRITE, GL_R32UI);
+
+		glUseProgram(clearProgram);
+		glUniform4iv(clearViewportLoc, 1, viewport);
+		dispatchCompute((viewport[2] + ClearTileSize - 1) / ClearTileSize, (viewport[3] + ClearTileSize - 1) / ClearTileSize, 1);
+		memoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+
+		bindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, pointBuffer);
+		bindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, velocityBuffer);
+		bindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, chunks.indirectBuffer);
+
+		glUseProgram(rasterProgram);
+		glUniformMatrix4fv(rasterMatWVPLoc, 1, GL_TRUE, (const GLfloat*)&worldViewProj);
+		glUniform1f(rasterExtrapolationLoc, extrapolation);
+		glUniform4iv(rasterViewportLoc, 1, viewport);
+		GLuint groupsX = PointChunks::ChunkSize / LocalSize, groupsY = (GLuint)chunks.commands.size();
+
+		glUniform1i(rasterColorPassLoc, 0);
+		dispatchCompute(groupsX, groupsY, 1);
+		memoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+
+		glUniform1i(rasterColorPassLoc, 1);
+		dispatchCompute(groupsX, groupsY, 1);
+		memoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+
+		for (GLuint b = 0; b < 3; b++)
+			bindBufferBase(GL_SHADER_STORAGE_BUFFER, b, 0);
+
+		// Resolve, depth tested against the rest of the scene
+		glUseProgram(resolveProgram);
+		glActiveTexture(GL_TEXTURE1);
+		glBindTexture(GL_TEXTURE_2D, colorTex);
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_2D, depthTex);
+		glBindVertexArray(emptyVao);
+		glDrawArrays(GL_TRIANGLES, 0, 3);
+
+		glBindVertexArray(0);
+		glUseProgram(0);
+	}
+};
@@ -0,0 +1,280 @@
+#pragma once
+
+#include "LibOVRKernel/Src/GL/CAPI_GLE.h"
+#include "LibOVR/Include/Extras/OVR_Math.h"
+#include "PointChunks.h"
+#include "ProgramCache.h"
+#include <iostream>
+#include <algorithm>
+
+//--------------------------------------------------------------------------
+// Surface splatting of the point cloud. Every point is drawn as a point
+// sprite covering its sensor footprint at its view depth, optionally clipped
+// to the ellipse of a disc oriented by its normal. Overlapping splats are
+// blended in three passes:
+//   1. visibility: depth only, with the splats pushed back by DepthOffset
+//   2. accumulation: weighted colors of the splats that lie within
+//      DepthOffset of the front surface, added up in a float target
+//   3. resolve: accumulated color divided by accumulated weight
+// All passes use the depth buffer of the bound render target, so the opaque
+// geometry must be rendered before the splats.
+
+struct PointSplatter
+{
+	// Attribute locations shared by both splat programs, so that a single
+	// vertex array serves both passes
+	enum { PositionAttrib = 0, ColorAttrib = 1, NormalAttrib = 2, VelocityAttrib = 3 };
+
+	struct SplatProgram
+	{
+		GLuint program;
+		GLint  matWVLoc, matPLoc, footprintLoc, projScaleLoc, depthOffsetLoc, orientedLoc, extrapolationLoc;
+	};
+
+	SplatProgram visibility;
+	SplatProgram accumulation;
+	GLuint       resolveProgram;
+	GLuint       emptyVao;
+	GLuint       accumFbo;
+	GLuint       accumTex;
+	OVR::Sizei   accumSize;
+
+	float RadiusScale; // Splat radius relative to the sample spacing
+	float DepthOffset; // Metres behind the front surface still blended into it
+
+	PointSplatter() :
+		resolveProgram(0),
+		emptyVao(0),
+		accumFbo(0),
+		accumTex(0),
+		accumSize(0, 0),
+		RadiusScale(1.0f),
+		DepthOffset(0.02f)
+	{
+		static const GLchar* VertexShaderSrc =
+			"#version 150\n"
+			"uniform mat4 matWV;\n"
+			"uniform mat4 matP;\n"
+			"uniform float footprint;\n"   // Sample spacing at one metre from the sensor
+			"uniform float projScale;\n"   // Pixels per metre at one metre from the eye
+			"uniform float depthOffset;\n"
+			"uniform float extrapolation;\n" // Seconds to move the points along their velocity
+			"in vec4 position;\n"
+			"in vec3 color;\n"
+			"in vec3 normal;\n"
+			"in vec3 velocity;\n"
+			"out vec3 splatColor;\n"
+			"out vec3 splatNormal;\n"
+			"void main() {\n"
+			"	vec4 eyePos = matWV * vec4(position.xyz + velocity * extrapolation, 1.0);\n"
+			"	eyePos.xyz += normalize(eyePos.xyz) * depthOffset;\n"
+			"	gl_Position = matP * eyePos;\n"
+			"	gl_PointSize = max(2.0 * footprint * position.z * projScale / gl_Position.w, 1.0);\n"
+			"	splatColor = color;\n"
+			"	splatNormal = mat3(matWV) * normal;\n"
+			"}";
+
+		// Discards the sprite texels outside of the splat and returns the
+		// squared distance to the splat centre
+		#define SPLAT_SHAPE_SRC \
+			"uniform bool oriented;\n" \
+			"in vec3 splatColor;\n" \
+			"in vec3 splatNormal;\n" \
+			"float splatShape() {\n" \
+			"	vec2 d = gl_PointCoord * 2.0 - 1.0;\n" \
+			"	d.y = -d.y;\n" \
+			"	float r2 = dot(d, d);\n" \
+			"	if (oriented) {\n" \
+			"		vec3 n = normalize(splatNormal);\n" \
+			"		float nz = n.z < 0.0 ? min(n.z, -0.3) : max(n.z, 0.3);\n" \
+			"		float dz = -(n.x * d.x + n.y * d.y) / nz;\n" \
+			"		r2 += dz * dz;\n" \
+			"	}\n" \
+			"	if (r2 > 1.0) discard;\n" \
+			"	return r2;\n" \
+			"}\n"
+
+		static const GLchar* VisibilityShaderSrc =
+			"#version 150\n"
+			SPLAT_SHAPE_SRC
+			"out vec4 out_color;\n"
+			"void main() {\n"
+			"	splatShape();\n"
+			"	out_color = vec4(0.0);\n"
+			"}";
+
+		static const GLchar* AccumulationShaderSrc =
+			"#version 150\n"
+			SPLAT_SHAPE_SRC
+			"out vec4 out_color;\n"
+			"void main() {\n"
+			"	float w = exp(-2.0 * splatShape());\n"
+			"	out_color = vec4(splatColor * w, w);\n"
+			"}";
+
+		#undef SPLAT_SHAPE_SRC
+
+		static const GLchar* ResolveVertexShaderSrc =
+			"#version 150\n"
+			"void main() {\n"
+			"	vec2 p = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);\n"
+			"	gl_Position = vec4(p * 2.0 - 1.0, 0.0, 1.0);\n"
+			"}";
+
+		static const GLchar* ResolveFragmentShaderSrc =
+			"#version 150\n"
+			"uniform sampler2D accum;\n"
+			"out vec4 out_color;\n"
+			"void main() {\n"
+			"	vec4 s = texelFetch(accum, ivec2(gl_FragCoord.xy), 0);\n"
+			"	if (s.a < 0.0001) discard;\n"
+			"	out_color = vec4(s.rgb / s.a, 1.0);\n"
+			"}";
+
+		ProgramCache& cache = ProgramCache::Get();
+		visibility.program = cache.Begin(VertexShaderSrc, VisibilityShaderSrc, AttribNames(), NumAttribs);
+		accumulation.program = cache.Begin(VertexShaderSrc, AccumulationShaderSrc, AttribNames(), NumAttribs);
+		resolveProgram = cache.Begin(ResolveVertexShaderSrc, ResolveFragmentShaderSrc);
+		cache.Finish(visibility.program);
+		cache.Finish(accumulation.program);
+		cache.Finish(resolveProgram);
+		InitSplatProgram(visibility);
+		InitSplatProgram(accumulation);
+
+		glUseProgram(resolveProgram);
+		glUniform1i(glGetUniformLocation(resolveProgram, "accum"), 0);
+		glUseProgram(0);
+
+		glGenVertexArrays(1, &emptyVao);
+		glGenFramebuffers(1, &accumFbo);
+	}
+
+	~PointSplatter()
+	{
+		glDeleteProgram(visibility.program);
+		glDeleteProgram(accumulation.program);
+		glDeleteProgram(resolveProgram);
+		glDeleteVertexArrays(1, &emptyVao);
+		glDeleteFramebuffers(1, &accumFbo);
+		if (accumTex)
+			glDeleteTextures(1, &accumTex);
+	}
+
+	// Names of the attribute locations above, for ProgramCache
+	static const char* const* AttribNames()
+	{
+		static const char* const names[] = { "position", "color", "normal", "velocity" };
+		return names;
+	}
+	enum { NumAttribs = 4 };
+
+	static void InitSplatProgram(SplatProgram& p)
+	{
+		p.matWVLoc = glGetUniformLocation(p.program, "matWV");
+		p.matPLoc = glGetUniformLocation(p.program, "matP");
+		p.footprintLoc = glGetUniformLocation(p.program, "footprint");
+		p.projScaleLoc = glGetUniformLocation(p.program, "projScale");
+		p.depthOffsetLoc = glGetUniformLocation(p.program, "depthOffset");
+		p.orientedLoc = glGetUniformLocation(p.program, "oriented");
+		p.extrapolationLoc = glGetUniformLocation(p.program, "extrapolation");
+	}
+
+	// Grows the accumulation target to cover the given viewport extent. It is
+	// shared by both eyes, so it only ever grows.
+	void ReserveTarget(int width, int height)
+	{
+		if (width <= accumSize.w && height <= accumSize.h)
+			return;
+
+		accumSize = OVR::Sizei(std::max(width, accumSize.w), std::max(height, accumSize.h));
+		if (!accumTex)
+			glGenTextures(1, &accumTex);
+		glBindTexture(GL_TEXTURE_2D, accumTex);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, accumSize.w, accumSize.h, 0, GL_RGBA, GL_FLOAT, NULL);
+
+		glBindFramebuffer(GL_FRAMEBUFFER, accumFbo);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, accumTex, 0);
+	}
+
+	void DrawSplats(const SplatProgram& p, const OVR::Matrix4f& worldView, const OVR::Matrix4f& proj,
+		float footprint, float projScale, float depthOffset, bool oriented, float extrapolation, const PointChunks& chunks)
+	{
+		glUseProgram(p.program);
+		glUniformMatrix4fv(p.matWVLoc, 1, GL_TRUE, (const GLfloat*)&worldView);
+		glUniformMatrix4fv(p.matPLoc, 1, GL_TRUE, (const GLfloat*)&proj);
+		glUniform1f(p.footprintLoc, footprint * RadiusScale);
+		glUniform1f(p.projScaleLoc, projScale);
+		glUniform1f(p.depthOffsetLoc, depthOffset);
+		glUniform1i(p.orientedLoc, oriented ? 1 : 0);
+		glUniform1f(p.extrapolationLoc, extrapolation);
+		chunks.Draw(GL_POINTS);
+	}
+
+	// Splats the visible chunks of the vertex array into the bound render
+	// target. footprint is the spacing of the samples at one metre from the
+	// sensor, oriented selects elliptical splats (the vertex array must then
+	// provide normals) and the points are moved by extrapolation times their
+	// velocity.
+	void Render(GLuint vao, const PointChunks& chunks, const OVR::Matrix4f& world, OVR::Matrix4f view, OVR::Matrix4f proj,
+		float footprint, bool oriented, float extrapolation)
+	{
+		if (!chunks.AnyVisible())
+			return;
+
+		GLint target, depthTex, viewport[4];
+		glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &target);
+		glGetFramebufferAttachmentParameteriv(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+			GL_FRAMEBUFFER_ATTACHMENT_OBJECT_NAME, &depthTex);
+		glGetIntegerv(GL_VIEWPORT, viewport);
+
+		OVR::Matrix4f worldView = view * world;
+		float projScale = 0.5f * viewport[3] * proj.M[1][1];
+
+		GLboolean pointSmooth = glIsEnabled(GL_POINT_SMOOTH);
+		glDisable(GL_POINT_SMOOTH);
+		glEnable(GL_POINT_SPRITE);
+		glEnable(GL_PROGRAM_POINT_SIZE);
+		glBindVertexArray(vao);
+
+		// Visibility
+		glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+		DrawSplats(visibility, worldView, proj, footprint, projScale, DepthOffset, oriented, extrapolation, chunks);
+		glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+
+		// Accumulation, tested against the visibility depth of the target
+		ReserveTarget(viewport[0] + viewport[2], viewport[1] + viewport[3]);
+		glBindFramebuffer(GL_FRAMEBUFFER, accumFbo);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthTex, 0);
+		static const GLfloat zero[4] = { 0, 0, 0, 0 };
+		glClearBufferfv(GL_COLOR, 0, zero);
+
+		glDepthMask(GL_FALSE);
+		glEnable(GL_BLEND);
+		glBlendFunc(GL_ONE, GL_ONE);
+		DrawSplats(accumulation, worldView, proj, footprint, projScale, 0.0f, oriented, extrapolation, chunks);
+		glDisable(GL_BLEND);
+		glDepthMask(GL_TRUE);
+
+		glDisable(GL_PROGRAM_POINT_SIZE);
+		glDisable(GL_POINT_SPRITE);
+		if (pointSmooth)
+			glEnable(GL_POINT_SMOOTH);
+
+		// Resolve into the target; its depth already holds the splats
+		glBindFramebuffer(GL_FRAMEBUFFER, target);
+		glDisable(GL_DEPTH_TEST);
+		glUseProgram(resolveProgram);
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_2D, accumTex);
+		glBindVertexArray(emptyVao);
+		glDrawArrays(GL_TRIANGLES, 0, 3);
+		glEnable(GL_DEPTH_TEST);
+
+		glBindVertexArray(0);
+		glUseProgram(0);
+	}
+};
@@ -0,0 +1,363 @@
+#pragma once
+
+#include "LibOVRKernel/Src/GL/CAPI_GLE.h"
+#include "GLPlatform.h"
+#include "Win32Shims.h"
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <thread>
+#include <stdio.h>
+#include <string.h>
+
+#ifndef GL_PROGRAM_BINARY_RETRIEVABLE_HINT
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#endif
+#ifndef GL_PROGRAM_BINARY_LENGTH
+#define GL_PROGRAM_BINARY_LENGTH 0x8741
+#endif
+#ifndef GL_NUM_PROGRAM_BINARY_FORMATS
+#define GL_NUM_PROGRAM_BINARY_FORMATS 0x87FE
+#endif
+#ifndef GL_COMPUTE_SHADER
+#define GL_COMPUTE_SHADER 0x91B9
+#endif
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
+// ARB_get_program_binary (core in OpenGL 4.1) and KHR_parallel_shader_compile
+// are not loaded by GLE
+typedef void (GLAPIENTRY * PFNGETPROGRAMBINARYPROC) (GLuint program, GLsizei bufSize, GLsizei *length, GLenum *binaryFormat, void *binary);
+typedef void (GLAPIENTRY * PFNPROGRAMBINARYPROC) (GLuint program, GLenum binaryFormat, const void *binary, GLsizei length);
+typedef void (GLAPIENTRY * PFNPROGRAMPARAMETERIPROC) (GLuint program, GLenum pname, GLint value);
+typedef void (GLAPIENTRY * PFNMAXSHADERCOMPILERTHREADSKHRPROC) (GLuint count);
+
+//--------------------------------------------------------------------------
+// Builds the GLSL programs from their sources, keeping the linked binaries
+// on disk so that later runs on the same driver skip the compilation. A
+// binary is keyed by a hash of the sources and attribute bindings together
+// with the GL vendor, renderer and version strings; one the driver rejects
+// is compiled again and replaced.
+//
+// Programs are built in two steps so that, where the driver has
+// KHR_parallel_shader_compile, all the programs of a module compile at the
+// same time: Begin every program first, then Finish them. Finish polls the
+// completion status rather than the link status, which would wait, and
+// finishes the other programs that complete in the meantime.
+
+struct ProgramCache
+{
+	std::string Directory;
+	std::string DriverKey;
+	bool        initialized;
+	bool        binarySupported;
+	bool        parallelCompile;
+
+	PFNGETPROGRAMBINARYPROC  getProgramBinary;
+	PFNPROGRAMBINARYPROC     programBinary;
+	PFNPROGRAMPARAMETERIPROC programParameteri;
+
+	// Programs between Begin and Finish that were compiled from source
+	struct Pending
+	{
+		GLuint      program;
+		GLuint      vshader, fshader;   // Compute programs: the shader and 0
+		std::string path;
+		unsigned long long hash;
+	};
+	std::vector<Pending> pending;
+
+	ProgramCache() :
+		Directory("ShaderCache"),
+		initialized(false),
+		binarySupported(false),
+		parallelCompile(false),
+		getProgramBinary(nullptr),
+		programBinary(nullptr),
+		programParameteri(nullptr)
+	{}
+
+	static ProgramCache& Get()
+	{
+		static ProgramCache cache;
+		return cache;
+	}
+
+	// Starts building a program; attribNames[i], when given, is bound to location i
+	GLuint Begin(const GLchar* vertexSrc, const GLchar* fragmentSrc, const char* const* attribNames = nullptr, int numAttribs = 0)
+	{
+		Init();
+
+		std::string key = std::string(vertexSrc) + '\0' + fragmentSrc;
+		for (int i = 0; i < numAttribs; i++)
+			key += std::string(1, '\0') + attribNames[i];
+		unsigned long long hash = Hash(key);
+		char name[32];
+		sprintf(name, "/%016llx.bin", Hash(key + '\0' + DriverKey));
+		std::string path = Directory + name;
+
+		GLuint program = glCreateProgram();
+		if (binarySupported && LoadBinary(program, path, hash))
+			return program;
+
+		Pending p;
+		p.program = program;
+		p.path = path;
+		p.hash = hash;
+		p.vshader = Compile(vertexSrc, GL_VERTEX_SHADER);
+		p.fshader = Compile(fragmentSrc, GL_FRAGMENT_SHADER);
+		glAttachShader(program, p.vshader);
+		glAttachShader(program, p.fshader);
+		for (int i = 0; i < numAttribs; i++)
+			glBindAttribLocation(program, i, attribNames[i]);
+		if (binarySupported)
+			programParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+		glLinkProgram(program);
+		pending.push_back(p);
+		return program;
+	}
+
+	// Waits for a program from Begin, logs its errors and stores its binary
+	GLuint Finish(GLuint program)
+	{
+		for (;;)
+		{
+			size_t i = 0;
+			while (i < pending.size() && pending[i].program != program)
+				i++;
+			if (i == pending.size())
+				return program;   // Loaded from the cache, or finished while waiting
+			if (Completed(program))
+			{
+				Conclude(i);
+				return program;
+			}
+			if (!FinishCompleted())
+				std::this_thread::yield();
+		}
+	}
+
+	// Finishes every program begun, in the order they complete
+	void FinishAll()
+	{
+		while (!pending.empty())
+		{
+			if (!FinishCompleted())
+				std::this_thread::yield();
+		}
+	}
+
+	// Finishes the programs done compiling; false if none was
+	bool FinishCompleted()
+	{
+		bool any = false;
+		for (size_t i = 0; i < pending.size();)
+		{
+			if (Completed(pending[i].program))
+			{
+				Conclude(i);
+				any = true;
+			}
+			else
+				i++;
+		}
+		return any;
+	}
+
+	// Without KHR_parallel_shader_compile the driver compiles as it is
+	// asked, so every program counts as complete
+	bool Completed(GLuint program) const
+	{
+		if (!parallelCompile)
+			return true;
+		GLint done = 0;
+		glGetProgramiv(program, GL_COMPLETION_STATUS_KHR, &done);
+		return done != 0;
+	}
+
+	// Checks pending program i, which is done compiling, and stores its binary
+	void Conclude(size_t i)
+	{
+		Pending p = pending[i];
+		GLuint  program = p.program;
+		pending.erase(pending.begin() + i);
+
+		GLint r;
+		GLuint shaders[2] = { p.vshader, p.fshader };
+		for (int k = 0; k < 2 && shaders[k]; k++)
+		{
+			glGetShaderiv(shaders[k], GL_COMPILE_STATUS, &r);
+			if (!r) LogShader(shaders[k]);
+			glDetachShader(program, shaders[k]);
+			glDeleteShader(shaders[k]);
+		}
+
+		glGetProgramiv(program, GL_LINK_STATUS, &r);
+		if (!r)
+		{
+			GLchar msg[1024];
+			glGetProgramInfoLog(program, sizeof(msg), 0, msg);
+			std::cout << "Program linking failed! : " << msg << std::endl;
+		}
+		else if (binarySupported)
+		{
+			SaveBinary(program, p.path, p.hash);
+		}
+	}
+
+	// Starts building a compute program
+	GLuint BeginCompute(const GLchar* computeSrc)
+	{
+		Init();
+
+		std::string key = std::string("compute") + '\0' + computeSrc;
+		unsigned long long hash = Hash(key);
+		char name[32];
+		sprintf(name, "/%016llx.bin", Hash(key + '\0' + DriverKey));
+		std::string path = Directory + name;
+
+		GLuint program = glCreateProgram();
+		if (binarySupported && LoadBinary(program, path, hash))
+			return program;
+
+		Pending p;
+		p.program = program;
+		p.path = path;
+		p.hash = hash;
+		p.vshader = Compile(computeSrc, GL_COMPUTE_SHADER);
+		p.fshader = 0;
+		glAttachShader(program, p.vshader);
+		if (binarySupported)
+			programParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+		glLinkProgram(program);
+		pending.push_back(p);
+		return program;
+	}
+
+	GLuint Build(const GLchar* vertexSrc, const GLchar* fragmentSrc, const char* const* attribNames = nullptr, int numAttribs = 0)
+	{
+		return Finish(Begin(vertexSrc, fragmentSrc, attribNames, numAttribs));
+	}
+
+	void Init()
+	{
+		if (initialized)
+			return;
+		initialized = true;
+
+		DriverKey = std::string((const char*)glGetString(GL_VENDOR)) + '\0' +
+			(const char*)glGetString(GL_RENDERER) + '\0' + (const char*)glGetString(GL_VERSION);
+
+		GLint numFormats = 0;
+		glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &numFormats);
+		getProgramBinary = (PFNGETPROGRAMBINARYPROC)GLPlatform::GetProc("glGetProgramBinary");
+		programBinary = (PFNPROGRAMBINARYPROC)GLPlatform::GetProc("glProgramBinary");
+		programParameteri = (PFNPROGRAMPARAMETERIPROC)GLPlatform::GetProc("glProgramParameteri");
+		binarySupported = numFormats > 0 && getProgramBinary && programBinary && programParameteri;
+		if (binarySupported)
+			CreateDirectoryA(Directory.c_str(), NULL);
+
+		GLint numExtensions = 0;
+		glGetIntegerv(GL_NUM_EXTENSIONS, &numExtensions);
+		for (GLint i = 0; i < numExtensions; i++)
+		{
+			if (strcmp((const char*)glGetStringi(GL_EXTENSIONS, i), "GL_KHR_parallel_shader_compile") == 0)
+			{
+				parallelCompile = true;
+
+				// Let the driver pick the number of compiler threads
+				PFNMAXSHADERCOMPILERTHREADSKHRPROC maxShaderCompilerThreads =
+					(PFNMAXSHADERCOMPILERTHREADSKHRPROC)GLPlatform::GetProc("glMaxShaderCompilerThreadsKHR");
+				if (maxShaderCompilerThreads)
+					maxShaderCompilerThreads(0xFFFFFFFF);
+				break;
+			}
+		}
+	}
+
+	// File layout: source hash, driver key, binary format, binary
+	bool LoadBinary(GLuint program, const std::string& path, unsigned long long hash)
+	{
+		std::ifstream file(path.c_str(), std::ios::binary);
+		if (!file)
+			return false;
+
+		unsigned long long fileHash = 0;
+		unsigned int       keyLength = 0;
+		file.read((char*)&fileHash, sizeof(fileHash));
+		file.read((char*)&keyLength, sizeof(keyLength));
+		if (!file || fileHash != hash || keyLength != DriverKey.size())
+			return false;
+
+		std::string key(keyLength, '\0');
+		GLenum      format = 0;
+		GLsizei     length = 0;
+		file.read(&key[0], keyLength);
+		file.read((char*)&format, sizeof(format));
+		file.read((char*)&length, sizeof(length));
+		if (!file || key != DriverKey || length <= 0)
+			return false;
+
+		std::vector<char> binary(length);
+		file.read(&binary[0], length);
+		if (!file)
+			return false;
+
+		programBinary(program, format, &binary[0], length);
+		GLint r;
+		glGetProgramiv(program, GL_LINK_STATUS, &r);
+		return r != 0;
+	}
+
+	void SaveBinary(GLuint program, const std::string& path, unsigned long long hash)
+	{
+		GLint length = 0;
+		glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+		if (length <= 0)
+			return;
+
+		std::vector<char> binary(length);
+		GLenum format = 0;
+		getProgramBinary(program, length, &length, &format, &binary[0]);
+
+		std::ofstream file(path.c_str(), std::ios::binary | std::ios::trunc);
+		unsigned int keyLength = (unsigned int)DriverKey.size();
+		file.write((const char*)&hash, sizeof(hash));
+		file.write((const char*)&keyLength, sizeof(keyLength));
+		file.write(DriverKey.data(), keyLength);
+		file.write((const char*)&format, sizeof(format));
+		file.write((const char*)&length, sizeof(length));
+		file.write(&binary[0], length);
+	}
+
+	static GLuint Compile(const GLchar* src, GLenum shaderType)
+	{
+		GLuint shader = glCreateShader(shaderType);
+		glShaderSource(shader, 1, &src, NULL);
+		glCompileShader(shader);
+		return shader;
+	}
+
+	static void LogShader(GLuint shader)
+	{
+		GLchar msg[1024];
+		glGetShaderInfoLog(shader, sizeof(msg), 0, msg);
+		if (msg[0]) {
+			std::cout << "Shader compilation failed! : " << msg << std::endl;
+		}
+	}
+
+	// 64 bit FNV-1a
+	static unsigned long long Hash(const std::string& s)
+	{
+		unsigned long long h = 14695981039346656037ULL;
+		for (size_t i = 0; i < s.size(); i++)
+		{
+			h ^= (unsigned char)s[i];
+			h *= 1099511628211ULL;
+		}
+		return h;
+	}
+};
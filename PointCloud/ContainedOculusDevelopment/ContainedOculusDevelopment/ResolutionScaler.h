@@ -0,0 +1,88 @@
+#pragma once
+
+#include "LibOVR/Include/Extras/OVR_Math.h"
+#include <algorithm>
+#include <iostream>
+
+//--------------------------------------------------------------------------
+// Picks the fraction of the eye buffers rendered each frame from the
+// measured frame times. The eye buffers are allocated at full size and the
+// scaled viewport is what gets rendered and sent to the compositor.
+//
+// Hysteresis keeps the scale from oscillating: it goes down a Step after
+// DownFrames consecutive frames with the eyes' GPU time above DownThreshold
+// of the frame budget, and up a Step only after UpFrames consecutive frames
+// with both GPU and CPU time below UpThreshold. The GPU times come from
+// queries a few frames old, so after every change the next Cooldown frames
+// are ignored. Only GPU time can make the scale drop, as the resolution
+// does not change the CPU cost of a frame.
+
+struct ResolutionScaler
+{
+	float Scale;
+	float MinScale, MaxScale, Step;
+	float BudgetMs;
+	float DownThreshold, UpThreshold;
+	int   DownFrames, UpFrames, Cooldown;
+
+	int   overFrames, underFrames, cooldownFrames;
+	int   decreases, increases; // Changes of the scale so far, reported by GpuProfiler
+
+	ResolutionScaler(float refreshRate) :
+		Scale(1.0f),
+		MinScale(0.6f),
+		MaxScale(1.0f),
+		Step(0.05f),
+		BudgetMs(1000.0f / refreshRate),
+		DownThreshold(0.9f),
+		UpThreshold(0.7f),
+		DownFrames(3),
+		UpFrames(90),
+		Cooldown(8),
+		overFrames(0),
+		underFrames(0),
+		cooldownFrames(0),
+		decreases(0),
+		increases(0)
+	{}
+
+	// Feeds the times of one measured frame; returns true if the scale changed
+	bool Update(float gpuMs, float cpuMs)
+	{
+		if (cooldownFrames > 0)
+		{
+			cooldownFrames--;
+			return false;
+		}
+
+		overFrames = (gpuMs > BudgetMs * DownThreshold) ? overFrames + 1 : 0;
+		underFrames = (std::max(gpuMs, cpuMs) < BudgetMs * UpThreshold) ? underFrames + 1 : 0;
+
+		float newScale = Scale;
+		if (overFrames >= DownFrames)
+			newScale = std::max(MinScale, Scale - Step);
+		else if (underFrames >= UpFrames)
+			newScale = std::min(MaxScale, Scale + Step);
+
+		if (overFrames >= DownFrames || underFrames >= UpFrames)
+			overFrames = underFrames = 0;
+		if (newScale == Scale)
+			return false;
+
+		std::cout << "Resolution scale " << Scale << " -> " << newScale << " (GPU " << gpuMs << " ms, CPU "
+			<< cpuMs << " ms, budget " << BudgetMs << " ms)" << std::endl;
+		if (newScale < Scale)
+			decreases++;
+		else
+			increases++;
+		Scale = newScale;
+		cooldownFrames = Cooldown;
+		return true;
+	}
+
+	// Part of a full size eye buffer rendered at the current scale
+	OVR::Recti Viewport(const OVR::Sizei& full) const
+	{
+		return OVR::Recti(0, 0, std::max(1, (int)(full.w * Scale + 0.5f)), std::max(1, (int)(full.h * Scale + 0.5f)));
+	}
+};
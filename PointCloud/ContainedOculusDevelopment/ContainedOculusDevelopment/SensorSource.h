@@ -0,0 +1,261 @@
+#pragma once
+
+#include "KinectHandler.h"
+#include "TsdfVolume.h"
+#include "FrameRecording.h"
+#include <vector>
+#include <string>
+#include <iostream>
+#include <math.h>
+
+//--------------------------------------------------------------------------
+// Where the depth, color, body index and joint frames come from: the live
+// Kinect, a recording (see FrameRecording.h) or a synthetic scene. Frames
+// are handed out like KinectHandler::GetColorDepthAndBody does, and the
+// depth pixels are mapped to camera and color space by the source, so the
+// renderer does not know which one it reads. Headless runs use the last
+// two, which need no sensor and deliver the same frames on every run. The
+// Kinect is only there on Windows.
+//
+// Joints hold 6 floats per joint, position then color, for BODY_COUNT
+// bodies of JointType_Count joints each. Depth pixels without depth map to
+// Z = 0.
+
+struct SensorSource
+{
+	virtual ~SensorSource() {}
+
+	virtual bool Init() = 0;
+
+	// S_OK when there is a new frame, which the buffers then point to
+	virtual HRESULT GetColorDepthAndBody(RGBQUAD*& color, BYTE*& bodyIndex, UINT16*& depth, float*& joints, int*& bodyTracked, CameraSpacePoint*& headPositions) = 0;
+
+	// Camera and color space position of every pixel of depth
+	virtual void MapDepthFrame(const UINT16* depth, CameraSpacePoint* cameraGrid, ColorSpacePoint* colorGrid) = 0;
+
+	// Pinhole model of the depth camera; nominal is returned when the
+	// source knows no better
+	virtual TsdfVolume::Intrinsics DepthIntrinsics(const TsdfVolume::Intrinsics& nominal) = 0;
+};
+
+//--------------------------------------------------------------------------
+#ifdef _WIN32
+struct KinectSource : SensorSource
+{
+	KinectHandler* kinect;
+
+	KinectSource() : kinect(new KinectHandler()) {}
+	~KinectSource() { delete kinect; }
+
+	bool Init()
+	{
+		return SUCCEEDED(kinect->KinectInit());
+	}
+
+	HRESULT GetColorDepthAndBody(RGBQUAD*& color, BYTE*& bodyIndex, UINT16*& depth, float*& joints, int*& bodyTracked, CameraSpacePoint*& headPositions)
+	{
+		return kinect->GetColorDepthAndBody(color, bodyIndex, depth, joints, bodyTracked, headPositions);
+	}
+
+	void MapDepthFrame(const UINT16* depth, CameraSpacePoint* cameraGrid, ColorSpacePoint* colorGrid)
+	{
+		const UINT frameSize = KinectHandler::cDepthWidth * KinectHandler::cDepthHeight;
+		kinect->m_pCoordinateMapper->MapDepthFrameToCameraSpace(frameSize, depth, frameSize, cameraGrid);
+		kinect->m_pCoordinateMapper->MapDepthFrameToColorSpace(frameSize, depth, frameSize, colorGrid);
+	}
+
+	// Measured through the coordinate mapper
+	TsdfVolume::Intrinsics DepthIntrinsics(const TsdfVolume::Intrinsics& nominal)
+	{
+		TsdfVolume::Intrinsics intr = nominal;
+		CameraSpacePoint points[3] = { { 0, 0, 1 }, { 0.1f, 0, 1 }, { 0, 0.1f, 1 } };
+		DepthSpacePoint  pixels[3];
+		if (SUCCEEDED(kinect->m_pCoordinateMapper->MapCameraPointsToDepthSpace(3, points, 3, pixels)) && pixels[1].X != pixels[0].X && pixels[2].Y != pixels[0].Y)
+		{
+			intr.cx = pixels[0].X;
+			intr.cy = pixels[0].Y;
+			intr.fx = (pixels[1].X - pixels[0].X) / 0.1f;
+			intr.fy = (pixels[2].Y - pixels[0].Y) / 0.1f;
+		}
+		return intr;
+	}
+};
+#endif
+
+//--------------------------------------------------------------------------
+// Frames a recording or a generator fills in, delivered once every Interval
+// calls: the display rate over the sensor rate, 3 for a 90 Hz HMD and the
+// 30 Hz Kinect. The color frame is as large as the Kinect's, and depth
+// pixel (u, v) maps to its pixel (u, v); the camera space comes from the
+// pinhole model.
+
+struct BufferedSource : SensorSource
+{
+	TsdfVolume::Intrinsics      Intr;
+	int                         Interval;
+
+	int                         calls;
+	FrameRecording::Frame       frame;
+	std::vector<RGBQUAD>        colorBuffer;
+	std::vector<UINT16>         depthBuffer;
+	std::vector<float>          jointBuffer;
+	int                         tracked[BODY_COUNT];
+	CameraSpacePoint            heads[BODY_COUNT];
+
+	BufferedSource() :
+		Interval(3),
+		calls(0)
+	{
+		memset(&Intr, 0, sizeof(Intr));
+	}
+
+	// Fills frame with the next frame; false if there is none
+	virtual bool NextFrame() = 0;
+
+	// The renderer's buffers are the size of the Kinect's depth frame, so
+	// frames of any other size are refused
+	bool Init()
+	{
+		if (Intr.width != KinectHandler::cDepthWidth || Intr.height != KinectHandler::cDepthHeight)
+		{
+			std::cout << "Sensor frames are " << Intr.width << "x" << Intr.height << ", not "
+				<< KinectHandler::cDepthWidth << "x" << KinectHandler::cDepthHeight << std::endl;
+			return false;
+		}
+		colorBuffer.resize(KinectHandler::cColorWidth * KinectHandler::cColorHeight);
+		jointBuffer.resize(BODY_COUNT * JointType_Count * 6);
+		return true;
+	}
+
+	HRESULT GetColorDepthAndBody(RGBQUAD*& color, BYTE*& bodyIndex, UINT16*& depth, float*& joints, int*& bodyTracked, CameraSpacePoint*& headPositions)
+	{
+		if (calls++ % Interval != 0 || !NextFrame())
+			return E_PENDING;
+
+		for (int v = 0; v < Intr.height; v++)
+		{
+			for (int u = 0; u < Intr.width; u++)
+			{
+				unsigned int c = frame.colors[v * Intr.width + u];
+				RGBQUAD& q = colorBuffer[v * KinectHandler::cColorWidth + u];
+				q.rgbRed = c & 0xff;
+				q.rgbGreen = (c >> 8) & 0xff;
+				q.rgbBlue = (c >> 16) & 0xff;
+				q.rgbReserved = 0xff;
+			}
+		}
+		depthBuffer.assign(frame.depth.begin(), frame.depth.end());
+
+		for (int body = 0; body < BODY_COUNT; body++)
+		{
+			tracked[body] = frame.tracked[body];
+			for (int j = 0; j < JointType_Count; j++)
+			{
+				float* joint = &jointBuffer[(body * JointType_Count + j) * 6];
+				for (int c = 0; c < 3; c++)
+					joint[c] = frame.joints[(body * JointType_Count + j) * 3 + c];
+				joint[3] = 1.0f; // Red, like the Kinect's
+				joint[4] = 0;
+				joint[5] = 0;
+			}
+			const float* head = &frame.joints[(body * JointType_Count + JointType_Head) * 3];
+			CameraSpacePoint p = { head[0], head[1], head[2] };
+			heads[body] = p;
+		}
+
+		color = &colorBuffer[0];
+		bodyIndex = &frame.bodyIndex[0];
+		depth = &depthBuffer[0];
+		joints = &jointBuffer[0];
+		memcpy(bodyTracked, tracked, sizeof(tracked));
+		memcpy(headPositions, heads, sizeof(heads));
+		return S_OK;
+	}
+
+	void MapDepthFrame(const UINT16* depth, CameraSpacePoint* cameraGrid, ColorSpacePoint* colorGrid)
+	{
+		#pragma omp parallel for
+		for (int v = 0; v < Intr.height; v++)
+		{
+			for (int u = 0; u < Intr.width; u++)
+			{
+				int   k = v * Intr.width + u;
+				float z = depth[k] * 0.001f;
+				CameraSpacePoint p = { (u - Intr.cx) / Intr.fx * z, (v - Intr.cy) / Intr.fy * z, z };
+				ColorSpacePoint  c = { (float)u, (float)v };
+				cameraGrid[k] = p;
+				colorGrid[k] = c;
+			}
+		}
+	}
+
+	TsdfVolume::Intrinsics DepthIntrinsics(const TsdfVolume::Intrinsics&)
+	{
+		return Intr;
+	}
+};
+
+//--------------------------------------------------------------------------
+// Replays a recording of the application (F3 / F4), looping at its end
+struct RecordedSource : BufferedSource
+{
+	std::string    Path;
+	FrameRecording recording;
+
+	RecordedSource(const std::string& path) : Path(path) {}
+
+	bool Init()
+	{
+		if (!recording.Open(Path))
+		{
+			std::cout << "Could not read the recording " << Path << std::endl;
+			return false;
+		}
+		Intr = recording.Intr;
+		return BufferedSource::Init();
+	}
+
+	bool NextFrame()
+	{
+		if (recording.Read(frame))
+			return true;
+		recording.Rewind();
+		return recording.Read(frame);
+	}
+};
+
+//--------------------------------------------------------------------------
+// A wall 3 m away and one body in front of it, a box 0.4 m wide and 1.6 m
+// tall swaying sideways, 2 s per sway. The body has no skeleton. Frame n
+// is always the same.
+
+struct SyntheticSource : BufferedSource
+{
+	int frameIndex;
+
+	SyntheticSource(const TsdfVolume::Intrinsics& intr) : frameIndex(0)
+	{
+		Intr = intr;
+	}
+
+	bool NextFrame()
+	{
+		int   n = frameIndex++;
+		float bodyX = 0.5f * (float)sin(n * (2 * 3.14159265 / 60));
+		frame.Resize(Intr.width * Intr.height);
+		for (int v = 0; v < Intr.height; v++)
+		{
+			for (int u = 0; u < Intr.width; u++)
+			{
+				int   k = v * Intr.width + u;
+				float rx = (u - Intr.cx) / Intr.fx, ry = (v - Intr.cy) / Intr.fy;
+				bool  body = fabs(rx * 2.0f - bodyX) < 0.2f && fabs(ry * 2.0f) < 0.8f;
+				frame.depth[k] = body ? 2000 : 3000;
+				frame.bodyIndex[k] = body ? 0 : 0xff;
+				frame.colors[k] = body ? 0xff3060c0u : ((u / 32 + v / 32) % 2 ? 0xff909090u : 0xff606060u);
+			}
+		}
+		frame.time = n / 30.0;
+		return true;
+	}
+};
@@ -0,0 +1,324 @@
+#pragma once
+
+#include "LibOVRKernel/Src/GL/CAPI_GLE.h"
+#include "LibOVR/Include/Extras/OVR_Math.h"
+#include "KinectHandler.h"
+#include "MeshDecimator.h"
+#include "ProgramCache.h"
+#include <vector>
+#include <stddef.h>
+#include <math.h>
+
+//--------------------------------------------------------------------------
+// Mesh of a user captured once and driven by the Kinect skeleton. Each
+// joint but the spine base ends a bone starting at its parent joint; every
+// vertex is bound to the Influences bones closest to it, weighted by the
+// inverse of the distance. Each frame a bone turns by the shortest arc from
+// its captured direction to its current one, about its parent joint, which
+// then moves to the current parent position. Twist about the bone is not
+// seen by the sensor and is not applied.
+//
+// Skinning runs in the vertex shader, by linear blending of the bone
+// matrices or by blending of their dual quaternions, which keeps the volume
+// around bent joints. A frame costs the bone uniforms only.
+
+struct SkinnedAvatar
+{
+	enum { JointCount = JointType_Count, BoneCount = JointType_Count - 1, Influences = 4 };
+	enum { PositionAttrib = 0, ColorAttrib = 1, BonesAttrib = 2, WeightsAttrib = 3 };
+
+	struct Vertex
+	{
+		float position[3];
+		float color[3];
+		float bones[Influences];
+		float weights[Influences];
+	};
+
+	GLuint  program;
+	GLint   matWVPLoc, dualQuaternionLoc, boneMatrixLoc, boneRealLoc, boneDualLoc;
+	GLuint  vao, vbo, ibo;
+	GLsizei numIndices;
+
+	int  Body;            // Kinect body slot the mesh was captured from, -1 => none
+	bool DualQuaternion;  // Dual quaternion instead of linear blend skinning
+	bool posed;
+
+	OVR::Vector3f restJoints[JointCount];
+	float         boneMatrix[BoneCount * 16]; // Row major
+	float         boneReal[BoneCount * 4];    // xyzw
+	float         boneDual[BoneCount * 4];
+
+	SkinnedAvatar() :
+		numIndices(0),
+		Body(-1),
+		DualQuaternion(true),
+		posed(false)
+	{
+		static const GLchar* VertexShaderSrc =
+			"#version 150\n"
+			"uniform mat4 matWVP;\n"
+			"uniform bool dualQuaternion;\n"
+			"uniform mat4 boneMatrix[24];\n"
+			"uniform vec4 boneReal[24];\n"
+			"uniform vec4 boneDual[24];\n"
+			"in vec3 position;\n"
+			"in vec3 color;\n"
+			"in vec4 bones;\n"
+			"in vec4 weights;\n"
+			"out vec3 fragmentColor;\n"
+			"void main() {\n"
+			"	vec3 p;\n"
+			"	if (dualQuaternion) {\n"
+			"		vec4 r0 = boneReal[int(bones.x)];\n"
+			"		vec4 r = vec4(0.0);\n"
+			"		vec4 d = vec4(0.0);\n"
+			"		for (int i = 0; i < 4; i++) {\n"
+			"			int b = int(bones[i]);\n"
+			"			float w = dot(boneReal[b], r0) < 0.0 ? -weights[i] : weights[i];\n" // Same hemisphere as the first bone
+			"			r += w * boneReal[b];\n"
+			"			d += w * boneDual[b];\n"
+			"		}\n"
+			"		float len = length(r);\n"
+			"		r /= len;\n"
+			"		d /= len;\n"
+			"		vec3 t = 2.0 * (r.w * d.xyz - d.w * r.xyz + cross(r.xyz, d.xyz));\n"
+			"		p = position + 2.0 * cross(r.xyz, cross(r.xyz, position) + r.w * position) + t;\n"
+			"	} else {\n"
+			"		mat4 m = weights.x * boneMatrix[int(bones.x)] + weights.y * boneMatrix[int(bones.y)]\n"
+			"			+ weights.z * boneMatrix[int(bones.z)] + weights.w * boneMatrix[int(bones.w)];\n"
+			"		p = (m * vec4(position, 1.0)).xyz;\n"
+			"	}\n"
+			"	gl_Position = matWVP * vec4(p, 1.0);\n"
+			"	fragmentColor = color;\n"
+			"}";
+
+		static const GLchar* FragmentShaderSrc =
+			"#version 150\n"
+			"in vec3 fragmentColor;\n"
+			"out vec4 out_color;\n"
+			"void main() {\n"
+			"	out_color = vec4(fragmentColor, 1.0);\n"
+			"}";
+
+		static const char* const AttribNames[] = { "position", "color", "bones", "weights" };
+		program = ProgramCache::Get().Build(VertexShaderSrc, FragmentShaderSrc, AttribNames, 4);
+		matWVPLoc = glGetUniformLocation(program, "matWVP");
+		dualQuaternionLoc = glGetUniformLocation(program, "dualQuaternion");
+		boneMatrixLoc = glGetUniformLocation(program, "boneMatrix");
+		boneRealLoc = glGetUniformLocation(program, "boneReal");
+		boneDualLoc = glGetUniformLocation(program, "boneDual");
+
+		glGenVertexArrays(1, &vao);
+		glGenBuffers(1, &vbo);
+		glGenBuffers(1, &ibo);
+		glBindVertexArray(vao);
+		glBindBuffer(GL_ARRAY_BUFFER, vbo);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo);
+		glEnableVertexAttribArray(PositionAttrib);
+		glEnableVertexAttribArray(ColorAttrib);
+		glEnableVertexAttribArray(BonesAttrib);
+		glEnableVertexAttribArray(WeightsAttrib);
+		glVertexAttribPointer(PositionAttrib, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, position));
+		glVertexAttribPointer(ColorAttrib, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, color));
+		glVertexAttribPointer(BonesAttrib, Influences, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, bones));
+		glVertexAttribPointer(WeightsAttrib, Influences, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, weights));
+		glBindVertexArray(0);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	}
+
+	~SkinnedAvatar()
+	{
+		glDeleteProgram(program);
+		glDeleteVertexArrays(1, &vao);
+		glDeleteBuffers(1, &vbo);
+		glDeleteBuffers(1, &ibo);
+	}
+
+	// Parent of a joint in the Kinect hierarchy, -1 for the spine base
+	static int Parent(int joint)
+	{
+		static const int parents[JointCount] = {
+			-1,                        // SpineBase
+			JointType_SpineBase,       // SpineMid
+			JointType_SpineShoulder,   // Neck
+			JointType_Neck,            // Head
+			JointType_SpineShoulder,   // ShoulderLeft
+			JointType_ShoulderLeft,    // ElbowLeft
+			JointType_ElbowLeft,       // WristLeft
+			JointType_WristLeft,       // HandLeft
+			JointType_SpineShoulder,   // ShoulderRight
+			JointType_ShoulderRight,   // ElbowRight
+			JointType_ElbowRight,      // WristRight
+			JointType_WristRight,      // HandRight
+			JointType_SpineBase,       // HipLeft
+			JointType_HipLeft,         // KneeLeft
+			JointType_KneeLeft,        // AnkleLeft
+			JointType_AnkleLeft,       // FootLeft
+			JointType_SpineBase,       // HipRight
+			JointType_HipRight,        // KneeRight
+			JointType_KneeRight,       // AnkleRight
+			JointType_AnkleRight,      // FootRight
+			JointType_SpineMid,        // SpineShoulder
+			JointType_HandLeft,        // HandTipLeft
+			JointType_WristLeft,       // ThumbLeft
+			JointType_HandRight,       // HandTipRight
+			JointType_WristRight };    // ThumbRight
+		return parents[joint];
+	}
+
+	// Bone b ends at joint b + 1
+	static int BoneJoint(int bone) { return bone + 1; }
+
+	// Joint j of a body in the joint stream, 6 floats per joint
+	static OVR::Vector3f Joint(const float* joints, int j) { return OVR::Vector3f(joints[j * 6], joints[j * 6 + 1], joints[j * 6 + 2]); }
+
+	static float SegmentDistance(const OVR::Vector3f& p, const OVR::Vector3f& a, const OVR::Vector3f& b)
+	{
+		OVR::Vector3f ab = b - a;
+		float len2 = ab.LengthSq();
+		float t = len2 > 0 ? (p - a).Dot(ab) / len2 : 0;
+		t = t < 0 ? 0 : (t > 1 ? 1 : t);
+		return (p - (a + ab * t)).Length();
+	}
+
+	// Binds mesh, captured from body while its joints were joints, and
+	// uploads it
+	void Bind(const SimpleMesh& mesh, const float* joints, int body)
+	{
+		for (int j = 0; j < JointCount; j++)
+			restJoints[j] = Joint(joints, j);
+
+		int numVertices = (int)(mesh.positions.size() / 3);
+		std::vector<Vertex> vertices(numVertices);
+
+		#pragma omp parallel for
+		for (int i = 0; i < numVertices; i++)
+		{
+			Vertex& v = vertices[i];
+			OVR::Vector3f p(mesh.positions[i * 3], mesh.positions[i * 3 + 1], mesh.positions[i * 3 + 2]);
+			for (int k = 0; k < 3; k++)
+			{
+				v.position[k] = mesh.positions[i * 3 + k];
+				v.color[k] = mesh.colors[i * 3 + k];
+			}
+
+			// Closest bones first
+			float best[Influences];
+			int   bone[Influences];
+			for (int k = 0; k < Influences; k++)
+			{
+				best[k] = 1e30f;
+				bone[k] = 0;
+			}
+			for (int b = 0; b < BoneCount; b++)
+			{
+				int j = BoneJoint(b);
+				float d = SegmentDistance(p, restJoints[Parent(j)], restJoints[j]);
+				for (int k = 0; k < Influences; k++)
+				{
+					if (d >= best[k])
+						continue;
+					for (int m = Influences - 1; m > k; m--)
+					{
+						best[m] = best[m - 1];
+						bone[m] = bone[m - 1];
+					}
+					best[k] = d;
+					bone[k] = b;
+					break;
+				}
+			}
+
+			// Falls off fast, so that a vertex follows its own bone away from the joints
+			float sum = 0;
+			for (int k = 0; k < Influences; k++)
+			{
+				float w = 1.0f / (best[k] + 0.01f);
+				v.weights[k] = w * w * w * w;
+				v.bones[k] = (float)bone[k];
+				sum += v.weights[k];
+			}
+			for (int k = 0; k < Influences; k++)
+				v.weights[k] /= sum;
+		}
+
+		glBindBuffer(GL_ARRAY_BUFFER, vbo);
+		glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), vertices.empty() ? NULL : &vertices[0], GL_STATIC_DRAW);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, mesh.indices.size() * sizeof(GLuint), mesh.indices.empty() ? NULL : &mesh.indices[0], GL_STATIC_DRAW);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+		numIndices = (GLsizei)mesh.indices.size();
+		Body = body;
+		posed = false;
+	}
+
+	// Shortest arc rotation taking unit vector a to unit vector b
+	static OVR::Quatf Arc(const OVR::Vector3f& a, const OVR::Vector3f& b)
+	{
+		float d = a.Dot(b);
+		if (d < -0.9999f)
+		{
+			// Half turn about any axis across a
+			OVR::Vector3f axis = fabs(a.x) < 0.9f ? a.Cross(OVR::Vector3f(1, 0, 0)) : a.Cross(OVR::Vector3f(0, 1, 0));
+			axis.Normalize();
+			return OVR::Quatf(axis.x, axis.y, axis.z, 0);
+		}
+		OVR::Vector3f c = a.Cross(b);
+		return OVR::Quatf(c.x, c.y, c.z, 1 + d).Normalized();
+	}
+
+	// Bone transforms for the current joints of the body
+	void Pose(const float* joints)
+	{
+		for (int b = 0; b < BoneCount; b++)
+		{
+			int j = BoneJoint(b), p = Parent(j);
+			OVR::Vector3f restDir = restJoints[j] - restJoints[p];
+			OVR::Vector3f dir = Joint(joints, j) - Joint(joints, p);
+			OVR::Quatf q = (restDir.LengthSq() > 0 && dir.LengthSq() > 0) ? Arc(restDir.Normalized(), dir.Normalized()) : OVR::Quatf();
+
+			// x' = q (x - rest parent) + parent = q x + t
+			OVR::Vector3f t = Joint(joints, p) - q.Rotate(restJoints[p]);
+			OVR::Matrix4f m = OVR::Matrix4f::Translation(t) * OVR::Matrix4f(q);
+			memcpy(&boneMatrix[b * 16], &m.M[0][0], 16 * sizeof(float));
+
+			boneReal[b * 4] = q.x;
+			boneReal[b * 4 + 1] = q.y;
+			boneReal[b * 4 + 2] = q.z;
+			boneReal[b * 4 + 3] = q.w;
+			OVR::Vector3f dual = (t * q.w + t.Cross(OVR::Vector3f(q.x, q.y, q.z))) * 0.5f;
+			boneDual[b * 4] = dual.x;
+			boneDual[b * 4 + 1] = dual.y;
+			boneDual[b * 4 + 2] = dual.z;
+			boneDual[b * 4 + 3] = -0.5f * t.Dot(OVR::Vector3f(q.x, q.y, q.z));
+		}
+		posed = true;
+	}
+
+	void Draw(const OVR::Matrix4f& worldViewProj) const
+	{
+		if (!posed || !numIndices)
+			return;
+		glUseProgram(program);
+		glUniformMatrix4fv(matWVPLoc, 1, GL_TRUE, (const FLOAT*)&worldViewProj);
+		glUniform1i(dualQuaternionLoc, DualQuaternion);
+		if (DualQuaternion)
+		{
+			glUniform4fv(boneRealLoc, BoneCount, boneReal);
+			glUniform4fv(boneDualLoc, BoneCount, boneDual);
+		}
+		else
+			glUniformMatrix4fv(boneMatrixLoc, BoneCount, GL_TRUE, boneMatrix);
+
+		GLboolean cull = glIsEnabled(GL_CULL_FACE);
+		glDisable(GL_CULL_FACE);
+		glBindVertexArray(vao);
+		glDrawElements(GL_TRIANGLES, numIndices, GL_UNSIGNED_INT, 0);
+		glBindVertexArray(0);
+		if (cull)
+			glEnable(GL_CULL_FACE);
+	}
+};
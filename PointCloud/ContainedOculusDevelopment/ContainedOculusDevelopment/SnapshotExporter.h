@@ -0,0 +1,305 @@
+#pragma once
+
+#include "GridSurface.h"
+#include "MeshDecimator.h"
+#include <vector>
+#include <deque>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <string.h>
+
+//--------------------------------------------------------------------------
+// Point cloud or surface of one sensor frame, on its way to the disk. The
+// renderer does not copy its buffers into a snapshot: it swaps them with
+// the snapshot's own, which it overwrites on the next frame anyway.
+struct CloudSnapshot
+{
+	enum Kind { Kind_Points, Kind_Grid };
+
+	Kind   kind;
+	double time;  // Seconds
+	int    index; // Set by Submit
+
+	// Kind_Points: numPoints points of 6 floats, position (xyz) then color (rgb)
+	float* points;
+	int    numPoints;
+
+	// Kind_Grid: vertices and valid faces of a GridSurface of cols nodes per
+	// row, stride floats per vertex starting with position and color
+	std::vector<float>         gridVertices;
+	std::vector<unsigned char> faceValid;
+	int                        cols, stride;
+};
+
+//--------------------------------------------------------------------------
+// Writes snapshots on a worker thread, each as a binary PLY file and as a
+// raw columnar file (see WriteColumns), named Prefix, the snapshot index
+// and the extension. Meshes keep only the vertices of their valid faces.
+//
+// Acquire and Submit only take a lock, so handing a snapshot over costs
+// the frame next to nothing. The snapshots come from a fixed pool, so the
+// queue never holds more than QueueDepth frames; when they are all queued
+// or being written, Acquire returns NULL and the frame is dropped.
+
+struct SnapshotExporter
+{
+	enum { Format_Ply = 1, Format_Columns = 2 };
+
+	std::string Prefix;
+	int         Formats;
+	int         written, dropped;
+
+	// Snapshots hold up to pointCapacity points
+	SnapshotExporter(int pointCapacity, int queueDepth) :
+		Prefix("snapshot_"),
+		Formats(Format_Ply | Format_Columns),
+		written(0),
+		dropped(0),
+		quit(false),
+		sequence(0)
+	{
+		pool.resize(queueDepth);
+		for (int i = 0; i < queueDepth; i++)
+		{
+			pool[i].points = new float[pointCapacity * 6];
+			pool[i].numPoints = 0;
+			freeSnapshots.push_back(&pool[i]);
+		}
+	}
+
+	~SnapshotExporter()
+	{
+		Stop();
+		for (size_t i = 0; i < pool.size(); i++)
+			delete[] pool[i].points;
+	}
+
+	//----------------------------------------------------------------------
+	// Worker thread
+
+	std::thread                 worker;
+	std::mutex                  lock;
+	std::condition_variable     wake;
+	bool                        quit;
+	int                         sequence;
+	std::vector<CloudSnapshot>  pool;
+	std::vector<CloudSnapshot*> freeSnapshots;
+	std::deque<CloudSnapshot*>  queue;
+
+	// A free snapshot to fill, NULL if there is none
+	CloudSnapshot* Acquire()
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		if (freeSnapshots.empty())
+		{
+			dropped++;
+			return NULL;
+		}
+		CloudSnapshot* s = freeSnapshots.back();
+		freeSnapshots.pop_back();
+		return s;
+	}
+
+	// Queues a filled snapshot for writing
+	void Submit(CloudSnapshot* s)
+	{
+		if (!worker.joinable())
+			worker = std::thread(&SnapshotExporter::Run, this);
+		std::lock_guard<std::mutex> guard(lock);
+		s->index = sequence++;
+		queue.push_back(s);
+		wake.notify_one();
+	}
+
+	// Writes what is queued, then stops
+	void Stop()
+	{
+		if (!worker.joinable())
+			return;
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			quit = true;
+			wake.notify_one();
+		}
+		worker.join();
+	}
+
+	void Run()
+	{
+		for (;;)
+		{
+			CloudSnapshot* s;
+			{
+				std::unique_lock<std::mutex> guard(lock);
+				while (!quit && queue.empty())
+					wake.wait(guard);
+				if (queue.empty())
+					return;
+				s = queue.front();
+				queue.pop_front();
+			}
+
+			bool ok = Write(*s);
+
+			std::lock_guard<std::mutex> guard(lock);
+			freeSnapshots.push_back(s);
+			written += ok;
+		}
+	}
+
+	//----------------------------------------------------------------------
+	// Encoding
+
+	SimpleMesh        mesh;     // Snapshot being written
+	std::vector<int>  remap;    // Grid node to mesh vertex
+	std::vector<char> encoded;
+
+	bool Write(const CloudSnapshot& s)
+	{
+		if (s.kind == CloudSnapshot::Kind_Points)
+			PointsMesh(s, mesh);
+		else
+			GridMesh(s, mesh);
+
+		std::ostringstream name;
+		name << Prefix << std::setw(6) << std::setfill('0') << s.index;
+		bool ok = true;
+		if (Formats & Format_Ply)
+		{
+			EncodePly(mesh, s.time, encoded);
+			ok = Save(name.str() + ".ply", encoded) && ok;
+		}
+		if (Formats & Format_Columns)
+		{
+			EncodeColumns(mesh, s.time, encoded);
+			ok = Save(name.str() + ".cols", encoded) && ok;
+		}
+		return ok;
+	}
+
+	static void PointsMesh(const CloudSnapshot& s, SimpleMesh& mesh)
+	{
+		mesh.Clear();
+		mesh.positions.resize(s.numPoints * 3);
+		mesh.colors.resize(s.numPoints * 3);
+		for (int i = 0; i < s.numPoints; i++)
+		{
+			memcpy(&mesh.positions[i * 3], &s.points[i * 6], 3 * sizeof(float));
+			memcpy(&mesh.colors[i * 3], &s.points[i * 6 + 3], 3 * sizeof(float));
+		}
+	}
+
+	void GridMesh(const CloudSnapshot& s, SimpleMesh& mesh)
+	{
+		mesh.Clear();
+		remap.assign(s.gridVertices.size() / s.stride, -1);
+		for (int f = 0; f < (int)s.faceValid.size(); f++)
+		{
+			if (!s.faceValid[f])
+				continue;
+			int nodes[3];
+			GridSurface::FaceNodes(f, s.cols, nodes);
+			for (int k = 0; k < 3; k++)
+			{
+				int& r = remap[nodes[k]];
+				if (r < 0)
+				{
+					r = (int)(mesh.positions.size() / 3);
+					const float* v = &s.gridVertices[nodes[k] * s.stride];
+					mesh.positions.insert(mesh.positions.end(), v, v + 3);
+					mesh.colors.insert(mesh.colors.end(), v + 3, v + 6);
+				}
+				mesh.indices.push_back(r);
+			}
+		}
+	}
+
+	static unsigned char Channel(float c)
+	{
+		return (unsigned char)(c <= 0 ? 0 : (c >= 1 ? 255 : c * 255 + 0.5f));
+	}
+
+	static void Append(std::vector<char>& out, const void* data, size_t size)
+	{
+		out.insert(out.end(), (const char*)data, (const char*)data + size);
+	}
+
+	// Binary little endian PLY: float positions, uchar colors and, for
+	// meshes, triangles as int index lists
+	static void EncodePly(const SimpleMesh& mesh, double time, std::vector<char>& out)
+	{
+		int numVertices = (int)(mesh.positions.size() / 3), numFaces = mesh.NumTriangles();
+		std::ostringstream header;
+		header << "ply\nformat binary_little_endian 1.0\ncomment time " << std::setprecision(17) << time << "\n"
+			<< "element vertex " << numVertices << "\n"
+			<< "property float x\nproperty float y\nproperty float z\n"
+			<< "property uchar red\nproperty uchar green\nproperty uchar blue\n";
+		if (numFaces)
+			header << "element face " << numFaces << "\nproperty list uchar int vertex_indices\n";
+		header << "end_header\n";
+
+		std::string h = header.str();
+		out.clear();
+		out.reserve(h.size() + numVertices * 15 + numFaces * 13);
+		Append(out, h.data(), h.size());
+		for (int i = 0; i < numVertices; i++)
+		{
+			unsigned char rgb[3] = { Channel(mesh.colors[i * 3]), Channel(mesh.colors[i * 3 + 1]), Channel(mesh.colors[i * 3 + 2]) };
+			Append(out, &mesh.positions[i * 3], 3 * sizeof(float));
+			Append(out, rgb, 3);
+		}
+		for (int f = 0; f < numFaces; f++)
+		{
+			unsigned char three = 3;
+			Append(out, &three, 1);
+			Append(out, &mesh.indices[f * 3], 3 * sizeof(unsigned int));
+		}
+	}
+
+	// Columnar layout: the 8 byte tag "PCCOLS1", the vertex and triangle
+	// counts as uint32 and the time as a double, then every x, every y,
+	// every z as floats, every red, green and blue as uchar, and the
+	// triangles as uint32 index triples
+	static void EncodeColumns(const SimpleMesh& mesh, double time, std::vector<char>& out)
+	{
+		unsigned int numVertices = (unsigned int)(mesh.positions.size() / 3), numFaces = (unsigned int)mesh.NumTriangles();
+		const char tag[8] = "PCCOLS1";
+		out.clear();
+		out.reserve(24 + numVertices * 15 + numFaces * 12);
+		Append(out, tag, sizeof(tag));
+		Append(out, &numVertices, sizeof(numVertices));
+		Append(out, &numFaces, sizeof(numFaces));
+		Append(out, &time, sizeof(time));
+		for (int k = 0; k < 3; k++)
+		{
+			for (unsigned int i = 0; i < numVertices; i++)
+				Append(out, &mesh.positions[i * 3 + k], sizeof(float));
+		}
+		for (int k = 0; k < 3; k++)
+		{
+			for (unsigned int i = 0; i < numVertices; i++)
+				out.push_back((char)Channel(mesh.colors[i * 3 + k]));
+		}
+		if (numFaces)
+			Append(out, &mesh.indices[0], numFaces * 3 * sizeof(unsigned int));
+	}
+
+	static bool Save(const std::string& path, const std::vector<char>& data)
+	{
+		std::ofstream file(path.c_str(), std::ios::binary | std::ios::trunc);
+		if (!data.empty())
+			file.write(&data[0], data.size());
+		if (!file)
+		{
+			std::cout << "Could not write " << path << std::endl;
+			return false;
+		}
+		return true;
+	}
+};
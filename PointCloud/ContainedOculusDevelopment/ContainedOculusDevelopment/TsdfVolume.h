@@ -0,0 +1,556 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <math.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define TSDF_SSE2 1
+#include <emmintrin.h>
+#endif
+
+//--------------------------------------------------------------------------
+// Truncated signed distance volume fused from depth frames. Space is split
+// into blocks of BlockSide^3 voxels, and only the blocks within Truncation
+// of a measured surface are allocated, from a pool of fixed size. A hash
+// table with linear probing maps block coordinates to their pool slot.
+//
+// Integrate allocates the blocks around the samples of the frame, then
+// updates their voxels in parallel, four voxels of a row at a time with
+// SSE2 where available. The blocks it updated stay in touched until the
+// next frame, and those whose voxels moved by ChangeThreshold in total
+// since they were last meshed are listed in changed. Only std and OpenMP
+// are used, so the volume also builds outside of the application, to
+// replay recorded frames (see FrameRecording.h).
+//
+// Every CarveStep-th ray also updates the blocks already allocated in front
+// of its sample, which the frame sees as free space, so a surface that moved
+// away (a person walking off) fades out instead of staying as a ghost. A
+// carved block left without any voxel behind a surface is evicted. When
+// fewer than Reserve blocks are free after a frame, the blocks integrated
+// least recently are evicted too, those never observed first, so the pool
+// never stays exhausted. The blocks evicted by a frame are listed in
+// evicted until the next one.
+
+struct TsdfVolume
+{
+	enum { BlockSide = 8, BlockVoxels = BlockSide * BlockSide * BlockSide };
+
+	// Pinhole model of the depth camera: pixel (u, v) of camera point
+	// (x, y, z) is (cx + fx * x / z, cy + fy * y / z). fx and fy carry the
+	// sign of the image axes.
+	struct Intrinsics
+	{
+		int   width, height;
+		float fx, fy, cx, cy;
+	};
+
+	// Voxel i is (i % BlockSide, i / BlockSide % BlockSide, i / BlockSide^2)
+	// of the block. Colors are RGBA bytes.
+	struct Block
+	{
+		float        tsdf[BlockVoxels];   // In [-1, 1] of Truncation
+		float        weight[BlockVoxels]; // 0 => never observed
+		unsigned int color[BlockVoxels];
+		int          x, y, z;             // Block coordinates
+		int          frame;               // Last frame that integrated it
+		float        change;              // Largest tsdf change of a frame, summed since the block was meshed
+	};
+
+	struct Slot
+	{
+		int x, y, z;
+		int block; // -1 => empty
+	};
+
+	float VoxelSize;   // Metres
+	float Truncation;  // Metres
+	float MaxWeight;   // Frames a voxel averages at most
+	float MinDepth, MaxDepth;
+	int   AllocStep;   // Every AllocStep-th row and column allocates blocks
+	float ChangeThreshold; // Change in tsdf units that makes a block worth meshing again
+	int   CarveStep;   // Every CarveStep-th row and column carves free space, 0 => no carving
+	int   Reserve;     // Blocks kept free by evicting the least recently integrated
+
+	std::vector<Block> pool;
+	std::vector<int>   freeBlocks;
+	std::vector<Slot>  table;
+	unsigned int       tableMask;
+	int                frame;
+	bool               full;    // Some block of the last frame could not be allocated
+
+	std::vector<int>   touched; // Blocks of the last frame
+	std::vector<int>   carved;  // Blocks of the last frame only seen as free space
+	std::vector<int>   changed; // Blocks of the last frame that changed enough
+	std::vector<int>   evicted; // Blocks freed by the last frame, still holding their coordinates
+	std::vector<int>   keys;    // Block coordinates found by the last allocation, 3 per block, then blocks found by carving
+	std::vector<std::pair<int, int> > candidates; // Age and pool index of the blocks that may be evicted
+
+	TsdfVolume(int blockCapacity, float voxelSize) :
+		VoxelSize(voxelSize),
+		Truncation(4 * voxelSize),
+		MaxWeight(64.0f),
+		MinDepth(0.4f),
+		MaxDepth(4.5f),
+		AllocStep(2),
+		ChangeThreshold(0.125f),
+		CarveStep(8),
+		Reserve(blockCapacity / 8),
+		pool(blockCapacity),
+		tableMask(0),
+		frame(0),
+		full(false)
+	{
+		unsigned int size = 1;
+		while (size < 2 * (unsigned int)blockCapacity)
+			size <<= 1;
+		table.resize(size);
+		tableMask = size - 1;
+		Clear();
+	}
+
+	void Clear()
+	{
+		freeBlocks.resize(pool.size());
+		for (size_t i = 0; i < pool.size(); i++)
+			freeBlocks[i] = (int)(pool.size() - 1 - i);
+		for (size_t i = 0; i < table.size(); i++)
+			table[i].block = -1;
+		touched.clear();
+		carved.clear();
+		changed.clear();
+		evicted.clear();
+		full = false;
+	}
+
+	int NumBlocks() const { return (int)(pool.size() - freeBlocks.size()); }
+
+	float BlockSize() const { return VoxelSize * BlockSide; }
+
+	static unsigned int Hash(int x, int y, int z)
+	{
+		return ((unsigned int)x * 73856093u) ^ ((unsigned int)y * 19349669u) ^ ((unsigned int)z * 83492791u);
+	}
+
+	// Pool index of block (x, y, z), -1 if it is not allocated
+	int Find(int x, int y, int z) const
+	{
+		for (unsigned int h = Hash(x, y, z) & tableMask;; h = (h + 1) & tableMask)
+		{
+			const Slot& s = table[h];
+			if (s.block < 0)
+				return -1;
+			if (s.x == x && s.y == y && s.z == z)
+				return s.block;
+		}
+	}
+
+	// Pool index of block (x, y, z), allocated and cleared if needed. -1 when
+	// the pool is exhausted.
+	int FindOrAllocate(int x, int y, int z)
+	{
+		unsigned int h = Hash(x, y, z) & tableMask;
+		for (;; h = (h + 1) & tableMask)
+		{
+			const Slot& s = table[h];
+			if (s.block < 0)
+				break;
+			if (s.x == x && s.y == y && s.z == z)
+				return s.block;
+		}
+		if (freeBlocks.empty())
+		{
+			full = true;
+			return -1;
+		}
+
+		int b = freeBlocks.back();
+		freeBlocks.pop_back();
+		Block& block = pool[b];
+		for (int i = 0; i < BlockVoxels; i++)
+		{
+			block.tsdf[i] = 1.0f;
+			block.weight[i] = 0.0f;
+			block.color[i] = 0;
+		}
+		block.x = x;
+		block.y = y;
+		block.z = z;
+		block.frame = -1;
+		block.change = 0;
+
+		Slot& s = table[h];
+		s.x = x;
+		s.y = y;
+		s.z = z;
+		s.block = b;
+		return b;
+	}
+
+	// Frees block b and lists it in evicted. The slots after its own are
+	// shifted back over the hole, so no probe sequence is cut short.
+	void Evict(int b)
+	{
+		Block& block = pool[b];
+		unsigned int h = Hash(block.x, block.y, block.z) & tableMask;
+		while (table[h].block != b)
+			h = (h + 1) & tableMask;
+		for (unsigned int next = (h + 1) & tableMask;; next = (next + 1) & tableMask)
+		{
+			const Slot& s = table[next];
+			if (s.block < 0)
+				break;
+			// s can move to the hole unless its home lies after the hole, up to it
+			unsigned int home = Hash(s.x, s.y, s.z) & tableMask;
+			if (((next - home) & tableMask) < ((next - h) & tableMask))
+				continue;
+			table[h] = s;
+			h = next;
+		}
+		table[h].block = -1;
+
+		block.frame = -1;
+		freeBlocks.push_back(b);
+		evicted.push_back(b);
+	}
+
+	// True if some observed voxel of block is behind a surface
+	static bool HasSurface(const Block& block)
+	{
+		for (int i = 0; i < BlockVoxels; i++)
+		{
+			if (block.weight[i] > 0 && block.tsdf[i] < 0)
+				return true;
+		}
+		return false;
+	}
+
+	static bool Observed(const Block& block)
+	{
+		for (int i = 0; i < BlockVoxels; i++)
+		{
+			if (block.weight[i] > 0)
+				return true;
+		}
+		return false;
+	}
+
+	// Fuses a depth frame in millimetres, 0 => no depth. colors holds an
+	// RGBA color per depth pixel, or is NULL. cameraToWorld is a row-major
+	// 3x4 rigid transform, NULL => the volume is in camera space. Returns
+	// the number of blocks updated.
+	int Integrate(const unsigned short* depth, const unsigned int* colors, const Intrinsics& intr, const float* cameraToWorld)
+	{
+		static const float Identity[12] = { 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0 };
+		const float* pose = cameraToWorld ? cameraToWorld : Identity;
+
+		frame++;
+		full = false;
+		evicted.clear();
+		Allocate(depth, intr, pose);
+		Carve(depth, intr, pose);
+
+		// World to camera is the transposed rotation
+		Frame f;
+		f.depth = depth;
+		f.colors = colors;
+		f.intr = intr;
+		for (int r = 0; r < 3; r++)
+		{
+			for (int c = 0; c < 3; c++)
+				f.R[r * 3 + c] = pose[c * 4 + r];
+			f.t[r] = -(pose[r] * pose[3] + pose[4 + r] * pose[7] + pose[8 + r] * pose[11]);
+		}
+
+		int count = (int)touched.size();
+		#pragma omp parallel for schedule(dynamic)
+		for (int i = 0; i < count; i++)
+			IntegrateBlock(pool[touched[i]], f);
+
+		for (size_t i = 0; i < carved.size(); i++)
+		{
+			if (!HasSurface(pool[carved[i]]))
+				Evict(carved[i]);
+		}
+		changed.clear();
+		for (int i = 0; i < count; i++)
+		{
+			const Block& block = pool[touched[i]];
+			if (block.frame == frame && block.change >= ChangeThreshold)
+				changed.push_back(touched[i]);
+		}
+		if ((int)freeBlocks.size() < Reserve)
+			EvictOldest(Reserve - (int)freeBlocks.size());
+		return count;
+	}
+
+	// Evicts count blocks that were not integrated by the current frame,
+	// those never observed first, then the least recently integrated
+	void EvictOldest(int count)
+	{
+		candidates.clear();
+		for (size_t h = 0; h < table.size(); h++)
+		{
+			int b = table[h].block;
+			if (b < 0 || pool[b].frame == frame)
+				continue;
+			candidates.push_back(std::make_pair(Observed(pool[b]) ? pool[b].frame : -1, b));
+		}
+		count = std::min(count, (int)candidates.size());
+		if (count <= 0)
+			return;
+		std::nth_element(candidates.begin(), candidates.begin() + (count - 1), candidates.end());
+		for (int i = 0; i < count; i++)
+			Evict(candidates[i].second);
+	}
+
+	// Allocates the blocks within Truncation of the samples of the frame
+	// along their rays, and lists them in touched
+	void Allocate(const unsigned short* depth, const Intrinsics& intr, const float* pose)
+	{
+		float blockSize = BlockSize();
+		float step = blockSize * 0.5f;
+		int   steps = (int)ceil(2 * Truncation / step);
+		keys.clear();
+
+		#pragma omp parallel
+		{
+			std::vector<int> local;
+
+			#pragma omp for schedule(dynamic)
+			for (int v = 0; v < intr.height; v += AllocStep)
+			{
+				for (int u = 0; u < intr.width; u += AllocStep)
+				{
+					float d = depth[v * intr.width + u] * 0.001f;
+					if (d < MinDepth || d > MaxDepth)
+						continue;
+					float rx = (u - intr.cx) / intr.fx, ry = (v - intr.cy) / intr.fy;
+					int   lx = 0, ly = 0, lz = 0;
+					bool  first = true;
+					for (int s = 0; s <= steps; s++)
+					{
+						float z = d - Truncation + s * (2 * Truncation / steps);
+						float cx = rx * z, cy = ry * z;
+						int bx = (int)floor((pose[0] * cx + pose[1] * cy + pose[2] * z + pose[3]) / blockSize);
+						int by = (int)floor((pose[4] * cx + pose[5] * cy + pose[6] * z + pose[7]) / blockSize);
+						int bz = (int)floor((pose[8] * cx + pose[9] * cy + pose[10] * z + pose[11]) / blockSize);
+						if (!first && bx == lx && by == ly && bz == lz)
+							continue;
+						local.push_back(bx);
+						local.push_back(by);
+						local.push_back(bz);
+						lx = bx;
+						ly = by;
+						lz = bz;
+						first = false;
+					}
+				}
+			}
+
+			#pragma omp critical
+			keys.insert(keys.end(), local.begin(), local.end());
+		}
+
+		touched.clear();
+		for (size_t k = 0; k < keys.size(); k += 3)
+		{
+			int b = FindOrAllocate(keys[k], keys[k + 1], keys[k + 2]);
+			if (b < 0 || pool[b].frame == frame)
+				continue;
+			pool[b].frame = frame;
+			touched.push_back(b);
+		}
+	}
+
+	// Lists in carved, and adds to touched, the allocated blocks that the
+	// rays of every CarveStep-th row and column cross in front of their
+	// samples, where the frame sees free space
+	void Carve(const unsigned short* depth, const Intrinsics& intr, const float* pose)
+	{
+		carved.clear();
+		if (CarveStep <= 0)
+			return;
+		float blockSize = BlockSize();
+		float step = blockSize * 0.5f;
+		keys.clear();
+
+		#pragma omp parallel
+		{
+			std::vector<int> local;
+
+			#pragma omp for schedule(dynamic)
+			for (int v = 0; v < intr.height; v += CarveStep)
+			{
+				for (int u = 0; u < intr.width; u += CarveStep)
+				{
+					float d = depth[v * intr.width + u] * 0.001f;
+					if (d < MinDepth || d > MaxDepth)
+						continue;
+					float rx = (u - intr.cx) / intr.fx, ry = (v - intr.cy) / intr.fy;
+					int   last = -1;
+					for (float z = MinDepth; z < d - Truncation; z += step)
+					{
+						float cx = rx * z, cy = ry * z;
+						int b = Find((int)floor((pose[0] * cx + pose[1] * cy + pose[2] * z + pose[3]) / blockSize),
+							(int)floor((pose[4] * cx + pose[5] * cy + pose[6] * z + pose[7]) / blockSize),
+							(int)floor((pose[8] * cx + pose[9] * cy + pose[10] * z + pose[11]) / blockSize));
+						if (b < 0 || b == last)
+							continue;
+						local.push_back(b);
+						last = b;
+					}
+				}
+			}
+
+			#pragma omp critical
+			keys.insert(keys.end(), local.begin(), local.end());
+		}
+
+		for (size_t k = 0; k < keys.size(); k++)
+		{
+			int b = keys[k];
+			if (pool[b].frame == frame)
+				continue;
+			pool[b].frame = frame;
+			touched.push_back(b);
+			carved.push_back(b);
+		}
+	}
+
+	// Frame being integrated, with the world to camera transform
+	struct Frame
+	{
+		const unsigned short* depth;
+		const unsigned int*   colors;
+		Intrinsics            intr;
+		float                 R[9];
+		float                 t[3];
+	};
+
+	void IntegrateBlock(Block& block, const Frame& f) const
+	{
+		// Camera space step from one voxel of a row to the next
+		float stepX[3] = { f.R[0] * VoxelSize, f.R[3] * VoxelSize, f.R[6] * VoxelSize };
+		float wx = (block.x * BlockSide + 0.5f) * VoxelSize;
+		float change = 0;
+
+		for (int z = 0; z < BlockSide; z++)
+		{
+			float wz = (block.z * BlockSide + z + 0.5f) * VoxelSize;
+			for (int y = 0; y < BlockSide; y++)
+			{
+				float wy = (block.y * BlockSide + y + 0.5f) * VoxelSize;
+				float base[3];
+				for (int r = 0; r < 3; r++)
+					base[r] = f.R[r * 3] * wx + f.R[r * 3 + 1] * wy + f.R[r * 3 + 2] * wz + f.t[r];
+				int row = (z * BlockSide + y) * BlockSide;
+				for (int x = 0; x < BlockSide; x += 4)
+				{
+					float c = UpdateVoxels(block, row + x, x, base, stepX, f);
+					change = c > change ? c : change;
+				}
+			}
+		}
+		block.change += change;
+	}
+
+	// Updates voxels i to i + 3 of the block, at x to x + 3 along their row,
+	// and returns the largest change of their tsdf
+	float UpdateVoxels(Block& block, int i, int x, const float* base, const float* stepX, const Frame& f) const
+	{
+		const Intrinsics& intr = f.intr;
+		float camZ[4];
+		int   u[4], v[4];
+
+#ifdef TSDF_SSE2
+		__m128 xs = _mm_set_ps((float)(x + 3), (float)(x + 2), (float)(x + 1), (float)x);
+		__m128 px = _mm_add_ps(_mm_set1_ps(base[0]), _mm_mul_ps(xs, _mm_set1_ps(stepX[0])));
+		__m128 py = _mm_add_ps(_mm_set1_ps(base[1]), _mm_mul_ps(xs, _mm_set1_ps(stepX[1])));
+		__m128 pz = _mm_add_ps(_mm_set1_ps(base[2]), _mm_mul_ps(xs, _mm_set1_ps(stepX[2])));
+		__m128 inv = _mm_div_ps(_mm_set1_ps(1.0f), pz);
+		__m128 pu = _mm_add_ps(_mm_set1_ps(intr.cx), _mm_mul_ps(_mm_set1_ps(intr.fx), _mm_mul_ps(px, inv)));
+		__m128 pv = _mm_add_ps(_mm_set1_ps(intr.cy), _mm_mul_ps(_mm_set1_ps(intr.fy), _mm_mul_ps(py, inv)));
+		_mm_storeu_ps(camZ, pz);
+		_mm_storeu_si128((__m128i*)u, _mm_cvtps_epi32(pu));
+		_mm_storeu_si128((__m128i*)v, _mm_cvtps_epi32(pv));
+#else
+		for (int l = 0; l < 4; l++)
+		{
+			float px = base[0] + (x + l) * stepX[0];
+			float py = base[1] + (x + l) * stepX[1];
+			camZ[l] = base[2] + (x + l) * stepX[2];
+			u[l] = (int)floor(intr.cx + intr.fx * px / camZ[l] + 0.5f);
+			v[l] = (int)floor(intr.cy + intr.fy * py / camZ[l] + 0.5f);
+		}
+#endif
+
+		// Depth seen through each voxel, 0 => none; gathers stay scalar
+		float d[4];
+		for (int l = 0; l < 4; l++)
+		{
+			d[l] = 0;
+			if (!(camZ[l] > MinDepth) || u[l] < 0 || u[l] >= intr.width || v[l] < 0 || v[l] >= intr.height)
+				continue;
+			float m = f.depth[v[l] * intr.width + u[l]] * 0.001f;
+			if (m >= MinDepth && m <= MaxDepth)
+				d[l] = m;
+		}
+
+		// Colors average over the voxels near the surface, before the weights change
+		if (f.colors)
+		{
+			for (int l = 0; l < 4; l++)
+			{
+				float sdf = d[l] - camZ[l];
+				if (d[l] <= 0 || fabs(sdf) >= Truncation)
+					continue;
+				unsigned int c = f.colors[v[l] * intr.width + u[l]];
+				unsigned int& old = block.color[i + l];
+				float w = block.weight[i + l], inv = 1.0f / (w + 1);
+				unsigned int mixed = 0xff000000u;
+				for (int s = 0; s < 24; s += 8)
+				{
+					float a = (float)((old >> s) & 0xff), b = (float)((c >> s) & 0xff);
+					mixed |= (unsigned int)((a * w + b) * inv + 0.5f) << s;
+				}
+				old = mixed;
+			}
+		}
+
+#ifdef TSDF_SSE2
+		__m128 dv = _mm_loadu_ps(d);
+		__m128 sdf = _mm_sub_ps(dv, pz);
+		__m128 valid = _mm_and_ps(_mm_cmpgt_ps(dv, _mm_setzero_ps()), _mm_cmpgt_ps(sdf, _mm_set1_ps(-Truncation)));
+		__m128 sample = _mm_min_ps(_mm_set1_ps(1.0f), _mm_mul_ps(sdf, _mm_set1_ps(1.0f / Truncation)));
+		__m128 w = _mm_loadu_ps(&block.weight[i]);
+		__m128 t = _mm_loadu_ps(&block.tsdf[i]);
+		__m128 w1 = _mm_add_ps(w, _mm_set1_ps(1.0f));
+		__m128 t1 = _mm_div_ps(_mm_add_ps(_mm_mul_ps(t, w), sample), w1);
+		w1 = _mm_min_ps(w1, _mm_set1_ps(MaxWeight));
+		_mm_storeu_ps(&block.tsdf[i], _mm_or_ps(_mm_and_ps(valid, t1), _mm_andnot_ps(valid, t)));
+		_mm_storeu_ps(&block.weight[i], _mm_or_ps(_mm_and_ps(valid, w1), _mm_andnot_ps(valid, w)));
+
+		// Absolute value by clearing the sign bit
+		__m128 delta = _mm_and_ps(valid, _mm_andnot_ps(_mm_set1_ps(-0.0f), _mm_sub_ps(t1, t)));
+		delta = _mm_max_ps(delta, _mm_shuffle_ps(delta, delta, _MM_SHUFFLE(1, 0, 3, 2)));
+		delta = _mm_max_ps(delta, _mm_shuffle_ps(delta, delta, _MM_SHUFFLE(2, 3, 0, 1)));
+		return _mm_cvtss_f32(delta);
+#else
+		float change = 0;
+		for (int l = 0; l < 4; l++)
+		{
+			float sdf = d[l] - camZ[l];
+			if (d[l] <= 0 || sdf <= -Truncation)
+				continue;
+			float sample = sdf / Truncation < 1.0f ? sdf / Truncation : 1.0f;
+			float w = block.weight[i + l];
+			float t = (block.tsdf[i + l] * w + sample) / (w + 1);
+			change = fabs(t - block.tsdf[i + l]) > change ? fabs(t - block.tsdf[i + l]) : change;
+			block.tsdf[i + l] = t;
+			block.weight[i + l] = w + 1 < MaxWeight ? w + 1 : MaxWeight;
+		}
+		return change;
+#endif
+	}
+};
@@ -0,0 +1,70 @@
+#pragma once
+
+//--------------------------------------------------------------------------
+// The few Win32 types and calls the scene uses, so that it also builds
+// where there is no windows.h: the headless EGL runs on Linux (see
+// EglPlatform.h). On Windows these are the real ones. Elsewhere the calls
+// do what the scene needs of them and no more: MessageBoxA writes to
+// stderr, and timeBeginPeriod does nothing, the POSIX sleeps being precise
+// enough already.
+
+#ifdef _WIN32
+
+#include <windows.h>
+#include <mmsystem.h>
+
+#else
+
+#include <stdint.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+typedef unsigned char  BYTE;
+typedef unsigned short UINT16;
+typedef unsigned int   UINT;
+typedef uint32_t       DWORD;
+typedef int32_t        LONG;
+typedef int32_t        HRESULT;
+typedef float          FLOAT;
+typedef void*          HWND;
+
+struct RGBQUAD
+{
+	BYTE rgbBlue;
+	BYTE rgbGreen;
+	BYTE rgbRed;
+	BYTE rgbReserved;
+};
+
+#define S_OK      ((HRESULT)0)
+#define E_FAIL    ((HRESULT)0x80004005L)
+#define E_PENDING ((HRESULT)0x8000000AL)
+#define SUCCEEDED(hr) (((HRESULT)(hr)) >= 0)
+#define FAILED(hr)    (((HRESULT)(hr)) < 0)
+
+#define MAX_PATH     260
+#define MB_OK        0x0
+#define MB_ICONERROR 0x10
+
+inline int MessageBoxA(HWND, const char* text, const char* caption, UINT)
+{
+	fprintf(stderr, "%s: %s\n", caption, text);
+	return 1;
+}
+
+inline void Sleep(DWORD milliseconds)
+{
+	usleep(milliseconds * 1000);
+}
+
+// Succeeds, like the Win32 call, only if the directory is new
+inline int CreateDirectoryA(const char* path, void*)
+{
+	return mkdir(path, 0755) == 0;
+}
+
+inline UINT timeBeginPeriod(UINT) { return 0; }
+inline UINT timeEndPeriod(UINT)   { return 0; }
+
+#endif
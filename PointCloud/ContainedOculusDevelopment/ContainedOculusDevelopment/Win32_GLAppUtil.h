@@ -17,6 +17,8 @@ See the License for the specific language governing permissions and
 limitations under the License.
 *************************************************************************************/
 
+#pragma once
+
 #include "btBulletDynamicsCommon.h"
 #include "LibOVRKernel/Src/GL/CAPI_GLE.h"
 #include "LibOVR/Include/Extras/OVR_Math.h"
@@ -24,7 +26,28 @@ limitations under the License.
 #include "LibOVR/Include/OVR_CAPI_GL.h"
 #include "LibOVRKernel/Src/Kernel/OVR_Types.h"
 #include "KinectHandler.h"
+#include "SensorSource.h"
+#include "GLPlatform.h"
+#include "PointSplatting.h"
+#include "HoleFilling.h"
+#include "PointMotion.h"
+#include "PointChunks.h"
+#include "PointRasterizer.h"
+#include "GridSurface.h"
+#include "TsdfVolume.h"
+#include "BlockMesher.h"
+#include "MeshDecimator.h"
+#include "SkinnedAvatar.h"
+#include "BodyHulls.h"
+#include "SnapshotExporter.h"
+#include "FrameRecording.h"
+#include "PhysicsThread.h"
+#include "BoneCapsules.h"
+#include "ProgramCache.h"
+#include "GpuProfiler.h"
 #include <iostream>
+#include <vector>
+#include <algorithm>
 
 #define screen_width 1024
 #define screen_height 848
@@ -32,12 +55,14 @@ limitations under the License.
 #define color_height 1080
 #define depth_width 512
 #define depth_height 424
+#define depth_focal_length 365.5f // Approximate, in depth pixels
 
 using namespace OVR;
 using namespace std;
 
-KinectHandler* kinect;
+SensorSource* sensor; // Set before the Scene for a replay, else Scene::Init opens the Kinect (Windows) or the synthetic scene
 btDiscreteDynamicsWorld* dynamicsWorld;
+PhysicsThread* physics; // Steps dynamicsWorld, which only its thread touches once started
 
 #ifndef VALIDATE
 #define VALIDATE(x, msg) if (!(x)) { MessageBoxA(NULL, (msg), "OculusRoomTiny", MB_ICONERROR | MB_OK); exit(-1); }
@@ -188,13 +213,22 @@ struct TextureBuffer
 
 	void SetAndClearRenderSurface(DepthBuffer* dbuffer)
 	{
-		auto tex = reinterpret_cast<ovrGLTexture*>(&TextureSet->Textures[TextureSet->CurrentIndex]);
+		SetAndClearRenderSurface(dbuffer, Recti(texSize));
+	}
+
+	// Renders into the viewport only, for dynamic resolution
+	void SetAndClearRenderSurface(DepthBuffer* dbuffer, const Recti& viewport)
+	{
+		// Targets not displayable on the HMD render to their own texture
+		GLuint colorTexId = texId;
+		if (TextureSet)
+			colorTexId = reinterpret_cast<ovrGLTexture*>(&TextureSet->Textures[TextureSet->CurrentIndex])->OGL.TexId;
 
 		glBindFramebuffer(GL_FRAMEBUFFER, fboId);
-		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, tex->OGL.TexId, 0);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, colorTexId, 0);
 		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, dbuffer->texId, 0);
 
-		glViewport(0, 0, texSize.w, texSize.h);
+		glViewport(viewport.x, viewport.y, viewport.w, viewport.h);
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 		glEnable(GL_FRAMEBUFFER_SRGB);
 	}
@@ -208,19 +242,16 @@ struct TextureBuffer
 };
 
 //---------------------------------------------------------------------------
-struct OGL
+// Win32 window with a WGL context
+#ifdef _WIN32
+struct OGL : GLPlatform
 {
 	static const bool       UseDebugContext = false;
+	bool                    Headless;   // Renders offscreen only, the window stays hidden
 
 	HWND                    Window;
 	HDC                     hDC;
 	HGLRC                   WglContext;
-	OVR::GLEContext         GLEContext;
-	bool                    Running;
-	bool                    Key[256];
-	int                     WinSizeW;
-	int                     WinSizeH;
-	GLuint                  fboId;
 	HINSTANCE               hInstance;
 
 	static LRESULT CALLBACK WindowProc(_In_ HWND hWnd, _In_ UINT Msg, _In_ WPARAM wParam, _In_ LPARAM lParam)
@@ -248,20 +279,12 @@ struct OGL
 	}
 
 	OGL() :
+		Headless(false),
 		Window(nullptr),
 		hDC(nullptr),
 		WglContext(nullptr),
-		GLEContext(),
-		Running(false),
-		WinSizeW(0),
-		WinSizeH(0),
-		fboId(0),
 		hInstance(nullptr)
-	{
-		// Clear input
-		for (int i = 0; i < sizeof(Key) / sizeof(Key[0]); ++i)
-			Key[i] = false;
-	}
+	{}
 
 	~OGL()
 	{
@@ -309,6 +332,11 @@ struct OGL
 		}
 	}
 
+	bool InitDevice(int vpW, int vpH)
+	{
+		return InitDevice(vpW, vpH, nullptr);
+	}
+
 	// Note: currently there is no way to get GL to use the passed pLuid
 	bool InitDevice(int vpW, int vpH, const LUID* /*pLuid*/, bool windowed = true)
 	{
@@ -317,7 +345,7 @@ struct OGL
 
 		RECT size = { 0, 0, vpW, vpH };
 		AdjustWindowRect(&size, WS_OVERLAPPEDWINDOW, false);
-		const UINT flags = SWP_NOMOVE | SWP_NOZORDER | SWP_SHOWWINDOW;
+		const UINT flags = SWP_NOMOVE | SWP_NOZORDER | (Headless ? 0 : SWP_SHOWWINDOW);
 		if (!SetWindowPos(Window, nullptr, 0, 0, size.right - size.left, size.bottom - size.top, flags))
 			return false;
 
@@ -385,14 +413,7 @@ struct OGL
 		WglContext = wglCreateContextAttribsARBFunc(hDC, 0, attribs);
 		VALIDATE(wglMakeCurrent(hDC, WglContext), "wglMakeCurrent failed.");
 
-		OVR::GLEContext::SetCurrentContext(&GLEContext);
-		GLEContext.Init();
-
-		glGenFramebuffers(1, &fboId);
-
-		glEnable(GL_DEPTH_TEST);
-		glFrontFace(GL_CW);
-		glEnable(GL_CULL_FACE);
+		InitGL();
 
 		if (UseDebugContext && GLE_ARB_debug_output)
 		{
@@ -422,6 +443,16 @@ struct OGL
 		return Running;
 	}
 
+	void Present()
+	{
+		SwapBuffers(hDC);
+	}
+
+	void* LoadProc(const char* name)
+	{
+		return (void*)wglGetProcAddress(name);
+	}
+
 	void Run(bool(*MainLoop)(bool retryCreate))
 	{
 		// false => just fail on any error
@@ -438,13 +469,9 @@ struct OGL
 
 	void ReleaseDevice()
 	{
-		if (fboId)
-		{
-			glDeleteFramebuffers(1, &fboId);
-			fboId = 0;
-		}
 		if (WglContext)
 		{
+			ReleaseGL();
 			wglMakeCurrent(NULL, NULL);
 			wglDeleteContext(WglContext);
 			WglContext = nullptr;
@@ -460,35 +487,38 @@ struct OGL
 
 // Global OpenGL state
 static OGL Platform;
+#endif
 
 //---------------------------------------------------------------------------
 struct ShaderFill
 {
 	GLuint            program;
+	GLint             matWVPLoc;
 	TextureBuffer   * texture;
 
-	ShaderFill(GLuint vertexShader, GLuint pixelShader, TextureBuffer* _texture)
+	// The program comes from ProgramCache, compiled or loaded from disk
+	ShaderFill(const GLchar* vertexSrc, const GLchar* pixelSrc, TextureBuffer* _texture)
 	{
-		texture = _texture;
-
-		program = glCreateProgram();
-
-		glAttachShader(program, vertexShader);
-		glAttachShader(program, pixelShader);
+		Init(ProgramCache::Get().Build(vertexSrc, pixelSrc), _texture);
+	}
 
-		glLinkProgram(program);
+	// Takes a program from ProgramCache::Begin, so that the programs of
+	// several fills compile at the same time
+	ShaderFill(GLuint begunProgram, TextureBuffer* _texture)
+	{
+		Init(ProgramCache::Get().Finish(begunProgram), _texture);
+	}
 
-		glDetachShader(program, vertexShader);
-		glDetachShader(program, pixelShader);
+	void Init(GLuint _program, TextureBuffer* _texture)
+	{
+		texture = _texture;
+		program = _program;
 
-		GLint r;
-		glGetProgramiv(program, GL_LINK_STATUS, &r);
-		if (!r)
-		{
-			GLchar msg[1024];
-			glGetProgramInfoLog(program, sizeof(msg), 0, msg);
-			OVR_DEBUG_LOG(("Linking shaders failed: %s\n", msg));
-		}
+		// Looked up once here so that recording draws needs no GL calls
+		matWVPLoc = glGetUniformLocation(program, "matWVP");
+		glUseProgram(program);
+		glUniform1i(glGetUniformLocation(program, "Texture0"), 0);
+		glUseProgram(0);
 	}
 
 	~ShaderFill()
@@ -549,64 +579,384 @@ struct IndexBuffer
 };
 
 //---------------------------------------------------------------------------
+// Captures the attribute layout of a vertex/index buffer pair in a vertex
+// array object, so that drawing it later only needs a glBindVertexArray.
+// Attributes the program does not use (location -1) are skipped.
+
+static GLuint CreateVertexArray(GLuint program, GLuint vbo, GLuint ibo, GLsizei stride,
+	const char* posName, size_t posOffset,
+	const char* colorName, GLint colorSize, GLenum colorType, size_t colorOffset,
+	const char* uvName, size_t uvOffset)
+{
+	GLuint vao;
+	glGenVertexArrays(1, &vao);
+	glBindVertexArray(vao);
+	glBindBuffer(GL_ARRAY_BUFFER, vbo);
+	if (ibo) glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo);
 
-struct Model
+	GLint posLoc = posName ? glGetAttribLocation(program, posName) : -1;
+	GLint colorLoc = colorName ? glGetAttribLocation(program, colorName) : -1;
+	GLint uvLoc = uvName ? glGetAttribLocation(program, uvName) : -1;
+
+	if (posLoc >= 0)
+	{
+		glEnableVertexAttribArray(posLoc);
+		glVertexAttribPointer(posLoc, 3, GL_FLOAT, GL_FALSE, stride, (void*)posOffset);
+	}
+	if (colorLoc >= 0)
+	{
+		glEnableVertexAttribArray(colorLoc);
+		glVertexAttribPointer(colorLoc, colorSize, colorType, colorType == GL_FLOAT ? GL_FALSE : GL_TRUE, stride, (void*)colorOffset);
+	}
+	if (uvLoc >= 0)
+	{
+		glEnableVertexAttribArray(uvLoc);
+		glVertexAttribPointer(uvLoc, 2, GL_FLOAT, GL_FALSE, stride, (void*)uvOffset);
+	}
+
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	return vao;
+}
+
+//---------------------------------------------------------------------------
+// A DrawCommand is everything needed to issue one draw of the frame. The
+// scene records its draws once per frame into a DrawCommandList and the
+// list is then replayed for each eye, only changing the view-projection.
+// Recording makes no GL calls, so it can run off the GL thread.
+
+struct DrawCommand
+{
+	GLuint      program;
+	GLuint      texture;    // 0 => leave texture unit 0 untouched
+	GLuint      vao;
+	GLint       matWVPLoc;
+	GLenum      primitive;
+	GLenum      indexType;  // 0 => glDrawArrays
+	GLint       first;      // first index (indexed) or first vertex
+	GLsizei     count;
+	GLsizei     instanceCount; // 0 => not instanced
+	GLfloat     pointSize;
+	Matrix4f    World;
+	int         pass;       // GpuProfiler pass it is timed in, -1 => none
+	bool        prepass;    // Also drawn in the depth prepass
+	Vector3f    Center;     // World space bounding sphere, Radius < 0 => unbounded
+	float       Radius;
+};
+
+//---------------------------------------------------------------------------
+// Before each eye the commands can be sorted front to back, so that the
+// early depth test rejects the pixels of the room hidden behind the props
+// and the bodies. The key is the view depth of the nearest point of the
+// bounds in DepthBucket steps, then the program, texture and vertex array,
+// so that draws at about the same depth keep sharing their state. Commands
+// whose bounds hold the eye, like the room, or have no bounds go last.
+//
+// Geometry a single key cannot order, such as the instances of a batch,
+// can also be drawn depth only first (DepthPrepass); the color pass then
+// only shades the visible fragments.
+
+struct DrawCommandList
 {
-	struct Vertex
+	vector<DrawCommand>        Commands;
+	vector<size_t>             Order;   // Replay order, set by Sort
+	vector<unsigned long long> keys;
+
+	bool  SortFrontToBack;
+	bool  DepthPrepass;
+	float DepthBucket;  // Metres of view depth sorted as one
+
+	int   curPass;
+	bool  curPrepass;
+
+	DrawCommandList() :
+		SortFrontToBack(true),
+		DepthPrepass(false),
+		DepthBucket(0.25f),
+		curPass(-1),
+		curPrepass(false)
 	{
-		Vector3f  Pos;
-		DWORD     C;
-		float     U, V;
-	};
+		Commands.reserve(64);
+	}
 
-	Vector3f        Pos;
-	Quatf           Rot;
-	Matrix4f        Mat;
-	int             numVertices, numIndices;
-	Vertex          Vertices[2000]; // Note fixed maximum
-	GLushort        Indices[2000];
-	ShaderFill    * Fill;
-	VertexBuffer  * vertexBuffer;
-	IndexBuffer   * indexBuffer;
+	void Reset()
+	{
+		Commands.clear();
+		Order.clear();
+	}
 
-	Model(Vector3f pos, ShaderFill * fill) :
-		numVertices(0),
-		numIndices(0),
-		Pos(pos),
-		Rot(),
-		Mat(),
-		Fill(fill),
-		vertexBuffer(nullptr),
-		indexBuffer(nullptr)
-	{}
+	// The commands added between BeginPass and EndPass are timed as pass, and
+	// are part of the depth prepass if prepass is set
+	void BeginPass(int pass, bool prepass = false)
+	{
+		curPass = pass;
+		curPrepass = prepass;
+	}
 
-	~Model()
+	void EndPass()
 	{
-		FreeBuffers();
+		curPass = -1;
+		curPrepass = false;
 	}
 
-	Matrix4f& GetMatrix()
+	DrawCommand& Add(GLuint program, GLuint texture, GLuint vao, GLint matWVPLoc, const Matrix4f& world)
 	{
-		Mat = Matrix4f(Rot);
-		Mat = Matrix4f::Translation(Pos) * Mat;
-		return Mat;
+		Commands.push_back(DrawCommand());
+		DrawCommand& c = Commands.back();
+		c.program = program;
+		c.texture = texture;
+		c.vao = vao;
+		c.matWVPLoc = matWVPLoc;
+		c.primitive = GL_TRIANGLES;
+		c.indexType = 0;
+		c.first = 0;
+		c.count = 0;
+		c.instanceCount = 0;
+		c.pointSize = 1.0f;
+		c.World = world;
+		c.pass = curPass;
+		c.prepass = curPrepass;
+		c.Center = Vector3f(0, 0, 0);
+		c.Radius = -1.0f;
+		return c;
 	}
 
-	void AddVertex(const Vertex& v) { Vertices[numVertices++] = v; }
-	void AddIndex(GLushort a) { Indices[numIndices++] = a; }
+	void AddElements(GLuint program, GLuint texture, GLuint vao, GLint matWVPLoc, const Matrix4f& world, GLenum primitive, GLenum indexType, GLint first, GLsizei count)
+	{
+		DrawCommand& c = Add(program, texture, vao, matWVPLoc, world);
+		c.primitive = primitive;
+		c.indexType = indexType;
+		c.first = first;
+		c.count = count;
+	}
 
-	void AllocateBuffers()
+	// The vertex array carries the per instance attributes; World is applied
+	// to all the instances
+	void AddElementsInstanced(GLuint program, GLuint texture, GLuint vao, GLint matWVPLoc, const Matrix4f& world, GLenum primitive, GLenum indexType, GLint first, GLsizei count, GLsizei instanceCount)
 	{
-		vertexBuffer = new VertexBuffer(&Vertices[0], numVertices * sizeof(Vertices[0]));
-		indexBuffer = new IndexBuffer(&Indices[0], numIndices * sizeof(Indices[0]));
+		AddElements(program, texture, vao, matWVPLoc, world, primitive, indexType, first, count);
+		Commands.back().instanceCount = instanceCount;
 	}
 
-	void FreeBuffers()
+	void AddArrays(GLuint program, GLuint texture, GLuint vao, GLint matWVPLoc, const Matrix4f& world, GLenum primitive, GLint first, GLsizei count, GLfloat pointSize)
 	{
-		delete vertexBuffer; vertexBuffer = nullptr;
-		delete indexBuffer; indexBuffer = nullptr;
+		DrawCommand& c = Add(program, texture, vao, matWVPLoc, world);
+		c.primitive = primitive;
+		c.first = first;
+		c.count = count;
+		c.pointSize = pointSize;
+	}
+
+	// World space bounds of the last command added
+	void SetBounds(Vector3f center, float radius)
+	{
+		Commands.back().Center = center;
+		Commands.back().Radius = radius;
+	}
+
+	unsigned long long SortKey(const DrawCommand& c, const Matrix4f& view) const
+	{
+		unsigned long long layer = 0, bucket = 0;
+		Vector3f p = view.Transform(c.Center);
+		if (c.Radius < 0 || p.Length() < c.Radius)
+			layer = 1;
+		else
+			bucket = (unsigned long long)min(max(-p.z - c.Radius, 0.0f) / DepthBucket, 65535.0f);
+
+		unsigned long long material = ((unsigned long long)(c.program & 0xfff) << 24) |
+			((unsigned long long)(c.texture & 0xfff) << 12) | (c.vao & 0xfff);
+		return (layer << 52) | (bucket << 36) | material;
+	}
+
+	// Sets the replay order for the eye at view
+	void Sort(const Matrix4f& view)
+	{
+		Order.resize(Commands.size());
+		keys.resize(Commands.size());
+		for (size_t i = 0; i < Commands.size(); ++i)
+		{
+			Order[i] = i;
+			keys[i] = SortKey(Commands[i], view);
+		}
+		const vector<unsigned long long>& k = keys;
+		std::stable_sort(Order.begin(), Order.end(), [&k](size_t a, size_t b) { return k[a] < k[b]; });
+	}
+
+	// GL state bound by the commands replayed so far
+	struct ReplayState
+	{
+		GLuint  program, texture, vao;
+		GLfloat pointSize;
+	};
+
+	static void Draw(const DrawCommand& c, const Matrix4f& viewProj, ReplayState& s)
+	{
+		if (c.program != s.program)
+		{
+			glUseProgram(c.program);
+			s.program = c.program;
+		}
+		if (c.texture && c.texture != s.texture)
+		{
+			glBindTexture(GL_TEXTURE_2D, c.texture);
+			s.texture = c.texture;
+		}
+		if (c.vao != s.vao)
+		{
+			glBindVertexArray(c.vao);
+			s.vao = c.vao;
+		}
+		if (c.primitive == GL_POINTS && c.pointSize != s.pointSize)
+		{
+			glPointSize(c.pointSize);
+			s.pointSize = c.pointSize;
+		}
+
+		Matrix4f combined = viewProj * c.World;
+		glUniformMatrix4fv(c.matWVPLoc, 1, GL_TRUE, (FLOAT*)&combined);
+
+		if (c.indexType)
+		{
+			size_t indexSize = (c.indexType == GL_UNSIGNED_INT) ? sizeof(GLuint) : sizeof(GLushort);
+			if (c.instanceCount)
+				glDrawElementsInstanced(c.primitive, c.count, c.indexType, (void*)(c.first * indexSize), c.instanceCount);
+			else
+				glDrawElements(c.primitive, c.count, c.indexType, (void*)(c.first * indexSize));
+		}
+		else
+		{
+			glDrawArrays(c.primitive, c.first, c.count);
+		}
+	}
+
+	// Replays in the order of the last Sort, or in recording order if the list
+	// changed since
+	void Replay(Matrix4f view, Matrix4f proj, GpuProfiler* profiler = nullptr) const
+	{
+		Matrix4f    viewProj = proj * view;
+		ReplayState s = { 0, 0, 0, -1.0f };
+		bool        sorted = Order.size() == Commands.size();
+		bool        prepass = false;
+
+		glActiveTexture(GL_TEXTURE0);
+
+		if (DepthPrepass)
+		{
+			for (size_t i = 0; i < Commands.size() && !prepass; ++i)
+				prepass = Commands[i].prepass;
+		}
+		if (prepass)
+		{
+			if (profiler) profiler->Begin(GpuProfiler::Pass_Prepass);
+			glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+			for (size_t i = 0; i < Commands.size(); ++i)
+			{
+				const DrawCommand& c = Commands[sorted ? Order[i] : i];
+				if (c.prepass)
+					Draw(c, viewProj, s);
+			}
+			glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+			if (profiler) profiler->End(GpuProfiler::Pass_Prepass);
+
+			// The same programs give the same depths, which must pass again
+			glDepthFunc(GL_LEQUAL);
+		}
+
+		// Sorting can split a pass; its time is the sum of the pieces
+		int open = -1;
+		for (size_t i = 0; i < Commands.size(); ++i)
+		{
+			const DrawCommand& c = Commands[sorted ? Order[i] : i];
+			if (profiler && c.pass != open)
+			{
+				if (open >= 0) profiler->End(open);
+				if (c.pass >= 0) profiler->Begin(c.pass);
+				open = c.pass;
+			}
+			Draw(c, viewProj, s);
+		}
+		if (profiler && open >= 0)
+			profiler->End(open);
+
+		if (prepass)
+			glDepthFunc(GL_LESS);
+		glBindVertexArray(0);
+		glUseProgram(0);
+	}
+};
+
+//---------------------------------------------------------------------------
+// Vertex layout of all the meshes of the scene
+
+struct MeshVertex
+{
+	Vector3f  Pos;
+	DWORD     C;
+	float     U, V;
+};
+
+//---------------------------------------------------------------------------
+// Growable vertex and 32 bit index lists the models and the static batches
+// build their buffers from. Released once uploaded.
+
+struct MeshBuilder
+{
+	vector<MeshVertex> Vertices;
+	vector<GLuint>     Indices;
+
+	GLsizei NumIndices() const { return (GLsizei)Indices.size(); }
+
+	void AddVertex(const MeshVertex& v) { Vertices.push_back(v); }
+	void AddIndex(GLuint a) { Indices.push_back(a); }
+
+	// Appends another mesh with its positions transformed by world
+	void Append(const MeshBuilder& m, const Matrix4f& world)
+	{
+		GLuint base = (GLuint)Vertices.size();
+		Vertices.reserve(Vertices.size() + m.Vertices.size());
+		Indices.reserve(Indices.size() + m.Indices.size());
+
+		for (size_t i = 0; i < m.Vertices.size(); ++i)
+		{
+			MeshVertex v = m.Vertices[i];
+			v.Pos = world.Transform(v.Pos);
+			Vertices.push_back(v);
+		}
+		for (size_t i = 0; i < m.Indices.size(); ++i)
+			Indices.push_back(base + m.Indices[i]);
+	}
+
+	void Release()
+	{
+		vector<MeshVertex>().swap(Vertices);
+		vector<GLuint>().swap(Indices);
+	}
+
+	// Sphere around the bounding box of the vertices
+	void Bounds(Vector3f& center, float& radius) const
+	{
+		if (Vertices.empty())
+		{
+			center = Vector3f(0, 0, 0);
+			radius = -1.0f;
+			return;
+		}
+		Vector3f lo = Vertices[0].Pos, hi = Vertices[0].Pos;
+		for (size_t i = 1; i < Vertices.size(); ++i)
+		{
+			const Vector3f& p = Vertices[i].Pos;
+			lo = Vector3f(min(lo.x, p.x), min(lo.y, p.y), min(lo.z, p.z));
+			hi = Vector3f(max(hi.x, p.x), max(hi.y, p.y), max(hi.z, p.z));
+		}
+		center = (lo + hi) * 0.5f;
+		radius = (hi - lo).Length() * 0.5f;
 	}
 
+	// An empty builder (a batch without geometry) gets empty buffers
+	VertexBuffer* CreateVertexBuffer() { return new VertexBuffer(Vertices.empty() ? NULL : &Vertices[0], Vertices.size() * sizeof(MeshVertex)); }
+	IndexBuffer* CreateIndexBuffer() { return new IndexBuffer(Indices.empty() ? NULL : &Indices[0], Indices.size() * sizeof(GLuint)); }
+
 	void AddSolidColorBox(float x1, float y1, float z1, float x2, float y2, float z2, DWORD c)
 	{
 		Vector3f Vert[][2] =
@@ -635,14 +985,15 @@ struct Model
 			21, 20, 22, 22, 20, 23
 		};
 
+		GLuint base = (GLuint)Vertices.size();
 		for (int i = 0; i < sizeof(CubeIndices) / sizeof(CubeIndices[0]); ++i)
-			AddIndex(CubeIndices[i] + GLushort(numVertices));
+			AddIndex(CubeIndices[i] + base);
 
 		// Generate a quad for each box face
 		for (int v = 0; v < 6 * 4; v++)
 		{
 			// Make vertices, with some token lighting
-			Vertex vvv; vvv.Pos = Vert[v][0]; vvv.U = Vert[v][1].x; vvv.V = Vert[v][1].y;
+			MeshVertex vvv; vvv.Pos = Vert[v][0]; vvv.U = Vert[v][1].x; vvv.V = Vert[v][1].y;
 			float dist1 = (vvv.Pos - Vector3f(-2, 4, -2)).Length();
 			float dist2 = (vvv.Pos - Vector3f(3, 4, -3)).Length();
 			float dist3 = (vvv.Pos - Vector3f(-4, 3, 25)).Length();
@@ -658,115 +1009,349 @@ struct Model
 		}
 	}
 
-	void Render(Matrix4f view, Matrix4f proj)
+	void AddSolidSphere(float r)
 	{
-		Matrix4f combined = proj * view * GetMatrix();
-
-		glUseProgram(Fill->program);
-		glUniform1i(glGetUniformLocation(Fill->program, "Texture0"), 0);
-		glUniformMatrix4fv(glGetUniformLocation(Fill->program, "matWVP"), 1, GL_TRUE, (FLOAT*)&combined);
+		int npointsh = 18, npointsv = 18;
 
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, Fill->texture->texId);
+		for (int i = 0; i < npointsh; i++)
+		{
+			for (int j = 0; j <= npointsv; j++)
+			{
+				float phi = i*((2 * 3.1415) / npointsv);
+				float theta = j*(3.1415 / npointsh);
 
-		glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer->buffer);
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer->buffer);
+				MeshVertex v;
+				v.Pos.x = r*cos(phi)*sin(theta);
+				v.Pos.y = r*sin(phi)*sin(theta);
+				v.Pos.z = r*cos(theta);
 
-		GLuint posLoc = glGetAttribLocation(Fill->program, "Position");
-		GLuint colorLoc = glGetAttribLocation(Fill->program, "Color");
-		GLuint uvLoc = glGetAttribLocation(Fill->program, "TexCoord");
+				//v.C = ((v.Pos.x * 255 > 255 ? 255 : DWORD(v.Pos.x * 255)) << 16) +
+				//((v.Pos.y * 255 > 255 ? 255 : DWORD(v.Pos.y * 255)) << 8) +
+				//(v.Pos.z * 255 > 255 ? 255 : DWORD(v.Pos.z * 255));
+				v.C = 0xffffffff;
+				v.U = v.V = 0;
 
-		glEnableVertexAttribArray(posLoc);
-		glEnableVertexAttribArray(colorLoc);
-		glEnableVertexAttribArray(uvLoc);
+				AddVertex(v);
+			}
+		}
 
-		glVertexAttribPointer(posLoc, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)OVR_OFFSETOF(Vertex, Pos));
-		glVertexAttribPointer(colorLoc, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(Vertex), (void*)OVR_OFFSETOF(Vertex, C));
-		glVertexAttribPointer(uvLoc, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)OVR_OFFSETOF(Vertex, U));
+		int x = 1;
+		for (int i = 0; i < npointsv*npointsh + npointsv; i++)
+		{
+			if (i == x*npointsv + (x - 1)){
+				x++;
+				continue;
+			}
 
-		glDrawElements(GL_TRIANGLES, numIndices, GL_UNSIGNED_SHORT, NULL);
+			if (i + npointsv + 1 > npointsv*npointsh + npointsv)
+			{
+				AddIndex(i);
+				AddIndex((i - npointsv*npointsh) + 1);
+				AddIndex(i + 1);
 
-		glDisableVertexAttribArray(posLoc);
-		glDisableVertexAttribArray(colorLoc);
-		glDisableVertexAttribArray(uvLoc);
+				AddIndex(i);
+				AddIndex((i - npointsv*npointsh));
+				AddIndex((i - npointsv*npointsh) + 1);
+			}
+			else
+			{
+				AddIndex(i);
+				AddIndex(i + npointsv + 2);
+				AddIndex(i + 1);
 
-		glBindBuffer(GL_ARRAY_BUFFER, 0);
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+				AddIndex(i);
+				AddIndex(i + npointsv + 1);
+				AddIndex(i + npointsv + 2);
+			}
 
-		glUseProgram(0);
+		}
 	}
 };
 
-//------------------------------------------------------------------------- 
-// This MyDots structure was created to deal with the point cloud data, using 
-// a similar aproach to what is presented in the Model struct, provided by 
-// the original file
+//---------------------------------------------------------------------------
 
-struct MyDots
+struct Model
 {
-	btCollisionShape *sphereShape;
-	btDefaultMotionState *sphereMotionState;
-	btScalar massRigidBody;
-	btVector3 sphereInertia;
-	btRigidBody::btRigidBodyConstructionInfo *sphereRigidBodyCI;
-	btRigidBody *sphereRigidBody;
-	btRigidBody* rigidBodyArray[6 * 25]; //Sphere rigid bodies for each body * joint
-	int bodyTrackedBefore[6];
+	typedef MeshVertex Vertex;
 
-	GLuint vao_position;
-	GLuint vao_joints;
-	GLuint vbo_position;
-	GLuint vbo_joints;
-	ShaderFill    * Fill;
+	Vector3f        Pos;
 	Quatf           Rot;
 	Matrix4f        Mat;
-	Vector3f        Pos;
-	bool mode = false;
-	int* bodyTracked = new int[6];
-	CameraSpacePoint* headPositions = new CameraSpacePoint[6];
-
-	GLfloat* position = new GLfloat[depth_height*depth_width * 3];//NULL;
-	GLubyte* color = new GLubyte[depth_height*depth_width * 3];//NULL;
-	int numPoints = depth_height*depth_width;
-	int pixelCount;
-
-	float* jointsVertices = NULL;
-	RGBQUAD* ColorData = NULL;
-	BYTE* BodyIndexBuffer = NULL;
-	UINT16* DepthBuffer = NULL;
+	MeshBuilder     Mesh;
+	GLsizei         numIndices;
+	ShaderFill    * Fill;
+	VertexBuffer  * vertexBuffer;
+	IndexBuffer   * indexBuffer;
+	GLuint          vao;
 
-	MyDots(Vector3f pos)
+	Model(Vector3f pos, ShaderFill * fill) :
+		numIndices(0),
+		Pos(pos),
+		Rot(),
+		Mat(),
+		Fill(fill),
+		vertexBuffer(nullptr),
+		indexBuffer(nullptr),
+		vao(0)
+	{}
+
+	~Model()
 	{
-		Pos = pos;
+		FreeBuffers();
+	}
 
-		for (int i = 0; i < 6; i++)
+	Matrix4f& GetMatrix()
+	{
+		Mat = Matrix4f(Rot);
+		Mat = Matrix4f::Translation(Pos) * Mat;
+		return Mat;
+	}
+
+	void AddVertex(const Vertex& v) { Mesh.AddVertex(v); }
+	void AddIndex(GLuint a) { Mesh.AddIndex(a); }
+
+	void AllocateBuffers()
+	{
+		numIndices = Mesh.NumIndices();
+		vertexBuffer = Mesh.CreateVertexBuffer();
+		indexBuffer = Mesh.CreateIndexBuffer();
+		vao = CreateVertexArray(Fill->program, vertexBuffer->buffer, indexBuffer->buffer, sizeof(Vertex),
+			"Position", OVR_OFFSETOF(Vertex, Pos),
+			"Color", 4, GL_UNSIGNED_BYTE, OVR_OFFSETOF(Vertex, C),
+			"TexCoord", OVR_OFFSETOF(Vertex, U));
+		Mesh.Release();
+	}
+
+	void FreeBuffers()
+	{
+		delete vertexBuffer; vertexBuffer = nullptr;
+		delete indexBuffer; indexBuffer = nullptr;
+		if (vao)
+		{
+			glDeleteVertexArrays(1, &vao);
+			vao = 0;
+		}
+	}
+
+	void AddSolidColorBox(float x1, float y1, float z1, float x2, float y2, float z2, DWORD c)
+	{
+		Mesh.AddSolidColorBox(x1, y1, z1, x2, y2, z2, c);
+	}
+
+	void Record(DrawCommandList& list)
+	{
+		list.AddElements(Fill->program, Fill->texture->texId, vao, Fill->matWVPLoc,
+			GetMatrix(), GL_TRIANGLES, GL_UNSIGNED_INT, 0, numIndices);
+	}
+};
+
+//---------------------------------------------------------------------------
+// Merges the immovable models into one vertex and index buffer per material,
+// with their transforms baked in, so that every material costs one draw
+
+struct StaticBatcher
+{
+	struct Batch
+	{
+		ShaderFill   * Fill;
+		MeshBuilder    Mesh;
+		VertexBuffer * vertexBuffer;
+		IndexBuffer  * indexBuffer;
+		GLuint         vao;
+		GLsizei        numIndices;
+		Vector3f       center;
+		float          radius;
+	};
+
+	vector<Batch*> Batches;
+
+	~StaticBatcher()
+	{
+		for (size_t i = 0; i < Batches.size(); ++i)
 		{
-			rigidBodyArray[i] = 0;
+			delete Batches[i]->vertexBuffer;
+			delete Batches[i]->indexBuffer;
+			if (Batches[i]->vao)
+				glDeleteVertexArrays(1, &Batches[i]->vao);
+			delete Batches[i];
 		}
+	}
 
-		/*float radio = 0.01;
-		sphereShape = new btSphereShape(radio);
-		sphereMotionState = new btDefaultMotionState(btTransform(btQuaternion(0, 0, 0, 1), btVector3(0, 0, 0)));
-		float massRigidBody = 0.1;
-		sphereInertia = btVector3(0, 0, 0);
-		sphereShape->calculateLocalInertia(massRigidBody, sphereInertia);
-		sphereRigidBodyCI = new btRigidBody::btRigidBodyConstructionInfo(massRigidBody, sphereMotionState, sphereShape, sphereInertia);*/
+	// Takes the geometry of a model whose buffers have not been allocated
+	void Add(Model* m)
+	{
+		Batch* batch = nullptr;
+		for (size_t i = 0; i < Batches.size() && !batch; ++i)
+		{
+			if (Batches[i]->Fill == m->Fill && !Batches[i]->vao)
+				batch = Batches[i];
+		}
+		if (!batch)
+		{
+			batch = new Batch();
+			batch->Fill = m->Fill;
+			batch->vertexBuffer = nullptr;
+			batch->indexBuffer = nullptr;
+			batch->vao = 0;
+			batch->numIndices = 0;
+			Batches.push_back(batch);
+		}
 
-		for (int i = 0; i < 6 * 25; i++)
+		batch->Mesh.Append(m->Mesh, m->GetMatrix());
+		m->Mesh.Release();
+	}
+
+	// Uploads the batches added since the last Build
+	void Build()
+	{
+		for (size_t i = 0; i < Batches.size(); ++i)
+		{
+			Batch* b = Batches[i];
+			if (b->vao)
+				continue;
+
+			b->numIndices = b->Mesh.NumIndices();
+			b->Mesh.Bounds(b->center, b->radius);
+			b->vertexBuffer = b->Mesh.CreateVertexBuffer();
+			b->indexBuffer = b->Mesh.CreateIndexBuffer();
+			b->vao = CreateVertexArray(b->Fill->program, b->vertexBuffer->buffer, b->indexBuffer->buffer, sizeof(MeshVertex),
+				"Position", OVR_OFFSETOF(MeshVertex, Pos),
+				"Color", 4, GL_UNSIGNED_BYTE, OVR_OFFSETOF(MeshVertex, C),
+				"TexCoord", OVR_OFFSETOF(MeshVertex, U));
+			b->Mesh.Release();
+		}
+	}
+
+	void Record(DrawCommandList& list)
+	{
+		for (size_t i = 0; i < Batches.size(); ++i)
 		{
-			float radio = 0.01;
-			sphereShape = new btSphereShape(radio);
-			sphereMotionState = new btDefaultMotionState(btTransform(btQuaternion(0, 0, 0, 1), btVector3(0, 0, 0)));
-			float massRigidBody = 0.1;
-			sphereInertia = btVector3(0, 0, 0);
-			sphereShape->calculateLocalInertia(massRigidBody, sphereInertia);
-			sphereRigidBodyCI = new btRigidBody::btRigidBodyConstructionInfo(massRigidBody, sphereMotionState, sphereShape, sphereInertia);
-			sphereRigidBody = new btRigidBody(*sphereRigidBodyCI);
-			sphereRigidBody->setRestitution(btScalar(0.1));
-			sphereRigidBody->setFriction(btScalar(2));
-			sphereRigidBody->setCollisionFlags(sphereRigidBody->getCollisionFlags() | btCollisionObject::CF_KINEMATIC_OBJECT);
-			sphereRigidBody->setActivationState(DISABLE_DEACTIVATION);
-			rigidBodyArray[i] = sphereRigidBody;
+			Batch* b = Batches[i];
+			if (b->vao)
+			{
+				list.AddElements(b->Fill->program, b->Fill->texture->texId, b->vao, b->Fill->matWVPLoc,
+					Matrix4f(), GL_TRIANGLES, GL_UNSIGNED_INT, 0, b->numIndices);
+				list.SetBounds(b->center, b->radius);
+			}
+		}
+	}
+};
+
+//------------------------------------------------------------------------- 
+// This MyDots structure was created to deal with the point cloud data, using 
+// a similar aproach to what is presented in the Model struct, provided by 
+// the original file
+
+struct MyDots
+{
+	BoneCapsules* capsules[BODY_COUNT]; // Collider of each body, sized on this thread, posed on the physics thread
+	int   MeasureStep = 4;               // Only every MeasureStep-th row and column of the depth frame size the capsules
+	vector<float> measurePoints[BODY_COUNT];
+	PhysicsThread::JointTargets jointTargets;
+
+	// How the point cloud is drawn: raw points, round splats, splats
+	// oriented by the surface normal, raw points rasterized in compute
+	// shaders (falls back to raw points without OpenGL 4.3), triangles
+	// between the neighbouring pixels of the depth frame, or the mesh of the
+	// volume the frames are fused into. The avatar mode draws a captured
+	// mesh skinned by the skeleton instead, and builds no cloud at all.
+	enum RenderMode { Render_Points, Render_Splats, Render_OrientedSplats, Render_ComputePoints, Render_Surface, Render_Volume, Render_Avatar };
+
+	GLuint vao_position;
+	GLuint vao_joints;
+	GLuint vao_splats;
+	GLuint vbo_position;
+	GLuint vbo_joints;
+	GLuint vbo_normals;
+	GLuint vbo_velocity;
+	GLint  extrapolationLoc;
+	ShaderFill    * Fill;
+	PointSplatter * Splatter;
+	PullPushFiller* Filler;
+	ComputePointRasterizer* Rasterizer;
+	GridSurface   * Surface;
+	TsdfVolume    * Volume = nullptr; // Created on the first fused frame
+	BlockMesher   * Mesher = nullptr;
+	MeshDecimator * Decimator = nullptr; // Created when the surface is first decimated
+	TileMotion    * Motion;
+	PointChunks   * Chunks;
+	Quatf           Rot;
+	Matrix4f        Mat;
+	Vector3f        Pos;
+	bool mode = false;
+	RenderMode renderMode = Render_Points;
+	bool fillHoles = false; // Fill the holes between raw points in screen space
+	int rowStep = 2; // Only every rowStep-th row and colStep-th column of the depth frame are used
+	int colStep = 1;
+	bool extrapolate = true; // Move the points to the predicted display time along their velocity
+	float extrapolation = 0; // Seconds the points are moved in the current frame
+	bool fuse = false; // Fuse the depth frames into Volume, always done to draw its mesh
+	bool volumeFull = false;
+	bool meshFull = false;
+	bool decimate = false; // Draw the surface simplified to DecimateBudget triangles, as the worker delivers it
+	int  DecimateBudget = 20000;
+	SimpleMesh  decimatorInput, decimated;
+	vector<int> meshRemap; // Grid node to mesh vertex, for gridMesh
+	SkinnedAvatar* Avatar = nullptr;      // Created on the first capture
+	GridSurface  * CaptureGrid = nullptr; // Never drawn, so never initialized
+	bool captureRequested = false;
+	bool bodyHulls = false; // Decompose the tracked bodies into convex hulls, their colliders and culling bounds
+	int  HullStep = 2;      // Only every HullStep-th row and column of the depth frame go into the hulls
+	BodyHulls* Hulls = nullptr; // Created when the hulls are first enabled
+	vector<BodyHulls::Cloud> hullClouds;
+	vector<BodyHulls::Set>   hullSets; // Latest hulls, one set per body that has them
+	btRigidBody*     hullBody[BODY_COUNT]; // Kinematic, in the world while its body has hulls
+	btCompoundShape* hullShape[BODY_COUNT]; // Physics thread side
+	bool             hullInWorld[BODY_COUNT];
+	SnapshotExporter* Exporter = nullptr; // Created on the first snapshot
+	bool   exportRequested = false;  // Write a snapshot of the next sensor frame
+	bool   exportContinuous = false; // Write snapshots at ExportRate
+	float  ExportRate = 5.0f;        // Snapshots per second
+	double nextExport = 0;
+	bool   record = false;            // Write the sensor frames to recording_<n>.pcf, see FrameRecording.h
+	int    recordings = 0;
+	FrameRecording* Recording = nullptr; // Open while recording
+	LatestJobWorker<FrameRecording::Frame, int> recordWorker; // Writes the frames
+	FrameRecording::Frame recordBuffer;
+	GLuint  vao_lod, vbo_lod[2], ibo_lod;
+	GLsizei lodIndices = 0;
+	TsdfVolume::Intrinsics depthIntrinsics;
+	vector<UINT16>       fusionDepth;  // Depth frame with the pixels left out of the volume zeroed
+	vector<unsigned int> fusionColors; // RGBA color of every depth pixel
+	int* bodyTracked = new int[6];
+	CameraSpacePoint* headPositions = new CameraSpacePoint[6];
+
+	// Every chunk of the depth frame has room for all of its pixels
+	enum { pointCapacity = ((depth_width + PointChunks::ChunkWidth - 1) / PointChunks::ChunkWidth) *
+		((depth_height + PointChunks::ChunkHeight - 1) / PointChunks::ChunkHeight) * PointChunks::ChunkSize };
+
+	GLfloat* position = new GLfloat[pointCapacity * 6];
+	GLfloat* normals = new GLfloat[pointCapacity * 3];
+	GLfloat* velocities = new GLfloat[pointCapacity * 3];
+	GLubyte* color = new GLubyte[depth_height*depth_width * 3];//NULL;
+	int numPoints = depth_height*depth_width;
+	int pixelCount = 0;
+
+	// Camera and color space coordinates of every pixel of the depth frame
+	CameraSpacePoint* cameraGrid = new CameraSpacePoint[depth_height*depth_width];
+	ColorSpacePoint* colorGrid = new ColorSpacePoint[depth_height*depth_width];
+
+	float* jointsVertices = NULL;
+	RGBQUAD* ColorData = NULL;
+	BYTE* BodyIndexBuffer = NULL;
+	UINT16* DepthBuffer = NULL;
+
+	MyDots(Vector3f pos)
+	{
+		Pos = pos;
+
+		for (int i = 0; i < 6; i++)
+		{
+			capsules[i] = new BoneCapsules();
+			bodyTracked[i] = 0;
+			hullShape[i] = 0;
+			hullBody[i] = 0;
+			hullInWorld[i] = false;
 		}
 
 		glGenVertexArrays(1, &vao_joints);
@@ -787,11 +1372,13 @@ struct MyDots
 		static const GLchar* VertexShaderSrc =
 			"#version 150\n"
 			"uniform mat4 matWVP;\n"
+			"uniform float extrapolation;\n"
 			"in vec4 position;\n"
 			"in vec3 color;"
+			"in vec3 velocity;\n"
 			"out vec3 fragmentColor;"
 			"void main(){\n"
-			"   gl_Position = (matWVP * position);\n"
+			"   gl_Position = (matWVP * vec4(position.xyz + velocity * extrapolation, 1.0));\n"
 			"	fragmentColor = color;"
 			"}";
 
@@ -804,9 +1391,6 @@ struct MyDots
 			"	out_color = vec4(fragmentColor, 1.0);\n"
 			"}";
 
-		GLuint vshader = createShader(VertexShaderSrc, GL_VERTEX_SHADER);
-		GLuint fshader = createShader(FragmentShaderSrc, GL_FRAGMENT_SHADER);
-
 		///*************
 		//ShaderFill * grid_material;
 
@@ -820,7 +1404,68 @@ struct MyDots
 		}
 		TextureBuffer * generated_texture = new TextureBuffer(nullptr, false, false, Sizei(256, 256), 4, (unsigned char *)tex_pixels, 1);
 
-		Fill = new ShaderFill(vshader, fshader, generated_texture);
+		Fill = new ShaderFill(VertexShaderSrc, FragmentShaderSrc, generated_texture);
+
+		// Both buffers hold interleaved position (xyz) and color (rgb) floats
+		GLint position_attribute = glGetAttribLocation(Fill->program, "position");
+		GLint color_attribute = glGetAttribLocation(Fill->program, "color");
+
+		GLuint vaos[2] = { vao_position, vao_joints };
+		GLuint vbos[2] = { vbo_position, vbo_joints };
+		for (int k = 0; k < 2; k++)
+		{
+			glBindVertexArray(vaos[k]);
+			glBindBuffer(GL_ARRAY_BUFFER, vbos[k]);
+			glEnableVertexAttribArray(position_attribute);
+			glEnableVertexAttribArray(color_attribute);
+			glVertexAttribPointer(position_attribute, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(GLfloat), 0);
+			glVertexAttribPointer(color_attribute, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(GLfloat), (void*)(3 * sizeof(GLfloat)));
+		}
+
+		// Per point velocities, shared by the raw points, the splats and the
+		// hole filling. Zeroed so that unused velocities never move anything.
+		Motion = new TileMotion(depth_width, depth_height);
+		Chunks = new PointChunks(depth_width, depth_height);
+		extrapolationLoc = glGetUniformLocation(Fill->program, "extrapolation");
+		vector<GLfloat> zeros(pointCapacity * 3, 0.0f);
+		glGenBuffers(1, &vbo_velocity);
+		glBindBuffer(GL_ARRAY_BUFFER, vbo_velocity);
+		glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat) * pointCapacity * 3, &zeros[0], GL_STREAM_DRAW);
+
+		GLint velocity_attribute = glGetAttribLocation(Fill->program, "velocity");
+		glBindVertexArray(vao_position);
+		glEnableVertexAttribArray(velocity_attribute);
+		glVertexAttribPointer(velocity_attribute, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(GLfloat), 0);
+
+		// The surface is drawn with the same program, from its own buffers
+		Surface = new GridSurface(depth_focal_length);
+		Surface->Init(position_attribute, color_attribute, velocity_attribute);
+
+		// The splats and the hole filling read the same points plus a separate
+		// normal buffer, which is only filled for oriented splats
+		Splatter = new PointSplatter();
+		Filler = new PullPushFiller();
+		Rasterizer = new ComputePointRasterizer();
+		if (!Rasterizer->Supported())
+			cout << "No OpenGL 4.3, compute rasterized points fall back to GL_POINTS" << endl;
+		glGenBuffers(1, &vbo_normals);
+		glGenVertexArrays(1, &vao_splats);
+		glBindVertexArray(vao_splats);
+		glBindBuffer(GL_ARRAY_BUFFER, vbo_position);
+		glEnableVertexAttribArray(PointSplatter::PositionAttrib);
+		glEnableVertexAttribArray(PointSplatter::ColorAttrib);
+		glVertexAttribPointer(PointSplatter::PositionAttrib, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(GLfloat), 0);
+		glVertexAttribPointer(PointSplatter::ColorAttrib, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(GLfloat), (void*)(3 * sizeof(GLfloat)));
+		glBindBuffer(GL_ARRAY_BUFFER, vbo_normals);
+		glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat) * pointCapacity * 3, NULL, GL_STREAM_DRAW);
+		glEnableVertexAttribArray(PointSplatter::NormalAttrib);
+		glVertexAttribPointer(PointSplatter::NormalAttrib, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(GLfloat), 0);
+		glBindBuffer(GL_ARRAY_BUFFER, vbo_velocity);
+		glEnableVertexAttribArray(PointSplatter::VelocityAttrib);
+		glVertexAttribPointer(PointSplatter::VelocityAttrib, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(GLfloat), 0);
+
+		glBindVertexArray(0);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
 	}
 
 	Matrix4f& GetMatrix()
@@ -830,592 +1475,1032 @@ struct MyDots
 		return Mat;
 	}
 
-	void display(Matrix4f view, Matrix4f proj)
+	// Hands the latest skeletons and bone radii to the physics thread. A
+	// body no longer tracked starts again from the default radii.
+	void updateJoints()
 	{
-		Matrix4f combined = proj * view * GetMatrix();
-
-		//Preparing body vertices to DrawArrays
-		glBindVertexArray(vao_position);
-		glBindBuffer(GL_ARRAY_BUFFER, vbo_position);
+		if (!jointsVertices) return;
 
-		glUseProgram(Fill->program);
-		glUniformMatrix4fv(glGetUniformLocation(Fill->program, "matWVP"), 1, GL_TRUE, (FLOAT*)&combined);
+		for (int i = 0; i < BODY_COUNT; i++)
+		{
+			jointTargets.tracked[i] = bodyTracked[i];
+			for (int j = 0; j < JointType_Count; j++)
+			{
+				for (int k = 0; k < 3; k++)
+					jointTargets.joints[(JointType_Count * i + j) * 3 + k] = jointsVertices[(JointType_Count * i + j) * 6 + k];
+			}
+			if (bodyTracked[i] != 1)
+				capsules[i]->Reset();
+			for (int b = 0; b < BoneCapsules::BoneCount; b++)
+				jointTargets.radii[BoneCapsules::BoneCount * i + b] = capsules[i]->radius[b];
+		}
+		physics->PushJoints(jointTargets);
+	}
 
-		GLint position_attribute = glGetAttribLocation(Fill->program, "position");
-		GLuint color_attribute = glGetAttribLocation(Fill->program, "color");
+	// Lays the bone capsules of every tracked body along targets and
+	// adds/removes them from the world as bodies come and go; a body whose
+	// hulls are in the world does without its capsules. Runs on the physics
+	// thread.
+	void applyJoints(const PhysicsThread::JointTargets& targets)
+	{
+		for (int i = 0; i < BODY_COUNT; i++)
+		{
+			BoneCapsules* c = capsules[i];
+			if (targets.tracked[i] == 1 && !hullInWorld[i])
+			{
+				c->Pose(&targets.joints[JointType_Count * i * 3], 3, &targets.radii[BoneCapsules::BoneCount * i]);
+				if (!c->inWorld)
+				{
+					dynamicsWorld->addRigidBody(c->body);
+					c->inWorld = true;
+				}
+			}
+			else if (c->inWorld)
+			{
+				dynamicsWorld->removeRigidBody(c->body);
+				c->inWorld = false;
+			}
+		}
+	}
 
-		glEnableVertexAttribArray(position_attribute);
-		glEnableVertexAttribArray(color_attribute);
+	// Sizes the bone capsules of every tracked body from its points, every
+	// MeasureStep-th row and column of the depth frame
+	void measureBodies()
+	{
+		if (!BodyIndexBuffer || !jointsVertices)
+			return;
 
-		//glVertexAttribPointer(position_attribute, 3, GL_FLOAT, GL_FALSE, 0, 0);
-		glVertexAttribPointer(position_attribute, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(GLfloat), 0);
-		glVertexAttribPointer(color_attribute, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(GLfloat), (void*)(3 * sizeof(GLfloat)));
+		for (int i = 0; i < BODY_COUNT; i++)
+			measurePoints[i].clear();
+		for (int i = 0; i < depth_height; i += MeasureStep)
+		{
+			for (int j = 0; j < depth_width; j += MeasureStep)
+			{
+				int k = i * depth_width + j;
+				if (BodyIndexBuffer[k] >= BODY_COUNT || bodyTracked[BodyIndexBuffer[k]] != 1 || !(cameraGrid[k].Z > 0))
+					continue;
+				vector<float>& points = measurePoints[BodyIndexBuffer[k]];
+				points.push_back(cameraGrid[k].X);
+				points.push_back(cameraGrid[k].Y);
+				points.push_back(cameraGrid[k].Z);
+			}
+		}
+		for (int i = 0; i < BODY_COUNT; i++)
+		{
+			if (measurePoints[i].empty())
+				continue;
+			capsules[i]->Measure(&jointsVertices[JointType_Count * i * 6], 6, &measurePoints[i][0], (int)(measurePoints[i].size() / 3));
+		}
+	}
 
-		//GLint color_attribute = glGetAttribLocation(Fill->program, "color");
-		//glVertexAttribPointer(color_attribute, 3, GL_FLOAT, GL_TRUE, 0, 0);
-		//glEnableVertexAttribArray(color_attribute);
+	// Records the joints of every tracked body. The point cloud is culled for
+	// every eye, so it is not recorded but drawn by RenderSurface.
+	void Record(DrawCommandList& list)
+	{
+		GetMatrix();
 
-		glClear(GL_COLOR_BUFFER_BIT);
+		for (int i = 0; i < BODY_COUNT; i++)
+		{
+			if (bodyTracked[i] != 1 || !jointsVertices)
+				continue;
+			list.AddArrays(Fill->program, 0, vao_joints, Fill->matWVPLoc, Mat, GL_POINTS, 25 * i, 25, 10.0f);
 
-		glBindVertexArray(vao_position);
-		glEnable(GL_POINT_SMOOTH);
-		glPointSize(1);
-		glDrawArrays(GL_POINTS, 0, numPoints);
+			// Bounds of the joints of the body, in world space
+			const float* joint = &jointsVertices[JointType_Count * i * 6];
+			Vector3f lo = Mat.Transform(Vector3f(joint[0], joint[1], joint[2])), hi = lo;
+			for (int j = 1; j < 25; j++)
+			{
+				Vector3f p = Mat.Transform(Vector3f(joint[j * 6], joint[j * 6 + 1], joint[j * 6 + 2]));
+				lo = Vector3f(min(lo.x, p.x), min(lo.y, p.y), min(lo.z, p.z));
+				hi = Vector3f(max(hi.x, p.x), max(hi.y, p.y), max(hi.z, p.z));
+			}
+			list.SetBounds((lo + hi) * 0.5f, (hi - lo).Length() * 0.5f + 0.05f);
+		}
+	}
 
-		for (int i = 0; i < BODY_COUNT; i++)
+	// Draws the chunks of the point cloud in the eye frustum, after the rest
+	// of the scene
+	void RenderSurface(Matrix4f view, Matrix4f proj)
+	{
+		if (renderMode == Render_Surface)
 		{
-			if (bodyTracked[i] == 1)
+			Matrix4f worldViewProj = proj * view * Mat;
+			glUseProgram(Fill->program);
+			glUniformMatrix4fv(Fill->matWVPLoc, 1, GL_TRUE, (FLOAT*)&worldViewProj);
+			if (decimate && lodIndices)
 			{
-				glBindVertexArray(vao_joints);
-				glBindBuffer(GL_ARRAY_BUFFER, vbo_joints);
+				GLboolean cull = glIsEnabled(GL_CULL_FACE);
+				glDisable(GL_CULL_FACE);
+				glBindVertexArray(vao_lod);
+				glDrawElements(GL_TRIANGLES, lodIndices, GL_UNSIGNED_INT, 0);
+				glBindVertexArray(0);
+				if (cull)
+					glEnable(GL_CULL_FACE);
+			}
+			else
+				Surface->Draw();
+			return;
+		}
+		if (renderMode == Render_Avatar)
+		{
+			if (!Avatar || Avatar->Body < 0 || bodyTracked[Avatar->Body] != 1)
+				return;
+			const BodyHulls::Set* set = hullSet(Avatar->Body);
+			if (!set || BodyHulls::Visible(*set, proj * view * Mat))
+				Avatar->Draw(proj * view * Mat);
+			return;
+		}
+		if (renderMode == Render_Volume)
+		{
+			if (!Mesher)
+				return;
+			Matrix4f worldViewProj = proj * view * Mat;
+			glUseProgram(Fill->program);
+			glUniformMatrix4fv(Fill->matWVPLoc, 1, GL_TRUE, (FLOAT*)&worldViewProj);
+			Mesher->Draw();
+			return;
+		}
+
+		// Points can move up to the extrapolation reach and splats cover a few centimetres around them
+		Chunks->Cull(proj * view * Mat, Motion->MaxSpeed * extrapolation + 0.05f);
+		if (!Chunks->AnyVisible())
+			return;
 
-				glUseProgram(Fill->program);
-				glUniformMatrix4fv(glGetUniformLocation(Fill->program, "matWVP"), 1, GL_TRUE, (FLOAT*)&combined);
+		if (renderMode == Render_ComputePoints && Rasterizer->Supported())
+		{
+			Rasterizer->Render(vbo_position, vbo_velocity, *Chunks, proj * view * Mat, extrapolation);
+		}
+		else if (renderMode == Render_Splats || renderMode == Render_OrientedSplats)
+		{
+			Splatter->Render(vao_splats, *Chunks, Mat, view, proj,
+				max(rowStep, colStep) / depth_focal_length, renderMode == Render_OrientedSplats, extrapolation);
+		}
+		else if (fillHoles)
+		{
+			GpuProfiler::Get().Begin(GpuProfiler::Pass_HoleFill);
+			Filler->Render(vao_splats, *Chunks, Mat, view, proj, extrapolation);
+			GpuProfiler::Get().End(GpuProfiler::Pass_HoleFill);
+		}
+		else
+		{
+			Matrix4f worldViewProj = proj * view * Mat;
+			glUseProgram(Fill->program);
+			glUniformMatrix4fv(Fill->matWVPLoc, 1, GL_TRUE, (FLOAT*)&worldViewProj);
+			glPointSize(1.0f);
+			glBindVertexArray(vao_position);
+			Chunks->Draw(GL_POINTS);
+			glBindVertexArray(0);
+		}
+	}
 
-				GLint position_attribute = glGetAttribLocation(Fill->program, "position");
-				GLuint color_attribute = glGetAttribLocation(Fill->program, "color");
+	// Sets how far the points are moved along their velocity for a frame
+	// shown at displayTime
+	void setDisplayTime(double displayTime)
+	{
+		extrapolation = extrapolate ? Motion->Extrapolation(displayTime) : 0.0f;
+		glUseProgram(Fill->program);
+		glUniform1f(extrapolationLoc, extrapolation);
+		glUseProgram(0);
+	}
 
-				glEnableVertexAttribArray(position_attribute);
-				glEnableVertexAttribArray(color_attribute);
+	// Normal of the depth pixel (i, j) from its neighbours on the grid, facing
+	// the sensor. Falls back to the direction of the sensor across depth jumps.
+	void gridNormal(int i, int j, GLfloat* n)
+	{
+		int k = i * depth_width + j;
+		int di = (i + 1 < depth_height) ? depth_width : -depth_width;
+		int dj = (j + 1 < depth_width) ? 1 : -1;
+		const CameraSpacePoint& p = cameraGrid[k];
+		const CameraSpacePoint& a = cameraGrid[k + dj];
+		const CameraSpacePoint& b = cameraGrid[k + di];
+
+		Vector3f v(p.X, p.Y, p.Z);
+		Vector3f normal = -v;
+		if (a.Z > 0 && b.Z > 0 && fabs(a.Z - p.Z) < 0.05f && fabs(b.Z - p.Z) < 0.05f)
+		{
+			Vector3f c = (Vector3f(a.X, a.Y, a.Z) - v).Cross(Vector3f(b.X, b.Y, b.Z) - v);
+			if (c.LengthSq() > 0)
+				normal = (c.Dot(v) > 0) ? -c : c;
+		}
+		normal.Normalize();
 
-				//glVertexAttribPointer(position_attribute, 3, GL_FLOAT, GL_FALSE, 0, 0);
-				glVertexAttribPointer(position_attribute, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), 0);
-				glVertexAttribPointer(color_attribute, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)(3 * sizeof(float)));
+		n[0] = normal.x;
+		n[1] = normal.y;
+		n[2] = normal.z;
+	}
 
-				glBindVertexArray(vao_joints);
-				glEnable(GL_POINT_SMOOTH);
-				glPointSize(10);
-				glDrawArrays(GL_POINTS, 25 * i, 25);
+	// Packs the valid points of the depth frame into the chunks and uploads them
+	void updateChunks(bool withNormals, bool withVelocity)
+	{
+		pixelCount = 0;
 
-				if (bodyTrackedBefore[i] == 0)
+		// Every chunk is packed at the start of its own slice of the buffers,
+		// then the chunks are moved together, so no counter is shared between threads
+		#pragma omp parallel for schedule(dynamic)
+		for (int c = 0; c < Chunks->numChunks; c++)
+		{
+			GLfloat* chunkPosition = position + c * PointChunks::ChunkSize * 6;
+			GLfloat* chunkNormals = normals + c * PointChunks::ChunkSize * 3;
+			GLfloat* chunkVelocities = velocities + c * PointChunks::ChunkSize * 3;
+			Vector3f boundsMin(FLT_MAX, FLT_MAX, FLT_MAX), boundsMax(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+			int count = 0;
+
+			// Rows and columns stay on the rowStep/colStep grid of the whole frame
+			int y0 = Chunks->FirstRow(c), x0 = Chunks->FirstColumn(c);
+			int y1 = min(y0 + (int)PointChunks::ChunkHeight, depth_height), x1 = min(x0 + (int)PointChunks::ChunkWidth, depth_width);
+			for (int i = (y0 + rowStep - 1) / rowStep * rowStep; i < y1; i += rowStep)
+			{
+				for (int j = (x0 + colStep - 1) / colStep * colStep; j < x1; j += colStep)
 				{
-					for (int j = 0; j < 25; j++)
+					int k = i * depth_width + j;
+					if (mode && BodyIndexBuffer[k] == 0xff)
+						continue;
+
+					int colorX = static_cast<int>(std::floor(colorGrid[k].X + 0.5f));
+					int colorY = static_cast<int>(std::floor(colorGrid[k].Y + 0.5f));
+
+					if ((0 <= colorX) && (colorX < color_width) && (0 <= colorY) && (colorY < color_height))
 					{
-						dynamicsWorld->addRigidBody(rigidBodyArray[j + 25 * i]);
-						//rigidBodyArray[j + 25 * 6 * i]->setCollisionFlags(point->getRigidBody()->getCollisionFlags() | btCollisionObject::CF_NO_CONTACT_RESPONSE);
-					}
-				}
+						RGBQUAD colorRGB = ColorData[colorY * color_width + colorX];
+						chunkPosition[count * 6] = cameraGrid[k].X;
+						chunkPosition[count * 6 + 1] = cameraGrid[k].Y;
+						chunkPosition[count * 6 + 2] = cameraGrid[k].Z;
 
+						chunkPosition[count * 6 + 3] = static_cast<float>(colorRGB.rgbRed) / 255;
+						chunkPosition[count * 6 + 4] = static_cast<float>(colorRGB.rgbGreen) / 255;
+						chunkPosition[count * 6 + 5] = static_cast<float>(colorRGB.rgbBlue) / 255;
 
-				btTransform trans;
-				for (int j = 0; j < 25; j++)
-				{
-					float x = jointsVertices[((j * 6) + 0) + JointType_Count*i * 6];
-					float y = jointsVertices[((j * 6) + 1) + JointType_Count*i * 6];
-					float z = jointsVertices[((j * 6) + 2) + JointType_Count*i * 6];
+						Vector3f p(cameraGrid[k].X, cameraGrid[k].Y, cameraGrid[k].Z);
+						boundsMin = Vector3f(min(boundsMin.x, p.x), min(boundsMin.y, p.y), min(boundsMin.z, p.z));
+						boundsMax = Vector3f(max(boundsMax.x, p.x), max(boundsMax.y, p.y), max(boundsMax.z, p.z));
 
-					rigidBodyArray[j + 25 * i]->getMotionState()->getWorldTransform(trans);
-					trans.setOrigin(btVector3(x, y, z));
-					rigidBodyArray[j + 25 * i]->getMotionState()->setWorldTransform(trans);
-				}
+						if (withNormals)
+							gridNormal(i, j, chunkNormals + count * 3);
 
-				bodyTrackedBefore[i] = 1;
-			}
-			else
-			{
-				if (bodyTrackedBefore[i] == 1)
-				{
-					for (int j = 0; j < 25; j++)
-					{
-						dynamicsWorld->removeRigidBody(rigidBodyArray[j + 25 * i]);
+						if (withVelocity)
+						{
+							// Only the bodies move, the rest of the room stays still
+							Vector3f v = (BodyIndexBuffer[k] != 0xff) ? Motion->Velocity(i, j) : Vector3f(0, 0, 0);
+							chunkVelocities[count * 3] = v.x;
+							chunkVelocities[count * 3 + 1] = v.y;
+							chunkVelocities[count * 3 + 2] = v.z;
+						}
+
+						count++;
 					}
 				}
+			}
+			Chunks->count[c] = count;
+			Chunks->boundsMin[c] = boundsMin;
+			Chunks->boundsMax[c] = boundsMax;
+		}
 
-				bodyTrackedBefore[i] = 0;
+		for (int c = 0; c < Chunks->numChunks; c++)
+		{
+			int slice = c * PointChunks::ChunkSize;
+			int count = Chunks->count[c];
+			if (pixelCount != slice)
+			{
+				memmove(position + pixelCount * 6, position + slice * 6, count * 6 * sizeof(GLfloat));
+				if (withNormals)
+					memmove(normals + pixelCount * 3, normals + slice * 3, count * 3 * sizeof(GLfloat));
+				if (withVelocity)
+					memmove(velocities + pixelCount * 3, velocities + slice * 3, count * 3 * sizeof(GLfloat));
 			}
+			Chunks->first[c] = pixelCount;
+			pixelCount += count;
 		}
 
-		glDisableVertexAttribArray(position_attribute);
-		glDisableVertexAttribArray(color_attribute);
-		glUseProgram(0);
+		// Orphan the buffers and upload only the valid points
+		glBindBuffer(GL_ARRAY_BUFFER, vbo_position);
+		glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat) * pointCapacity * 6, NULL, GL_STREAM_DRAW);
+		glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(GLfloat) * pixelCount * 6, position);
+
+		if (withNormals)
+		{
+			glBindBuffer(GL_ARRAY_BUFFER, vbo_normals);
+			glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat) * pointCapacity * 3, NULL, GL_STREAM_DRAW);
+			glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(GLfloat) * pixelCount * 3, normals);
+		}
+
+		if (withVelocity)
+		{
+			glBindBuffer(GL_ARRAY_BUFFER, vbo_velocity);
+			glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat) * pointCapacity * 3, NULL, GL_STREAM_DRAW);
+			glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(GLfloat) * pixelCount * 3, velocities);
+		}
 	}
 
-	GLuint createShader(const GLchar* src, GLenum shaderType)
+	// Rebuilds the triangle surface from the depth frame mapped into
+	// cameraGrid and colorGrid, and uploads it
+	void updateSurface(bool withVelocity)
 	{
-		GLuint shader = glCreateShader(shaderType);
-		glShaderSource(shader, 1, &src, NULL);
-		glCompileShader(shader);
+		Surface->Resize(depth_width, depth_height, rowStep, colStep);
+		fillGrid(*Surface, -1, withVelocity);
+		Surface->Update();
+		Surface->Upload();
+		if (decimate)
+			submitDecimation();
+	}
 
-		//Check compilation
-		GLint test;
-		glGetShaderiv(shader, GL_COMPILE_STATUS, &test);
-		if (!test)
+	// Writes the nodes of grid from cameraGrid and colorGrid; only the pixels
+	// of body are valid, or with body -1 those the mode keeps
+	void fillGrid(GridSurface& grid, int body, bool withVelocity)
+	{
+		#pragma omp parallel for schedule(dynamic)
+		for (int r = 0; r < grid.rows; r++)
 		{
-			GLchar msg[1024];
-			glGetShaderInfoLog(shader, sizeof(msg), 0, msg);
-			if (msg[0]) {
-				cout << "Shader compilation failed! : " << msg << endl;
+			int i = r * grid.rowStep;
+			for (int c = 0; c < grid.cols; c++)
+			{
+				int j = c * grid.colStep;
+				int k = i * depth_width + j;
+				float& z = grid.depth[r * grid.cols + c];
+				z = 0;
+				if (body >= 0 ? BodyIndexBuffer[k] != body : (mode && BodyIndexBuffer[k] == 0xff))
+					continue;
+
+				// Pixels without depth map to -infinity
+				if (!(cameraGrid[k].Z > 0))
+					continue;
+				int colorX = static_cast<int>(std::floor(colorGrid[k].X + 0.5f));
+				int colorY = static_cast<int>(std::floor(colorGrid[k].Y + 0.5f));
+				if (colorX < 0 || colorX >= color_width || colorY < 0 || colorY >= color_height)
+					continue;
+
+				RGBQUAD colorRGB = ColorData[colorY * color_width + colorX];
+				Vector3f v = (withVelocity && BodyIndexBuffer[k] != 0xff) ? Motion->Velocity(i, j) : Vector3f(0, 0, 0);
+				GLfloat* vertex = grid.Vertex(r, c);
+				vertex[0] = cameraGrid[k].X;
+				vertex[1] = cameraGrid[k].Y;
+				vertex[2] = cameraGrid[k].Z;
+				vertex[3] = static_cast<float>(colorRGB.rgbRed) / 255;
+				vertex[4] = static_cast<float>(colorRGB.rgbGreen) / 255;
+				vertex[5] = static_cast<float>(colorRGB.rgbBlue) / 255;
+				vertex[6] = v.x;
+				vertex[7] = v.y;
+				vertex[8] = v.z;
+				z = cameraGrid[k].Z;
 			}
 		}
 
-		return shader;
 	}
 
-	GLuint createProgram(const char* vertexShaderSrc, const char* fragmentShaderSrc)
+	// Indexed mesh of the valid faces of grid, with only the vertices they use
+	void gridMesh(const GridSurface& grid, SimpleMesh& mesh)
 	{
-		GLuint vertexShader = createShader(vertexShaderSrc, GL_VERTEX_SHADER);
-		GLuint fragmentShader = createShader(fragmentShaderSrc, GL_FRAGMENT_SHADER);
+		mesh.Clear();
+		meshRemap.assign(grid.rows * grid.cols, -1);
+		for (GLsizei i = 0; i < grid.numIndices; i++)
+		{
+			if (!grid.faceValid[i / 3])
+				continue;
+			int& r = meshRemap[grid.indices[i]];
+			if (r < 0)
+			{
+				r = (int)(mesh.positions.size() / 3);
+				const GLfloat* v = &grid.current[grid.indices[i] * GridSurface::VertexFloats];
+				mesh.positions.insert(mesh.positions.end(), v, v + 3);
+				mesh.colors.insert(mesh.colors.end(), v + 3, v + 6);
+			}
+			mesh.indices.push_back(r);
+		}
+	}
 
-		GLuint shaderProgram = glCreateProgram();
-		glAttachShader(shaderProgram, vertexShader);
-		glAttachShader(shaderProgram, fragmentShader);
+	// Captures the first tracked body as a mesh and binds it to its joints
+	void captureAvatar()
+	{
+		captureRequested = false;
+		if (!BodyIndexBuffer || !jointsVertices)
+			return;
+		int body = 0;
+		while (body < BODY_COUNT && bodyTracked[body] != 1)
+			body++;
+		if (body == BODY_COUNT)
+		{
+			cout << "No tracked body to capture" << endl;
+			return;
+		}
 
-		glDeleteShader(vertexShader);
-		glDeleteShader(fragmentShader);
+		if (!CaptureGrid)
+			CaptureGrid = new GridSurface(depth_focal_length);
+		CaptureGrid->Resize(depth_width, depth_height, 2, 2);
+		fillGrid(*CaptureGrid, body, false);
+		CaptureGrid->Update();
+		SimpleMesh mesh;
+		gridMesh(*CaptureGrid, mesh);
+
+		if (!Avatar)
+			Avatar = new SkinnedAvatar();
+		Avatar->Bind(mesh, &jointsVertices[JointType_Count * body * 6], body);
+		cout << "Captured an avatar of " << mesh.NumTriangles() << " triangles from body " << body << endl;
+	}
 
-		glLinkProgram(shaderProgram);
-		glUseProgram(shaderProgram);
+	// Hands the kept triangles of the surface to the decimator, unless it is
+	// still busy with an earlier frame
+	void submitDecimation()
+	{
+		if (!Decimator)
+		{
+			Decimator = new MeshDecimator();
+			glGenVertexArrays(1, &vao_lod);
+			glGenBuffers(2, vbo_lod);
+			glGenBuffers(1, &ibo_lod);
+			GLint locs[2] = { glGetAttribLocation(Fill->program, "position"), glGetAttribLocation(Fill->program, "color") };
+			glBindVertexArray(vao_lod);
+			for (int a = 0; a < 2; a++)
+			{
+				glBindBuffer(GL_ARRAY_BUFFER, vbo_lod[a]);
+				glEnableVertexAttribArray(locs[a]);
+				glVertexAttribPointer(locs[a], 3, GL_FLOAT, GL_FALSE, 3 * sizeof(GLfloat), 0);
+			}
+			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo_lod);
+			glBindVertexArray(0);
+			glBindBuffer(GL_ARRAY_BUFFER, 0);
+			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+		}
+		if (Decimator->Pending())
+			return;
 
-		return shaderProgram;
+		gridMesh(*Surface, decimatorInput);
+		Decimator->Submit(decimatorInput, DecimateBudget);
 	}
 
-	void updatePoints()
+	// Uploads the latest simplified surface, if the decimator has a new one
+	void uploadDecimated()
 	{
-		kinect->GetColorDepthAndBody(ColorData, BodyIndexBuffer, DepthBuffer, jointsVertices, bodyTracked, headPositions);
-		pixelCount = 0;
+		if (!Decimator || !Decimator->Take(decimated))
+			return;
+		glBindBuffer(GL_ARRAY_BUFFER, vbo_lod[0]);
+		glBufferData(GL_ARRAY_BUFFER, decimated.positions.size() * sizeof(float), decimated.positions.empty() ? NULL : &decimated.positions[0], GL_STREAM_DRAW);
+		glBindBuffer(GL_ARRAY_BUFFER, vbo_lod[1]);
+		glBufferData(GL_ARRAY_BUFFER, decimated.colors.size() * sizeof(float), decimated.colors.empty() ? NULL : &decimated.colors[0], GL_STREAM_DRAW);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo_lod);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, decimated.indices.size() * sizeof(GLuint), decimated.indices.empty() ? NULL : &decimated.indices[0], GL_STREAM_DRAW);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+		lodIndices = (GLsizei)decimated.indices.size();
+	}
 
-		if (DepthBuffer != NULL)
-		{
-			delete[] position;
-			position = new GLfloat[(depth_height*depth_width * 3 * 2)];
+	// Hands the points of every tracked body to the hull builder, unless it
+	// is still busy with an earlier frame
+	void submitHulls()
+	{
+		if (!Hulls)
+			Hulls = new BodyHulls();
+		if (Hulls->Pending() || !BodyIndexBuffer || !jointsVertices)
+			return;
 
-			#pragma omp parallel for schedule(dynamic)
-			for (int i = 0; i < depth_height; i += 2)
+		int cloudOf[BODY_COUNT];
+		size_t numClouds = 0;
+		for (int i = 0; i < BODY_COUNT; i++)
+		{
+			cloudOf[i] = -1;
+			if (bodyTracked[i] != 1)
+				continue;
+			if (hullClouds.size() <= numClouds)
+				hullClouds.resize(numClouds + 1);
+			BodyHulls::Cloud& cloud = hullClouds[numClouds];
+			cloud.body = i;
+			cloud.points.clear();
+			for (int j = 0; j < JointType_Count; j++)
 			{
-				for (int j = 0; j < depth_width; j += 1)
-				{
-					if (mode && bodyTracked)
-					{
-						if (BodyIndexBuffer[i * depth_width + j] != 0xff)
-						{
-							DepthSpacePoint depthSpacePoint = { static_cast<float>(j), static_cast<float>(i) };
-							UINT16 depth = DepthBuffer[i * depth_width + j];
-							ColorSpacePoint colorSpacePoint = { 0.0f, 0.0f };
-							kinect->m_pCoordinateMapper->MapDepthPointToColorSpace(depthSpacePoint, depth, &colorSpacePoint);
-							int colorX = static_cast<int>(std::floor(colorSpacePoint.X + 0.5f));
-							int colorY = static_cast<int>(std::floor(colorSpacePoint.Y + 0.5f));
-
-							if ((0 <= colorX) && (colorX < color_width) && (0 <= colorY) && (colorY < color_height))
-							{
-								RGBQUAD colorRGB = ColorData[colorY * color_width + colorX];
-								CameraSpacePoint cameraSpacePoint = { 0.0f, 0.0f, 0.0f };
-								kinect->m_pCoordinateMapper->MapDepthPointToCameraSpace(depthSpacePoint, depth, &cameraSpacePoint);
-								position[pixelCount * 6] = cameraSpacePoint.X;
-								position[pixelCount * 6 + 1] = cameraSpacePoint.Y;
-								position[pixelCount * 6 + 2] = cameraSpacePoint.Z;
-
-								position[pixelCount * 6 + 3] = static_cast<float>(colorRGB.rgbRed) / 255;
-								position[pixelCount * 6 + 4] = static_cast<float>(colorRGB.rgbGreen) / 255;
-								position[pixelCount * 6 + 5] = static_cast<float>(colorRGB.rgbBlue) / 255;
-
-								pixelCount++;
-							}
-						}
-					}
-					else
-					{
-						DepthSpacePoint depthSpacePoint = { static_cast<float>(j), static_cast<float>(i) };
-						UINT16 depth = DepthBuffer[i * depth_width + j];
-						ColorSpacePoint colorSpacePoint = { 0.0f, 0.0f };
-						kinect->m_pCoordinateMapper->MapDepthPointToColorSpace(depthSpacePoint, depth, &colorSpacePoint);
-						int colorX = static_cast<int>(std::floor(colorSpacePoint.X + 0.5f));
-						int colorY = static_cast<int>(std::floor(colorSpacePoint.Y + 0.5f));
-
-						if ((0 <= colorX) && (colorX < color_width) && (0 <= colorY) && (colorY < color_height))
-						{
-							RGBQUAD colorRGB = ColorData[colorY * color_width + colorX];
-							CameraSpacePoint cameraSpacePoint = { 0.0f, 0.0f, 0.0f };
-							kinect->m_pCoordinateMapper->MapDepthPointToCameraSpace(depthSpacePoint, depth, &cameraSpacePoint);
-							position[pixelCount * 6] = cameraSpacePoint.X;
-							position[pixelCount * 6 + 1] = cameraSpacePoint.Y;
-							position[pixelCount * 6 + 2] = cameraSpacePoint.Z;
-
-							position[pixelCount * 6 + 3] = static_cast<float>(colorRGB.rgbRed) / 255;
-							position[pixelCount * 6 + 4] = static_cast<float>(colorRGB.rgbGreen) / 255;
-							position[pixelCount * 6 + 5] = static_cast<float>(colorRGB.rgbBlue) / 255;
-
-							pixelCount++;
-						}
-					}
-				}
+				for (int k = 0; k < 3; k++)
+					cloud.joints[j * 3 + k] = jointsVertices[(JointType_Count * i + j) * 6 + k];
 			}
+			cloudOf[i] = (int)numClouds++;
+		}
+		hullClouds.resize(numClouds);
 
-			glBindVertexArray(vao_position);
-			glBindBuffer(GL_ARRAY_BUFFER, vbo_position);
-			glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat)*depth_height*depth_width * 3 * 2, position, GL_STATIC_DRAW);
-
-			glBindVertexArray(vao_joints);
-			glBindBuffer(GL_ARRAY_BUFFER, vbo_joints);
-			glBufferData(GL_ARRAY_BUFFER, sizeof(float)* JointType_Count * BODY_COUNT * 3 * 2, jointsVertices, GL_STATIC_DRAW);
-
+		for (int i = 0; i < depth_height; i += HullStep)
+		{
+			for (int j = 0; j < depth_width; j += HullStep)
+			{
+				int k = i * depth_width + j;
+				if (BodyIndexBuffer[k] >= BODY_COUNT || cloudOf[BodyIndexBuffer[k]] < 0 || !(cameraGrid[k].Z > 0))
+					continue;
+				vector<float>& points = hullClouds[cloudOf[BodyIndexBuffer[k]]].points;
+				points.push_back(cameraGrid[k].X);
+				points.push_back(cameraGrid[k].Y);
+				points.push_back(cameraGrid[k].Z);
+			}
 		}
+		Hulls->Submit(hullClouds);
 	}
-};
-//--------------------------------------------------------------------------
-// this boxModel was created to implement a box object that handles the 
-// graphics generation and the physical simulation with the Bullet Engine
 
-struct boxModel
-{
-	struct Vertex
+	// Latest hulls of body, NULL if it has none
+	const BodyHulls::Set* hullSet(int body) const
 	{
-		Vector3f  Pos;
-		DWORD     C;
-		float     U, V;
-	};
-
-	btCollisionShape *boxShape;
-	btDefaultMotionState *boxMotionState;
-	btScalar massRigidBody;
-	btVector3 boxInertia;
-	btRigidBody::btRigidBodyConstructionInfo *boxRigidBodyCI;
-	btRigidBody *boxRigidBody;
-
-	Vector3f        Pos;
-	Quatf           Rot;
-	Matrix4f        Mat;
-	int             numVertices, numIndices;
-	Vertex          Vertices[2000]; // Note fixed maximum
-	GLushort        Indices[2000];
-	ShaderFill    * Fill;
-	VertexBuffer  * vertexBuffer;
-	IndexBuffer   * indexBuffer;
+		for (size_t s = 0; s < hullSets.size(); s++)
+		{
+			if (hullSets[s].body == body)
+				return &hullSets[s];
+		}
+		return NULL;
+	}
 
-	boxModel(Vector3f pos, ShaderFill * fill) :
-		numVertices(0),
-		numIndices(0),
-		Pos(pos),
-		Rot(),
-		Mat(),
-		Fill(fill),
-		vertexBuffer(nullptr),
-		indexBuffer(nullptr)
-	{}
+	// Takes the latest hulls from the builder, or drops them all once the
+	// hulls are off, and has the physics thread swap the colliders of the
+	// bodies to them
+	void updateHulls()
+	{
+		if (bodyHulls)
+		{
+			if (!Hulls || !Hulls->Take(hullSets))
+				return;
+		}
+		else if (hullSets.empty())
+			return;
+		else
+			hullSets.clear();
 
-	~boxModel()
-	{
-		FreeBuffers();
+		for (int i = 0; i < BODY_COUNT; i++)
+		{
+			const BodyHulls::Set* set = hullSet(i);
+			btCompoundShape* shape = (set && bodyTracked[i] == 1) ? BodyHulls::Shape(*set, 0.01f) : NULL;
+			if (shape && !hullBody[i])
+			{
+				btRigidBody::btRigidBodyConstructionInfo info(0, new btDefaultMotionState(), shape);
+				hullBody[i] = new btRigidBody(info);
+				hullBody[i]->setRestitution(btScalar(0.1));
+				hullBody[i]->setFriction(btScalar(2));
+				hullBody[i]->setCollisionFlags(hullBody[i]->getCollisionFlags() | btCollisionObject::CF_KINEMATIC_OBJECT);
+				hullBody[i]->setActivationState(DISABLE_DEACTIVATION);
+			}
+			physics->Post([this, i, shape]() { setHullShape(i, shape); });
+		}
 	}
 
-	Matrix4f& GetMatrix()
+	// Gives body its new hulls, or takes its collider out of the world
+	// without them. Runs on the physics thread.
+	void setHullShape(int body, btCompoundShape* shape)
 	{
-		Mat = Matrix4f(Rot);
-		Mat = Matrix4f::Translation(Pos) * Mat;
-		return Mat;
+		if (hullInWorld[body])
+		{
+			dynamicsWorld->removeRigidBody(hullBody[body]);
+			hullInWorld[body] = false;
+		}
+		if (!shape)
+			return;
+		hullBody[body]->setCollisionShape(shape);
+		if (hullShape[body] && hullShape[body] != shape)
+			BodyHulls::DeleteShape(hullShape[body]);
+		hullShape[body] = shape;
+		dynamicsWorld->addRigidBody(hullBody[body]);
+		hullInWorld[body] = true;
 	}
 
-	void AddVertex(const Vertex& v) { Vertices[numVertices++] = v; }
-	void AddIndex(GLushort a) { Indices[numIndices++] = a; }
+	// Hands the points or the surface just built to the exporter when a
+	// snapshot is due. Nothing is copied but the valid faces: the point
+	// buffer and the node vertices are swapped with those of the snapshot,
+	// and the next frame rewrites them all
+	void exportSnapshot()
+	{
+		double now = ovr_GetTimeInSeconds();
+		bool due = exportContinuous && now >= nextExport;
+		if (!exportRequested && !due)
+			return;
+		exportRequested = false;
+		if (due)
+			nextExport = max(nextExport + 1.0 / ExportRate, now);
+
+		bool points = (renderMode == Render_Points || renderMode == Render_Splats ||
+			renderMode == Render_OrientedSplats || renderMode == Render_ComputePoints);
+		if (!points && renderMode != Render_Surface)
+			return;
+		if (!Exporter)
+			Exporter = new SnapshotExporter(pointCapacity, 3);
+		CloudSnapshot* s = Exporter->Acquire();
+		if (!s)
+			return;
+
+		s->time = now;
+		if (points)
+		{
+			s->kind = CloudSnapshot::Kind_Points;
+			std::swap(position, s->points);
+			s->numPoints = pixelCount;
+		}
+		else
+		{
+			s->kind = CloudSnapshot::Kind_Grid;
+			if (s->gridVertices.size() != Surface->vertices.size())
+				s->gridVertices.resize(Surface->vertices.size());
+			std::swap(Surface->vertices, s->gridVertices);
+			s->faceValid = Surface->faceValid;
+			s->cols = Surface->cols;
+			s->stride = GridSurface::VertexFloats;
+		}
+		Exporter->Submit(s);
+	}
 
-	void AllocateBuffers()
+	// Pinhole model of the depth camera, as the sensor knows it; approximate
+	// if it does not
+	TsdfVolume::Intrinsics DepthIntrinsics() const
 	{
-		vertexBuffer = new VertexBuffer(&Vertices[0], numVertices * sizeof(Vertices[0]));
-		indexBuffer = new IndexBuffer(&Indices[0], numIndices * sizeof(Indices[0]));
+		return sensor->DepthIntrinsics(NominalIntrinsics());
 	}
 
-	void FreeBuffers()
+	static TsdfVolume::Intrinsics NominalIntrinsics()
 	{
-		delete vertexBuffer; vertexBuffer = nullptr;
-		delete indexBuffer; indexBuffer = nullptr;
+		TsdfVolume::Intrinsics intr = { depth_width, depth_height, depth_focal_length, -depth_focal_length, depth_width / 2.0f, depth_height / 2.0f };
+		return intr;
 	}
 
-	void setupBulletRigidBody(float x1, float y1, float z1, float x2, float y2, float z2)
+	// RGBA color of every pixel of the depth frame, 0 where it has no depth
+	// or falls outside of the color frame
+	void depthColors(unsigned int* colors) const
 	{
-		btVector3 halfExtents;
-		halfExtents.setX(x2);
-		halfExtents.setY(y2);
-		halfExtents.setZ(z2);
-		//halfExtents.setX(0.1);
-		//halfExtents.setY(0.1);
-		//halfExtents.setZ(0.1);
-		boxShape = new btBoxShape(halfExtents);
-		boxMotionState = new btDefaultMotionState(btTransform(btQuaternion(0, 0, 0, 1), btVector3(Pos.x, Pos.y, Pos.z)));
-		float massRigidBody = 1;
-		boxInertia = btVector3(0, 0, 0);
-		boxShape->calculateLocalInertia(massRigidBody, boxInertia);
-		boxRigidBodyCI = new btRigidBody::btRigidBodyConstructionInfo(massRigidBody, boxMotionState, boxShape, boxInertia);
-		boxRigidBody = new btRigidBody(*boxRigidBodyCI);
-		boxRigidBody->setRestitution(btScalar(0.7));
-		boxRigidBody->setFriction(btScalar(0.9));
-		dynamicsWorld->addRigidBody(boxRigidBody);
+		const int frameSize = depth_width * depth_height;
+		#pragma omp parallel for
+		for (int k = 0; k < frameSize; k++)
+		{
+			colors[k] = 0;
+			if (!(cameraGrid[k].Z > 0))
+				continue;
+			int colorX = static_cast<int>(std::floor(colorGrid[k].X + 0.5f));
+			int colorY = static_cast<int>(std::floor(colorGrid[k].Y + 0.5f));
+			if (colorX < 0 || colorX >= color_width || colorY < 0 || colorY >= color_height)
+				continue;
+			RGBQUAD colorRGB = ColorData[colorY * color_width + colorX];
+			colors[k] = colorRGB.rgbRed | (colorRGB.rgbGreen << 8) | (colorRGB.rgbBlue << 16) | 0xff000000u;
+		}
 	}
 
-	void AddSolidColorBox(float x1, float y1, float z1, float x2, float y2, float z2, DWORD c)
+	// Opens or closes the recording when record changes
+	void updateRecording()
 	{
-		Vector3f Vert[][2] =
+		if (record == (Recording != nullptr))
+			return;
+		if (!record)
 		{
-			Vector3f(x1, y2, z1), Vector3f(z1, x1), Vector3f(x2, y2, z1), Vector3f(z1, x2),
-			Vector3f(x2, y2, z2), Vector3f(z2, x2), Vector3f(x1, y2, z2), Vector3f(z2, x1),
-			Vector3f(x1, y1, z1), Vector3f(z1, x1), Vector3f(x2, y1, z1), Vector3f(z1, x2),
-			Vector3f(x2, y1, z2), Vector3f(z2, x2), Vector3f(x1, y1, z2), Vector3f(z2, x1),
-			Vector3f(x1, y1, z2), Vector3f(z2, y1), Vector3f(x1, y1, z1), Vector3f(z1, y1),
-			Vector3f(x1, y2, z1), Vector3f(z1, y2), Vector3f(x1, y2, z2), Vector3f(z2, y2),
-			Vector3f(x2, y1, z2), Vector3f(z2, y1), Vector3f(x2, y1, z1), Vector3f(z1, y1),
-			Vector3f(x2, y2, z1), Vector3f(z1, y2), Vector3f(x2, y2, z2), Vector3f(z2, y2),
-			Vector3f(x1, y1, z1), Vector3f(x1, y1), Vector3f(x2, y1, z1), Vector3f(x2, y1),
-			Vector3f(x2, y2, z1), Vector3f(x2, y2), Vector3f(x1, y2, z1), Vector3f(x1, y2),
-			Vector3f(x1, y1, z2), Vector3f(x1, y1), Vector3f(x2, y1, z2), Vector3f(x2, y1),
-			Vector3f(x2, y2, z2), Vector3f(x2, y2), Vector3f(x1, y2, z2), Vector3f(x1, y2)
-		};
+			recordWorker.Stop();
+			cout << "Recorded " << Recording->frames << " frames" << endl;
+			Recording->Close();
+			delete Recording;
+			Recording = nullptr;
+			return;
+		}
 
-		GLushort CubeIndices[] =
+		ostringstream path;
+		path << "recording_" << recordings++ << ".pcf";
+		Recording = new FrameRecording();
+		if (!Recording->Create(path.str(), DepthIntrinsics()))
 		{
-			0, 1, 3, 3, 1, 2,
-			5, 4, 6, 6, 4, 7,
-			8, 9, 11, 11, 9, 10,
-			13, 12, 14, 14, 12, 15,
-			16, 17, 19, 19, 17, 18,
-			21, 20, 22, 22, 20, 23
+			cout << "Could not create " << path.str() << endl;
+			delete Recording;
+			Recording = nullptr;
+			record = false;
+			return;
+		}
+		FrameRecording* recording = Recording;
+		recordWorker.Process = [recording](FrameRecording::Frame& frame, int& written)
+		{
+			recording->Write(frame);
+			written = recording->frames;
 		};
+		cout << "Recording to " << path.str() << endl;
+	}
 
-		for (int i = 0; i < sizeof(CubeIndices) / sizeof(CubeIndices[0]); ++i)
-			AddIndex(CubeIndices[i] + GLushort(numVertices));
-
-		// Generate a quad for each box face
-		for (int v = 0; v < 6 * 4; v++)
+	// Hands the sensor frame to the recording thread, stamped with time. A
+	// frame that arrives while the previous one is still waiting replaces
+	// it, so a slow disk drops frames rather than stalling the renderer.
+	void recordSensorFrame(double time)
+	{
+		if (!Recording)
+			return;
+		const int frameSize = depth_width * depth_height;
+		recordBuffer.Resize(frameSize);
+		recordBuffer.time = time;
+		memcpy(&recordBuffer.depth[0], DepthBuffer, frameSize * sizeof(UINT16));
+		if (BodyIndexBuffer)
+			memcpy(&recordBuffer.bodyIndex[0], BodyIndexBuffer, frameSize);
+		else
+			memset(&recordBuffer.bodyIndex[0], 0xff, frameSize);
+		depthColors(&recordBuffer.colors[0]);
+		for (int body = 0; body < BODY_COUNT; body++)
 		{
-			// Make vertices, with some token lighting
-			Vertex vvv; vvv.Pos = Vert[v][0]; vvv.U = Vert[v][1].x; vvv.V = Vert[v][1].y;
-			float dist1 = (vvv.Pos - Vector3f(-2, 4, -2)).Length();
-			float dist2 = (vvv.Pos - Vector3f(3, 4, -3)).Length();
-			float dist3 = (vvv.Pos - Vector3f(-4, 3, 25)).Length();
-			int   bri = rand() % 160;
-			float B = ((c >> 16) & 0xff) * (bri + 192.0f * (0.65f + 8 / dist1 + 1 / dist2 + 4 / dist3)) / 255.0f;
-			float G = ((c >> 8) & 0xff) * (bri + 192.0f * (0.65f + 8 / dist1 + 1 / dist2 + 4 / dist3)) / 255.0f;
-			float R = ((c >> 0) & 0xff) * (bri + 192.0f * (0.65f + 8 / dist1 + 1 / dist2 + 4 / dist3)) / 255.0f;
-			vvv.C = (c & 0xff000000) +
-				((R > 255 ? 255 : DWORD(R)) << 16) +
-				((G > 255 ? 255 : DWORD(G)) << 8) +
-				(B > 255 ? 255 : DWORD(B));
-			AddVertex(vvv);
+			recordBuffer.tracked[body] = bodyTracked[body];
+			for (int j = 0; j < JointType_Count; j++)
+			{
+				for (int c = 0; c < 3; c++)
+					recordBuffer.joints[(body * JointType_Count + j) * 3 + c] = jointsVertices ? jointsVertices[(body * JointType_Count + j) * 6 + c] : 0;
+			}
 		}
-
-		setupBulletRigidBody(x1, y1, z1, x2, y2, z2);
+		recordWorker.Submit(recordBuffer);
 	}
 
-	void Render(Matrix4f view, Matrix4f proj)
+	// Fuses the depth frame into the volume, which stays in the camera space
+	// of the sensor like the points, and meshes the blocks that changed
+	void updateVolume()
 	{
-		Matrix4f combined = proj * view * GetMatrix();
-
-		glUseProgram(Fill->program);
-		glUniform1i(glGetUniformLocation(Fill->program, "Texture0"), 0);
-		glUniformMatrix4fv(glGetUniformLocation(Fill->program, "matWVP"), 1, GL_TRUE, (FLOAT*)&combined);
-
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, Fill->texture->texId);
+		const int frameSize = depth_width * depth_height;
+		if (!Volume)
+		{
+			Volume = new TsdfVolume(8192, 0.02f);
+			Mesher = new BlockMesher();
+			Mesher->Init(glGetAttribLocation(Fill->program, "position"), glGetAttribLocation(Fill->program, "color"), 1 << 20);
+			depthIntrinsics = DepthIntrinsics();
+			fusionDepth.resize(frameSize);
+			fusionColors.resize(frameSize);
+		}
 
-		glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer->buffer);
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer->buffer);
+		depthColors(&fusionColors[0]);
+		#pragma omp parallel for
+		for (int k = 0; k < frameSize; k++)
+			fusionDepth[k] = (mode && BodyIndexBuffer && BodyIndexBuffer[k] == 0xff) ? 0 : DepthBuffer[k];
 
-		GLuint posLoc = glGetAttribLocation(Fill->program, "Position");
-		GLuint colorLoc = glGetAttribLocation(Fill->program, "Color");
-		GLuint uvLoc = glGetAttribLocation(Fill->program, "TexCoord");
+		Volume->Integrate(&fusionDepth[0], &fusionColors[0], depthIntrinsics, NULL);
+		if (Volume->full && !volumeFull)
+			cout << "Fusion volume full, " << Volume->NumBlocks() << " blocks" << endl;
+		volumeFull = Volume->full;
 
-		glEnableVertexAttribArray(posLoc);
-		glEnableVertexAttribArray(colorLoc);
-		glEnableVertexAttribArray(uvLoc);
+		Mesher->Update(*Volume);
+		if (Mesher->full && !meshFull)
+			cout << "Fusion mesh buffer full, " << Mesher->numVertices << " vertices" << endl;
+		meshFull = Mesher->full;
+	}
 
-		glVertexAttribPointer(posLoc, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)OVR_OFFSETOF(Vertex, Pos));
-		glVertexAttribPointer(colorLoc, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(Vertex), (void*)OVR_OFFSETOF(Vertex, C));
-		glVertexAttribPointer(uvLoc, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)OVR_OFFSETOF(Vertex, U));
+	// Rebuilds the points when the sensor has a new frame; the HMD runs faster
+	// than the sensor, so most frames keep the points of the previous one.
+	// A new frame is stamped with displayTime, that of the frame it is first
+	// shown in, so that the extrapolation to the display times of the next
+	// frames is measured on the clock they come from, the fake HMD's in
+	// headless runs.
+	void updatePoints(double displayTime)
+	{
+		uploadDecimated();
+		updateHulls();
+		updateRecording();
 
-		glDrawElements(GL_TRIANGLES, numIndices, GL_UNSIGNED_SHORT, NULL);
+		HRESULT hr = sensor->GetColorDepthAndBody(ColorData, BodyIndexBuffer, DepthBuffer, jointsVertices, bodyTracked, headPositions);
+		if (FAILED(hr))
+			return;
 
-		glDisableVertexAttribArray(posLoc);
-		glDisableVertexAttribArray(colorLoc);
-		glDisableVertexAttribArray(uvLoc);
+		if (DepthBuffer != NULL)
+		{
+			// The avatar alone needs the joints only
+			if (renderMode != Render_Avatar || captureRequested || fuse || bodyHulls || Recording)
+			{
+				sensor->MapDepthFrame(DepthBuffer, cameraGrid, colorGrid);
+
+				bool withNormals = (renderMode == Render_OrientedSplats);
+				bool withVelocity = (BodyIndexBuffer != NULL);
+				if (withVelocity)
+					Motion->Update(cameraGrid, BodyIndexBuffer, displayTime);
+
+				GpuProfiler::Get().CpuBegin(GpuProfiler::Stage_CloudBuild);
+				if (captureRequested)
+					captureAvatar();
+				if (renderMode == Render_Surface)
+					updateSurface(withVelocity);
+				else if (renderMode != Render_Volume && renderMode != Render_Avatar)
+					updateChunks(withNormals, withVelocity);
+				if (fuse || renderMode == Render_Volume)
+					updateVolume();
+				if (bodyHulls)
+					submitHulls();
+				measureBodies();
+				GpuProfiler::Get().CpuEnd(GpuProfiler::Stage_CloudBuild);
+				exportSnapshot();
+				recordSensorFrame(displayTime);
+			}
 
-		glBindBuffer(GL_ARRAY_BUFFER, 0);
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+			glBindVertexArray(vao_joints);
+			glBindBuffer(GL_ARRAY_BUFFER, vbo_joints);
+			glBufferData(GL_ARRAY_BUFFER, sizeof(float)* JointType_Count * BODY_COUNT * 3 * 2, jointsVertices, GL_STATIC_DRAW);
 
-		glUseProgram(0);
+			// The avatar follows the joints of the body it was captured from
+			if (Avatar && Avatar->Body >= 0 && jointsVertices && bodyTracked[Avatar->Body] == 1)
+				Avatar->Pose(&jointsVertices[JointType_Count * Avatar->Body * 6]);
+		}
 	}
 };
 
 //---------------------------------------------------------------------------
+// Renders every dynamic physics prop of one shape with a single instanced
+// draw. Each shape has one unit mesh, scaled per instance, and the world
+// matrices and colors of the instances are read from the Bullet motion
+// states into a stream buffer once per frame.
 
-// this SphereModel was created to implement a sphere object that handles the 
-// graphics generation and the physical simulation with the Bullet Engine
-
-struct SphereModel
+struct PropRenderer
 {
-	struct Vertex
+	enum PropShape { Prop_Box, Prop_Sphere, Prop_ShapeCount };
+
+	// Per instance attributes, the world matrix is column major
+	struct PropInstance
 	{
-		Vector3f  Pos;
-		DWORD     C;
-		float     U, V;
+		float World[16];
+		DWORD C;
 	};
 
-	//Bullet simulation Objects
-	btCollisionShape *sphereShape;
-	btDefaultMotionState *sphereMotionState;
-	btScalar massRigidBody;
-	btVector3 sphereInertia;
-	btRigidBody::btRigidBodyConstructionInfo *sphereRigidBodyCI;
-	btRigidBody *sphereRigidBody;
+	struct Prop
+	{
+		btCollisionShape     * shape;
+		btDefaultMotionState * motionState;
+		btRigidBody          * body;
+		int                    slot;  // Of its transform in the physics snapshots
+		Vector3f               scale;
+		DWORD                  C;
+	};
 
-	Vector3f        Pos;
-	Quatf           Rot;
-	Matrix4f        Mat;
-	int             numVertices, numIndices;
-	Vertex          Vertices[2000]; // Note fixed maximum
-	GLushort        Indices[2000];
-	ShaderFill    * Fill;
-	VertexBuffer  * vertexBuffer;
-	IndexBuffer   * indexBuffer;
-	float radio;
+	struct ShapeBatch
+	{
+		VertexBuffer       * vertexBuffer;
+		IndexBuffer        * indexBuffer;
+		GLuint               vao;
+		GLsizei              numIndices;
+		GLuint               instanceBuffer;
+		size_t               instanceCapacity;
+		vector<Prop>         props;
+		vector<PropInstance> instances;
+		Vector3f             center;   // Bounds of all the instances
+		float                radius;
+	};
 
+	ShaderFill * Fill;
+	GLuint       texture;
+	ShapeBatch   shapes[Prop_ShapeCount];
+	vector<PhysicsThread::BodyState> states;
 
-	SphereModel(Vector3f pos, ShaderFill * fill) :
-		numVertices(0),
-		numIndices(0),
-		Pos(pos),
-		Rot(),
-		Mat(),
+	// fill must use the instance attributes, see Scene::Init. Takes ownership of it.
+	PropRenderer(ShaderFill* fill, GLuint texture) :
 		Fill(fill),
-		vertexBuffer(nullptr),
-		indexBuffer(nullptr)
-	{}
-
-	~SphereModel()
+		texture(texture)
 	{
-		FreeBuffers();
+		MeshBuilder box, sphere;
+		box.AddSolidColorBox(-1, -1, -1, 1, 1, 1, 0xffffffff);
+		sphere.AddSolidSphere(1);
+		CreateShape(shapes[Prop_Box], box);
+		CreateShape(shapes[Prop_Sphere], sphere);
 	}
 
-	Matrix4f& GetMatrix()
+	~PropRenderer()
 	{
-		Mat = Matrix4f(Rot);
-		Mat = Matrix4f::Translation(Pos) * Mat;
-		return Mat;
+		for (int s = 0; s < Prop_ShapeCount; s++)
+		{
+			ShapeBatch& b = shapes[s];
+			for (size_t i = 0; i < b.props.size(); i++)
+			{
+				dynamicsWorld->removeRigidBody(b.props[i].body);
+				delete b.props[i].body;
+				delete b.props[i].motionState;
+				delete b.props[i].shape;
+			}
+			delete b.vertexBuffer;
+			delete b.indexBuffer;
+			glDeleteVertexArrays(1, &b.vao);
+			glDeleteBuffers(1, &b.instanceBuffer);
+		}
+		delete Fill;
 	}
 
-	void AddVertex(const Vertex& v) { Vertices[numVertices++] = v; }
-	void AddIndex(GLushort a) { Indices[numIndices++] = a; }
-
-	void AllocateBuffers()
+	void CreateShape(ShapeBatch& b, MeshBuilder& mesh)
 	{
-		vertexBuffer = new VertexBuffer(&Vertices[0], numVertices * sizeof(Vertices[0]));
-		indexBuffer = new IndexBuffer(&Indices[0], numIndices * sizeof(Indices[0]));
+		b.numIndices = mesh.NumIndices();
+		b.vertexBuffer = mesh.CreateVertexBuffer();
+		b.indexBuffer = mesh.CreateIndexBuffer();
+		b.vao = CreateVertexArray(Fill->program, b.vertexBuffer->buffer, b.indexBuffer->buffer, sizeof(MeshVertex),
+			"Position", OVR_OFFSETOF(MeshVertex, Pos),
+			"Color", 4, GL_UNSIGNED_BYTE, OVR_OFFSETOF(MeshVertex, C),
+			"TexCoord", OVR_OFFSETOF(MeshVertex, U));
+		b.instanceCapacity = 0;
+
+		glGenBuffers(1, &b.instanceBuffer);
+		glBindVertexArray(b.vao);
+		glBindBuffer(GL_ARRAY_BUFFER, b.instanceBuffer);
+
+		GLint worldLoc = glGetAttribLocation(Fill->program, "InstanceWorld");
+		GLint colorLoc = glGetAttribLocation(Fill->program, "InstanceColor");
+		if (worldLoc >= 0)
+		{
+			// A mat4 attribute takes one location per column
+			for (int col = 0; col < 4; col++)
+			{
+				glEnableVertexAttribArray(worldLoc + col);
+				glVertexAttribPointer(worldLoc + col, 4, GL_FLOAT, GL_FALSE, sizeof(PropInstance), (void*)(OVR_OFFSETOF(PropInstance, World) + col * 4 * sizeof(float)));
+				glVertexAttribDivisor(worldLoc + col, 1);
+			}
+		}
+		if (colorLoc >= 0)
+		{
+			glEnableVertexAttribArray(colorLoc);
+			glVertexAttribPointer(colorLoc, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(PropInstance), (void*)OVR_OFFSETOF(PropInstance, C));
+			glVertexAttribDivisor(colorLoc, 1);
+		}
+
+		glBindVertexArray(0);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
 	}
 
-	void FreeBuffers()
+	// Adds a dynamic body of mass 1, returns its index within its shape
+	int AddProp(PropShape type, btCollisionShape* shape, Vector3f pos, Vector3f scale, DWORD c, float restitution)
 	{
-		delete vertexBuffer; vertexBuffer = nullptr;
-		delete indexBuffer; indexBuffer = nullptr;
+		Prop p;
+		p.shape = shape;
+		p.motionState = new btDefaultMotionState(btTransform(btQuaternion(0, 0, 0, 1), btVector3(pos.x, pos.y, pos.z)));
+		btScalar mass = 1;
+		btVector3 inertia(0, 0, 0);
+		shape->calculateLocalInertia(mass, inertia);
+		p.body = new btRigidBody(btRigidBody::btRigidBodyConstructionInfo(mass, p.motionState, shape, inertia));
+		p.body->setRestitution(btScalar(restitution));
+		p.body->setFriction(btScalar(0.9));
+		dynamicsWorld->addRigidBody(p.body);
+		p.slot = physics->Track(p.body);
+		p.scale = scale;
+		// Colors are given as 0xAARRGGBB, the same as the room boxes
+		p.C = (c & 0xff00ff00) | ((c >> 16) & 0xff) | ((c & 0xff) << 16);
+
+		shapes[type].props.push_back(p);
+		return (int)shapes[type].props.size() - 1;
 	}
 
-	void setupBulletRigidBody()
+	int AddBox(Vector3f pos, Vector3f halfExtents, DWORD c)
 	{
-		sphereShape = new btSphereShape(radio);
-		sphereMotionState = new btDefaultMotionState(btTransform(btQuaternion(0, 0, 0, 1), btVector3(Pos.x, Pos.y, Pos.z)));
-		float massRigidBody = 1;
-		sphereInertia = btVector3(0, 0, 0);
-		sphereShape->calculateLocalInertia(massRigidBody, sphereInertia);
-		sphereRigidBodyCI = new btRigidBody::btRigidBodyConstructionInfo(massRigidBody, sphereMotionState, sphereShape, sphereInertia);
-		sphereRigidBody = new btRigidBody(*sphereRigidBodyCI);
-		sphereRigidBody->setRestitution(btScalar(0.9));
-		sphereRigidBody->setFriction(btScalar(0.9));
-		dynamicsWorld->addRigidBody(sphereRigidBody);
+		return AddProp(Prop_Box, new btBoxShape(btVector3(halfExtents.x, halfExtents.y, halfExtents.z)), pos, halfExtents, c, 0.7f);
 	}
 
-	void AddSolidSphere(float r, DWORD c)
+	int AddSphere(Vector3f pos, float r, DWORD c)
 	{
-		radio = r;
-		int npointsh = 18, npointsv = 18;
+		return AddProp(Prop_Sphere, new btSphereShape(r), pos, Vector3f(r, r, r), c, 0.9f);
+	}
 
-		for (int i = 0; i < npointsh; i++)
+	// Puts a prop back at pos, at rest, before the next physics step
+	void ResetProp(PropShape type, int i, Vector3f pos)
+	{
+		btRigidBody* body = shapes[type].props[i].body;
+		physics->Post([body, pos]()
 		{
-			for (int j = 0; j <= npointsv; j++)
-			{
-				float phi = i*((2 * 3.1415) / npointsv);
-				float theta = j*(3.1415 / npointsh);
-
-				Vertex v;
-				v.Pos.x = r*cos(phi)*sin(theta);
-				v.Pos.y = r*sin(phi)*sin(theta);
-				v.Pos.z = r*cos(theta);
-
-				//v.C = ((v.Pos.x * 255 > 255 ? 255 : DWORD(v.Pos.x * 255)) << 16) +
-				//((v.Pos.y * 255 > 255 ? 255 : DWORD(v.Pos.y * 255)) << 8) +
-				//(v.Pos.z * 255 > 255 ? 255 : DWORD(v.Pos.z * 255));
+			btTransform start(btQuaternion(0, 0, 0, 1), btVector3(pos.x, pos.y, pos.z));
+			body->setWorldTransform(start);
+			body->getMotionState()->setWorldTransform(start);
+			body->setLinearVelocity(btVector3(0, 0, 0));
+			body->setAngularVelocity(btVector3(0, 0, 0));
+			body->clearForces();
+			body->activate(true);
+		});
+	}
 
-				AddVertex(v);
-			}
-		}
+	// Samples the transforms of the bodies for displayTime and uploads the
+	// instances, on the GL thread
+	void Update(double displayTime)
+	{
+		physics->Sample(displayTime, ovr_GetTimeInSeconds(), states);
 
-		int x = 1;
-		for (int i = 0; i < npointsv*npointsh + npointsv; i++)
+		for (int s = 0; s < Prop_ShapeCount; s++)
 		{
-			if (i == x*npointsv + (x - 1)){
-				x++;
+			ShapeBatch& b = shapes[s];
+			b.instances.resize(b.props.size());
+			if (b.props.empty())
 				continue;
-			}
-
-			if (i + npointsv + 1 > npointsv*npointsh + npointsv)
-			{
-				AddIndex(i);
-				AddIndex((i - npointsv*npointsh) + 1);
-				AddIndex(i + 1);
 
-				AddIndex(i);
-				AddIndex((i - npointsv*npointsh));
-				AddIndex((i - npointsv*npointsh) + 1);
-			}
-			else
+			Vector3f lo, hi;
+			float    extent = 0;
+			for (size_t i = 0; i < b.props.size(); i++)
 			{
-				AddIndex(i);
-				AddIndex(i + npointsv + 2);
-				AddIndex(i + 1);
+				const Prop& p = b.props[i];
+				PropInstance& inst = b.instances[i];
+				const PhysicsThread::BodyState& state = states[p.slot];
+				btTransform trans(btQuaternion(state.rotation[0], state.rotation[1], state.rotation[2], state.rotation[3]),
+					btVector3(state.position[0], state.position[1], state.position[2]));
+				trans.getOpenGLMatrix(inst.World);
+				for (int k = 0; k < 3; k++)
+				{
+					inst.World[k] *= p.scale.x;
+					inst.World[4 + k] *= p.scale.y;
+					inst.World[8 + k] *= p.scale.z;
+				}
+				inst.C = p.C;
 
-				AddIndex(i);
-				AddIndex(i + npointsv + 1);
-				AddIndex(i + npointsv + 2);
+				// The unit meshes fit in a sphere of radius sqrt(3)
+				Vector3f pos(inst.World[12], inst.World[13], inst.World[14]);
+				lo = i ? Vector3f(min(lo.x, pos.x), min(lo.y, pos.y), min(lo.z, pos.z)) : pos;
+				hi = i ? Vector3f(max(hi.x, pos.x), max(hi.y, pos.y), max(hi.z, pos.z)) : pos;
+				extent = max(extent, p.scale.Length() * 1.733f);
 			}
-
+			b.center = (lo + hi) * 0.5f;
+			b.radius = (hi - lo).Length() * 0.5f + extent;
+
+			// Orphan the previous storage so that this frame does not wait on the last one
+			glBindBuffer(GL_ARRAY_BUFFER, b.instanceBuffer);
+			b.instanceCapacity = std::max(b.instanceCapacity, b.instances.size());
+			glBufferData(GL_ARRAY_BUFFER, b.instanceCapacity * sizeof(PropInstance), NULL, GL_STREAM_DRAW);
+			glBufferSubData(GL_ARRAY_BUFFER, 0, b.instances.size() * sizeof(PropInstance), &b.instances[0]);
+			glBindBuffer(GL_ARRAY_BUFFER, 0);
 		}
-
-		setupBulletRigidBody();
 	}
 
-	void Render(Matrix4f view, Matrix4f proj)
+	void Record(DrawCommandList& list)
 	{
-		Matrix4f combined = proj * view * GetMatrix();
-
-		glUseProgram(Fill->program);
-		glUniform1i(glGetUniformLocation(Fill->program, "Texture0"), 0);
-		glUniformMatrix4fv(glGetUniformLocation(Fill->program, "matWVP"), 1, GL_TRUE, (FLOAT*)&combined);
-
-		glActiveTexture(GL_TEXTURE0);
-		//glBindTexture(GL_TEXTURE_2D, Fill->texture->texId);
-
-		glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer->buffer);
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer->buffer);
-
-		GLuint posLoc = glGetAttribLocation(Fill->program, "position");
-		GLuint colorLoc = glGetAttribLocation(Fill->program, "color");
-		GLuint uvLoc = glGetAttribLocation(Fill->program, "TexCoord");
-
-		glEnableVertexAttribArray(posLoc);
-		glEnableVertexAttribArray(colorLoc);
-		glEnableVertexAttribArray(uvLoc);
-
-		glVertexAttribPointer(posLoc, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)OVR_OFFSETOF(Vertex, Pos));
-		glVertexAttribPointer(colorLoc, 3, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(Vertex), (void*)OVR_OFFSETOF(Vertex, Pos));
-		glVertexAttribPointer(uvLoc, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)OVR_OFFSETOF(Vertex, U));
-
-		glDrawElements(GL_TRIANGLES, numIndices, GL_UNSIGNED_SHORT, NULL);
-		//glEnable(GL_POINT_SMOOTH);
-		//glPointSize(5);
-		//glDrawArrays(GL_POINTS, 0, numVertices);
-
-		glDisableVertexAttribArray(posLoc);
-		glDisableVertexAttribArray(colorLoc);
-		glDisableVertexAttribArray(uvLoc);
-
-		glBindBuffer(GL_ARRAY_BUFFER, 0);
-		//glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-
-		glUseProgram(0);
+		for (int s = 0; s < Prop_ShapeCount; s++)
+		{
+			const ShapeBatch& b = shapes[s];
+			if (b.instances.empty())
+				continue;
+			list.AddElementsInstanced(Fill->program, texture, b.vao, Fill->matWVPLoc,
+				Matrix4f(), GL_TRIANGLES, GL_UNSIGNED_INT, 0, b.numIndices, (GLsizei)b.instances.size());
+			list.SetBounds(b.center, b.radius);
+		}
 	}
 };
 
@@ -1429,94 +2514,98 @@ struct Scene
 	ShaderFill * grid_material[4];
 	int     numModels;
 	Model * Models[10];
-	int     numBoxModels;
-	boxModel * boxModels[10];
 	MyDots* dotsTest;
 	int framecount = 0;
-	SphereModel* sphereModel;
-	SphereModel* sphereModel2;
-
+	PropRenderer* props;
+	DrawCommandList drawList;
+	StaticBatcher staticGeometry;
+	bool Headless; // Steps the physics by the display times, on the render thread
+
+	// Parts of dynamicsWorld, which Init creates and Release deletes
+	btBroadphaseInterface*               broadphase;
+	btDefaultCollisionConfiguration*     collisionConfiguration;
+	btCollisionDispatcher*               dispatcher;
+	btSequentialImpulseConstraintSolver* solver;
+	btRigidBody*                         groundRigidBody;
+
+	// Adds an immovable model; it is merged into the static batch of its
+	// material, which is uploaded at the end of Init
 	void    Add(Model * n)
 	{
 		Models[numModels++] = n;
+		staticGeometry.Add(n);
 	}
 
-	void AddBox(boxModel * n)
-	{
-		boxModels[numBoxModels++] = n;
-	}
-
-	void Render(Matrix4f view, Matrix4f proj)
+	// Per frame work: physics, sensor data and recording of the draw list.
+	// Must be called once per frame, before Render is called for each eye,
+	// with the predicted display time of the frame.
+	void Update(double displayTime)
 	{
 		// This part resets the box object in case it has fallen out of reach from the user
 		if (resetBox)
 		{
-			dynamicsWorld->removeRigidBody(boxModels[0]->boxRigidBody);
-			boxModel *b;
-			DWORD c = 0xff105020;
-			float hx = 0.1, hy = 0.7, hz = 0.1;
-			b = new boxModel(Vector3f(0, -0.9, 0.6), grid_material[3]);  // Walls
-			b->AddSolidColorBox(-hx, -hy, -hz, hx, hy, hz, c); // First Box
-			b->AllocateBuffers();
-			boxModels[0] = b;
+			props->ResetProp(PropRenderer::Prop_Box, 0, Vector3f(0, -0.9, 0.6)); // First Box
 			resetBox = false;
 		}
 
-		dynamicsWorld->stepSimulation(1 / 50.f, 1000);
-		btTransform trans;
+		// The physics thread steps the world at its own rate; headless runs
+		// step it here, by the display times, to stay reproducible
+		physics->StepTo(displayTime);
 
-		//updates data points and renders the point cloud
-		dotsTest->updatePoints();
-		dotsTest->display(view, proj);
+		//updates data points and the joint colliders
+		dotsTest->updatePoints(displayTime);
+		dotsTest->setDisplayTime(displayTime);
+		dotsTest->updateJoints();
 
-		//Renders default models
-		for (int i = 0; i < numModels; ++i)
-			Models[i]->Render(view, proj);
-
-		//Updates rotation and position of each box model
-		for (int i = 0; i < numBoxModels; ++i)
-		{
-			boxModels[i]->boxRigidBody->getMotionState()->getWorldTransform(trans);
-			boxModels[i]->Pos = Vector3f(trans.getOrigin().getX(), trans.getOrigin().getY(), trans.getOrigin().getZ());
-			boxModels[i]->Rot = Quatf(trans.getRotation().getX(), trans.getRotation().getY(), trans.getRotation().getZ(), trans.getRotation().getW());
-			boxModels[i]->Render(view, proj);
-		}
+		//Updates rotation and position of the boxes and spheres, as simulated by the display time
+		props->Update(displayTime);
 
-		//updates rotation and position for sphere
-		sphereModel2->sphereRigidBody->getMotionState()->getWorldTransform(trans);
-		sphereModel2->Pos = Vector3f(trans.getOrigin().getX(), trans.getOrigin().getY(), trans.getOrigin().getZ());
-		sphereModel2->Rot = Quatf(trans.getRotation().getX(), trans.getRotation().getY(), trans.getRotation().getZ(), trans.getRotation().getW());
-		sphereModel2->Render(view, proj);
+		Record();
 	}
 
-	GLuint CreateShader(GLenum type, const GLchar* src)
+	// Records the draws of the frame. They are sorted for each eye in Render;
+	// the instanced props are what the depth prepass is for.
+	void Record()
 	{
-		GLuint shader = glCreateShader(type);
+		drawList.Reset();
 
-		glShaderSource(shader, 1, &src, NULL);
-		glCompileShader(shader);
+		drawList.BeginPass(GpuProfiler::Pass_Joints);
+		dotsTest->Record(drawList);
+		drawList.EndPass();
 
-		GLint r;
-		glGetShaderiv(shader, GL_COMPILE_STATUS, &r);
-		if (!r)
-		{
-			GLchar msg[1024];
-			glGetShaderInfoLog(shader, sizeof(msg), 0, msg);
-			if (msg[0]) {
-				OVR_DEBUG_LOG(("Compiling shader failed: %s\n", msg));
-			}
-			return 0;
-		}
+		drawList.BeginPass(GpuProfiler::Pass_Static);
+		staticGeometry.Record(drawList);
+		drawList.EndPass();
 
-		return shader;
+		drawList.BeginPass(GpuProfiler::Pass_Props, true);
+		props->Record(drawList);
+		drawList.EndPass();
 	}
 
-	void Init(int includeIntensiveGPUobject)
+	void Render(Matrix4f view, Matrix4f proj)
 	{
-		kinect = new KinectHandler();
-		kinect->KinectInit();
+		GpuProfiler& profiler = GpuProfiler::Get();
+		if (drawList.SortFrontToBack)
+			drawList.Sort(view);
+		drawList.Replay(view, proj, &profiler);
+
+		profiler.Begin(GpuProfiler::Pass_Points);
+		dotsTest->RenderSurface(view, proj);
+		profiler.End(GpuProfiler::Pass_Points);
+	}
 
-		dotsTest = new MyDots(Vector3f(0, 0, 0));
+	void Init(int includeIntensiveGPUobject)
+	{
+		if (!sensor)
+		{
+#ifdef _WIN32
+			sensor = new KinectSource();
+#else
+			sensor = new SyntheticSource(MyDots::NominalIntrinsics());
+#endif
+		}
+		if (!sensor->Init())
+			cout << "The sensor could not be opened" << endl;
 
 		static const GLchar* VertexShaderSrc =
 			"#version 150\n"
@@ -1545,8 +2634,36 @@ struct Scene
 			"   FragColor = oColor * texture2D(Texture0, oTexCoord);\n"
 			"}\n";
 
-		GLuint    vshader = CreateShader(GL_VERTEX_SHADER, VertexShaderSrc);
-		GLuint    fshader = CreateShader(GL_FRAGMENT_SHADER, FragmentShaderSrc);
+		// The dynamic props are drawn instanced, with the world matrix and color
+		// of each one as vertex attributes, and the blank texture
+		static const GLchar* PropVertexShaderSrc =
+			"#version 150\n"
+			"uniform mat4 matWVP;\n"
+			"in      vec4 Position;\n"
+			"in      vec4 Color;\n"
+			"in      vec2 TexCoord;\n"
+			"in      mat4 InstanceWorld;\n"
+			"in      vec4 InstanceColor;\n"
+			"out     vec2 oTexCoord;\n"
+			"out     vec4 oColor;\n"
+			"void main()\n"
+			"{\n"
+			"   gl_Position = matWVP * (InstanceWorld * Position);\n"
+			"   oTexCoord   = TexCoord;\n"
+			"   oColor      = Color * InstanceColor;\n"
+			"   oColor.rgb  = pow(oColor.rgb, vec3(2.2));\n"
+			"}\n";
+
+		// The programs of the scene are begun first, so that they compile while
+		// the dots build theirs, and are finished as their materials are made
+		ProgramCache& cache = ProgramCache::Get();
+		GLuint gridPrograms[4];
+		for (int k = 0; k < 4; ++k)
+			gridPrograms[k] = cache.Begin(VertexShaderSrc, FragmentShaderSrc);
+		GLuint propProgram = cache.Begin(PropVertexShaderSrc, FragmentShaderSrc);
+
+		dotsTest = new MyDots(Vector3f(0, 0, 0));
+		glEnable(GL_POINT_SMOOTH);
 
 		// Make textures
 		for (int k = 0; k < 4; ++k)
@@ -1564,56 +2681,31 @@ struct Scene
 				}
 			}
 			TextureBuffer * generated_texture = new TextureBuffer(nullptr, false, false, Sizei(256, 256), 4, (unsigned char *)tex_pixels, 1);
-			grid_material[k] = new ShaderFill(vshader, fshader, generated_texture);
+			grid_material[k] = new ShaderFill(gridPrograms[k], generated_texture);
 		}
 
-		glDeleteShader(vshader);
-		glDeleteShader(fshader);
+		props = new PropRenderer(new ShaderFill(propProgram, nullptr), grid_material[3]->texture->texId);
 
 		//=============================================================
-		btBroadphaseInterface* broadphase = new btDbvtBroadphase();
-		btDefaultCollisionConfiguration* collisionConfiguration = new btDefaultCollisionConfiguration();
-		btCollisionDispatcher* dispatcher = new btCollisionDispatcher(collisionConfiguration);
-		btSequentialImpulseConstraintSolver* solver = new btSequentialImpulseConstraintSolver;
+		broadphase = new btDbvtBroadphase();
+		collisionConfiguration = new btDefaultCollisionConfiguration();
+		dispatcher = new btCollisionDispatcher(collisionConfiguration);
+		solver = new btSequentialImpulseConstraintSolver;
 		dynamicsWorld = new btDiscreteDynamicsWorld(dispatcher, broadphase, solver, collisionConfiguration);
 		dynamicsWorld->setGravity(btVector3(0, -9.8, 0));
+		physics = new PhysicsThread(dynamicsWorld);
+		physics->ApplyJoints = [this](const PhysicsThread::JointTargets& targets) { dotsTest->applyJoints(targets); };
 
 		//Initializes static object that represents the ground in the dynamicsWorld
 		btCollisionShape* groundShape = new btStaticPlaneShape(btVector3(0, 1, 0), 0);
 		btDefaultMotionState* groundMotionState = new btDefaultMotionState(btTransform(btQuaternion(0, 0, 0, 1), btVector3(0, -1, 0)));
 		btRigidBody::btRigidBodyConstructionInfo groundRigidBodyCI(0, groundMotionState, groundShape, btVector3(0, 0, 0));
-		btRigidBody* groundRigidBody = new btRigidBody(groundRigidBodyCI);
+		groundRigidBody = new btRigidBody(groundRigidBodyCI);
 		groundRigidBody->setRestitution(btScalar(0.8));
 		groundRigidBody->setFriction(1);
 		dynamicsWorld->addRigidBody(groundRigidBody);
 
-		static const GLchar* mVertexShaderSrc =
-			"#version 150\n"
-			"uniform mat4	matWVP;\n"
-			"in		vec4	position;\n"
-			"in		vec4	color;"
-			"out	vec4	fragmentColor;"
-			"void main(){\n"
-			"   gl_Position		=	(matWVP * position);\n"
-			"	fragmentColor	=	color;"
-			"}";
-
-		static const GLchar* mFragmentShaderSrc =
-			"#version 150\n"
-			"in		vec4	fragmentColor;\n"
-			"out	vec4	out_color;\n"
-			"void main() {\n"
-			//"	out_color		=	vec4(fragmentColor, 1.0);\n"
-			"	out_color		=	fragmentColor;\n"
-			"}";
-
-		GLuint    mvshader = CreateShader(GL_VERTEX_SHADER, mVertexShaderSrc);
-		GLuint    mfshader = CreateShader(GL_FRAGMENT_SHADER, mFragmentShaderSrc);
-		ShaderFill* myShader = new ShaderFill(mvshader, mfshader, NULL);
-
-		sphereModel2 = new SphereModel(Vector3f(0.35, 2, 0.8), myShader);
-		sphereModel2->AddSolidSphere(0.15f, 0xff202050);
-		sphereModel2->AllocateBuffers();
+		props->AddSphere(Vector3f(0.35, 2, 0.8), 0.15f, 0xff202050);
 
 		//=============================================================
 
@@ -1627,35 +2719,63 @@ struct Scene
 		m->AddSolidColorBox(-10.0f, -1.1f, -20.0f, 10.0f, -1.0f, 20.1f, c); // Main floor
 		m->AddSolidColorBox(-10.0f, 4.0f, -20.0f, 10.0f, 4.1f, 20.1f, c); //ceiling
 		m->AddSolidColorBox(-10.0f, -1.1f, 20.1f, 10.0f, 4.0f, 20.0f, c); // Front Wall
-		m->AllocateBuffers();
 		Add(m);
 
-		boxModel *b;
 		c = 0xff105020;
 		float hx = 0.1, hy = 0.7, hz = 0.1;
-		b = new boxModel(Vector3f(0, -0.9, 0.6), grid_material[3]);
-		b->AddSolidColorBox(-hx, -hy, -hz, hx, hy, hz, c); // First Box
-		b->AllocateBuffers();
-		AddBox(b);
+		props->AddBox(Vector3f(0, -0.9, 0.6), Vector3f(hx, hy, hz), c); // First Box
 
 		// In order to see how to add more objects from the Model Structure
 		// refer to the original project available in the Oculus Rift SDK 0.8
 
+		staticGeometry.Build();
+
+		// The world belongs to the physics thread from here on
+		physics->Start(!Headless);
 	}
 
-	Scene() : numModels(0), numBoxModels(0) {}
-	Scene(bool includeIntensiveGPUobject) :
-		numModels(0), numBoxModels(0)
+	Scene() : numModels(0), props(nullptr), Headless(false),
+		broadphase(nullptr), collisionConfiguration(nullptr), dispatcher(nullptr), solver(nullptr), groundRigidBody(nullptr) {}
+	Scene(bool includeIntensiveGPUobject, bool headless = false) :
+		numModels(0), props(nullptr), Headless(headless),
+		broadphase(nullptr), collisionConfiguration(nullptr), dispatcher(nullptr), solver(nullptr), groundRigidBody(nullptr)
 	{
 		Init(includeIntensiveGPUobject);
 	}
 	void Release()
 	{
+		// The props leave the world on this thread
+		if (physics && solver)
+			physics->Stop();
+
 		while (numModels-- > 0)
 			delete Models[numModels];
 
-		while (numBoxModels-- > 0)
-			delete boxModels[numBoxModels];
+		delete props;
+		props = nullptr;
+
+		// Only the scene that created the world deletes it. The physics thread
+		// goes first, with ApplyJoints and the commands that point into the
+		// scene, so that a scene made after a lost display starts afresh.
+		if (!solver)
+			return;
+		delete physics;
+		physics = nullptr;
+		dynamicsWorld->removeRigidBody(groundRigidBody);
+		delete groundRigidBody->getMotionState();
+		delete groundRigidBody->getCollisionShape();
+		delete groundRigidBody;
+		groundRigidBody = nullptr;
+		delete dynamicsWorld;
+		dynamicsWorld = nullptr;
+		delete solver;
+		solver = nullptr;
+		delete dispatcher;
+		dispatcher = nullptr;
+		delete collisionConfiguration;
+		collisionConfiguration = nullptr;
+		delete broadphase;
+		broadphase = nullptr;
 	}
 	~Scene()
 	{
@@ -24,7 +24,15 @@ limitations under the License.
 /// is not that great!
 
 #include "Win32_GLAppUtil.h"
+#include "HeadlessLoop.h"
+#include "ResolutionScaler.h"
+#include "MirrorOutput.h"
+#ifdef HEADLESS_EGL
+#include "EglPlatform.h"
+#endif
 #include "LibOVRKernel/Src/Kernel/OVR_System.h"
+#include "LibOVRKernel/Src/Kernel/OVR_Timer.h"
+#include <fstream>
 // Include the Oculus SDK
 #include "LibOVR/Include/OVR_CAPI_GL.h"
 
@@ -32,14 +40,18 @@ using namespace OVR;
 
 int bodySelection = 6;
 
+// Configured from the command line, see WinMain
+static MirrorOutput Mirror;
+
 // return true to retry later (e.g. after display lost)
 static bool MainLoop(bool retryCreate)
 {
 	TextureBuffer * eyeRenderTexture[2] = { nullptr, nullptr };
 	DepthBuffer   * eyeDepthBuffer[2] = { nullptr, nullptr };
 	ovrGLTexture  * mirrorTexture = nullptr;
-	GLuint          mirrorFBO = 0;
 	Scene         * roomScene = nullptr;
+	GpuProfiler   & profiler = GpuProfiler::Get();
+	int             measuredFrames = 0;
 
 	ovrHmd HMD;
 	ovrGraphicsLuid luid;
@@ -49,6 +61,10 @@ static bool MainLoop(bool retryCreate)
 
 	ovrHmdDesc hmdDesc = ovr_GetHmdDesc(HMD);
 
+	// The eye buffers are allocated at full size, the scaler picks the part rendered
+	ResolutionScaler scaler(hmdDesc.DisplayRefreshRate);
+	profiler.Scaler = &scaler;
+
 	// Setup Window and Graphics
 	// Note: the mirror window can be any size, for this sample we use 1/2 the HMD resolution
 	ovrSizei windowSize = { hmdDesc.Resolution.w / 2, hmdDesc.Resolution.h / 2 };
@@ -69,20 +85,25 @@ static bool MainLoop(bool retryCreate)
 		}
 	}
 
-	// Create mirror texture and an FBO used to copy mirror texture to back buffer
-	result = ovr_CreateMirrorTextureGL(HMD, GL_SRGB8_ALPHA8, windowSize.w, windowSize.h, reinterpret_cast<ovrTexture**>(&mirrorTexture));
-	if (!OVR_SUCCESS(result))
+	// Create mirror texture, at the mirror output scale, unless the output is off
+	if (Mirror.Enabled())
 	{
-		if (retryCreate) goto Done;
-		VALIDATE(false, "Failed to create mirror texture.");
-	}
+		result = ovr_CreateMirrorTextureGL(HMD, GL_SRGB8_ALPHA8, Mirror.TextureWidth(windowSize.w), Mirror.TextureHeight(windowSize.h),
+			reinterpret_cast<ovrTexture**>(&mirrorTexture));
+		if (!OVR_SUCCESS(result))
+		{
+			if (retryCreate) goto Done;
+			VALIDATE(false, "Failed to create mirror texture.");
+		}
 
-	// Configure the mirror read buffer
-	glGenFramebuffers(1, &mirrorFBO);
-	glBindFramebuffer(GL_READ_FRAMEBUFFER, mirrorFBO);
-	glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, mirrorTexture->OGL.TexId, 0);
-	glFramebufferRenderbuffer(GL_READ_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, 0);
-	glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+		if (!Mirror.Init(mirrorTexture->OGL.TexId, mirrorTexture->OGL.Header.TextureSize.w, mirrorTexture->OGL.Header.TextureSize.h))
+		{
+			cout << "Mirroring to the window instead" << endl;
+			Mirror.Release();
+			Mirror.mode = MirrorOutput::Mirror_Window;
+			Mirror.Init(mirrorTexture->OGL.TexId, mirrorTexture->OGL.Header.TextureSize.w, mirrorTexture->OGL.Header.TextureSize.h);
+		}
+	}
 
 	ovrEyeRenderDesc EyeRenderDesc[2];
 	EyeRenderDesc[0] = ovr_GetRenderDesc(HMD, ovrEye_Left, hmdDesc.DefaultEyeFov[0]);
@@ -99,6 +120,17 @@ static bool MainLoop(bool retryCreate)
 	// Main loop
 	while (Platform.HandleMessages())
 	{
+		profiler.BeginFrame();
+		profiler.CpuBegin(GpuProfiler::Stage_Frame);
+
+		// Adapt the eye viewports to the last frame the GPU timings are known for
+		if (profiler.measuredFrames != measuredFrames)
+		{
+			measuredFrames = profiler.measuredFrames;
+			scaler.Update(profiler.lastFrameMs[GpuProfiler::Pass_LeftEye] + profiler.lastFrameMs[GpuProfiler::Pass_RightEye],
+				profiler.cpu[GpuProfiler::Stage_Update].Last() + profiler.cpu[GpuProfiler::Stage_Render].Last());
+		}
+		Recti eyeViewport[2] = { scaler.Viewport(eyeRenderTexture[0]->GetSize()), scaler.Viewport(eyeRenderTexture[1]->GetSize()) };
 
 		// Keyboard inputs to adjust player orientation
 		static float Yaw(0);// (3.141592f);
@@ -115,6 +147,60 @@ static bool MainLoop(bool retryCreate)
 		//Resets BODY ONLY visualisation mode
 		if (Platform.Key['N'])     roomScene->dotsTest->mode = false;
 
+		//Point cloud drawing: I = points, O = round splats, P = splats oriented by the surface normal,
+		//L = points rasterized in compute shaders, M = triangle surface, Q = mesh of the fused volume
+		if (Platform.Key['I'])     roomScene->dotsTest->renderMode = MyDots::Render_Points;
+		if (Platform.Key['O'])     roomScene->dotsTest->renderMode = MyDots::Render_Splats;
+		if (Platform.Key['P'])     roomScene->dotsTest->renderMode = MyDots::Render_OrientedSplats;
+		if (Platform.Key['L'])     roomScene->dotsTest->renderMode = MyDots::Render_ComputePoints;
+		if (Platform.Key['M'])     roomScene->dotsTest->renderMode = MyDots::Render_Surface;
+		if (Platform.Key['Q'])     roomScene->dotsTest->renderMode = MyDots::Render_Volume;
+
+		//Surface simplified on a worker thread for drawing: F5 = on, F6 = off
+		if (Platform.Key[VK_F5])   roomScene->dotsTest->decimate = true;
+		if (Platform.Key[VK_F6])   roomScene->dotsTest->decimate = false;
+
+		//Skinned avatar: F7 = capture the first tracked body and draw it, F8 = linear blend, F9 = dual quaternion skinning
+		if (Platform.Key[VK_F7])   { roomScene->dotsTest->captureRequested = true; roomScene->dotsTest->renderMode = MyDots::Render_Avatar; }
+		if (Platform.Key[VK_F8] && roomScene->dotsTest->Avatar)   roomScene->dotsTest->Avatar->DualQuaternion = false;
+		if (Platform.Key[VK_F9] && roomScene->dotsTest->Avatar)   roomScene->dotsTest->Avatar->DualQuaternion = true;
+
+		//Convex hulls of the tracked bodies as their colliders: F1 = on, F2 = off
+		if (Platform.Key[VK_F1])   roomScene->dotsTest->bodyHulls = true;
+		if (Platform.Key[VK_F2])   roomScene->dotsTest->bodyHulls = false;
+
+		//Snapshots of the points or of the surface, written as snapshot_<n>.ply and .cols in the
+		//working directory: 7 = the next frame, 8 = continuous, 9 = stop the continuous snapshots
+		if (Platform.Key['7'])     roomScene->dotsTest->exportRequested = true;
+		if (Platform.Key['8'])     roomScene->dotsTest->exportContinuous = true;
+		if (Platform.Key['9'])     roomScene->dotsTest->exportContinuous = false;
+
+		//Recording of the sensor frames to recording_<n>.pcf in the working directory, for replays: F3 = start, F4 = stop
+		if (Platform.Key[VK_F3])   roomScene->dotsTest->record = true;
+		if (Platform.Key[VK_F4])   roomScene->dotsTest->record = false;
+
+		//Fusion of the depth frames into a volume: F = on, E = off
+		if (Platform.Key['F'])     roomScene->dotsTest->fuse = true;
+		if (Platform.Key['E'])     roomScene->dotsTest->fuse = false;
+
+		//Screen space hole filling of the raw points: H = on, G = off
+		if (Platform.Key['H'])     roomScene->dotsTest->fillHoles = true;
+		if (Platform.Key['G'])     roomScene->dotsTest->fillHoles = false;
+
+		//Depth frame sampling: J = dense (every other row), K = sparse (every third row and column)
+		if (Platform.Key['J'])     { roomScene->dotsTest->rowStep = 2; roomScene->dotsTest->colStep = 1; }
+		if (Platform.Key['K'])     { roomScene->dotsTest->rowStep = 3; roomScene->dotsTest->colStep = 3; }
+
+		//Extrapolation of the moving points to the display time: V = on, C = off
+		if (Platform.Key['V'])     roomScene->dotsTest->extrapolate = true;
+		if (Platform.Key['C'])     roomScene->dotsTest->extrapolate = false;
+
+		//Draw list order: T = front to back, U = recording order; depth prepass of the props: Z = on, X = off
+		if (Platform.Key['T'])     roomScene->drawList.SortFrontToBack = true;
+		if (Platform.Key['U'])     roomScene->drawList.SortFrontToBack = false;
+		if (Platform.Key['Z'])     roomScene->drawList.DepthPrepass = true;
+		if (Platform.Key['X'])     roomScene->drawList.DepthPrepass = false;
+
 		//Resets GREEN BOX position for tests purposes
 		if (Platform.Key['R'])		roomScene->resetBox = true;
 
@@ -130,6 +216,16 @@ static bool MainLoop(bool retryCreate)
 		if (Platform.Key['Y']) Yaw += 3.141592f;
 
 
+		// Simulate, build the point cloud and record the frame before the head
+		// pose is sampled, so that none of this work ages the pose
+		double ftiming = ovr_GetPredictedDisplayTime(HMD, 0);
+		if (isVisible)
+		{
+			profiler.CpuBegin(GpuProfiler::Stage_Update);
+			roomScene->Update(ftiming);
+			profiler.CpuEnd(GpuProfiler::Stage_Update);
+		}
+
 		//Defines point of adjustments
 		// if any user is selected, the ajustments have a finer tunning parameter
 		if (bodySelection >= 0 && bodySelection < 6)
@@ -155,26 +251,33 @@ static bool MainLoop(bool retryCreate)
 			if (Platform.Key[VK_DOWN]) Pos2 += Matrix4f::RotationY(Yaw).Transform(Vector3f(0, -0.02f, 0));
 		}
 
-		// Get eye poses, feeding in correct IPD offset
+		// Get eye poses, feeding in correct IPD offset. They are latched here,
+		// just before the eyes are rendered, and predicted for the display time
+		// as known now.
 		ovrVector3f               ViewOffset[2] = { EyeRenderDesc[0].HmdToEyeViewOffset,
 			EyeRenderDesc[1].HmdToEyeViewOffset };
 		ovrPosef                  EyeRenderPose[2];
 
-		double           ftiming = ovr_GetPredictedDisplayTime(HMD, 0);
+		double           poseTiming = ovr_GetPredictedDisplayTime(HMD, 0);
 		// Keeping sensorSampleTime as close to ovr_GetTrackingState as possible - fed into the layer
 		double           sensorSampleTime = ovr_GetTimeInSeconds();
-		ovrTrackingState hmdState = ovr_GetTrackingState(HMD, ftiming, ovrTrue);
+		ovrTrackingState hmdState = ovr_GetTrackingState(HMD, poseTiming, ovrTrue);
 		ovr_CalcEyePoses(hmdState.HeadPose.ThePose, ViewOffset, EyeRenderPose);
+		profiler.CpuBegin(GpuProfiler::Stage_PoseToSubmit);
 
 		if (isVisible)
 		{
+			// Replay the recorded frame for each eye
+			profiler.CpuBegin(GpuProfiler::Stage_Render);
 			for (int eye = 0; eye < 2; ++eye)
 			{
+				profiler.Begin(GpuProfiler::Pass_LeftEye + eye);
+
 				// Increment to use next texture, just before writing
 				eyeRenderTexture[eye]->TextureSet->CurrentIndex = (eyeRenderTexture[eye]->TextureSet->CurrentIndex + 1) % eyeRenderTexture[eye]->TextureSet->TextureCount;
 
 				// Switch to eye render target
-				eyeRenderTexture[eye]->SetAndClearRenderSurface(eyeDepthBuffer[eye]);
+				eyeRenderTexture[eye]->SetAndClearRenderSurface(eyeDepthBuffer[eye], eyeViewport[eye]);
 
 				// Get view and projection matrices
 				Matrix4f rollPitchYaw = Matrix4f::RotationY(Yaw);
@@ -194,10 +297,14 @@ static bool MainLoop(bool retryCreate)
 				// would bind a framebuffer with an invalid COLOR_ATTACHMENT0 because the texture ID
 				// associated with COLOR_ATTACHMENT0 had been unlocked by calling wglDXUnlockObjectsNV.
 				eyeRenderTexture[eye]->UnsetRenderSurface();
+
+				profiler.End(GpuProfiler::Pass_LeftEye + eye);
 			}
+			profiler.CpuEnd(GpuProfiler::Stage_Render);
 		}
 
 		// Do distortion rendering, Present and flush/sync
+		profiler.CpuBegin(GpuProfiler::Stage_Submit);
 
 		// Set up positional data.
 		ovrViewScaleDesc viewScaleDesc;
@@ -212,13 +319,14 @@ static bool MainLoop(bool retryCreate)
 		for (int eye = 0; eye < 2; ++eye)
 		{
 			ld.ColorTexture[eye] = eyeRenderTexture[eye]->TextureSet;
-			ld.Viewport[eye] = Recti(eyeRenderTexture[eye]->GetSize());
+			ld.Viewport[eye] = eyeViewport[eye];
 			ld.Fov[eye] = hmdDesc.DefaultEyeFov[eye];
 			ld.RenderPose[eye] = EyeRenderPose[eye];
 			ld.SensorSampleTime = sensorSampleTime;
 		}
 
 		ovrLayerHeader* layers = &ld.Header;
+		profiler.CpuEnd(GpuProfiler::Stage_PoseToSubmit);
 		ovrResult result = ovr_SubmitFrame(HMD, 0, &viewScaleDesc, &layers, 1);
 		// exit the rendering loop if submit returns an error, will retry on ovrError_DisplayLost
 		if (!OVR_SUCCESS(result))
@@ -226,22 +334,24 @@ static bool MainLoop(bool retryCreate)
 
 		isVisible = (result == ovrSuccess);
 
-		// Blit mirror texture to back buffer
-		glBindFramebuffer(GL_READ_FRAMEBUFFER, mirrorFBO);
-		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
-		GLint w = mirrorTexture->OGL.Header.TextureSize.w;
-		GLint h = mirrorTexture->OGL.Header.TextureSize.h;
-		glBlitFramebuffer(0, h, w, 0,
-			0, 0, w, h,
-			GL_COLOR_BUFFER_BIT, GL_NEAREST);
-		glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
-
-		SwapBuffers(Platform.hDC);
+		// Mirror output; the desktop window is only swapped when it was drawn
+		profiler.Begin(GpuProfiler::Pass_Mirror);
+		bool mirrored = Mirror.Present(windowSize.w, windowSize.h);
+		profiler.End(GpuProfiler::Pass_Mirror);
+
+		if (mirrored)
+			Platform.Present();
+		profiler.CpuEnd(GpuProfiler::Stage_Submit);
+
+		profiler.CpuEnd(GpuProfiler::Stage_Frame);
+		profiler.EndFrame();
 	}
 
 Done:
+	profiler.Release();
+	profiler.Scaler = NULL;
 	delete roomScene;
-	if (mirrorFBO) glDeleteFramebuffers(1, &mirrorFBO);
+	Mirror.Release();
 	if (mirrorTexture) ovr_DestroyMirrorTexture(HMD, reinterpret_cast<ovrTexture*>(mirrorTexture));
 	for (int eye = 0; eye < 2; ++eye)
 	{
@@ -256,10 +366,68 @@ Done:
 }
 
 //-------------------------------------------------------------------------------------
-int WINAPI WinMain(HINSTANCE hinst, HINSTANCE, LPSTR, int)
+int WINAPI WinMain(HINSTANCE hinst, HINSTANCE, LPSTR lpCmdLine, int)
 {
 	OVR::System::Init();
 
+	// -headless [frames] [pose script]: renders offscreen from a fake HMD,
+	// without LibOVR or a Rift, for performance runs and image comparison.
+	// The sensor frames are synthetic, or those of a recording with
+	// -replay <recording>. -egl renders with an EGL context instead of a
+	// hidden window, in builds with HEADLESS_EGL. Off Windows the same runs
+	// go through Tests/HeadlessSceneCheck.cpp.
+	if (strncmp(lpCmdLine, "-headless", 9) == 0)
+	{
+		int  frames = 900;
+		char poseScript[MAX_PATH] = "";
+		char recording[MAX_PATH] = "";
+		sscanf(lpCmdLine + 9, "%d %259s", &frames, poseScript);
+		if (poseScript[0] == '-')
+			poseScript[0] = 0;
+		if (const char* arg = strstr(lpCmdLine, "-replay "))
+			sscanf(arg + 8, "%259s", recording);
+
+		if (recording[0])
+			sensor = new RecordedSource(recording);
+		else
+			sensor = new SyntheticSource(MyDots::NominalIntrinsics());
+
+		GLPlatform* platform = &Platform;
+#ifdef HEADLESS_EGL
+		EglPlatform egl;
+		if (strstr(lpCmdLine, "-egl"))
+			platform = &egl;
+#else
+		if (strstr(lpCmdLine, "-egl"))
+			cout << "Built without HEADLESS_EGL, rendering to a hidden window" << endl;
+#endif
+		if (platform == &Platform)
+		{
+			VALIDATE(Platform.InitWindow(hinst, L"Oculus Room Tiny (GL)"), "Failed to open window.");
+			Platform.Headless = true;
+		}
+		bool rendered = HeadlessLoop(*platform, poseScript[0] ? poseScript : nullptr, frames);
+
+		OVR::System::Destroy();
+		return rendered ? 0 : 1;
+	}
+
+	// -mirror off|window|shared: where the mirror goes, shared being the
+	// shared memory ring of MirrorOutput. -mirrorinterval N: every Nth frame.
+	// -mirrorscale S: size of the mirror relative to the window.
+	if (const char* arg = strstr(lpCmdLine, "-mirror "))
+	{
+		char mode[16] = "";
+		sscanf(arg + 8, "%15s", mode);
+		if (strcmp(mode, "off") == 0)          Mirror.mode = MirrorOutput::Mirror_Off;
+		else if (strcmp(mode, "shared") == 0)  Mirror.mode = MirrorOutput::Mirror_SharedMemory;
+		else                                   Mirror.mode = MirrorOutput::Mirror_Window;
+	}
+	if (const char* arg = strstr(lpCmdLine, "-mirrorinterval "))
+		sscanf(arg + 16, "%d", &Mirror.Interval);
+	if (const char* arg = strstr(lpCmdLine, "-mirrorscale "))
+		sscanf(arg + 13, "%f", &Mirror.Scale);
+
 	// Initializes LibOVR, and the Rift
 	ovrResult result = ovr_Initialize(nullptr);
 	VALIDATE(OVR_SUCCESS(result), "Failed to initialize libOVR.");
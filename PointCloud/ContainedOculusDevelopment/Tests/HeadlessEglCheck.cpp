@@ -0,0 +1,147 @@
+//--------------------------------------------------------------------------
+// Renders without a window system through EglPlatform: fuses synthetic
+// depth frames of a box in front of a wall into a TsdfVolume, meshes it
+// with BlockMesher and draws the mesh into a framebuffer, then checks that
+// the box and the wall show where they should. Runs on any EGL driver with
+// desktop OpenGL, Mesa's llvmpipe included, so it needs no GPU.
+//
+// Build and run from this directory (LibOVRKernel's log is not linked, see
+// LogText below):
+//   D=../ContainedOculusDevelopment/Dependencies
+//   g++ -O2 -fopenmp -std=c++11 -DHEADLESS_EGL -I../ContainedOculusDevelopment -I$D -I$D/LibOVRKernel/Src -I$D/LibOVR/Include HeadlessEglCheck.cpp $D/LibOVRKernel/Src/GL/CAPI_GLE.cpp -lEGL -lGL -o HeadlessEglCheck
+//   ./HeadlessEglCheck
+
+#include "EglPlatform.h"
+#include "BlockMesher.h"
+#include <iostream>
+#include <vector>
+
+using namespace std;
+
+namespace OVR { void LogText(const char*, ...) {} }
+
+static int failures = 0;
+
+static void Check(bool ok, const char* what)
+{
+	cout << (ok ? "ok     " : "FAILED ") << what << endl;
+	if (!ok)
+		failures++;
+}
+
+// Orthographic view of the camera space of the sensor, x and y within
+// 1.5 m, depth from 0 to 5 m
+static const GLchar* VertexShaderSrc =
+	"#version 150\n"
+	"in  vec3 position;\n"
+	"in  vec3 color;\n"
+	"out vec3 oColor;\n"
+	"void main()\n"
+	"{\n"
+	"   gl_Position = vec4(position.x / 1.5, position.y / 1.5, position.z / 2.5 - 1.0, 1.0);\n"
+	"   oColor = color;\n"
+	"}\n";
+
+static const GLchar* FragmentShaderSrc =
+	"#version 150\n"
+	"in  vec3 oColor;\n"
+	"out vec4 FragColor;\n"
+	"void main()\n"
+	"{\n"
+	"   FragColor = vec4(oColor, 1.0);\n"
+	"}\n";
+
+static GLuint Compile(GLenum type, const GLchar* src)
+{
+	GLuint shader = glCreateShader(type);
+	glShaderSource(shader, 1, &src, 0);
+	glCompileShader(shader);
+	GLint ok = 0;
+	glGetShaderiv(shader, GL_COMPILE_STATUS, &ok);
+	return ok ? shader : 0;
+}
+
+int main()
+{
+	enum { Size = 256 };
+
+	EglPlatform platform;
+	if (!platform.InitDevice(Size, Size))
+	{
+		Check(false, "EGL context");
+		return 1;
+	}
+	Check(true, "EGL context");
+	cout << glGetString(GL_VERSION) << ", " << glGetString(GL_RENDERER) << endl;
+
+	GLuint program = glCreateProgram();
+	GLuint vs = Compile(GL_VERTEX_SHADER, VertexShaderSrc), fs = Compile(GL_FRAGMENT_SHADER, FragmentShaderSrc);
+	Check(vs && fs, "shaders compile");
+	glAttachShader(program, vs);
+	glAttachShader(program, fs);
+	glLinkProgram(program);
+
+	GLuint color, depth;
+	glGenTextures(1, &color);
+	glBindTexture(GL_TEXTURE_2D, color);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, Size, Size, 0, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+	glGenRenderbuffers(1, &depth);
+	glBindRenderbuffer(GL_RENDERBUFFER, depth);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, Size, Size);
+	glBindFramebuffer(GL_FRAMEBUFFER, platform.fboId);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, color, 0);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth);
+	Check(glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE, "framebuffer complete");
+
+	// A blue wall 3 m away and a red box of side 0.6 m, 1.5 m away, in the middle
+	TsdfVolume::Intrinsics intr = { 512, 424, 365.0f, -365.0f, 256.0f, 212.0f };
+	vector<unsigned short> frameDepth(intr.width * intr.height);
+	vector<unsigned int>   frameColors(intr.width * intr.height);
+	for (int v = 0; v < intr.height; v++)
+	{
+		for (int u = 0; u < intr.width; u++)
+		{
+			float rx = (u - intr.cx) / intr.fx, ry = (v - intr.cy) / intr.fy;
+			bool  box = fabs(rx * 1.5f) < 0.3f && fabs(ry * 1.5f) < 0.3f;
+			frameDepth[v * intr.width + u] = box ? 1500 : 3000;
+			frameColors[v * intr.width + u] = box ? 0xff0000ffu : 0xffff0000u;
+		}
+	}
+
+	TsdfVolume  volume(8192, 0.02f);
+	BlockMesher* mesher = new BlockMesher(); // Deleted while the context is current
+	mesher->Init(glGetAttribLocation(program, "position"), glGetAttribLocation(program, "color"), 1 << 20);
+	for (int i = 0; i < 10; i++)
+	{
+		volume.Integrate(&frameDepth[0], &frameColors[0], intr, NULL);
+		mesher->Update(volume);
+	}
+	cout << volume.NumBlocks() << " blocks, " << mesher->numVertices << " vertices" << endl;
+	Check(mesher->numVertices > 0 && !mesher->full, "volume meshed");
+
+	glViewport(0, 0, Size, Size);
+	glClearColor(0, 0, 0, 1);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	glUseProgram(program);
+	mesher->Draw();
+	glUseProgram(0);
+
+	vector<unsigned char> pixels(Size * Size * 4);
+	glReadPixels(0, 0, Size, Size, GL_RGBA, GL_UNSIGNED_BYTE, &pixels[0]);
+	const unsigned char* middle = &pixels[(Size / 2 * Size + Size / 2) * 4];
+	const unsigned char* side = &pixels[(Size / 2 * Size + Size / 8) * 4];
+	Check(middle[0] > 200 && middle[2] < 50, "box in front, in the middle");
+	Check(side[2] > 200 && side[0] < 50, "wall to the side");
+	Check(glGetError() == GL_NO_ERROR, "no GL error");
+
+	delete mesher;
+	glDeleteProgram(program);
+	glDeleteShader(vs);
+	glDeleteShader(fs);
+	glDeleteTextures(1, &color);
+	glDeleteRenderbuffers(1, &depth);
+	platform.ReleaseDevice();
+
+	cout << (failures ? "FAILED" : "passed") << endl;
+	return failures ? 1 : 0;
+}
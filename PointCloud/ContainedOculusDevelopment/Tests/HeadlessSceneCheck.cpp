@@ -0,0 +1,181 @@
+//--------------------------------------------------------------------------
+// Runs the application's Scene headless on Linux: Init, then Update and
+// Render for every frame of a FakeHmd, with the frames of a SyntheticSource,
+// in an EglPlatform context (see HeadlessLoop.h). Without arguments it
+// renders 30 frames from the pose of HeadlessScene/pose.txt, facing the
+// synthetic wall and body, and compares the eye images of the last frame,
+// shrunk 4 times, with HeadlessScene/left.ppm and right.ppm. A pixel
+// differs when one of its channels is more than Tolerance away; the check
+// fails if more than MaxDiffering of them do. The references were rendered
+// by Mesa's llvmpipe; run with -update to render them again.
+//
+// With arguments it is the Linux counterpart of WinMain's -headless, for
+// performance runs: [frames] [pose script] [-replay recording], writing the
+// eye images and the frame times like it, and comparing nothing.
+//
+// Build and run from this directory (LibOVRKernel's log is not linked, see
+// LogText below):
+//   S=../ContainedOculusDevelopment; D=$S/Dependencies
+//   OVR="$D/LibOVRKernel/Src/GL/CAPI_GLE.cpp $D/LibOVRKernel/Src/Kernel/OVR_Timer.cpp $D/LibOVR/Src/OVR_CAPI_Util.cpp $D/LibOVR/Src/OVR_StereoProjection.cpp"
+//   BULLET=$(find $D/bullet/BulletCollision $D/bullet/BulletDynamics $D/bullet/LinearMath -name '*.cpp')
+//   g++ -O2 -fopenmp -std=c++11 -DHEADLESS_EGL -I$S -I$D -I$D/bullet -I$D/LibOVR/Include -I$D/LibOVRKernel/Src HeadlessSceneCheck.cpp $OVR $BULLET -x c $D/LibOVR/Src/OVR_CAPIShim.c -x none -lEGL -lGL -ldl -lpthread -o HeadlessSceneCheck
+//   ./HeadlessSceneCheck
+
+#include "EglPlatform.h"
+#include "HeadlessLoop.h"
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <stdlib.h>
+
+using namespace std;
+
+namespace OVR { void LogText(const char*, ...) {} }
+
+static int failures = 0;
+
+static void Check(bool ok, const char* what)
+{
+	cout << (ok ? "ok     " : "FAILED ") << what << endl;
+	if (!ok)
+		failures++;
+}
+
+enum { Shrink = 4, Tolerance = 24 };
+static const double MaxDiffering = 0.01;
+
+struct Image
+{
+	int                   width, height;
+	vector<unsigned char> rgb;
+
+	Image() : width(0), height(0) {}
+
+	// Binary PPM as WritePPM saves them; false if the file is not one
+	bool Read(const string& path)
+	{
+		ifstream file(path.c_str(), ios::binary);
+		string   magic;
+		int      maxValue = 0;
+		if (!(file >> magic >> width >> height >> maxValue) || magic != "P6" || maxValue != 255 || width <= 0 || height <= 0)
+			return false;
+		file.get();
+		rgb.resize(width * height * 3);
+		return (bool)file.read((char*)&rgb[0], rgb.size());
+	}
+
+	bool Write(const string& path) const
+	{
+		ofstream file(path.c_str(), ios::binary);
+		file << "P6\n" << width << " " << height << "\n255\n";
+		file.write((const char*)&rgb[0], rgb.size());
+		return (bool)file;
+	}
+
+	// Mean of every factor x factor pixels, so that edges a pixel apart match
+	Image Shrunk(int factor) const
+	{
+		Image small;
+		small.width = width / factor;
+		small.height = height / factor;
+		small.rgb.resize(small.width * small.height * 3);
+		for (int y = 0; y < small.height; y++)
+		{
+			for (int x = 0; x < small.width; x++)
+			{
+				for (int c = 0; c < 3; c++)
+				{
+					int sum = 0;
+					for (int j = 0; j < factor; j++)
+						for (int i = 0; i < factor; i++)
+							sum += rgb[((y * factor + j) * width + x * factor + i) * 3 + c];
+					small.rgb[(y * small.width + x) * 3 + c] = (unsigned char)(sum / (factor * factor));
+				}
+			}
+		}
+		return small;
+	}
+};
+
+static void CompareEye(const char* rendered, const string& reference, bool update)
+{
+	Image image;
+	if (!image.Read(rendered))
+	{
+		Check(false, (string(rendered) + " written").c_str());
+		return;
+	}
+	Image small = image.Shrunk(Shrink);
+	if (update)
+	{
+		Check(small.Write(reference), (reference + " updated").c_str());
+		return;
+	}
+
+	Image expected;
+	if (!expected.Read(reference) || expected.width != small.width || expected.height != small.height)
+	{
+		Check(false, (reference + " read, of the size rendered").c_str());
+		return;
+	}
+	int differing = 0;
+	for (int p = 0; p < small.width * small.height; p++)
+	{
+		int worst = 0;
+		for (int c = 0; c < 3; c++)
+			worst = max(worst, abs(small.rgb[p * 3 + c] - expected.rgb[p * 3 + c]));
+		if (worst > Tolerance)
+			differing++;
+	}
+	cout << differing << " of " << small.width * small.height << " pixels differ from " << reference << endl;
+	Check(differing <= MaxDiffering * small.width * small.height, (string(rendered) + " matches the reference").c_str());
+}
+
+int main(int argc, char** argv)
+{
+	int         frames = 30;
+	string      poseScript = "HeadlessScene/pose.txt";
+	string      recording;
+	bool        update = false;
+	bool        compare = true;
+	int         positional = 0;
+	for (int i = 1; i < argc; i++)
+	{
+		string arg = argv[i];
+		if (arg == "-update")
+			update = true;
+		else if (arg == "-replay" && i + 1 < argc)
+		{
+			recording = argv[++i];
+			compare = false;
+		}
+		else if (positional++ == 0)
+		{
+			frames = atoi(argv[i]);
+			poseScript.clear();
+			compare = false;
+		}
+		else
+			poseScript = arg;
+	}
+
+	if (!recording.empty())
+		sensor = new RecordedSource(recording);
+	else
+		sensor = new SyntheticSource(MyDots::NominalIntrinsics());
+
+	EglPlatform platform;
+	bool rendered = HeadlessLoop(platform, poseScript.empty() ? nullptr : poseScript.c_str(), frames);
+	Check(rendered, "scene rendered headless");
+	delete sensor;
+	sensor = nullptr;
+	if (!rendered || !compare)
+		return rendered ? 0 : 1;
+
+	CompareEye("headless_left.ppm", "HeadlessScene/left.ppm", update);
+	CompareEye("headless_right.ppm", "HeadlessScene/right.ppm", update);
+
+	cout << (failures ? "FAILED" : "passed") << endl;
+	return failures ? 1 : 0;
+}
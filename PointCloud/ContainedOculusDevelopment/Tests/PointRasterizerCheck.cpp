@@ -0,0 +1,250 @@
+//--------------------------------------------------------------------------
+// Rasterizes a known cloud twice through EglPlatform, as GL_POINTS the way
+// MyDots draws its raw points and with ComputePointRasterizer::Render, and
+// checks that both leave the same depth and color in every pixel. The
+// projection is orthographic with the points on pixel centers, so both
+// cover exactly the pixels the points fall in. Every covered pixel gets two
+// points, a near one and a far one drawn in either order, and some pixels
+// none, so coverage and the nearest point winning are both compared. Needs
+// OpenGL 4.3; Mesa's llvmpipe will do.
+//
+// Build and run from this directory (LibOVRKernel's log is not linked, see
+// LogText below):
+//   S=../ContainedOculusDevelopment; D=$S/Dependencies
+//   g++ -O2 -std=c++11 -DHEADLESS_EGL -I$S -I$D -I$D/LibOVRKernel/Src -I$D/LibOVR/Include PointRasterizerCheck.cpp $D/LibOVRKernel/Src/GL/CAPI_GLE.cpp -lEGL -lGL -o PointRasterizerCheck
+//   ./PointRasterizerCheck
+
+#include "EglPlatform.h"
+#include "PointRasterizer.h"
+#include <iostream>
+#include <vector>
+#include <math.h>
+#include <stdlib.h>
+
+using namespace std;
+
+namespace OVR { void LogText(const char*, ...) {} }
+
+static int failures = 0;
+
+static void Check(bool ok, const char* what)
+{
+	cout << (ok ? "ok     " : "FAILED ") << what << endl;
+	if (!ok)
+		failures++;
+}
+
+// The raw point program of MyDots
+static const GLchar* VertexShaderSrc =
+	"#version 150\n"
+	"uniform mat4 matWVP;\n"
+	"uniform float extrapolation;\n"
+	"in vec3 position;\n"
+	"in vec3 color;\n"
+	"in vec3 velocity;\n"
+	"out vec3 fragmentColor;\n"
+	"void main(){\n"
+	"   gl_Position = (matWVP * vec4(position.xyz + velocity * extrapolation, 1.0));\n"
+	"	fragmentColor = color;"
+	"}";
+
+static const GLchar* FragmentShaderSrc =
+	"#version 150\n"
+	"in vec3 fragmentColor;\n"
+	"out vec4 out_color;\n"
+	"void main() {\n"
+	"	out_color = vec4(fragmentColor, 1.0);\n"
+	"}";
+
+enum { Size = 256, GridWidth = Size + 32, GridHeight = 2 * Size };
+static const float DepthTolerance = 1e-6f;
+static const int   ColorTolerance = 1;
+
+// Color and depth of the bound framebuffer
+struct Target
+{
+	vector<unsigned char> color;
+	vector<float>         depth;
+
+	void Read()
+	{
+		color.resize(Size * Size * 4);
+		depth.resize(Size * Size);
+		glPixelStorei(GL_PACK_ALIGNMENT, 1);
+		glReadPixels(0, 0, Size, Size, GL_RGBA, GL_UNSIGNED_BYTE, &color[0]);
+		glReadPixels(0, 0, Size, Size, GL_DEPTH_COMPONENT, GL_FLOAT, &depth[0]);
+	}
+};
+
+int main()
+{
+	EglPlatform platform;
+	if (!platform.InitDevice(Size, Size))
+	{
+		Check(false, "EGL context");
+		return 1;
+	}
+	Check(true, "EGL context");
+	cout << glGetString(GL_VERSION) << ", " << glGetString(GL_RENDERER) << endl;
+
+	ComputePointRasterizer* rasterizer = new ComputePointRasterizer(); // Deleted while the context is current
+	PointChunks*            chunks = new PointChunks(GridWidth, GridHeight);
+	Check(rasterizer->Supported() && chunks->indirectBuffer != 0, "compute rasterizer supported");
+	if (!rasterizer->Supported() || !chunks->indirectBuffer)
+	{
+		delete rasterizer;
+		delete chunks;
+		platform.ReleaseDevice();
+		cout << "FAILED" << endl;
+		return 1;
+	}
+
+	// Grid point (x, y) falls on pixel (x - 16, y / 2), so the first and last
+	// columns of chunks straddle the edges. Even rows are a gradient at depth
+	// 0.6 to 0.7, odd rows are nearer in a square in the middle and farther
+	// elsewhere. Every 17th column has no points. Chunks hold their points
+	// from the start of their slice, like MyDots fills them.
+	vector<GLfloat> points(chunks->Capacity() * 6, 0.0f);
+	vector<GLfloat> velocities(chunks->Capacity() * 3, 0.0f);
+	for (int c = 0; c < chunks->numChunks; c++)
+	{
+		int n = 0;
+		OVR::Vector3f lo(FLT_MAX, FLT_MAX, FLT_MAX), hi(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+		for (int y = chunks->FirstRow(c); y < min(chunks->FirstRow(c) + (int)PointChunks::ChunkHeight, (int)GridHeight); y++)
+		{
+			for (int x = chunks->FirstColumn(c); x < min(chunks->FirstColumn(c) + (int)PointChunks::ChunkWidth, (int)GridWidth); x++)
+			{
+				if (x % 17 == 0)
+					continue;
+				int   px = x - 16, py = y / 2;
+				bool  odd = (y & 1) != 0;
+				bool  square = abs(px - Size / 2) < Size / 4 && abs(py - Size / 2) < Size / 4;
+				float z = odd ? (square ? 0.3f : 0.9f) : 0.6f + 0.1f * px / GridWidth;
+				GLfloat* p = &points[(c * PointChunks::ChunkSize + n) * 6];
+				p[0] = px + 0.5f;
+				p[1] = py + 0.5f;
+				p[2] = z;
+				p[3] = odd ? 1.0f : (float)px / GridWidth;
+				p[4] = odd ? 0.25f : (float)py / Size;
+				p[5] = odd ? (float)(x & 15) / 15 : 0.5f;
+				lo = OVR::Vector3f(min(lo.x, p[0]), min(lo.y, p[1]), min(lo.z, p[2]));
+				hi = OVR::Vector3f(max(hi.x, p[0]), max(hi.y, p[1]), max(hi.z, p[2]));
+				n++;
+			}
+		}
+		chunks->first[c] = c * PointChunks::ChunkSize;
+		chunks->count[c] = n;
+		chunks->boundsMin[c] = lo;
+		chunks->boundsMax[c] = hi;
+	}
+
+	GLuint pointBuffer, velocityBuffer, vao;
+	glGenBuffers(1, &pointBuffer);
+	glBindBuffer(GL_ARRAY_BUFFER, pointBuffer);
+	glBufferData(GL_ARRAY_BUFFER, points.size() * sizeof(GLfloat), &points[0], GL_STATIC_DRAW);
+	glGenBuffers(1, &velocityBuffer);
+	glBindBuffer(GL_ARRAY_BUFFER, velocityBuffer);
+	glBufferData(GL_ARRAY_BUFFER, velocities.size() * sizeof(GLfloat), &velocities[0], GL_STATIC_DRAW);
+
+	const char* attribs[3] = { "position", "color", "velocity" };
+	GLuint program = ProgramCache::Get().Build(VertexShaderSrc, FragmentShaderSrc, attribs, 3);
+	glGenVertexArrays(1, &vao);
+	glBindVertexArray(vao);
+	glBindBuffer(GL_ARRAY_BUFFER, pointBuffer);
+	glEnableVertexAttribArray(0);
+	glEnableVertexAttribArray(1);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(GLfloat), 0);
+	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(GLfloat), (void*)(3 * sizeof(GLfloat)));
+	glBindBuffer(GL_ARRAY_BUFFER, velocityBuffer);
+	glEnableVertexAttribArray(2);
+	glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(GLfloat), 0);
+	glBindVertexArray(0);
+
+	GLuint color, depth;
+	glGenTextures(1, &color);
+	glBindTexture(GL_TEXTURE_2D, color);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, Size, Size, 0, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+	glGenTextures(1, &depth);
+	glBindTexture(GL_TEXTURE_2D, depth);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT32F, Size, Size, 0, GL_DEPTH_COMPONENT, GL_FLOAT, 0);
+	glBindFramebuffer(GL_FRAMEBUFFER, platform.fboId);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, color, 0);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depth, 0);
+	Check(glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE, "framebuffer complete");
+
+	// Pixels to clip space, and z in [0, 1] to window depth z
+	OVR::Matrix4f worldViewProj(
+		2.0f / Size, 0, 0, -1,
+		0, 2.0f / Size, 0, -1,
+		0, 0, 2, -1,
+		0, 0, 0, 1);
+	chunks->Cull(worldViewProj, 0);
+	Check((int)chunks->commands.size() == chunks->numChunks, "every chunk in view");
+
+	glViewport(0, 0, Size, Size);
+	glDisable(GL_CULL_FACE);
+	glDepthFunc(GL_LESS);
+	glClearColor(0, 0, 0, 0);
+	glClearDepth(1);
+
+	Target raw, compute;
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	glUseProgram(program);
+	glUniformMatrix4fv(glGetUniformLocation(program, "matWVP"), 1, GL_TRUE, (const GLfloat*)&worldViewProj);
+	glUniform1f(glGetUniformLocation(program, "extrapolation"), 0.0f);
+	glPointSize(1.0f);
+	glBindVertexArray(vao);
+	chunks->Draw(GL_POINTS);
+	glBindVertexArray(0);
+	glUseProgram(0);
+	raw.Read();
+
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	rasterizer->Render(pointBuffer, velocityBuffer, *chunks, worldViewProj, 0.0f);
+	compute.Read();
+	Check(glGetError() == GL_NO_ERROR, "no GL error");
+
+	int covered = 0, coverageDiffers = 0, depthDiffers = 0, colorDiffers = 0;
+	for (int p = 0; p < Size * Size; p++)
+	{
+		bool a = raw.color[p * 4 + 3] != 0, b = compute.color[p * 4 + 3] != 0;
+		covered += a;
+		if (a != b)
+		{
+			coverageDiffers++;
+			continue;
+		}
+		if (fabs(raw.depth[p] - compute.depth[p]) > DepthTolerance)
+			depthDiffers++;
+		for (int k = 0; k < 3; k++)
+		{
+			if (abs(raw.color[p * 4 + k] - compute.color[p * 4 + k]) > ColorTolerance)
+			{
+				colorDiffers++;
+				break;
+			}
+		}
+	}
+	int expected = 0;
+	for (int px = 0; px < Size; px++)
+		expected += ((px + 16) % 17 != 0) * Size;
+	cout << covered << " pixels covered, " << coverageDiffers << " covered by one only, " << depthDiffers
+		<< " with another depth, " << colorDiffers << " with another color" << endl;
+	Check(covered == expected, "GL_POINTS cover the pixels of the points");
+	Check(coverageDiffers == 0, "same pixels covered");
+	Check(depthDiffers == 0, "same depths");
+	Check(colorDiffers == 0, "same colors, of the nearest points");
+
+	delete rasterizer;
+	delete chunks;
+	glDeleteProgram(program);
+	glDeleteVertexArrays(1, &vao);
+	glDeleteBuffers(1, &pointBuffer);
+	glDeleteBuffers(1, &velocityBuffer);
+	glDeleteTextures(1, &color);
+	glDeleteTextures(1, &depth);
+	platform.ReleaseDevice();
+
+	cout << (failures ? "FAILED" : "passed") << endl;
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,181 @@
+//--------------------------------------------------------------------------
+// Replays recorded sensor frames through TsdfVolume, without a Kinect or a
+// GL context. Given a recording (F3 / F4 in the application) it fuses every
+// frame and prints the blocks in use, evicted and lost to a full pool.
+// Without one it writes a synthetic recording, a box moving in front of a
+// wall and then a camera turning to another wall, replays it and checks
+// that the box leaves no ghost behind, that stale blocks are evicted so the
+// pool never stays full, and that the hash table stays consistent.
+//
+// Build and run from this directory:
+//   g++ -O2 -fopenmp -std=c++11 -I../ContainedOculusDevelopment TsdfReplayCheck.cpp -o TsdfReplayCheck
+//   ./TsdfReplayCheck [recording.pcf]
+
+#include "FrameRecording.h"
+#include <iostream>
+#include <stdio.h>
+
+using namespace std;
+
+static int failures = 0;
+
+static void Check(bool ok, const char* what)
+{
+	cout << (ok ? "ok     " : "FAILED ") << what << endl;
+	if (!ok)
+		failures++;
+}
+
+// Every allocated block is found at its coordinates, and only those are
+static bool TableConsistent(const TsdfVolume& volume)
+{
+	int entries = 0;
+	for (size_t h = 0; h < volume.table.size(); h++)
+	{
+		int b = volume.table[h].block;
+		if (b < 0)
+			continue;
+		entries++;
+		const TsdfVolume::Block& block = volume.pool[b];
+		if (volume.Find(block.x, block.y, block.z) != b || block.x != volume.table[h].x)
+			return false;
+	}
+	return entries == volume.NumBlocks();
+}
+
+// True if the block holding point p of the volume has a voxel behind a surface
+static bool SurfaceAt(const TsdfVolume& volume, float x, float y, float z)
+{
+	float size = volume.BlockSize();
+	int b = volume.Find((int)floor(x / size), (int)floor(y / size), (int)floor(z / size));
+	return b >= 0 && TsdfVolume::HasSurface(volume.pool[b]);
+}
+
+// Frame of a wall wallDepth metres away, with a box of side 0.4 m, 1.5 m
+// away and centred at boxX, which only the camera looking straight ahead
+// (yaw 0) sees
+static void Synthesize(const TsdfVolume::Intrinsics& intr, float wallDepth, float boxX, float yaw, FrameRecording::Frame& f)
+{
+	f.Resize(intr.width * intr.height);
+	for (int v = 0; v < intr.height; v++)
+	{
+		for (int u = 0; u < intr.width; u++)
+		{
+			int   k = v * intr.width + u;
+			float rx = (u - intr.cx) / intr.fx, ry = (v - intr.cy) / intr.fy;
+			float d = wallDepth;
+			bool  box = yaw == 0 && fabs(rx * 1.5f - boxX) < 0.2f && fabs(ry * 1.5f) < 0.2f;
+			if (box)
+				d = 1.5f;
+			f.depth[k] = (unsigned short)(d * 1000 + 0.5f);
+			f.bodyIndex[k] = box ? 0 : 0xff;
+			f.colors[k] = box ? 0xff0000ffu : 0xff808080u;
+		}
+	}
+}
+
+// Row-major camera to world transform turning yaw radians about y
+static void Pose(float yaw, float* pose)
+{
+	float c = cos(yaw), s = sin(yaw);
+	float m[12] = { c, 0, s, 0, 0, 1, 0, 0, -s, 0, c, 0 };
+	for (int i = 0; i < 12; i++)
+		pose[i] = m[i];
+}
+
+static int Replay(const char* path)
+{
+	FrameRecording recording;
+	if (!recording.Open(path))
+	{
+		cout << "Could not read " << path << endl;
+		return 1;
+	}
+	TsdfVolume volume(8192, 0.02f);
+	FrameRecording::Frame f;
+	int evicted = 0, fullFrames = 0;
+	while (recording.Read(f))
+	{
+		volume.Integrate(&f.depth[0], &f.colors[0], recording.Intr, NULL);
+		evicted += (int)volume.evicted.size();
+		fullFrames += volume.full;
+	}
+	cout << recording.frames << " frames, " << volume.NumBlocks() << " blocks, " << evicted << " evicted, "
+		<< fullFrames << " frames with the pool full" << endl;
+	Check(TableConsistent(volume), "hash table consistent");
+	return failures ? 1 : 0;
+}
+
+int main(int argc, char** argv)
+{
+	if (argc > 1)
+		return Replay(argv[1]);
+
+	const char* path = "tsdf_replay_check.pcf";
+	TsdfVolume::Intrinsics intr = { 512, 424, 365.0f, -365.0f, 256.0f, 212.0f };
+
+	// Box still for 20 frames, moving 0.6 m right over 20, still for 40 more,
+	// then the camera turns 90 degrees to a wall for 30 frames
+	enum { Still = 20, Moving = 20, Settle = 40, Turned = 30 };
+	const float turn = 1.5707963f;
+	{
+		FrameRecording out;
+		FrameRecording::Frame f;
+		if (!out.Create(path, intr))
+		{
+			cout << "Could not create " << path << endl;
+			return 1;
+		}
+		for (int i = 0; i < Still + Moving + Settle + Turned; i++)
+		{
+			float t = (float)std::min(std::max(i - Still, 0), (int)Moving) / Moving;
+			Synthesize(intr, 3.0f, -0.3f + 0.6f * t, i < Still + Moving + Settle ? 0 : turn, f);
+			f.time = i / 30.0;
+			out.Write(f);
+		}
+		out.Close();
+	}
+
+	FrameRecording in;
+	Check(in.Open(path), "recording opens");
+	Check(in.Intr.width == intr.width && in.Intr.fy == intr.fy, "intrinsics read back");
+
+	// Pool for about one and a half walls
+	TsdfVolume volume(2048, 0.02f);
+	FrameRecording::Frame f;
+	float pose[12];
+	int   evicted = 0, fullFrames = 0;
+	bool  boxAtStart = false;
+	for (int i = 0; in.Read(f); i++)
+	{
+		Pose(i < Still + Moving + Settle ? 0 : turn, pose);
+		volume.Integrate(&f.depth[0], &f.colors[0], in.Intr, pose);
+		evicted += (int)volume.evicted.size();
+		if (i >= Still + Moving + Settle + 5)
+			fullFrames += volume.full;
+		if (i == Still - 1)
+			boxAtStart = SurfaceAt(volume, -0.3f, 0, 1.5f);
+		if (i == Still + Moving + Settle - 1)
+		{
+			Check(boxAtStart, "box fused where it started");
+			Check(!SurfaceAt(volume, -0.3f, 0, 1.5f), "no ghost where the box was");
+			Check(SurfaceAt(volume, 0.3f, 0, 1.5f), "box fused where it stopped");
+			Check(SurfaceAt(volume, 0, 0, 3.0f), "wall fused");
+		}
+	}
+	Check(in.frames == Still + Moving + Settle + Turned, "every frame read");
+
+	cout << volume.NumBlocks() << " blocks, " << evicted << " evicted, " << fullFrames << " full frames after the turn" << endl;
+	Check(evicted > 0, "stale blocks evicted");
+	Check(fullFrames == 0, "pool not full once the turn is fused");
+	Check((int)volume.freeBlocks.size() >= volume.Reserve, "reserve kept free");
+	Check(SurfaceAt(volume, 3.0f, 0, 0), "turned wall fused");
+	Check(TableConsistent(volume), "hash table consistent");
+
+	in.Rewind();
+	Check(in.Read(f) && f.time == 0, "rewind");
+	remove(path);
+
+	cout << (failures ? "FAILED" : "passed") << endl;
+	return failures ? 1 : 0;
+}